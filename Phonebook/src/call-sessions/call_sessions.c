@@ -1,5 +1,6 @@
 #include "call_sessions.h"
 #include "../common.h" // For logging macros
+#include "../stats_shm/stats_shm.h" // For the active_calls gauge
 
 #define MODULE_NAME "SESSION"
 
@@ -19,6 +20,7 @@ CallSession* create_call_session() {
             call_sessions[i].in_use = 1;
             call_sessions[i].state = CALL_STATE_FREE;
             call_sessions[i].creation_time = time(NULL); // For passive cleanup
+            STATS_INC(active_calls);
             memset(call_sessions[i].call_id, 0, sizeof(call_sessions[i].call_id));
             memset(call_sessions[i].cseq, 0, sizeof(call_sessions[i].cseq));
             memset(call_sessions[i].from_tag, 0, sizeof(call_sessions[i].from_tag));
@@ -39,6 +41,7 @@ void terminate_call_session(CallSession *session) {
     if (session && session->in_use) {
         LOG_INFO("Call Sessions: Terminating call session Call-ID: %s", session->call_id);
         session->in_use = 0;
+        STATS_DEC(active_calls);
         session->state = CALL_STATE_FREE;
         memset(session->call_id, 0, sizeof(session->call_id));
         memset(session->cseq, 0, sizeof(session->cseq));
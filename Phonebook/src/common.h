@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <ctype.h>   // For isspace in trim_whitespace (now in config_loader.c)
 #include <errno.h>   // For strerror
@@ -66,13 +67,38 @@
 #define BACKGROUND_TASK_NICE_VALUE 10
 
 // Phonebook Fetcher settings (Flash-friendly with temp downloads)
-#define PB_CSV_TEMP_PATH "/tmp/phonebook_download.csv"
 #define PB_CSV_PATH "/www/arednstack/phonebook.csv"
-#define PB_XML_BASE_PATH "/tmp/phonebook.xml"
-#define PB_XML_PUBLIC_PATH "/www/arednstack/phonebook_generic_direct.xml"
+#define PB_XML_PUBLIC_PATH "/www/arednstack/phonebook_generic_direct.xml" // Symlink to PB_XML_VOLATILE_PATH
+#define PB_XML_VOLATILE_PATH "/tmp/phonebook_generic_direct.xml" // Liveness-decorated XML, rewritten every status cycle (tmpfs)
 #define PB_LAST_GOOD_CSV_HASH_PATH "/www/arednstack/phonebook.csv.hash"
+#define PB_HTTP_VALIDATORS_PATH "/www/arednstack/phonebook.csv.validators" // ETag/Last-Modified per server
+#define PB_VERSIONS_DIR "/tmp/phonebook_versions" // Recent CSV versions by hash, bases for delta serving (tmpfs)
+#define PB_VERSIONS_KEEP 4
+#define PB_FORMAT_PUBLIC_DIR "/www/arednstack" // Other directory formats: phonebook_<format>.<ext>, symlinks into /tmp
+#define PB_FORMAT_VOLATILE_DIR "/tmp"
+#define PB_XML_MARKER_PREFIX "<!-- phonebook:" // Records CSV hash and renderer version in the published XML
 
 #define HASH_LENGTH 16
+#define MAX_PHONEBOOK_CSV_BYTES (4 * 1024 * 1024) // Upper bound for a (decompressed) phonebook download
+
+// Phonebook fetch timing (milliseconds, remain hardcoded)
+#define PB_FETCH_STAGGER_MS          1500   // Head start of a server before the next one is raced against it
+#define PB_FETCH_CONNECT_TIMEOUT_MS  8000
+#define PB_FETCH_IDLE_TIMEOUT_MS     15000  // Max silence while waiting for headers or body data
+#define PB_FETCH_TOTAL_TIMEOUT_MS    120000 // Whole race plus body transfer
+
+// Fetch scheduling after failures (seconds, remain hardcoded)
+#define PB_RETRY_BASE_SECONDS          30   // First retry after a failed cycle; doubles per failed cycle up to the interval
+#define PB_SERVER_BACKOFF_BASE_SECONDS 60   // First backoff of a failing server; doubles per consecutive failure
+#define PB_SERVER_BACKOFF_MAX_SECONDS  3600
+#define PB_FIRST_FETCH_SPREAD_SECONDS       300 // First fetch offset window when a phonebook is already on flash
+#define PB_FIRST_FETCH_SPREAD_EMPTY_SECONDS 30  // ... and when there is nothing to serve yet
+#define PB_INTERVAL_JITTER_PERCENT          10  // Per-node offset of each interval, +/- percent
+#define PB_FETCH_STATUS_PATH "/tmp/phonebook_fetch_status.json" // Per-server fetch stats (tmpfs, no flash wear)
+#define PB_CONTROL_SOCKET_PATH "/var/run/AREDN-Phonebook.sock" // Control socket: reload, status, dumps, log level
+#define PB_STATS_SHM_PATH "/tmp/phonebook_stats.shm" // Memory-mapped counters, read by 'AREDN-Phonebook stats'
+#define PB_CONFIG_PATH "/etc/sipserver.conf"
+#define PB_FLASH_STATUS_PATH "/tmp/phonebook_flash_status.json" // Daily write counters per file category
 
 // Defines for phonebook server list array sizes (remain hardcoded)
 #define MAX_PB_SERVERS 5
@@ -80,6 +106,7 @@
 #define MAX_SERVER_PORT_LEN 16
 #define MAX_SERVER_PATH_LEN 512
 #define MAX_CONFIG_PATH_LEN 512
+#define MAX_HTTP_VALIDATOR_LEN 128 // ETag / Last-Modified header values
 
 
 // --- Data Structures ---
@@ -106,6 +133,7 @@ typedef struct {
     char display_name[MAX_DISPLAY_NAME_LEN];
     bool is_active;                     // Active = user is registered / known, has valid DNS entry
     bool is_known_from_directory;       // Did this entry originate from the CSV directory?
+    bool is_registered;                 // Holds a live REGISTER binding (directory users included)
     // Removed: contact_uri, ip_address, port, registration_time
 } RegisteredUser;
 
@@ -121,6 +149,7 @@ typedef struct {
     struct sockaddr_in original_caller_addr;
     CallState state;
     time_t creation_time;  // For passive cleanup of stale sessions
+    uint64_t invite_ms;    // CLOCK_MONOTONIC of the INVITE, for call setup metrics
 } CallSession;
 
 
@@ -128,10 +157,17 @@ typedef struct {
 // extern volatile sig_atomic_t keep_running; // REMOVED
 // extern volatile sig_atomic_t phonebook_updated_flag; // REMOVED
 extern volatile sig_atomic_t phonebook_reload_requested; // For webhook-triggered reload
+extern volatile sig_atomic_t log_levels_reload_requested; // SIGHUP: re-read LOG_LEVEL* from the config
 
 // These are defined in config_loader.c and populated from sipserver.conf
 extern int g_pb_interval_seconds;
 extern int g_status_update_interval_seconds;
+extern int g_flash_write_budget_per_day;
+extern int g_phonebook_delta_fetch;
+extern int g_directory_formats; // Bit per DirectoryFormat published besides the Yealink XML
+extern int g_http_server_port; // 0 = embedded HTTP server disabled
+extern int g_sip_trace; // Per-stage SIP latency histograms
+extern int g_sip_trace_sample; // One message in N kept in the trace ring, 0 = none
 extern ConfigurableServer g_phonebook_servers_list[MAX_PB_SERVERS];
 extern int g_num_phonebook_servers;
 
@@ -164,14 +200,53 @@ extern pthread_cond_t updater_trigger_cond;
 #define LOG_LEVEL_INFO      3
 #define LOG_LEVEL_DEBUG     4
 
+// Calls above this level are compiled out; build with -DLOG_COMPILE_LEVEL=3 to drop debug lines entirely
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL   LOG_LEVEL_DEBUG
+#endif
+#define LOG_DEFAULT_LEVEL   LOG_LEVEL_INFO // Runtime level until config or the control socket changes it
+
 void log_init(const char* app_name);
 void log_shutdown(void);
 void log_message(int level, const char* app_name_in, const char* module_name_in, const char *format, ...);
-
-#define LOG_ERROR(format, ...)   log_message(LOG_LEVEL_ERROR, APP_NAME, MODULE_NAME, format, ##__VA_ARGS__)
-#define LOG_WARN(format, ...)    log_message(LOG_LEVEL_WARNING, APP_NAME, MODULE_NAME, format, ##__VA_ARGS__)
-#define LOG_INFO(format, ...)    log_message(LOG_LEVEL_INFO, APP_NAME, MODULE_NAME, format, ##__VA_ARGS__)
-#define LOG_DEBUG(format, ...)   log_message(LOG_LEVEL_DEBUG, APP_NAME, MODULE_NAME, format, ##__VA_ARGS__)
+int log_set_level(int level);
+int log_get_level(void);
+int log_set_module_level(const char *module_name, int level);
+const char *log_level_name(int level);
+int log_level_from_name(const char *name);
+uint32_t log_dropped_count(void);
+int *log_module_level_ref(const char *module_name);
+
+extern int log_max_level; // Highest runtime level of any module
+
+// This file's runtime level, looked up by MODULE_NAME on its first enabled-looking call
+static int *log_module_level_slot __attribute__((unused));
+
+static inline int log_module_level(const char *module_name) {
+    int *slot = __atomic_load_n(&log_module_level_slot, __ATOMIC_RELAXED);
+    if (!slot) {
+        slot = log_module_level_ref(module_name);
+        __atomic_store_n(&log_module_level_slot, slot, __ATOMIC_RELAXED);
+    }
+    return __atomic_load_n(slot, __ATOMIC_RELAXED);
+}
+
+// Tested before any argument is evaluated. Errors and warnings are always logged;
+// a disabled info/debug line costs one compare against log_max_level.
+#define LOG_ENABLED(level)                                                                     \
+    ((level) <= LOG_COMPILE_LEVEL &&                                                           \
+     ((level) <= LOG_LEVEL_WARNING ||                                                          \
+      ((level) <= __atomic_load_n(&log_max_level, __ATOMIC_RELAXED) && (level) <= log_module_level(MODULE_NAME))))
+
+#define LOG_AT(level, format, ...)                                                             \
+    do {                                                                                       \
+        if (LOG_ENABLED(level)) log_message(level, APP_NAME, MODULE_NAME, format, ##__VA_ARGS__); \
+    } while (0)
+
+#define LOG_ERROR(format, ...)   LOG_AT(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...)    LOG_AT(LOG_LEVEL_WARNING, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...)    LOG_AT(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_DEBUG(format, ...)   LOG_AT(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
 
 
 // --- Common Utility Function Declarations ---
@@ -183,6 +258,11 @@ extern void sanitize_utf8(const char *in, char *out, size_t out_sz);
 
 // File Utils Function Declarations (prototypes)
 int file_utils_copy_file(const char *src, const char *dst);
+int file_utils_write_file(const char *dst, const void *data, size_t len);
+int file_utils_atomic_write(const char *dst, const void *data, size_t len);
+int file_utils_atomic_write_deferrable(const char *dst, const void *data, size_t len);
+int file_utils_read_file(const char *src, char **data, size_t *len);
+int file_utils_ensure_symlink(const char *link_path, const char *target);
 int file_utils_ensure_directory_exists(const char *path);
 int file_utils_publish_file_to_destination(const char *source_path, const char *destination_path);
 
@@ -202,7 +282,6 @@ RegisteredUser* find_registered_user(const char *user_id);
 RegisteredUser* add_or_update_registered_user(const char *user_id, const char *display_name, int expires); // Simplified parameters
 RegisteredUser* add_csv_user_to_registered_users_table(const char *user_id_numeric, const char *display_name);
 void init_registered_users_table();
-void populate_registered_users_from_csv(const char *filepath);
 void load_directory_from_xml(const char *filepath); // Deprecated but retained prototype
 
 // Call Sessions
@@ -1,5 +1,6 @@
 // config_loader.c
 #include "config_loader.h" // This includes common.h
+#include "../directory_render/directory_render.h" // For format names
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -12,6 +13,12 @@
 // These are initialized with default values, which will be overwritten by the config file if present.
 int g_pb_interval_seconds = 3600; // Default: 1 hour
 int g_status_update_interval_seconds = 600; // Default: 10 minutes
+int g_flash_write_budget_per_day = 24; // Default: 24 flash writes per day
+int g_phonebook_delta_fetch = 0; // Default: always request the full CSV
+int g_directory_formats = 0; // Default: Yealink XML only
+int g_http_server_port = 0; // Default: embedded HTTP server disabled
+int g_sip_trace = 0; // Default: no stage timing
+int g_sip_trace_sample = 0; // Default: no sampled traces
 ConfigurableServer g_phonebook_servers_list[MAX_PB_SERVERS];
 int g_num_phonebook_servers = 0; // Will be populated by the loader
 
@@ -35,6 +42,44 @@ static char* trim_whitespace(char *str) {
     return str;
 }
 
+// LOG_LEVEL=<level> sets every module, LOG_LEVEL_<MODULE>=<level> one of them (e.g. LOG_LEVEL_SIP=debug).
+// Returns false if 'key' is not a log level key.
+static bool apply_log_level(const char *key, const char *value) {
+    if (strncmp(key, "LOG_LEVEL", 9) != 0 || (key[9] != '\0' && (key[9] != '_' || !key[10]))) {
+        return false;
+    }
+    int level = log_level_from_name(value);
+    int failed = level < 0 ? 1 : key[9] ? log_set_module_level(key + 10, level) : log_set_level(level);
+    if (failed) {
+        LOG_WARN("Invalid %s value '%s' (use none, error, warning, info or debug). Ignored.", key, value);
+    } else {
+        LOG_DEBUG("Config: %s = %s", key, log_level_name(level));
+    }
+    return true;
+}
+
+int reload_log_levels(const char *config_filepath) {
+    FILE *fp = fopen(config_filepath, "r");
+    if (!fp) {
+        LOG_WARN("Cannot reload log levels from '%s': %s.", config_filepath, strerror(errno));
+        return 1;
+    }
+    log_set_level(LOG_DEFAULT_LEVEL);
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        char *key = trim_whitespace(line);
+        char *value = strchr(key, '=');
+        if (key[0] == '#' || !value) {
+            continue;
+        }
+        *value++ = '\0';
+        apply_log_level(trim_whitespace(key), trim_whitespace(value));
+    }
+    fclose(fp);
+    LOG_INFO("Log levels reloaded from %s (default %s).", config_filepath, log_level_name(log_get_level()));
+    return 0;
+}
+
 int load_configuration(const char *config_filepath) {
     FILE *fp = fopen(config_filepath, "r");
     if (!fp) {
@@ -84,6 +129,58 @@ int load_configuration(const char *config_filepath) {
             } else {
                 LOG_WARN("Invalid STATUS_UPDATE_INTERVAL_SECONDS value '%s'. Using default %d.", value, g_status_update_interval_seconds);
             }
+        } else if (strcmp(key, "FLASH_WRITE_BUDGET_PER_DAY") == 0) {
+            int parsed_value = atoi(value);
+            if (parsed_value > 0) {
+                g_flash_write_budget_per_day = parsed_value;
+                LOG_DEBUG("Config: FLASH_WRITE_BUDGET_PER_DAY = %d", g_flash_write_budget_per_day);
+            } else {
+                LOG_WARN("Invalid FLASH_WRITE_BUDGET_PER_DAY value '%s'. Using default %d.", value, g_flash_write_budget_per_day);
+            }
+        } else if (strcmp(key, "PHONEBOOK_DELTA_FETCH") == 0) {
+            if (strcmp(value, "0") == 0 || strcmp(value, "1") == 0) {
+                g_phonebook_delta_fetch = atoi(value);
+                LOG_DEBUG("Config: PHONEBOOK_DELTA_FETCH = %d", g_phonebook_delta_fetch);
+            } else {
+                LOG_WARN("Invalid PHONEBOOK_DELTA_FETCH value '%s'. Using default %d.", value, g_phonebook_delta_fetch);
+            }
+        } else if (strcmp(key, "DIRECTORY_FORMATS") == 0) {
+            g_directory_formats = 0;
+            for (char *name = strtok(value, ","); name; name = strtok(NULL, ",")) {
+                name = trim_whitespace(name);
+                int format = directory_format_from_name(name);
+                if (format < 0) {
+                    LOG_WARN("Unknown DIRECTORY_FORMATS entry '%s'. Ignored.", name);
+                } else if (format != DIRECTORY_FORMAT_YEALINK) { // Always published
+                    g_directory_formats |= 1 << format;
+                }
+            }
+            LOG_DEBUG("Config: DIRECTORY_FORMATS = 0x%x", g_directory_formats);
+        } else if (strcmp(key, "HTTP_SERVER_PORT") == 0) {
+            int parsed_value = atoi(value);
+            if (parsed_value >= 0 && parsed_value <= 65535 && (parsed_value > 0 || strcmp(value, "0") == 0)) {
+                g_http_server_port = parsed_value;
+                LOG_DEBUG("Config: HTTP_SERVER_PORT = %d", g_http_server_port);
+            } else {
+                LOG_WARN("Invalid HTTP_SERVER_PORT value '%s'. Using default %d.", value, g_http_server_port);
+            }
+        } else if (strcmp(key, "SIP_TRACE") == 0) {
+            if (strcmp(value, "0") == 0 || strcmp(value, "1") == 0) {
+                g_sip_trace = atoi(value);
+                LOG_DEBUG("Config: SIP_TRACE = %d", g_sip_trace);
+            } else {
+                LOG_WARN("Invalid SIP_TRACE value '%s'. Using default %d.", value, g_sip_trace);
+            }
+        } else if (strcmp(key, "SIP_TRACE_SAMPLE") == 0) {
+            int parsed_value = atoi(value);
+            if (parsed_value > 0 || strcmp(value, "0") == 0) {
+                g_sip_trace_sample = parsed_value;
+                LOG_DEBUG("Config: SIP_TRACE_SAMPLE = %d", g_sip_trace_sample);
+            } else {
+                LOG_WARN("Invalid SIP_TRACE_SAMPLE value '%s'. Using default %d.", value, g_sip_trace_sample);
+            }
+        } else if (apply_log_level(key, value)) {
+            // Handled
         } else if (strcmp(key, "PHONEBOOK_SERVER") == 0) {
             if (current_server_idx < MAX_PB_SERVERS) {
                 // strtok modifies the string, so it's good if value is a copy or you don't need it later.
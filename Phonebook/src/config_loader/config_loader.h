@@ -7,6 +7,12 @@
 // These global variables are DECLARED here (extern) and DEFINED in config_loader.c
 extern int g_pb_interval_seconds;
 extern int g_status_update_interval_seconds;
+extern int g_flash_write_budget_per_day;
+extern int g_phonebook_delta_fetch;
+extern int g_directory_formats;
+extern int g_http_server_port;
+extern int g_sip_trace;
+extern int g_sip_trace_sample;
 extern ConfigurableServer g_phonebook_servers_list[MAX_PB_SERVERS];
 extern int g_num_phonebook_servers;
 
@@ -15,7 +21,9 @@ extern int g_num_phonebook_servers;
  *
  * This function reads key-value pairs from the configuration file.
  * It parses PB_INTERVAL_SECONDS, STATUS_UPDATE_INTERVAL_SECONDS,
- * and multiple PHONEBOOK_SERVER entries.
+ * FLASH_WRITE_BUDGET_PER_DAY, PHONEBOOK_DELTA_FETCH, DIRECTORY_FORMATS,
+ * HTTP_SERVER_PORT, SIP_TRACE, SIP_TRACE_SAMPLE, LOG_LEVEL, LOG_LEVEL_<MODULE> and multiple
+ * PHONEBOOK_SERVER entries.
  * Default values are used if the file is not found or if specific
  * parameters are missing/malformed.
  *
@@ -25,4 +33,14 @@ extern int g_num_phonebook_servers;
  */
 int load_configuration(const char *config_filepath);
 
+/**
+ * @brief Re-reads only LOG_LEVEL and LOG_LEVEL_<MODULE> from the configuration file.
+ *
+ * Levels not set in the file return to the default (info), so removing a line
+ * takes effect. Used on SIGHUP and by 'loglevel reload' on the control socket.
+ *
+ * @return 0 on success, 1 if the file cannot be opened (levels are left unchanged).
+ */
+int reload_log_levels(const char *config_filepath);
+
 #endif // CONFIG_LOADER_H
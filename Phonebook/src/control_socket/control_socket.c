@@ -0,0 +1,589 @@
+#define MODULE_NAME "CONTROL"
+
+#include "control_socket.h"
+#include "../common.h"
+#include "../phonebook_fetcher/phonebook_fetcher.h"
+#include "../passive_safety/passive_safety.h" // For thread heartbeats
+#include "../stats_shm/stats_shm.h"
+#include "../sip_trace/sip_trace.h"
+#include "../log_manager/log_manager.h"   // For per-module log levels
+#include "../config_loader/config_loader.h" // For reload_log_levels
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+typedef struct {
+    int fd; // -1 when the slot is free
+    char in[CONTROL_REQUEST_MAX];
+    size_t in_len;
+    char *out;                   // Response, malloc'd; the connection closes once it is sent
+    size_t out_len;
+    size_t sent;
+    unsigned long waiting_cycle; // Fetch cycle a 'reload' waits for, 0 if none
+    time_t reload_deadline;      // When a waiting 'reload' answers "pending" instead
+    time_t last_active;
+} ControlConnection;
+
+// Response under construction. On allocation failure 'failed' is set and further output dropped.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} Reply;
+
+static ControlConnection conns[CONTROL_MAX_CONNECTIONS];
+static int listen_fd = -1;
+static int notify_pipe[2] = { -1, -1 }; // Written by the fetcher thread, read by the main loop
+static time_t started_at = 0;
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int control_socket_init(const char *path) {
+    for (int i = 0; i < CONTROL_MAX_CONNECTIONS; i++) {
+        conns[i].fd = -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        LOG_ERROR("Control socket path '%s' is too long.", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    if (pipe(notify_pipe) != 0 || set_nonblocking(notify_pipe[0]) < 0 || set_nonblocking(notify_pipe[1]) < 0) {
+        LOG_ERROR("Control socket notification pipe failed: %s", strerror(errno));
+        return 1;
+    }
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        LOG_ERROR("Control socket creation failed: %s", strerror(errno));
+        return 1;
+    }
+    unlink(path); // Left over from a previous run
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0 ||
+        set_nonblocking(listen_fd) < 0) {
+        LOG_ERROR("Control socket could not listen on %s: %s", path, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return 1;
+    }
+    chmod(path, 0660);
+    started_at = time(NULL);
+    LOG_INFO("Control socket listening on %s.", path);
+    return 0;
+}
+
+void control_socket_notify(void) {
+    if (notify_pipe[1] >= 0) {
+        char byte = 1;
+        if (write(notify_pipe[1], &byte, 1) < 0) {
+            // EAGAIN: a wakeup is already pending
+        }
+    }
+}
+
+// --- Responses ---
+
+static void reply_printf(Reply *r, const char *format, ...) {
+    if (r->failed) {
+        return;
+    }
+    while (1) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(r->data ? r->data + r->len : NULL, r->data ? r->cap - r->len : 0, format, args);
+        va_end(args);
+        if (n < 0) {
+            r->failed = true;
+            return;
+        }
+        if (r->data && r->len + (size_t)n < r->cap) {
+            r->len += (size_t)n;
+            return;
+        }
+        size_t cap = r->cap ? r->cap * 2 : 1024;
+        while (cap <= r->len + (size_t)n) cap *= 2;
+        char *data = realloc(r->data, cap);
+        if (!data) {
+            r->failed = true;
+            return;
+        }
+        r->data = data;
+        r->cap = cap;
+    }
+}
+
+static void reply_json_string(Reply *r, const char *s) {
+    reply_printf(r, "\"");
+    for (; *s; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\') {
+            reply_printf(r, "\\%c", ch);
+        } else if (ch < 0x20) {
+            reply_printf(r, "\\u%04x", ch);
+        } else {
+            reply_printf(r, "%c", ch);
+        }
+    }
+    reply_printf(r, "\"");
+}
+
+static void reply_timestamp(Reply *r, time_t t) {
+    char stamp[32];
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    reply_printf(r, "\"%s\"", stamp);
+}
+
+static void reply_error(Reply *r, const char *message) {
+    reply_printf(r, "{\"status\":\"error\",\"message\":");
+    reply_json_string(r, message);
+    reply_printf(r, ",\"timestamp\":");
+    reply_timestamp(r, time(NULL));
+    reply_printf(r, "}\n");
+}
+
+// Report fields shared by 'reload' and 'status'
+static void reply_report_fields(Reply *r, const FetchCycleReport *report) {
+    reply_printf(r, "\"cycle\":%lu,\"result\":\"%s\",\"entries\":%d,\"added\":%d,\"removed\":%d,\"modified\":%d,"
+                 "\"duration_ms\":%ld,\"finished\":",
+                 report->cycle, fetch_result_name(report->result), report->entries, report->added, report->removed,
+                 report->modified, report->duration_ms);
+    reply_timestamp(r, report->finished);
+}
+
+static void reply_reload_result(Reply *r, const FetchCycleReport *report) {
+    static const char *messages[] = { "Phonebook reloaded with changes", "Phonebook is already current",
+                                      "Phonebook fetch failed" };
+    reply_printf(r, "{\"status\":\"%s\",\"message\":\"%s\",",
+                 report->result == FETCH_RESULT_FAILED ? "error" : "success", messages[report->result]);
+    reply_report_fields(r, report);
+    reply_printf(r, ",\"timestamp\":");
+    reply_timestamp(r, time(NULL));
+    reply_printf(r, "}\n");
+}
+
+// Answer to a 'reload' whose cycle is still running when its wait runs out
+static void reply_reload_pending(Reply *r, unsigned long cycle) {
+    reply_printf(r, "{\"status\":\"pending\",\"message\":\"Phonebook reload still running\",\"cycle\":%lu,"
+                 "\"timestamp\":", cycle);
+    reply_timestamp(r, time(NULL));
+    reply_printf(r, "}\n");
+}
+
+static void cmd_status(Reply *r) {
+    time_t now = time(NULL);
+    pthread_mutex_lock(&registered_users_mutex);
+    int registered = num_registered_users;
+    int directory = num_directory_entries;
+    int active_users = 0;
+    for (int i = 0; i < MAX_REGISTERED_USERS; i++) {
+        if (registered_users[i].user_id[0] && registered_users[i].is_active) active_users++;
+    }
+    pthread_mutex_unlock(&registered_users_mutex);
+    int active_calls = 0;
+    for (int i = 0; i < MAX_CALL_SESSIONS; i++) {
+        if (call_sessions[i].in_use) active_calls++;
+    }
+
+    reply_printf(r, "{\"status\":\"ok\",\"version\":\"%s\",\"pid\":%d,\"uptime_seconds\":%ld,"
+                 "\"fetcher_heartbeat_age\":%ld,\"updater_heartbeat_age\":%ld,"
+                 "\"registered_users\":%d,\"active_users\":%d,\"directory_entries\":%d,\"active_calls\":%d,"
+                 "\"log_level\":\"%s\",\"last_fetch\":",
+                 AREDN_PHONEBOOK_VERSION, (int)getpid(), (long)(now - started_at),
+                 g_fetcher_last_heartbeat ? (long)(now - g_fetcher_last_heartbeat) : -1L,
+                 g_updater_last_heartbeat ? (long)(now - g_updater_last_heartbeat) : -1L,
+                 registered, active_users, directory, active_calls, log_level_name(log_get_level()));
+    FetchCycleReport report;
+    if (phonebook_fetcher_last_report(&report)) {
+        reply_printf(r, "{");
+        reply_report_fields(r, &report);
+        reply_printf(r, "}");
+    } else {
+        reply_printf(r, "null");
+    }
+    reply_printf(r, ",\"timestamp\":");
+    reply_timestamp(r, now);
+    reply_printf(r, "}\n");
+}
+
+static void cmd_dump_users(Reply *r) {
+    reply_printf(r, "{\"status\":\"ok\",\"users\":[");
+    int n = 0;
+    pthread_mutex_lock(&registered_users_mutex);
+    for (int i = 0; i < MAX_REGISTERED_USERS; i++) {
+        const RegisteredUser *u = &registered_users[i];
+        if (!u->user_id[0]) continue;
+        reply_printf(r, "%s{\"user_id\":", n++ ? "," : "");
+        reply_json_string(r, u->user_id);
+        reply_printf(r, ",\"display_name\":");
+        reply_json_string(r, u->display_name);
+        reply_printf(r, ",\"active\":%s,\"directory\":%s}", u->is_active ? "true" : "false",
+                     u->is_known_from_directory ? "true" : "false");
+    }
+    pthread_mutex_unlock(&registered_users_mutex);
+    reply_printf(r, "],\"count\":%d}\n", n);
+}
+
+static const char *call_state_name(CallState state) {
+    switch (state) {
+        case CALL_STATE_INVITE_SENT: return "invite_sent";
+        case CALL_STATE_RINGING:     return "ringing";
+        case CALL_STATE_ESTABLISHED: return "established";
+        case CALL_STATE_TERMINATING: return "terminating";
+        default:                     return "free";
+    }
+}
+
+// Call sessions belong to the SIP loop, which is also the thread serving this socket.
+static void cmd_dump_calls(Reply *r) {
+    time_t now = time(NULL);
+    reply_printf(r, "{\"status\":\"ok\",\"calls\":[");
+    int n = 0;
+    for (int i = 0; i < MAX_CALL_SESSIONS; i++) {
+        const CallSession *s = &call_sessions[i];
+        if (!s->in_use) continue;
+        char caller[INET_ADDRSTRLEN], callee[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &s->original_caller_addr.sin_addr, caller, sizeof(caller));
+        inet_ntop(AF_INET, &s->callee_addr.sin_addr, callee, sizeof(callee));
+        reply_printf(r, "%s{\"call_id\":", n++ ? "," : "");
+        reply_json_string(r, s->call_id);
+        reply_printf(r, ",\"state\":\"%s\",\"caller\":\"%s:%d\",\"callee\":\"%s:%d\",\"age_seconds\":%ld}",
+                     call_state_name(s->state), caller, ntohs(s->original_caller_addr.sin_port), callee,
+                     ntohs(s->callee_addr.sin_port), (long)(now - s->creation_time));
+    }
+    reply_printf(r, "],\"count\":%d}\n", n);
+}
+
+// Trace ring belongs to the SIP loop as well
+static void cmd_dump_traces(Reply *r) {
+    static SipTrace traces[SIP_TRACE_RING_SIZE];
+    int n = sip_trace_snapshot(traces, SIP_TRACE_RING_SIZE);
+    reply_printf(r, "{\"status\":\"ok\",\"enabled\":%s,\"sample\":%d,\"traces\":[",
+                 sip_trace_enabled ? "true" : "false", sip_trace_sample_rate());
+    for (int i = 0; i < n; i++) {
+        const SipTrace *t = &traces[i];
+        char source[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &t->source.sin_addr, source, sizeof(source));
+        reply_printf(r, "%s{\"received\":", i ? "," : "");
+        reply_timestamp(r, t->received);
+        reply_printf(r, ",\"kind\":\"%s\",\"source\":\"%s:%d\",\"first_line\":", metrics_sip_kind_name(t->kind),
+                     source, ntohs(t->source.sin_port));
+        reply_json_string(r, t->first_line);
+        reply_printf(r, ",\"call_id\":");
+        reply_json_string(r, t->call_id);
+        reply_printf(r, ",\"stages_us\":{");
+        int reached = 0;
+        for (int s = 0; s < SIP_STAGE_COUNT; s++) {
+            if (t->stage_us[s] == SIP_TRACE_NOT_REACHED) continue;
+            reply_printf(r, "%s\"%s\":%u", reached++ ? "," : "", sip_stage_name((SipStage)s), t->stage_us[s]);
+        }
+        reply_printf(r, "},\"total_us\":%u}", t->total_us);
+    }
+    reply_printf(r, "],\"count\":%d}\n", n);
+}
+
+static void cmd_trace(Reply *r, const char *arg) {
+    if (strcmp(arg, "on") == 0) {
+        sip_trace_configure(true, sip_trace_sample_rate());
+    } else if (strcmp(arg, "off") == 0) {
+        sip_trace_configure(false, sip_trace_sample_rate());
+    } else if (strncmp(arg, "sample", 6) == 0 && isspace((unsigned char)arg[6]) && isdigit((unsigned char)arg[7])) {
+        int sample = atoi(arg + 7);
+        sip_trace_configure(sip_trace_enabled || sample > 0, sample);
+    } else if (arg[0]) {
+        reply_error(r, "Unknown trace setting (use on, off or sample <N>)");
+        return;
+    }
+    reply_printf(r, "{\"status\":\"ok\",\"enabled\":%s,\"sample\":%d}\n", sip_trace_enabled ? "true" : "false",
+                 sip_trace_sample_rate());
+}
+
+// loglevel [level | <module> <level> | reload]
+static void cmd_loglevel(Reply *r, const char *arg) {
+    char module[LOG_MODULE_NAME_LEN] = "";
+    const char *level_arg = arg;
+    const char *space = strpbrk(arg, " \t");
+    if (space) {
+        snprintf(module, sizeof(module), "%.*s", (int)(space - arg), arg);
+        level_arg = space + strspn(space, " \t");
+    }
+    if (strcmp(arg, "reload") == 0) {
+        if (reload_log_levels(PB_CONFIG_PATH) != 0) {
+            reply_error(r, "Cannot read " PB_CONFIG_PATH);
+            return;
+        }
+    } else if (arg[0]) {
+        int level = log_level_from_name(level_arg);
+        int failed = level < 0 ? 1 : module[0] ? log_set_module_level(module, level) : log_set_level(level);
+        if (failed) {
+            reply_error(r, "Unknown log level (use 0-4 or none, error, warning, info, debug)");
+            return;
+        }
+        LOG_WARN("Log level of %s set to %s over the control socket.", module[0] ? module : "all modules",
+                 log_level_name(level));
+    }
+    LogModuleLevel levels[LOG_MAX_MODULES];
+    int n = log_module_levels(levels, LOG_MAX_MODULES);
+    reply_printf(r, "{\"status\":\"ok\",\"log_level\":\"%s\",\"level\":%d,\"modules\":{",
+                 log_level_name(log_get_level()), log_get_level());
+    for (int i = 0; i < n; i++) {
+        reply_printf(r, "%s", i ? "," : "");
+        reply_json_string(r, levels[i].name);
+        reply_printf(r, ":\"%s\"", log_level_name(levels[i].level));
+    }
+    reply_printf(r, "}}\n");
+}
+
+// --- Connections ---
+
+static void close_connection(ControlConnection *c) {
+    close(c->fd);
+    free(c->out);
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+// Sends what is left of the response. Returns 1 when the connection is done.
+static int send_pending(ControlConnection *c) {
+    while (c->sent < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->sent, c->out_len - c->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : 1;
+        }
+        c->sent += (size_t)n;
+    }
+    return 1;
+}
+
+static int respond(ControlConnection *c, Reply *r) {
+    if (r->failed) {
+        free(r->data);
+        return 1;
+    }
+    c->out = r->data;
+    c->out_len = r->len;
+    c->sent = 0;
+    c->last_active = time(NULL);
+    return send_pending(c);
+}
+
+// Runs the command line in c->in. Returns 1 when the connection is done.
+static int handle_command(ControlConnection *c) {
+    char *line = c->in;
+    line[strcspn(line, "\r\n")] = '\0';
+    while (isspace((unsigned char)*line)) line++;
+    char *arg = line + strcspn(line, " \t");
+    if (*arg) {
+        *arg++ = '\0';
+        while (isspace((unsigned char)*arg)) arg++;
+    }
+    for (char *end = arg + strlen(arg); end > arg && isspace((unsigned char)end[-1]); ) *--end = '\0';
+    LOG_DEBUG("Control command '%s %s'.", line, arg);
+    STATS_INC(control_requests);
+
+    Reply r = { 0 };
+    if (strcmp(line, "reload") == 0) {
+        int wait_seconds = CONTROL_RELOAD_TIMEOUT_SECONDS;
+        if (strcmp(arg, "nowait") == 0) {
+            wait_seconds = 0;
+        } else if (strncmp(arg, "wait", 4) == 0 && isspace((unsigned char)arg[4])) {
+            wait_seconds = atoi(arg + 5);
+            if (wait_seconds < 1 || wait_seconds > CONTROL_RELOAD_TIMEOUT_SECONDS) {
+                reply_error(&r, "Reload wait must be 1-" STR(CONTROL_RELOAD_TIMEOUT_SECONDS) " seconds");
+                return respond(c, &r);
+            }
+        } else if (*arg) {
+            reply_error(&r, "Usage: reload [nowait | wait <seconds>]");
+            return respond(c, &r);
+        }
+        unsigned long cycle = phonebook_fetcher_request_reload();
+        LOG_INFO("Phonebook reload requested over the control socket (cycle %lu).", cycle);
+        if (wait_seconds > 0) {
+            c->waiting_cycle = cycle; // Answered by control_socket_process() once the cycle is reported
+            c->last_active = time(NULL);
+            c->reload_deadline = c->last_active + wait_seconds;
+            return 0;
+        }
+        reply_printf(&r, "{\"status\":\"success\",\"message\":\"Phonebook reload triggered\",\"cycle\":%lu,"
+                     "\"timestamp\":", cycle);
+        reply_timestamp(&r, time(NULL));
+        reply_printf(&r, "}\n");
+    } else if (strcmp(line, "status") == 0) {
+        cmd_status(&r);
+    } else if (strcmp(line, "dump") == 0 && strcmp(arg, "users") == 0) {
+        cmd_dump_users(&r);
+    } else if (strcmp(line, "dump") == 0 && strcmp(arg, "calls") == 0) {
+        cmd_dump_calls(&r);
+    } else if (strcmp(line, "dump") == 0 && strcmp(arg, "traces") == 0) {
+        cmd_dump_traces(&r);
+    } else if (strcmp(line, "trace") == 0) {
+        cmd_trace(&r, arg);
+    } else if (strcmp(line, "loglevel") == 0) {
+        cmd_loglevel(&r, arg);
+    } else {
+        reply_error(&r, "Unknown command (reload [nowait|wait N], status, dump users|calls|traces, trace [on|off|sample N], "
+                        "loglevel [level|module level|reload])");
+    }
+    return respond(c, &r);
+}
+
+// Answers the reloads whose cycle has been reported, and those that waited too long.
+static void answer_reloads(time_t now) {
+    FetchCycleReport report;
+    bool have_report = phonebook_fetcher_last_report(&report);
+    for (int i = 0; i < CONTROL_MAX_CONNECTIONS; i++) {
+        ControlConnection *c = &conns[i];
+        if (c->fd < 0 || !c->waiting_cycle) continue;
+        Reply r = { 0 };
+        if (have_report && report.cycle >= c->waiting_cycle) {
+            reply_reload_result(&r, &report);
+        } else if (now >= c->reload_deadline) {
+            reply_reload_pending(&r, c->waiting_cycle);
+        } else {
+            continue;
+        }
+        c->waiting_cycle = 0;
+        if (respond(c, &r) != 0) {
+            close_connection(c);
+        }
+    }
+}
+
+static void accept_connections(void) {
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return; // EAGAIN: backlog drained
+        }
+        ControlConnection *c = NULL;
+        for (int i = 0; i < CONTROL_MAX_CONNECTIONS && !c; i++) {
+            if (conns[i].fd < 0) c = &conns[i];
+        }
+        if (!c || fd >= FD_SETSIZE || set_nonblocking(fd) < 0) {
+            LOG_DEBUG("Refusing control connection: %s.", c ? "descriptor out of range" : "all slots busy");
+            close(fd);
+            continue;
+        }
+        memset(c, 0, sizeof(*c));
+        c->fd = fd;
+        c->last_active = time(NULL);
+    }
+}
+
+void control_socket_fill_fds(fd_set *readfds, fd_set *writefds, int *maxfd) {
+    if (listen_fd < 0) {
+        return;
+    }
+    FD_SET(listen_fd, readfds);
+    FD_SET(notify_pipe[0], readfds);
+    if (listen_fd > *maxfd) *maxfd = listen_fd;
+    if (notify_pipe[0] > *maxfd) *maxfd = notify_pipe[0];
+    for (int i = 0; i < CONTROL_MAX_CONNECTIONS; i++) {
+        ControlConnection *c = &conns[i];
+        if (c->fd < 0 || c->waiting_cycle) continue;
+        FD_SET(c->fd, c->out ? writefds : readfds);
+        if (c->fd > *maxfd) *maxfd = c->fd;
+    }
+}
+
+void control_socket_process(const fd_set *readfds, const fd_set *writefds) {
+    if (listen_fd < 0) {
+        return;
+    }
+    time_t now = time(NULL);
+    if (FD_ISSET(notify_pipe[0], readfds)) {
+        char drain[32];
+        while (read(notify_pipe[0], drain, sizeof(drain)) > 0) {
+        }
+    }
+    answer_reloads(now);
+
+    for (int i = 0; i < CONTROL_MAX_CONNECTIONS; i++) {
+        ControlConnection *c = &conns[i];
+        if (c->fd < 0 || c->waiting_cycle) continue;
+
+        int closing = 0;
+        if (c->out && FD_ISSET(c->fd, writefds)) {
+            closing = send_pending(c);
+        } else if (!c->out && FD_ISSET(c->fd, readfds)) {
+            ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len, 0);
+            if (n > 0) {
+                c->in_len += (size_t)n;
+                c->in[c->in_len] = '\0';
+                if (memchr(c->in, '\n', c->in_len) || c->in_len == sizeof(c->in) - 1) {
+                    closing = handle_command(c);
+                }
+            } else if (n == 0) {
+                // Client shut down its side: run a command sent without a newline
+                closing = c->in_len ? handle_command(c) : 1;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                closing = 1;
+            }
+        } else if (now - c->last_active > CONTROL_IDLE_TIMEOUT_SECONDS) {
+            closing = 1;
+        }
+        if (closing) {
+            close_connection(c);
+        }
+    }
+    if (FD_ISSET(listen_fd, readfds)) {
+        accept_connections();
+    }
+}
+
+// --- Client ---
+
+int control_socket_client(const char *path, const char *command) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Cannot connect to %s: %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 2;
+    }
+    char line[CONTROL_REQUEST_MAX];
+    int len = snprintf(line, sizeof(line), "%s\n", command);
+    if (len < 0 || (size_t)len >= sizeof(line) || send(fd, line, (size_t)len, MSG_NOSIGNAL) != len) {
+        fprintf(stderr, "Cannot send command to %s\n", path);
+        close(fd);
+        return 1;
+    }
+
+    // A 'reload wait N' is answered (possibly "pending") after N seconds
+    int wait_seconds = CONTROL_RELOAD_TIMEOUT_SECONDS;
+    if (sscanf(command, "reload wait %d", &wait_seconds) == 1 && wait_seconds < 0) {
+        wait_seconds = 0;
+    }
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int timeout_ms = (wait_seconds + CONTROL_IDLE_TIMEOUT_SECONDS) * 1000;
+    size_t received = 0;
+    char buf[4096];
+    while (poll(&pfd, 1, timeout_ms) > 0) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            break;
+        }
+        fwrite(buf, 1, (size_t)n, stdout);
+        received += (size_t)n;
+    }
+    close(fd);
+    if (received == 0) {
+        fprintf(stderr, "No response from %s\n", path);
+        return 1;
+    }
+    return 0;
+}
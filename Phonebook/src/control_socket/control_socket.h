@@ -0,0 +1,54 @@
+// control_socket.h
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+#include "../common.h"
+#include <sys/select.h>
+
+// Unix-domain control socket (PB_CONTROL_SOCKET_PATH) for the CGI scripts and
+// the command line. Like the HTTP server it has no thread of its own: it is
+// polled by the main select() loop. A client sends one command line and gets
+// one JSON document back, then the daemon closes the connection.
+//
+//   reload            Fetch now and answer when that cycle has finished:
+//                     {"status":"success","result":"changed|unchanged|failed",...}
+//                     or, after CONTROL_RELOAD_TIMEOUT_SECONDS, {"status":"pending","cycle":N,...}
+//   reload wait <s>   The same, answering "pending" after at most <s> seconds
+//   reload nowait     Fetch now, answer at once with the cycle number
+//   status            Uptime, heartbeats, counters and the last fetch cycle
+//   dump users        Registered user table
+//   dump calls        Call session table
+//   dump traces       Sampled SIP traces with per-stage timestamps, oldest first
+//   trace [setting]   Show or change SIP stage tracing: on, off, sample <N> (0 = no samples)
+//   loglevel [level]  Show or set the log level of every module (0-4 or none/error/warning/info/debug)
+//   loglevel <module> <level>
+//                     Set one module's level, e.g. 'loglevel SIP debug'
+//   loglevel reload   Re-read LOG_LEVEL and LOG_LEVEL_<MODULE> from the config file
+//
+// 'AREDN-Phonebook ctl <command>' is a client for scripts.
+
+#define CONTROL_MAX_CONNECTIONS 8
+#define CONTROL_REQUEST_MAX 128
+#define CONTROL_IDLE_TIMEOUT_SECONDS 5       // For the command line to arrive and the response to drain
+#define CONTROL_RELOAD_TIMEOUT_SECONDS 150   // A whole fetch cycle (PB_FETCH_TOTAL_TIMEOUT_MS) plus publishing
+
+// Creates the socket, replacing a stale one. Returns 0 on success, 1 on error.
+int control_socket_init(const char *path);
+
+// Adds the control sockets to the sets for the next select(); raises *maxfd as needed.
+void control_socket_fill_fds(fd_set *readfds, fd_set *writefds, int *maxfd);
+
+// Serves whatever select() reported ready and answers reloads whose cycle has finished.
+void control_socket_process(const fd_set *readfds, const fd_set *writefds);
+
+// Wakes the main loop after a fetch cycle. Safe to call from any thread.
+void control_socket_notify(void);
+
+/**
+ * @brief Sends 'command' to the daemon and copies the response to stdout.
+ *
+ * @return 0 if the daemon answered, 1 if it did not answer in time, 2 if it could not be reached.
+ */
+int control_socket_client(const char *path, const char *command);
+
+#endif // CONTROL_SOCKET_H
@@ -4,6 +4,11 @@
 #include "../common.h" // This includes necessary system headers and core types
 #include "../config_loader/config_loader.h" // For g_phonebook_servers_list, g_num_phonebook_servers
 #include "../file_utils/file_utils.h"
+#include "../gzip_inflate/gzip_inflate.h"
+#include "../phonebook_model/phonebook_model.h"
+#include "../phonebook_delta/phonebook_delta.h"
+#include "../http_client/http_client.h"
+#include "../fetch_scheduler/fetch_scheduler.h"
 
 // Note: Global extern declarations are now in common.h
 
@@ -36,385 +41,378 @@ void sanitize_utf8(const char *in, char *out, size_t out_sz) {
     out[o] = '\0';
 }
 
-static void xml_escape(const char *in, char *out, size_t out_sz) {
-    size_t o = 0;
-    const unsigned char *p = (const unsigned char*)in;
-    while (*p && o + 1 < out_sz) {
-        if (*p < 0x80) {
-            switch (*p) {
-                case '&':  o += snprintf(out+o, out_sz-o, "&amp;");  break;
-                case '<':  o += snprintf(out+o, out_sz-o, "&lt;");   break;
-                case '>':  o += snprintf(out+o, out_sz-o, "&gt;");   break;
-                case '"':  o += snprintf(out+o, out_sz-o, "&quot;"); break;
-                default:   out[o++] = *p; break;
-            }
-            p++;
-        } else {
-            size_t len = 0; unsigned int cp = 0;
-            if ((*p & 0xE0)==0xC0 && is_cont(p[1])) {
-                len = 2; cp = ((p[0]&0x1F)<<6)|(p[1]&0x3F);
-            } else if ((*p & 0xF0)==0xE0 && is_cont(p[1]) && is_cont(p[2])) {
-                len = 3; cp = ((p[0]&0x0F)<<12)|((p[1]&0x3F)<<6)|(p[2]&0x3F);
-            } else if ((*p & 0xF8)==0xF0
-                       && is_cont(p[1]) && is_cont(p[2]) && is_cont(p[3])) {
-                len = 4; cp = ((p[0]&0x07)<<18)
-                             | ((p[1]&0x3F)<<12)
-                             | ((p[2]&0x3F)<<6)
-                             |  (p[3]&0x3F);
-            }
-            if (len) {
-                o += snprintf(out+o, out_sz-o, "&#%u;", cp);
-                p += len;
-            } else {
-                p++;
-            }
+// --- HTTP cache validators (ETag / Last-Modified) per configured server ---
+// A server's validators are only sent back to it when the content they were
+// received with is still the content we hold locally (matching content hash).
+// Otherwise a 304 from server A could confirm a copy that actually came from B.
+typedef struct {
+    char key[MAX_SERVER_HOST_LEN + MAX_SERVER_PORT_LEN + MAX_SERVER_PATH_LEN + 2];
+    char etag[MAX_HTTP_VALIDATOR_LEN];
+    char last_modified[MAX_HTTP_VALIDATOR_LEN];
+    char content_hash[HASH_LENGTH + 1];
+} HttpValidators;
+
+static HttpValidators server_validators[MAX_PB_SERVERS];
+static int num_server_validators = 0;
+static bool validators_loaded = false;
+
+static void validators_make_key(const ConfigurableServer *server, char *key, size_t key_len) {
+    snprintf(key, key_len, "%s,%s,%s", server->host, server->port, server->path);
+}
+
+static HttpValidators *validators_find(const ConfigurableServer *server, bool create) {
+    char key[sizeof(server_validators[0].key)];
+    validators_make_key(server, key, sizeof(key));
+
+    for (int i = 0; i < num_server_validators; i++) {
+        if (strcmp(server_validators[i].key, key) == 0) {
+            return &server_validators[i];
         }
     }
-    out[o] = '\0';
+    if (!create || num_server_validators >= MAX_PB_SERVERS) {
+        return NULL;
+    }
+    HttpValidators *v = &server_validators[num_server_validators++];
+    memset(v, 0, sizeof(*v));
+    memcpy(v->key, key, sizeof(v->key));
+    return v;
+}
+
+// Copies one tab-separated field and advances *cursor past it.
+static void validators_next_field(char **cursor, char *out, size_t out_len) {
+    char *p = *cursor;
+    size_t n = strcspn(p, "\t\r\n");
+    size_t copy = (n < out_len - 1) ? n : out_len - 1;
+    memcpy(out, p, copy);
+    out[copy] = '\0';
+    p += n;
+    if (*p == '\t') p++;
+    *cursor = p;
 }
 
-int csv_processor_calculate_file_conceptual_hash(const char *filepath, char *output_hash_str, size_t hash_str_len) {
-    FILE *fp = fopen(filepath, "rb");
+static void validators_load(void) {
+    validators_loaded = true;
+    num_server_validators = 0;
+
+    FILE *fp = fopen(PB_HTTP_VALIDATORS_PATH, "r");
     if (!fp) {
-        LOG_ERROR("Failed to open '%s' to calculate hash. Error: %s", filepath, strerror(errno));
-        return 1;
+        LOG_DEBUG("No persisted HTTP validators at '%s'. First fetch will be unconditional.", PB_HTTP_VALIDATORS_PATH);
+        return;
     }
 
-    unsigned long checksum = 0;
-    char buffer[4096];
-    size_t bytesRead = 0;
-
-    LOG_DEBUG("Starting hash calculation for '%s'.", filepath);
-    while ((bytesRead = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
-        for (size_t i = 0; i < bytesRead; i++) {
-            checksum = (checksum << 1) + (unsigned char)buffer[i];
+    char line[sizeof(HttpValidators) + 8];
+    while (num_server_validators < MAX_PB_SERVERS && fgets(line, sizeof(line), fp)) {
+        HttpValidators *v = &server_validators[num_server_validators];
+        memset(v, 0, sizeof(*v));
+        char *cursor = line;
+        validators_next_field(&cursor, v->key, sizeof(v->key));
+        validators_next_field(&cursor, v->content_hash, sizeof(v->content_hash));
+        validators_next_field(&cursor, v->etag, sizeof(v->etag));
+        validators_next_field(&cursor, v->last_modified, sizeof(v->last_modified));
+        if (v->key[0] && v->content_hash[0]) {
+            num_server_validators++;
         }
-        LOG_DEBUG("Read %zu bytes for hash calculation.", bytesRead);
     }
+    fclose(fp);
+    LOG_INFO("Loaded HTTP validators for %d phonebook server(s).", num_server_validators);
+}
 
-    if (ferror(fp)) {
-        LOG_ERROR("Error reading file '%s' for hash calculation. Error: %s", filepath, strerror(errno));
-        fclose(fp);
-        return 1;
+static void validators_save(void) {
+    char buf[sizeof(server_validators) + MAX_PB_SERVERS * 4]; // All fields plus separators
+    size_t len = 0;
+    for (int i = 0; i < num_server_validators; i++) {
+        len += (size_t)snprintf(buf + len, sizeof(buf) - len, "%s\t%s\t%s\t%s\n", server_validators[i].key,
+                                server_validators[i].content_hash, server_validators[i].etag,
+                                server_validators[i].last_modified);
     }
+    if (file_utils_atomic_write(PB_HTTP_VALIDATORS_PATH, buf, len) != 0) {
+        LOG_WARN("Failed to persist HTTP validators to '%s'.", PB_HTTP_VALIDATORS_PATH);
+        return;
+    }
+    LOG_DEBUG("Persisted HTTP validators for %d server(s).", num_server_validators);
+}
 
-    snprintf(output_hash_str, hash_str_len, "%0*lX", (int)(hash_str_len - 1), checksum);
-    output_hash_str[hash_str_len - 1] = '\0';
-
-    LOG_DEBUG("Calculated conceptual hash for '%s': %s", filepath, output_hash_str);
-    fclose(fp);
-    return 0;
+// Body sink: decoded CSV bytes go straight into the model (hash, raw copy, tokenizer).
+static int download_sink_write(void *ctx, const unsigned char *data, size_t len) {
+    return phonebook_model_feed((PhonebookModel *)ctx, (const char *)data, len);
 }
 
-// Helper function to attempt download from a given host/port/path
-static int attempt_download(const char* host, const char* port, const char* path) {
-    LOG_INFO("Attempting CSV download from %s:%s%s", host, port, path);
-    struct addrinfo hints = { .ai_family=AF_UNSPEC, .ai_socktype=SOCK_STREAM },
-                    *res, *rp;
-    int sock = -1, rv;
-    int reuse_addr = 1;
-
-    LOG_DEBUG("Resolving hostname '%s'...", host);
-    if ((rv = getaddrinfo(host, port, &hints, &res)) != 0) {
-        LOG_INFO("DNS resolution for %s failed: %s", host, gai_strerror(rv));
+// A delta patch has to be complete before it can be applied
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} PatchBuffer;
+
+static int patch_sink_write(void *ctx, const unsigned char *data, size_t len) {
+    PatchBuffer *patch = (PatchBuffer *)ctx;
+    if (patch->len + len > MAX_PHONEBOOK_CSV_BYTES) {
+        LOG_ERROR("Delta patch exceeds %d bytes; rejecting.", MAX_PHONEBOOK_CSV_BYTES);
         return 1;
     }
-    LOG_DEBUG("Hostname '%s' resolved. Attempting to connect...", host);
-
-    for (rp = res; rp; rp = rp->ai_next) {
-        char ip_str[INET6_ADDRSTRLEN];
-        void *addr;
-        if (rp->ai_family == AF_INET) {
-            addr = &((struct sockaddr_in *)rp->ai_addr)->sin_addr;
-        } else { // AF_INET6
-            addr = &((struct sockaddr_in6 *)rp->ai_addr)->sin6_addr;
-        }
-        inet_ntop(rp->ai_family, addr, ip_str, sizeof(ip_str));
-        LOG_DEBUG("Trying to connect to IP:Port %s:%s (Family: %d, Type: %d, Protocol: %d)", ip_str, port, rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-
-        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (sock < 0) {
-            LOG_DEBUG("Failed to create socket for address family %d: %s. Trying next...", rp->ai_family, strerror(errno));
-            continue;
-        }
-
-        if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse_addr, sizeof(reuse_addr)) < 0) {
-            LOG_WARN("setsockopt(SO_REUSEADDR) failed for client socket: %s", strerror(errno));
+    if (patch->len + len > patch->cap) {
+        size_t new_cap = patch->cap ? patch->cap : 4096;
+        while (new_cap < patch->len + len) new_cap *= 2;
+        char *grown = realloc(patch->data, new_cap);
+        if (!grown) {
+            LOG_ERROR("Out of memory buffering %zu bytes of delta patch.", new_cap);
+            return 1;
         }
+        patch->data = grown;
+        patch->cap = new_cap;
+    }
+    memcpy(patch->data + patch->len, data, len);
+    patch->len += len;
+    return 0;
+}
 
-        struct sockaddr_in client_bind_addr = {0};
-        client_bind_addr.sin_family = AF_INET;
-        client_bind_addr.sin_addr.s_addr = INADDR_ANY;
-        client_bind_addr.sin_port = 0;
-
-        if (bind(sock, (const struct sockaddr *)&client_bind_addr, sizeof(client_bind_addr)) < 0) {
-            LOG_ERROR("Failed to bind client socket to ephemeral port: %s", strerror(errno));
-            close(sock);
-            sock = -1;
-            continue;
+// Internal result of receive_body: the server sent a patch that did not apply
+#define CSV_DOWNLOAD_DELTA_REJECTED 3
+
+// Builds the GET request for one server. Validators (and the delta base) are
+// only offered when they describe the copy we actually hold.
+static int build_request(const ConfigurableServer *server, const char *local_content_hash, bool offer_delta,
+                         HttpRaceEntry *entry) {
+    char conditional_hdrs[2 * MAX_HTTP_VALIDATOR_LEN + 64] = "";
+    char delta_hdrs[64 + HASH_LENGTH] = "";
+    HttpValidators *cached = validators_find(server, false);
+    if (cached && local_content_hash && local_content_hash[0] &&
+        strcmp(cached->content_hash, local_content_hash) == 0) {
+        int off = 0;
+        if (cached->etag[0]) {
+            off += snprintf(conditional_hdrs + off, sizeof(conditional_hdrs) - off,
+                            "If-None-Match: %s\r\n", cached->etag);
         }
-        LOG_DEBUG("Client socket bound to ephemeral port.");
-
-        if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) {
-            LOG_DEBUG("Successfully connected to %s:%s.", ip_str, port);
-            break;
+        if (cached->last_modified[0] && off < (int)sizeof(conditional_hdrs)) {
+            snprintf(conditional_hdrs + off, sizeof(conditional_hdrs) - off,
+                     "If-Modified-Since: %s\r\n", cached->last_modified);
         }
-        LOG_DEBUG("Connection failed to %s:%s: %s. Trying next address...", ip_str, port, strerror(errno));
-        close(sock);
-        sock = -1;
     }
-    freeaddrinfo(res);
-
-    if (sock < 0) {
-        LOG_INFO("Could not connect to %s:%s. No usable address found or all connections failed.", host, port);
-        return 1;
+    if (offer_delta && local_content_hash && local_content_hash[0]) {
+        snprintf(delta_hdrs, sizeof(delta_hdrs), "A-IM: %s\r\nX-Phonebook-Base: %s\r\n", PB_DELTA_IM, local_content_hash);
     }
-    LOG_DEBUG("Connection established. Preparing HTTP GET request.");
-
-    char req[512];
-    int n_req = snprintf(req, sizeof(req), "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n", path, host);
-    if (n_req >= (int)sizeof(req) || n_req < 0) {
-        LOG_ERROR("HTTP request string too long or snprintf error, requested size %d, buffer size %zu.", n_req, sizeof(req));
-        close(sock);
+    entry->server = server;
+    entry->conditional = conditional_hdrs[0] != '\0';
+    entry->delta = delta_hdrs[0] != '\0';
+    int n_req = snprintf(entry->request, sizeof(entry->request),
+                         "GET %s HTTP/1.0\r\nHost: %s\r\nAccept-Encoding: gzip, deflate\r\n%s%sConnection: close\r\n\r\n",
+                         server->path, server->host, conditional_hdrs, delta_hdrs);
+    if (n_req >= (int)sizeof(entry->request) || n_req < 0) {
+        LOG_ERROR("HTTP request string too long or snprintf error, requested size %d, buffer size %zu.", n_req, sizeof(entry->request));
         return 1;
     }
-    ssize_t sent_bytes = send(sock, req, n_req, 0);
-    if (sent_bytes < 0) {
-        LOG_ERROR("Failed to send HTTP GET request to %s:%s: %s", host, port, strerror(errno));
-        close(sock);
+    return 0;
+}
+
+// Streams a response body, decoding any Content-Encoding, into 'sink'.
+// Returns 0 on success, 1 on failure.
+static int read_body(const ConfigurableServer *server, HttpResponse *resp, inflate_write_fn sink, void *sink_ctx) {
+    const char *host = server->host;
+    const char *port = server->port;
+    char content_encoding[32] = "";
+    http_client_find_header(resp->buffer, "Content-Encoding", content_encoding, sizeof(content_encoding));
+
+    int encoding = -1; // Identity
+    if (strcasecmp(content_encoding, "gzip") == 0 || strcasecmp(content_encoding, "x-gzip") == 0) {
+        encoding = INFLATE_FORMAT_GZIP;
+    } else if (strcasecmp(content_encoding, "deflate") == 0) {
+        encoding = INFLATE_FORMAT_DEFLATE;
+    } else if (content_encoding[0] && strcasecmp(content_encoding, "identity") != 0) {
+        LOG_ERROR("Unsupported Content-Encoding '%s' from %s:%s.", content_encoding, host, port);
         return 1;
     }
-    LOG_DEBUG("Sent %zd bytes HTTP GET request:\n%s", sent_bytes, req);
 
-    FILE *fp = fopen(PB_CSV_TEMP_PATH, "wb");
-    if (!fp) {
-        LOG_ERROR("Failed to open temp file %s for writing: %s", PB_CSV_TEMP_PATH, strerror(errno));
-        close(sock);
-        return 1;
+    if (encoding >= 0) {
+        size_t compressed = 0, decoded = 0;
+        int rc = gzip_inflate_stream(encoding, http_client_read_body, resp, sink, sink_ctx,
+                                     MAX_PHONEBOOK_CSV_BYTES, &compressed, &decoded);
+        if (rc == INFLATE_TOO_LARGE) {
+            LOG_ERROR("Decompressed phonebook exceeds %d bytes; rejecting body from %s:%s.", MAX_PHONEBOOK_CSV_BYTES, host, port);
+            return 1;
+        } else if (rc != INFLATE_OK) {
+            LOG_ERROR("Failed to decode %s body from %s:%s (inflate error %d).", content_encoding, host, port, rc);
+            return 1;
+        }
+        LOG_INFO("Decoded %s body: %zu bytes on wire -> %zu bytes.", content_encoding, compressed, decoded);
+        return 0;
     }
-    LOG_DEBUG("Temporary file '%s' opened for writing downloaded CSV.", PB_CSV_TEMP_PATH);
 
-    char buf[4096];
+    unsigned char buf[4096];
     ssize_t len_read;
-    int http_status_code = 0;
-    size_t total_bytes_read = 0;
-    bool status_line_read = false;
-    char header_buffer[4096] = {0};
-    size_t header_buffer_len = 0;
-
-    LOG_DEBUG("Starting HTTP response read loop. Writing to %s.", PB_CSV_PATH);
-    while ((len_read = read(sock, buf, sizeof(buf))) > 0) {
-        // if (!keep_running) { // REMOVED
-        //     LOG_WARN("Download interrupted by shutdown signal. Read %zd bytes.", len_read);
-        //     break;
-        // }
-        LOG_DEBUG("Received %zd bytes from socket.", len_read);
-
-        if (!status_line_read) {
-            size_t copy_len = (header_buffer_len + len_read < sizeof(header_buffer)) ? len_read : (sizeof(header_buffer) - header_buffer_len -1);
-            memcpy(header_buffer + header_buffer_len, buf, copy_len);
-            header_buffer_len += copy_len;
-            header_buffer[header_buffer_len] = '\0';
-
-            char *end_of_line = strstr(header_buffer, "\r\n");
-            char *body_start = strstr(header_buffer, "\r\n\r\n");
-
-            if (end_of_line && body_start) {
-                size_t status_line_len = end_of_line - header_buffer;
-                char status_line[256] = {0};
-                strncpy(status_line, header_buffer, (status_line_len < sizeof(status_line)-1) ? status_line_len : sizeof(status_line)-1);
-                status_line[sizeof(status_line)-1] = '\0';
-
-                LOG_DEBUG("Received complete HTTP Status Line: '%s'", status_line);
-                if (sscanf(status_line, "HTTP/%*f %d", &http_status_code) != 1) {
-                    LOG_ERROR("Failed to parse HTTP status code from '%s'.", status_line);
-                    fclose(fp); close(sock); remove(PB_CSV_PATH); return 1;
-                }
-
-                if (http_status_code != 200) {
-                    LOG_ERROR("HTTP download failed with status code %d: '%s'.", http_status_code, status_line);
-                    fclose(fp); close(sock); remove(PB_CSV_PATH); return 1;
-                }
-                LOG_DEBUG("Parsed HTTP Status Code: %d. Headers received.", http_status_code);
-                status_line_read = true;
-
-                size_t header_len_total = body_start - header_buffer + 4;
-                if (len_read > header_len_total) {
-                     fwrite(buf + header_len_total, 1, len_read - header_len_total, fp);
-                     total_bytes_read += (size_t)(len_read - header_len_total);
-                     LOG_DEBUG("Wrote %zu bytes (body part of initial chunk) to CSV. Total: %zu.", (size_t)(len_read - header_len_total), total_bytes_read);
-                }
-            } else if (header_buffer_len >= sizeof(header_buffer) -1) {
-                LOG_ERROR("HTTP header too large or missing end of headers (\\r\\n\\r\\n). Header buffer exhausted.");
-                fclose(fp); close(sock); remove(PB_CSV_PATH); return 1;
-            } else {
-                 LOG_DEBUG("Partial HTTP header received (%zu bytes). Waiting for more data for status line/body split.", header_buffer_len);
-            }
-        } else {
-            fwrite(buf, 1, len_read, fp);
-            total_bytes_read += len_read;
-            LOG_DEBUG("Appended %zd bytes to CSV. Total: %zu.", len_read, total_bytes_read);
+    size_t total = 0;
+    while ((len_read = http_client_read_body(resp, buf, sizeof(buf))) > 0) {
+        if (sink(sink_ctx, buf, (size_t)len_read) != 0) {
+            LOG_ERROR("Rejecting body from %s:%s.", host, port);
+            return 1;
         }
+        total += (size_t)len_read;
+        LOG_DEBUG("Received %zd bytes of body. Total: %zu.", len_read, total);
     }
-    fclose(fp);
-    close(sock);
-
     if (len_read < 0) {
         LOG_ERROR("Error reading from socket during download: %s", strerror(errno));
-        remove(PB_CSV_PATH);
-        return 1;
-    } else if (total_bytes_read == 0 && http_status_code == 200) {
-        LOG_WARN("Downloaded CSV is empty (0 bytes body), despite 200 OK status. File: %s", PB_CSV_PATH);
-    } else if (!status_line_read) {
-        LOG_ERROR("HTTP response was too short or malformed; no complete status line/headers found. Received %zu bytes.", total_bytes_read);
-        remove(PB_CSV_PATH);
-        return 1;
-    } else if (http_status_code != 200) {
-        LOG_ERROR("HTTP download failed: Invalid status code %d. File not saved. Final bytes: %zu.", http_status_code, total_bytes_read);
-        remove(PB_CSV_PATH);
         return 1;
     }
-
-    LOG_INFO("CSV downloaded successfully to %s. Total bytes: %zu.", PB_CSV_PATH, total_bytes_read);
-    LOG_DEBUG("Finished CSV download process for %s:%s%s.", host, port, path);
     return 0;
 }
 
-
-int csv_processor_download_csv(void) {
-    for (int i = 0; i < g_num_phonebook_servers; i++) {
-        const ConfigurableServer *current_server = &g_phonebook_servers_list[i];
-        LOG_INFO("Attempting download from server %d: %s", i + 1, current_server->host);
-        if (attempt_download(current_server->host, current_server->port, current_server->path) == 0) {
-            LOG_INFO("Download successful from server %s.", current_server->host);
-            return 0;
-        } else {
-            LOG_WARN("Download failed from server %s. Trying next server.", current_server->host);
-        }
+// Rebuilds the phonebook from the persisted CSV and a patch received as 226 IM Used.
+static int receive_delta(const ConfigurableServer *server, HttpResponse *resp, const char *local_content_hash,
+                         PhonebookModel *model) {
+    PatchBuffer patch = {0};
+    if (read_body(server, resp, patch_sink_write, &patch) != 0) {
+        free(patch.data);
+        return CSV_DOWNLOAD_FAILED;
+    }
+    char *base = NULL;
+    size_t base_len = 0;
+    int rc = file_utils_read_file(PB_CSV_PATH, &base, &base_len);
+    if (rc == 0) {
+        rc = phonebook_delta_apply(base, base_len, local_content_hash, patch.data ? patch.data : "", patch.len, model);
     }
-    LOG_ERROR("All configured phonebook servers failed to provide CSV. Download failed completely.");
-    return 1;
+    free(base);
+    free(patch.data);
+    if (rc != 0) {
+        LOG_WARN("Delta from %s:%s could not be applied to the local copy.", server->host, server->port);
+        return CSV_DOWNLOAD_DELTA_REJECTED;
+    }
+    return CSV_DOWNLOAD_OK;
 }
 
+// Receives the body of a winning 200 (or 226 delta) response into the model.
+// Returns CSV_DOWNLOAD_OK, CSV_DOWNLOAD_FAILED or CSV_DOWNLOAD_DELTA_REJECTED.
+static int receive_body(const ConfigurableServer *server, HttpResponse *resp, const char *local_content_hash,
+                        PhonebookModel *model) {
+    char etag[MAX_HTTP_VALIDATOR_LEN] = "";
+    char last_modified[MAX_HTTP_VALIDATOR_LEN] = "";
+    http_client_find_header(resp->buffer, "ETag", etag, sizeof(etag));
+    http_client_find_header(resp->buffer, "Last-Modified", last_modified, sizeof(last_modified));
+    LOG_DEBUG("Response validators: ETag '%s', Last-Modified '%s'.", etag, last_modified);
+
+    if (resp->status_code == 226) {
+        int rc = receive_delta(server, resp, local_content_hash, model);
+        if (rc != CSV_DOWNLOAD_OK) {
+            return rc;
+        }
+    } else if (read_body(server, resp, download_sink_write, model) != 0 || phonebook_model_finish(model) != 0) {
+        return CSV_DOWNLOAD_FAILED;
+    }
+    if (model->csv_len == 0) {
+        LOG_WARN("Downloaded CSV is empty (0 bytes body), despite %d status.", resp->status_code);
+    }
 
-int csv_processor_convert_csv_to_xml_and_get_path(char *output_path, size_t output_path_len) {
-    LOG_INFO("Starting CSV to XML conversion from %s...", PB_CSV_PATH);
-    if (access(PB_CSV_PATH, R_OK) != 0) {
-        LOG_ERROR("CSV file %s not found or not readable. Error: %s", PB_CSV_PATH, strerror(errno));
-        return 1;
+    // Remember the validators together with the hash of the content they describe.
+    if (etag[0] || last_modified[0]) {
+        const char *content_hash = model->content_hash;
+        HttpValidators *v = validators_find(server, true);
+        if (v && (strcmp(v->etag, etag) != 0 || strcmp(v->last_modified, last_modified) != 0 ||
+                  strcmp(v->content_hash, content_hash) != 0)) {
+            strncpy(v->etag, etag, sizeof(v->etag) - 1);
+            v->etag[sizeof(v->etag) - 1] = '\0';
+            strncpy(v->last_modified, last_modified, sizeof(v->last_modified) - 1);
+            v->last_modified[sizeof(v->last_modified) - 1] = '\0';
+            strncpy(v->content_hash, content_hash, sizeof(v->content_hash) - 1);
+            v->content_hash[sizeof(v->content_hash) - 1] = '\0';
+            validators_save();
+        }
     }
 
-    strncpy(output_path, PB_XML_BASE_PATH, output_path_len - 1);
-    output_path[output_path_len - 1] = '\0';
+    LOG_INFO("CSV downloaded successfully. Total bytes: %zu (%zu body bytes on wire%s), %d entries.", model->csv_len,
+             resp->body_wire_bytes, resp->status_code == 226 ? " as delta" : "", model->count);
+    return CSV_DOWNLOAD_OK;
+}
 
-    FILE *xml = fopen(output_path, "w");
-    if (!xml) {
-        LOG_ERROR("Failed to open base xml file for writing '%s'. Error: %s", output_path, strerror(errno));
-        return 1;
-    }
 
-    FILE *csv = fopen(PB_CSV_PATH, "r");
-    if (!csv) {
-        LOG_ERROR("Failed to open CSV for reading '%s'. Error: %s", PB_CSV_PATH, strerror(errno));
-        fclose(xml);
-        remove(output_path);
-        return 1;
+int csv_processor_download_csv(const char *local_content_hash, PhonebookModel *model, size_t *wire_bytes) {
+    if (!validators_loaded) {
+        validators_load();
     }
 
-    fprintf(xml, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<YealinkIPPhoneDirectory>\n");
-    char line[2048];
-    int ln = 0;
-    LOG_DEBUG("Starting CSV parsing loop. Current line number: %d.", ln);
-    while (fgets(line, sizeof(line), csv)) {
-        // if (!keep_running) { // REMOVED
-        //     LOG_WARN("CSV conversion interrupted by shutdown signal.");
-        //     break;
-        // }
-        if (ln++ == 0) {
-            LOG_DEBUG("Skipping CSV header row (line %d): '%.*s'", ln, (int)strcspn(line, "\r\n"), line);
-            continue;
-        }
+    int order[MAX_PB_SERVERS];
+    int remaining = fetch_scheduler_order(order);
+    HttpRaceEntry *entries = calloc(MAX_PB_SERVERS, sizeof(HttpRaceEntry));
+    if (!entries) {
+        LOG_ERROR("Failed to allocate phonebook request buffers.");
+        return CSV_DOWNLOAD_FAILED;
+    }
 
-        int line_len = strcspn(line, "\r\n");
-        LOG_DEBUG("Processing line %d: '%.*s...'", ln,
-                 (line_len > 30) ? 30 : line_len, line);
-
-        char *cols[5] = {NULL};
-        char *p = line;
-        for (int i = 0; i < 5; i++) {
-            if (i < 4) {
-                char *c = strchr(p, ',');
-                if (c) {
-                    *c = '\0';
-                    cols[i] = p;
-                    p = c + 1;
-                } else {
-                    cols[i] = p;
-                    p = NULL;
-                }
-            } else {
-                cols[i] = p;
-            }
-            if (!p && i < 4) {
-                LOG_WARN("Line %d has fewer than 5 columns. Missing column %d and subsequent. Line: '%.*s'", ln, i+1, (int)strcspn(line, "\r\n"), line);
-                break;
+    // Race the remaining servers; if the winner's body fails, race the rest again.
+    int result = CSV_DOWNLOAD_FAILED;
+    bool offer_delta = g_phonebook_delta_fetch && local_content_hash && local_content_hash[0];
+    if (wire_bytes) {
+        *wire_bytes = 0;
+    }
+    while (remaining > 0) {
+        int count = 0;
+        int entry_server[MAX_PB_SERVERS];
+        for (int i = 0; i < remaining; i++) {
+            if (build_request(&g_phonebook_servers_list[order[i]], local_content_hash, offer_delta, &entries[count]) == 0) {
+                entry_server[count++] = order[i];
             }
         }
-
-        if (cols[4]) {
-            char *e = strchr(cols[4], ',');
-            if (e) *e = '\0';
-            cols[4][strcspn(cols[4], "\r\n")] = '\0';
+        if (count == 0) {
+            break;
         }
+        LOG_INFO("Racing %d phonebook server(s), preferred: %s.", count, entries[0].server->host);
 
-        if (!cols[4] || !*cols[4]) {
-            LOG_WARN("Skipping line %d due to missing or empty Telephone number (column 5). Line: '%.*s'", ln, (int)strcspn(line, "\r\n"), line);
-            continue;
+        HttpResponse *resp = malloc(sizeof(HttpResponse));
+        HttpAttemptResult results[MAX_PB_SERVERS];
+        if (!resp) {
+            LOG_ERROR("Failed to allocate phonebook response buffer.");
+            break;
+        }
+        int raced = http_client_race(entries, count, resp, results);
+        for (int i = 0; i < count; i++) {
+            fetch_scheduler_record(entry_server[i], &results[i]);
+        }
+        if (raced != 0) {
+            free(resp);
+            break;
         }
 
-        char s0[MAX_FIRST_NAME_LEN] = {0};
-        char s1[MAX_NAME_LEN] = {0};
-        char s2[MAX_CALLSIGN_LEN] = {0};
-        sanitize_utf8(cols[0] ? cols[0] : "", s0, sizeof(s0));
-        sanitize_utf8(cols[1] ? cols[1] : "", s1, sizeof(s1));
-        sanitize_utf8(cols[2] ? cols[2] : "", s2, sizeof(s2));
-
-        // Adjust buffer size calculation based on new max lengths, plus overhead for spaces and parentheses
-        char full_name_raw[MAX_FIRST_NAME_LEN + MAX_NAME_LEN + MAX_CALLSIGN_LEN + 5]; // +5 for " ()" and null
-        if (s0[0] && s1[0] && s2[0]) {
-            snprintf(full_name_raw, sizeof(full_name_raw), "%s %s (%s)", s0, s1, s2);
-        } else if (s0[0] && s1[0]) {
-            snprintf(full_name_raw, sizeof(full_name_raw), "%s %s", s0, s1);
-        } else if (s0[0]) {
-            strncpy(full_name_raw, s0, sizeof(full_name_raw) - 1);
-            full_name_raw[sizeof(full_name_raw) - 1] = '\0';
+        int winner_server = entry_server[resp->winner];
+        const ConfigurableServer *winner = entries[resp->winner].server;
+        if (resp->status_code == 304) {
+            LOG_INFO("Phonebook on server %s unchanged since last fetch (304).", winner->host);
+            result = CSV_DOWNLOAD_NOT_MODIFIED;
         } else {
-            strncpy(full_name_raw, "Unnamed", sizeof(full_name_raw) - 1);
-            full_name_raw[sizeof(full_name_raw) - 1] = '\0';
+            phonebook_model_free(model); // Drop any partial body from an earlier winner
+            result = receive_body(winner, resp, local_content_hash, model);
+        }
+        if (wire_bytes) {
+            *wire_bytes += resp->header_len + resp->body_wire_bytes;
+        }
+        http_client_close(resp);
+        free(resp);
+        if (result == CSV_DOWNLOAD_DELTA_REJECTED) {
+            // Not the server's fault as such: ask the same servers for the full file
+            LOG_WARN("Retrying without delta after an unusable patch from %s.", winner->host);
+            result = CSV_DOWNLOAD_FAILED;
+            offer_delta = false;
+            continue;
+        }
+        if (result != CSV_DOWNLOAD_FAILED) {
+            LOG_INFO("Download successful from server %s.", winner->host);
+            break;
         }
 
-        // The esc_name buffer size remains generous as XML escaping can greatly expand string length
-        char esc_name[MAX_DISPLAY_NAME_LEN * 4 + 32];
-        xml_escape(full_name_raw, esc_name, sizeof(esc_name));
-
-        fprintf(xml, "  <DirectoryEntry>\n    <Name>%s</Name>\n    <Telephone>%s</Telephone>\n  </DirectoryEntry>\n",
-                esc_name, cols[4]);
-        LOG_DEBUG("Added XML entry for Telephone: '%s'", cols[4]);
+        // Body failed: back off the winner and race the others.
+        LOG_WARN("Download failed from server %s. Trying remaining servers.", winner->host);
+        fetch_scheduler_record_body_failure(winner_server);
+        int n = 0;
+        for (int i = 0; i < remaining; i++) {
+            if (order[i] != winner_server) order[n++] = order[i];
+        }
+        remaining = n;
     }
+    free(entries);
 
-    if (ferror(csv)) {
-        LOG_ERROR("Error reading CSV file '%s' during conversion. Error: %s", PB_CSV_PATH, strerror(errno));
-        fclose(csv);
-        fclose(xml);
-        remove(output_path);
-        return 1;
+    if (result == CSV_DOWNLOAD_FAILED) {
+        LOG_ERROR("All configured phonebook servers failed to provide CSV. Download failed completely.");
     }
+    return result;
+}
 
-    fclose(csv);
-    fflush(xml);
-    fsync(fileno(xml));
-    fclose(xml);
-    LOG_INFO("XML conversion successful. Output: %s.", output_path);
-    LOG_DEBUG("Finished CSV to XML conversion process.");
-    return 0;
+
+void csv_processor_format_xml_marker(const char *content_hash, char *out, size_t out_len) {
+    snprintf(out, out_len, "%s %s %s -->", PB_XML_MARKER_PREFIX, content_hash, AREDN_PHONEBOOK_VERSION);
 }
@@ -2,14 +2,22 @@
 #define CSV_PROCESSOR_H
 
 #include "../common.h" 
+#include "../phonebook_model/phonebook_model.h"
 
-// Function to download CSV from URL to PB_CSV_PATH
-int csv_processor_download_csv(void);
+// Result codes for csv_processor_download_csv
+#define CSV_DOWNLOAD_OK            0 // New body parsed into the caller's model
+#define CSV_DOWNLOAD_FAILED        1 // No server delivered the phonebook
+#define CSV_DOWNLOAD_NOT_MODIFIED  2 // Server answered 304; local copy is current
 
-// Function to convert CSV to XML and get path to temp XML file
-int csv_processor_convert_csv_to_xml_and_get_path(char *output_path, size_t output_path_len);
+// Function to download CSV from the configured servers. The body is streamed
+// into 'model' (an initialized, empty model) without touching the filesystem.
+// local_content_hash is the hash of the CSV currently held locally (or NULL);
+// it decides whether cached ETag/Last-Modified validators may be sent.
+// With PHONEBOOK_DELTA_FETCH it is also offered as the base for a row-level patch.
+// wire_bytes (optional) receives the number of response bytes read from the network.
+int csv_processor_download_csv(const char *local_content_hash, PhonebookModel *model, size_t *wire_bytes);
 
-// Function to calculate a conceptual hash of a file
-int csv_processor_calculate_file_conceptual_hash(const char *filepath, char *output_hash_str, size_t hash_str_len);
+// Formats the comment line identifying which CSV (and renderer version) an XML was built from.
+void csv_processor_format_xml_marker(const char *content_hash, char *out, size_t out_len);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,131 @@
+#define MODULE_NAME "INDEX"
+
+#include "directory_index.h"
+#include "../common.h"
+#include <ctype.h>
+
+static const char *sort_arena; // qsort() has no context argument; builds are serialized by the caller
+
+static int compare_keys(const void *a, const void *b) {
+    const DirectoryIndexKey *ka = a, *kb = b;
+    int c = strcmp(sort_arena + ka->key, sort_arena + kb->key);
+    return c ? c : ka->entry - kb->entry;
+}
+
+static int compare_ints(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Appends the lowercased field as a key. Empty fields get no key.
+static void add_key(DirectoryIndex *index, size_t *arena_len, const char *field, int entry) {
+    if (!field[0]) {
+        return;
+    }
+    DirectoryIndexKey *k = &index->keys[index->count++];
+    k->key = (uint32_t)*arena_len;
+    k->entry = entry;
+    for (const char *p = field; *p; p++) {
+        index->arena[(*arena_len)++] = (char)tolower((unsigned char)*p);
+    }
+    index->arena[(*arena_len)++] = '\0';
+}
+
+int directory_index_build(DirectoryIndex *index, const PhonebookModel *model) {
+    memset(index, 0, sizeof(*index));
+    size_t arena_cap = 0;
+    for (int i = 0; i < model->count; i++) {
+        const PhonebookEntry *e = &model->entries[i];
+        arena_cap += strlen(e->first_name) + strlen(e->name) + strlen(e->callsign) + strlen(e->user_id) + 4;
+    }
+    index->keys = malloc((size_t)(model->count ? model->count : 1) * 4 * sizeof(DirectoryIndexKey));
+    index->arena = malloc(arena_cap ? arena_cap : 1);
+    index->seen = calloc((size_t)(model->count ? model->count : 1), sizeof(uint32_t));
+    if (!index->keys || !index->arena || !index->seen) {
+        LOG_ERROR("Out of memory indexing %d directory entries.", model->count);
+        directory_index_free(index);
+        return 1;
+    }
+
+    size_t arena_len = 0;
+    for (int i = 0; i < model->count; i++) {
+        const PhonebookEntry *e = &model->entries[i];
+        add_key(index, &arena_len, e->first_name, i);
+        add_key(index, &arena_len, e->name, i);
+        add_key(index, &arena_len, e->callsign, i);
+        add_key(index, &arena_len, e->user_id, i);
+    }
+    index->entries = model->count;
+    sort_arena = index->arena;
+    qsort(index->keys, (size_t)index->count, sizeof(DirectoryIndexKey), compare_keys);
+    return 0;
+}
+
+void directory_index_free(DirectoryIndex *index) {
+    free(index->keys);
+    free(index->arena);
+    free(index->seen);
+    memset(index, 0, sizeof(*index));
+}
+
+int directory_index_lookup(DirectoryIndex *index, const char *prefix, int **matches) {
+    char lower[MAX_DISPLAY_NAME_LEN];
+    size_t len = 0;
+    for (; prefix[len] && len < sizeof(lower) - 1; len++) {
+        lower[len] = (char)tolower((unsigned char)prefix[len]);
+    }
+    lower[len] = '\0';
+
+    if (len == 0) {
+        *matches = malloc((size_t)(index->entries ? index->entries : 1) * sizeof(int));
+        if (!*matches) {
+            return -1;
+        }
+        for (int i = 0; i < index->entries; i++) {
+            (*matches)[i] = i;
+        }
+        return index->entries;
+    }
+
+    // First key >= prefix
+    int lo = 0, hi = index->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strcmp(index->arena + index->keys[mid].key, lower) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    int end = lo;
+    while (end < index->count && strncmp(index->arena + index->keys[end].key, lower, len) == 0) {
+        end++;
+    }
+
+    *matches = malloc((size_t)(end > lo ? end - lo : 1) * sizeof(int));
+    if (!*matches) {
+        return -1;
+    }
+    if (++index->stamp == 0) { // Wrapped: forget all marks
+        memset(index->seen, 0, (size_t)index->entries * sizeof(uint32_t));
+        index->stamp = 1;
+    }
+    int found = 0;
+    for (int i = lo; i < end; i++) {
+        int entry = index->keys[i].entry;
+        if (index->seen[entry] != index->stamp) {
+            index->seen[entry] = index->stamp;
+            (*matches)[found++] = entry;
+        }
+    }
+    if (found > index->entries / 16) {
+        // Dense result: collecting marks in entry order beats sorting
+        found = 0;
+        for (int entry = 0; entry < index->entries; entry++) {
+            if (index->seen[entry] == index->stamp) (*matches)[found++] = entry;
+        }
+    } else {
+        qsort(*matches, (size_t)found, sizeof(int), compare_ints);
+    }
+    return found;
+}
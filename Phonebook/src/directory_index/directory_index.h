@@ -0,0 +1,43 @@
+// directory_index.h
+#ifndef DIRECTORY_INDEX_H
+#define DIRECTORY_INDEX_H
+
+#include "../common.h"
+#include "../phonebook_model/phonebook_model.h"
+#include <stdint.h>
+
+// Sorted prefix index over the phonebook for directory searches. Every entry
+// contributes its first name, name, callsign and number as lowercase keys;
+// a lookup is a binary search for the prefix plus a walk over the keys that
+// start with it, so it costs O(log n + k) rather than a scan of all entries.
+
+typedef struct {
+    uint32_t key;   // Offset of the NUL-terminated key in the arena
+    int32_t entry;  // Index into the model's entries
+} DirectoryIndexKey;
+
+typedef struct {
+    DirectoryIndexKey *keys; // Sorted by key
+    int count;
+    char *arena;
+    int entries;
+    uint32_t *seen;          // Per entry: last lookup that matched it (deduplicates keys)
+    uint32_t stamp;
+} DirectoryIndex;
+
+// Builds the index for 'model'. Returns 0 on success, 1 if out of memory.
+int directory_index_build(DirectoryIndex *index, const PhonebookModel *model);
+void directory_index_free(DirectoryIndex *index);
+
+/**
+ * @brief Finds the entries with a field starting with 'prefix'.
+ *
+ * Case-insensitive for ASCII. Not thread-safe: lookups on one index must be serialized.
+ *
+ * @param matches Receives a malloc'd array of entry indexes in directory order,
+ *        each entry once; caller frees. An empty prefix matches every entry.
+ * @return Number of matches, or -1 if out of memory.
+ */
+int directory_index_lookup(DirectoryIndex *index, const char *prefix, int **matches);
+
+#endif // DIRECTORY_INDEX_H
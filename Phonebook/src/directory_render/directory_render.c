@@ -0,0 +1,711 @@
+#define MODULE_NAME "RENDER"
+
+#include "directory_render.h"
+#include "../common.h"
+#include "../csv_processor/csv_processor.h"
+#include "../file_utils/file_utils.h"
+#include "../gzip_deflate/gzip_deflate.h"
+#include "../directory_index/directory_index.h"
+#include <inttypes.h>
+#include <stdint.h>
+#include <strings.h>
+
+typedef struct {
+    uint64_t key;                       // Hash of the entry's fields
+    char user_id[MAX_PHONE_NUMBER_LEN];
+    size_t offset;                      // Inactive variant, followed by the active one
+    uint32_t inactive_len;
+    uint32_t active_len;
+    char name[MAX_DISPLAY_NAME_LEN];    // Unescaped, for the formats rendered on demand
+} DirectoryFragment;
+
+typedef struct {
+    DirectoryFragment *frags;
+    int count;
+    char *arena;
+    size_t arena_len;
+    char header[192];
+    size_t header_len;
+    char marker[128];
+    char content_hash[HASH_LENGTH + 1];
+    DirectoryIndex index;               // For directory_render_query()
+} DirectoryFragments;
+
+// Latest rendering of one format, valid for one entries/liveness version pair
+typedef struct {
+    DirectoryOutput *out;   // Holds one reference; NULL until first use
+    unsigned long version;
+    unsigned long liveness_version;
+    char written_path[MAX_CONFIG_PATH_LEN]; // File last written with exactly this rendering
+    bool served;            // Acquired at least once; see prepare_served_formats()
+} FormatCache;
+
+typedef struct {
+    const char *name;
+    const char *extension;
+    // Header, one entry and footer of the output. Each returns the snprintf length.
+    int (*header)(char *out, size_t len);
+    int (*entry)(char *out, size_t len, const DirectoryFragment *f, bool active, int index);
+    const char *footer;
+    const char *content_type;
+} DirectoryRenderer;
+
+static const char xml_footer[] = "</YealinkIPPhoneDirectory>\n";
+
+static DirectoryFragments current;
+static unsigned long current_version = 0; // 0 until the first update
+static unsigned char *liveness = NULL;    // Bit i = entry i active; all clear after an update
+static unsigned long liveness_version = 0;
+static time_t updated_at = 0;             // When the entries last changed
+static time_t liveness_updated_at = 0;    // When a liveness bit last changed
+static FormatCache caches[DIRECTORY_FORMAT_COUNT];
+static pthread_mutex_t render_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void prepare_served_formats(void);
+
+static bool is_active(int i) {
+    return (liveness[i / 8] & (1u << (i % 8))) != 0;
+}
+
+static int is_cont(unsigned char c) { return (c & 0xC0) == 0x80; }
+
+static void xml_escape(const char *in, char *out, size_t out_sz) {
+    size_t o = 0;
+    const unsigned char *p = (const unsigned char*)in;
+    while (*p && o + 1 < out_sz) {
+        if (*p < 0x80) {
+            switch (*p) {
+                case '&':  o += snprintf(out+o, out_sz-o, "&amp;");  break;
+                case '<':  o += snprintf(out+o, out_sz-o, "&lt;");   break;
+                case '>':  o += snprintf(out+o, out_sz-o, "&gt;");   break;
+                case '"':  o += snprintf(out+o, out_sz-o, "&quot;"); break;
+                default:   out[o++] = *p; break;
+            }
+            p++;
+        } else {
+            size_t len = 0; unsigned int cp = 0;
+            if ((*p & 0xE0)==0xC0 && is_cont(p[1])) {
+                len = 2; cp = ((p[0]&0x1F)<<6)|(p[1]&0x3F);
+            } else if ((*p & 0xF0)==0xE0 && is_cont(p[1]) && is_cont(p[2])) {
+                len = 3; cp = ((p[0]&0x0F)<<12)|((p[1]&0x3F)<<6)|(p[2]&0x3F);
+            } else if ((*p & 0xF8)==0xF0
+                       && is_cont(p[1]) && is_cont(p[2]) && is_cont(p[3])) {
+                len = 4; cp = ((p[0]&0x07)<<18)
+                             | ((p[1]&0x3F)<<12)
+                             | ((p[2]&0x3F)<<6)
+                             |  (p[3]&0x3F);
+            }
+            if (len) {
+                o += snprintf(out+o, out_sz-o, "&#%u;", cp);
+                p += len;
+            } else {
+                p++;
+            }
+        }
+    }
+    out[o] = '\0';
+}
+
+static uint64_t hash_field(uint64_t h, const char *s) {
+    for (const unsigned char *p = (const unsigned char *)s; ; p++) {
+        h = (h ^ *p) * 1099511628211ULL; // FNV-1a, including the terminator
+        if (!*p) return h;
+    }
+}
+
+static uint64_t entry_key(const PhonebookEntry *e) {
+    uint64_t h = 14695981039346656037ULL;
+    h = hash_field(h, e->user_id);
+    h = hash_field(h, e->first_name);
+    h = hash_field(h, e->name);
+    return hash_field(h, e->callsign);
+}
+
+// Formats both variants of one entry into 'out'. Returns the inactive length; *active_len gets the other.
+static size_t format_fragment(const PhonebookEntry *e, char *out, size_t out_len, size_t *active_len) {
+    char full_name_raw[MAX_DISPLAY_NAME_LEN];
+    phonebook_model_format_name(e, full_name_raw, sizeof(full_name_raw));
+
+    // The esc_name buffer size remains generous as XML escaping can greatly expand string length
+    char esc_name[MAX_DISPLAY_NAME_LEN * 4 + 32];
+    char esc_phone[MAX_PHONE_NUMBER_LEN * 6];
+    xml_escape(full_name_raw, esc_name, sizeof(esc_name));
+    xml_escape(e->user_id, esc_phone, sizeof(esc_phone));
+
+    static const char fmt[] = "  <DirectoryEntry>\n    <Name>%s%s</Name>\n    <Telephone>%s</Telephone>\n  </DirectoryEntry>\n";
+    int inactive = snprintf(out, out_len, fmt, "", esc_name, esc_phone);
+    int active = snprintf(out + inactive, out_len - (size_t)inactive, fmt, "* ", esc_name, esc_phone);
+    *active_len = (size_t)active;
+    return (size_t)inactive;
+}
+
+// Old fragment with the same fields, found through a small open-addressing table.
+static const DirectoryFragment *find_reusable(const int *table, uint32_t mask, uint64_t key) {
+    for (uint32_t slot = (uint32_t)key & mask; table[slot] >= 0; slot = (slot + 1) & mask) {
+        if (current.frags[table[slot]].key == key) {
+            return &current.frags[table[slot]];
+        }
+    }
+    return NULL;
+}
+
+int directory_render_update(const PhonebookModel *model) {
+    pthread_mutex_lock(&render_mutex);
+
+    char marker[128];
+    csv_processor_format_xml_marker(model->content_hash, marker, sizeof(marker));
+    DirectoryFragments next;
+    memset(&next, 0, sizeof(next));
+    next.header_len = (size_t)snprintf(next.header, sizeof(next.header),
+                                       "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<YealinkIPPhoneDirectory>\n  %s\n", marker);
+    snprintf(next.marker, sizeof(next.marker), "%s", marker);
+    snprintf(next.content_hash, sizeof(next.content_hash), "%s", model->content_hash);
+
+    // Index the previous build by entry key
+    uint32_t slots = 16;
+    while (slots < (uint32_t)current.count * 2) slots <<= 1;
+    int *table = malloc(slots * sizeof(int));
+    size_t arena_cap = 64 * 1024;
+    next.frags = malloc((size_t)(model->count ? model->count : 1) * sizeof(DirectoryFragment));
+    next.arena = malloc(arena_cap);
+    unsigned char *next_liveness = calloc((size_t)model->count / 8 + 1, 1);
+    if (!table || !next.frags || !next.arena || !next_liveness) {
+        LOG_ERROR("Out of memory prerendering %d directory entries.", model->count);
+        goto fail;
+    }
+    if (directory_index_build(&next.index, model) != 0) {
+        goto fail;
+    }
+    memset(table, 0xFF, slots * sizeof(int));
+    for (int i = 0; i < current.count; i++) {
+        uint32_t slot = (uint32_t)current.frags[i].key & (slots - 1);
+        while (table[slot] >= 0) slot = (slot + 1) & (slots - 1);
+        table[slot] = i;
+    }
+
+    int reused = 0;
+    for (int i = 0; i < model->count; i++) {
+        const PhonebookEntry *e = &model->entries[i];
+        DirectoryFragment *f = &next.frags[i];
+        char buf[2 * (MAX_DISPLAY_NAME_LEN * 4 + MAX_PHONE_NUMBER_LEN * 6 + 128)];
+        f->key = entry_key(e);
+        memcpy(f->user_id, e->user_id, sizeof(f->user_id));
+        phonebook_model_format_name(e, f->name, sizeof(f->name));
+
+        const DirectoryFragment *old = find_reusable(table, slots - 1, f->key);
+        const char *src;
+        size_t inactive_len, active_len;
+        if (old) {
+            src = current.arena + old->offset;
+            inactive_len = old->inactive_len;
+            active_len = old->active_len;
+            reused++;
+        } else {
+            inactive_len = format_fragment(e, buf, sizeof(buf), &active_len);
+            src = buf;
+        }
+
+        if (next.arena_len + inactive_len + active_len > arena_cap) {
+            while (next.arena_len + inactive_len + active_len > arena_cap) arena_cap *= 2;
+            char *grown = realloc(next.arena, arena_cap);
+            if (!grown) {
+                LOG_ERROR("Out of memory growing directory arena to %zu bytes.", arena_cap);
+                goto fail;
+            }
+            next.arena = grown;
+        }
+        memcpy(next.arena + next.arena_len, src, inactive_len + active_len);
+        f->offset = next.arena_len;
+        f->inactive_len = (uint32_t)inactive_len;
+        f->active_len = (uint32_t)active_len;
+        next.arena_len += inactive_len + active_len;
+        next.count = i + 1;
+    }
+    free(table);
+
+    free(current.frags);
+    free(current.arena);
+    directory_index_free(&current.index);
+    free(liveness);
+    current = next;
+    liveness = next_liveness;
+    current_version++;
+    updated_at = liveness_updated_at = time(NULL);
+    LOG_INFO("Directory fragments ready: %d entries (%d reused, %d rendered), %zu bytes.", current.count, reused,
+             current.count - reused, current.arena_len);
+    pthread_mutex_unlock(&render_mutex);
+    prepare_served_formats();
+    return 0;
+
+fail:
+    free(table);
+    free(next.frags);
+    free(next.arena);
+    directory_index_free(&next.index);
+    free(next_liveness);
+    pthread_mutex_unlock(&render_mutex);
+    return 1;
+}
+
+int directory_render_entry_ids(char (**ids)[MAX_PHONE_NUMBER_LEN], int *count, unsigned long *version) {
+    pthread_mutex_lock(&render_mutex);
+    if (current_version == 0) {
+        pthread_mutex_unlock(&render_mutex);
+        return 1;
+    }
+    *ids = malloc((size_t)(current.count ? current.count : 1) * MAX_PHONE_NUMBER_LEN);
+    if (!*ids) {
+        pthread_mutex_unlock(&render_mutex);
+        return 1;
+    }
+    for (int i = 0; i < current.count; i++) {
+        memcpy((*ids)[i], current.frags[i].user_id, MAX_PHONE_NUMBER_LEN);
+    }
+    *count = current.count;
+    *version = current_version;
+    pthread_mutex_unlock(&render_mutex);
+    return 0;
+}
+
+static void json_escape(const char *in, char *out, size_t out_sz) {
+    size_t o = 0;
+    for (const unsigned char *p = (const unsigned char *)in; *p && o + 7 < out_sz; p++) {
+        if (*p == '"' || *p == '\\') {
+            out[o++] = '\\';
+            out[o++] = (char)*p;
+        } else if (*p < 0x20) {
+            o += (size_t)snprintf(out + o, out_sz - o, "\\u%04x", *p);
+        } else {
+            out[o++] = (char)*p; // UTF-8 passes through
+        }
+    }
+    out[o] = '\0';
+}
+
+static int xml_directory_header(char *out, size_t len, const char *root) {
+    return snprintf(out, len,
+                    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<%s>\n  %s\n  <Title>AREDN Phonebook</Title>\n"
+                    "  <Prompt>Select a number</Prompt>\n", root, current.marker);
+}
+
+static int xml_directory_entry(char *out, size_t len, const DirectoryFragment *f, bool active) {
+    char esc_name[MAX_DISPLAY_NAME_LEN * 4 + 32];
+    char esc_phone[MAX_PHONE_NUMBER_LEN * 6];
+    xml_escape(f->name, esc_name, sizeof(esc_name));
+    xml_escape(f->user_id, esc_phone, sizeof(esc_phone));
+    return snprintf(out, len, "  <DirectoryEntry>\n    <Name>%s%s</Name>\n    <Telephone>%s</Telephone>\n  </DirectoryEntry>\n",
+                    active ? "* " : "", esc_name, esc_phone);
+}
+
+static int cisco_header(char *out, size_t len) { return xml_directory_header(out, len, "CiscoIPPhoneDirectory"); }
+static int snom_header(char *out, size_t len) { return xml_directory_header(out, len, "SnomIPPhoneDirectory"); }
+
+static int cisco_entry(char *out, size_t len, const DirectoryFragment *f, bool active, int index) {
+    (void)index;
+    return xml_directory_entry(out, len, f, active);
+}
+
+static int grandstream_header(char *out, size_t len) {
+    return snprintf(out, len, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<AddressBook>\n  %s\n", current.marker);
+}
+
+static int grandstream_entry(char *out, size_t len, const DirectoryFragment *f, bool active, int index) {
+    (void)index;
+    char esc_name[MAX_DISPLAY_NAME_LEN * 4 + 32];
+    char esc_phone[MAX_PHONE_NUMBER_LEN * 6];
+    xml_escape(f->name, esc_name, sizeof(esc_name));
+    xml_escape(f->user_id, esc_phone, sizeof(esc_phone));
+    return snprintf(out, len,
+                    "  <Contact>\n    <FirstName>%s%s</FirstName>\n    <Phone>\n      <phonenumber>%s</phonenumber>\n"
+                    "      <accountindex>1</accountindex>\n    </Phone>\n  </Contact>\n",
+                    active ? "* " : "", esc_name, esc_phone);
+}
+
+static void format_iso_time(time_t t, char *out, size_t len) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(out, len, "%Y-%m-%dT%H:%M:%SZ", &tm);
+}
+
+// Superset of what the showphonebook CGI used to assemble from the XML
+static int json_header(char *out, size_t len) {
+    char updated[32], liveness_updated[32], now[32];
+    format_iso_time(updated_at, updated, sizeof(updated));
+    format_iso_time(liveness_updated_at, liveness_updated, sizeof(liveness_updated));
+    format_iso_time(time(NULL), now, sizeof(now));
+    int active_count = 0;
+    for (int i = 0; i < current.count; i++) {
+        active_count += is_active(i);
+    }
+    return snprintf(out, len,
+                    "{\"status\":\"success\",\"version\":\"%s\",\"hash\":\"%s\",\"last_updated\":\"%s\","
+                    "\"liveness_updated\":\"%s\",\"timestamp\":\"%s\",\"entry_count\":%d,\"active_count\":%d,"
+                    "\"entries\":[",
+                    AREDN_PHONEBOOK_VERSION, current.content_hash, updated, liveness_updated, now, current.count,
+                    active_count);
+}
+
+static int json_entry(char *out, size_t len, const DirectoryFragment *f, bool active, int index) {
+    char esc_name[MAX_DISPLAY_NAME_LEN * 6 + 8];
+    char esc_phone[MAX_PHONE_NUMBER_LEN * 6];
+    json_escape(f->name, esc_name, sizeof(esc_name));
+    json_escape(f->user_id, esc_phone, sizeof(esc_phone));
+    return snprintf(out, len, "%s\n{\"name\":\"%s\",\"telephone\":\"%s\",\"active\":%s}", index ? "," : "",
+                    esc_name, esc_phone, active ? "true" : "false");
+}
+
+// Yealink output copies the prerendered fragments
+static int yealink_header(char *out, size_t len) {
+    return snprintf(out, len, "%s", current.header);
+}
+
+static int yealink_entry(char *out, size_t len, const DirectoryFragment *f, bool active, int index) {
+    (void)index;
+    size_t n = active ? f->active_len : f->inactive_len;
+    if (n >= len) {
+        return 0;
+    }
+    memcpy(out, current.arena + f->offset + (active ? f->inactive_len : 0), n);
+    return (int)n;
+}
+
+#define XML_CONTENT_TYPE "text/xml; charset=utf-8"
+
+static const DirectoryRenderer renderers[DIRECTORY_FORMAT_COUNT] = {
+    [DIRECTORY_FORMAT_YEALINK]     = { "yealink", "xml", yealink_header, yealink_entry, xml_footer, XML_CONTENT_TYPE },
+    [DIRECTORY_FORMAT_GRANDSTREAM] = { "grandstream", "xml", grandstream_header, grandstream_entry, "</AddressBook>\n",
+                                       XML_CONTENT_TYPE },
+    [DIRECTORY_FORMAT_CISCO]       = { "cisco", "xml", cisco_header, cisco_entry, "</CiscoIPPhoneDirectory>\n",
+                                       XML_CONTENT_TYPE },
+    [DIRECTORY_FORMAT_SNOM]        = { "snom", "xml", snom_header, cisco_entry, "</SnomIPPhoneDirectory>\n",
+                                       XML_CONTENT_TYPE },
+    [DIRECTORY_FORMAT_JSON]        = { "json", "json", json_header, json_entry, "\n]}\n", "application/json" },
+};
+
+const char *directory_format_name(DirectoryFormat format) {
+    return renderers[format].name;
+}
+
+const char *directory_format_extension(DirectoryFormat format) {
+    return renderers[format].extension;
+}
+
+const char *directory_format_content_type(DirectoryFormat format) {
+    return renderers[format].content_type;
+}
+
+int directory_format_from_name(const char *name) {
+    for (int i = 0; i < DIRECTORY_FORMAT_COUNT; i++) {
+        if (strcasecmp(name, renderers[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int directory_render_set_liveness(const unsigned char *active, unsigned long version) {
+    pthread_mutex_lock(&render_mutex);
+    if (current_version == 0 || version != current_version) {
+        pthread_mutex_unlock(&render_mutex);
+        return current_version == 0 ? 1 : DIRECTORY_RENDER_STALE;
+    }
+    size_t bytes = (size_t)current.count / 8 + 1;
+    bool changed = memcmp(liveness, active, bytes) != 0;
+    if (changed) {
+        memcpy(liveness, active, bytes);
+        liveness_version++;
+        liveness_updated_at = time(NULL);
+    }
+    pthread_mutex_unlock(&render_mutex);
+    if (changed) {
+        prepare_served_formats();
+    }
+    return 0;
+}
+
+
+// Growable buffer for one rendering
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} RenderBuffer;
+
+// Makes room for 'more' bytes after the data. Returns 0 on success.
+static int buffer_reserve(RenderBuffer *b, size_t more) {
+    if (b->len + more <= b->cap) {
+        return 0;
+    }
+    size_t cap = b->cap ? b->cap : 64 * 1024;
+    while (b->len + more > cap) cap *= 2;
+    char *grown = realloc(b->data, cap);
+    if (!grown) {
+        return 1;
+    }
+    b->data = grown;
+    b->cap = cap;
+    return 0;
+}
+
+static void output_unref_locked(DirectoryOutput *out) {
+    if (out && --out->refs == 0) {
+        free(out->data);
+        free(out->gzip);
+        free(out);
+    }
+}
+
+// Renders 'format' for the current entries and liveness. Called with render_mutex held.
+static DirectoryOutput *render_output(DirectoryFormat format) {
+    const DirectoryRenderer *r = &renderers[format];
+    const size_t entry_max = MAX_DISPLAY_NAME_LEN * 6 + MAX_PHONE_NUMBER_LEN * 6 + 256;
+    RenderBuffer b = { NULL, 0, 0 };
+    DirectoryOutput *out = calloc(1, sizeof(*out));
+    if (!out || buffer_reserve(&b, entry_max) != 0) {
+        goto fail;
+    }
+    b.len += (size_t)r->header(b.data, b.cap);
+    for (int i = 0; i < current.count; i++) {
+        if (buffer_reserve(&b, entry_max) != 0) {
+            goto fail;
+        }
+        b.len += (size_t)r->entry(b.data + b.len, b.cap - b.len, &current.frags[i], is_active(i), i);
+    }
+    size_t footer_len = strlen(r->footer);
+    if (buffer_reserve(&b, footer_len + 1) != 0) {
+        goto fail;
+    }
+    memcpy(b.data + b.len, r->footer, footer_len + 1);
+    b.len += footer_len;
+
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < b.len; i++) {
+        h = (h ^ (unsigned char)b.data[i]) * 1099511628211ULL;
+    }
+    out->data = b.data;
+    out->len = b.len;
+    snprintf(out->etag, sizeof(out->etag), "\"%016" PRIx64 "\"", h);
+    out->rendered = time(NULL);
+    out->entries = current.count;
+    out->refs = 1;
+    LOG_DEBUG("Rendered %d directory entries as %s (%zu bytes).", current.count, r->name, b.len);
+    return out;
+
+fail:
+    LOG_ERROR("Out of memory rendering %d directory entries as %s.", current.count, r->name);
+    free(b.data);
+    free(out);
+    return NULL;
+}
+
+// Current rendering of 'format', rendered now if stale. Called with render_mutex held.
+static DirectoryOutput *cached_output_locked(DirectoryFormat format) {
+    FormatCache *c = &caches[format];
+    if (c->out && c->version == current_version && c->liveness_version == liveness_version) {
+        return c->out;
+    }
+    DirectoryOutput *out = render_output(format);
+    if (!out) {
+        return NULL;
+    }
+    output_unref_locked(c->out);
+    c->out = out;
+    c->version = current_version;
+    c->liveness_version = liveness_version;
+    c->written_path[0] = '\0';
+    return out;
+}
+
+int directory_render_to_file(DirectoryFormat format, const char *path, unsigned long version) {
+    pthread_mutex_lock(&render_mutex);
+    if (current_version == 0 || (version != 0 && version != current_version)) {
+        pthread_mutex_unlock(&render_mutex);
+        return current_version == 0 ? 1 : DIRECTORY_RENDER_STALE;
+    }
+    FormatCache *c = &caches[format];
+    DirectoryOutput *out = cached_output_locked(format);
+    if (!out) {
+        pthread_mutex_unlock(&render_mutex);
+        return 1;
+    }
+    // The Yealink file is always written: its path is also published from
+    // other sources, so written_path cannot vouch for it
+    if (format != DIRECTORY_FORMAT_YEALINK && strcmp(c->written_path, path) == 0 && access(path, F_OK) == 0) {
+        pthread_mutex_unlock(&render_mutex);
+        return DIRECTORY_RENDER_UNCHANGED;
+    }
+    out->refs++;
+    int entries = out->entries;
+    pthread_mutex_unlock(&render_mutex);
+
+    // Written unlocked; the rendering is immutable while referenced, and the
+    // SIP loop's acquire and query calls never wait on the file I/O
+    int ret = file_utils_atomic_write(path, out->data, out->len);
+
+    pthread_mutex_lock(&render_mutex);
+    if (ret == 0 && c->out == out) {
+        snprintf(c->written_path, sizeof(c->written_path), "%s", path);
+    }
+    output_unref_locked(out);
+    pthread_mutex_unlock(&render_mutex);
+    if (ret == 0) {
+        LOG_DEBUG("Wrote %d directory entries as %s to %s.", entries, directory_format_name(format), path);
+    }
+    return ret == 0 ? 0 : 1;
+}
+
+// Adds the gzip variant if it is missing. The caller holds a reference, and the
+// rendering is immutable while referenced, so it is compressed unlocked.
+static void attach_gzip(DirectoryOutput *out) {
+    pthread_mutex_lock(&render_mutex);
+    bool need_gzip = !out->gzip;
+    pthread_mutex_unlock(&render_mutex);
+    if (!need_gzip) {
+        return;
+    }
+    unsigned char *gz = NULL;
+    size_t gz_len = 0;
+    if (gzip_deflate_buffer((const unsigned char *)out->data, out->len, &gz, &gz_len) == 0) {
+        pthread_mutex_lock(&render_mutex);
+        if (!out->gzip) {
+            out->gzip = gz;
+            out->gzip_len = gz_len;
+            gz = NULL;
+        }
+        pthread_mutex_unlock(&render_mutex);
+        free(gz);
+    }
+}
+
+// Renders and compresses every format served from memory so far, on the thread
+// that just changed the entries or liveness (fetcher or status updater), so
+// that the HTTP server on the SIP loop finds them ready.
+static void prepare_served_formats(void) {
+    for (int format = 0; format < DIRECTORY_FORMAT_COUNT; format++) {
+        pthread_mutex_lock(&render_mutex);
+        DirectoryOutput *out = caches[format].served ? cached_output_locked((DirectoryFormat)format) : NULL;
+        if (out) {
+            out->refs++;
+        }
+        pthread_mutex_unlock(&render_mutex);
+        if (out) {
+            attach_gzip(out);
+            directory_render_release(out);
+        }
+    }
+}
+
+const DirectoryOutput *directory_render_acquire(DirectoryFormat format, bool gzip) {
+    pthread_mutex_lock(&render_mutex);
+    FormatCache *c = &caches[format];
+    DirectoryOutput *out = NULL;
+    if (current_version) {
+        // Once served, a stale rendering is replaced by prepare_served_formats();
+        // until then the previous one is returned instead of rendering here
+        out = c->served && c->out ? c->out : cached_output_locked(format);
+        c->served = true;
+    }
+    if (!out) {
+        pthread_mutex_unlock(&render_mutex);
+        return NULL;
+    }
+    out->refs++;
+    pthread_mutex_unlock(&render_mutex);
+
+    if (gzip) {
+        attach_gzip(out);
+    }
+    return out;
+}
+
+void directory_render_release(const DirectoryOutput *out) {
+    pthread_mutex_lock(&render_mutex);
+    output_unref_locked((DirectoryOutput *)out);
+    pthread_mutex_unlock(&render_mutex);
+}
+
+// Link to the next result page, inside the root element; NULL where the format has none
+static const char *const next_page_formats[DIRECTORY_FORMAT_COUNT] = {
+    [DIRECTORY_FORMAT_YEALINK] = "  <SoftKey index=\"1\">\n    <Label>Next</Label>\n    <URI>%s</URI>\n  </SoftKey>\n",
+    [DIRECTORY_FORMAT_CISCO]   = "  <SoftKeyItem>\n    <Name>Dial</Name>\n    <URL>SoftKey:Dial</URL>\n    <Position>1</Position>\n"
+                                 "  </SoftKeyItem>\n  <SoftKeyItem>\n    <Name>Next</Name>\n    <URL>%s</URL>\n"
+                                 "    <Position>2</Position>\n  </SoftKeyItem>\n  <SoftKeyItem>\n    <Name>Exit</Name>\n"
+                                 "    <URL>SoftKey:Exit</URL>\n    <Position>3</Position>\n  </SoftKeyItem>\n",
+    [DIRECTORY_FORMAT_SNOM]    = "  <SoftKeyItem>\n    <Name>F1</Name>\n    <Label>Next</Label>\n    <URL>%s</URL>\n  </SoftKeyItem>\n",
+};
+
+int directory_render_query(DirectoryFormat format, const DirectoryQuery *query, char **out, size_t *out_len,
+                           int *total) {
+    const DirectoryRenderer *r = &renderers[format];
+    const size_t entry_max = MAX_DISPLAY_NAME_LEN * 6 + MAX_PHONE_NUMBER_LEN * 6 + 256;
+    pthread_mutex_lock(&render_mutex);
+    if (current_version == 0) {
+        pthread_mutex_unlock(&render_mutex);
+        return 1;
+    }
+    int *matches = NULL;
+    int found = directory_index_lookup(&current.index, query->prefix ? query->prefix : "", &matches);
+    if (found < 0) {
+        pthread_mutex_unlock(&render_mutex);
+        LOG_ERROR("Out of memory searching the directory.");
+        return 1;
+    }
+    if (query->active_only) {
+        int kept = 0;
+        for (int i = 0; i < found; i++) {
+            if (is_active(matches[i])) matches[kept++] = matches[i];
+        }
+        found = kept;
+    }
+    int per_page = query->per_page > 0 ? query->per_page : found;
+    // 64-bit so a huge page number cannot wrap to a negative index; past the end is an empty page
+    int64_t first_wide = (int64_t)(query->page > 1 ? query->page - 1 : 0) * per_page;
+    int first = first_wide < found ? (int)first_wide : found;
+    int last = per_page < found - first ? first + per_page : found;
+    bool more = last < found && query->next_url;
+
+    RenderBuffer b = { NULL, 0, 0 };
+    int ret = buffer_reserve(&b, entry_max);
+    if (ret == 0) {
+        b.len += (size_t)r->header(b.data, b.cap);
+    }
+    for (int i = first; ret == 0 && i < last; i++) {
+        ret = buffer_reserve(&b, entry_max);
+        if (ret == 0) {
+            b.len += (size_t)r->entry(b.data + b.len, b.cap - b.len, &current.frags[matches[i]], is_active(matches[i]),
+                                      i - first);
+        }
+    }
+    pthread_mutex_unlock(&render_mutex);
+    free(matches);
+
+    if (ret == 0) {
+        ret = buffer_reserve(&b, 4096);
+    }
+    if (ret == 0 && format == DIRECTORY_FORMAT_JSON) {
+        char next[1024] = "null";
+        if (more) {
+            char esc[sizeof(next) - 2];
+            json_escape(query->next_url, esc, sizeof(esc));
+            snprintf(next, sizeof(next), "\"%s\"", esc);
+        }
+        b.len += (size_t)snprintf(b.data + b.len, b.cap - b.len, "\n],\"total\":%d,\"page\":%d,\"per_page\":%d,\"next\":%s}\n",
+                                  found, query->page > 1 ? query->page : 1, per_page, next);
+    } else if (ret == 0) {
+        if (more && next_page_formats[format]) {
+            char esc[1024];
+            xml_escape(query->next_url, esc, sizeof(esc));
+            b.len += (size_t)snprintf(b.data + b.len, b.cap - b.len, next_page_formats[format], esc);
+        }
+        b.len += (size_t)snprintf(b.data + b.len, b.cap - b.len, "%s", r->footer);
+    }
+    if (ret != 0) {
+        LOG_ERROR("Out of memory rendering directory search results.");
+        free(b.data);
+        return 1;
+    }
+    *out = b.data;
+    *out_len = b.len;
+    *total = found;
+    return 0;
+}
@@ -0,0 +1,113 @@
+// directory_render.h
+#ifndef DIRECTORY_RENDER_H
+#define DIRECTORY_RENDER_H
+
+#include "../common.h"
+#include "../phonebook_model/phonebook_model.h"
+
+// Directory outputs rendered from the applied phonebook and the latest
+// liveness bitmap. Shared by the fetcher (which updates the entries) and the
+// status updater (which sets liveness).
+//
+// Yealink XML is prerendered per entry into an arena, in an inactive and an
+// active ("* " name prefix) variant, so rendering it only copies fragments.
+// Every format is rendered into memory on first use after the entries or the
+// liveness changed and cached until the next change.
+
+typedef enum {
+    DIRECTORY_FORMAT_YEALINK,
+    DIRECTORY_FORMAT_GRANDSTREAM,
+    DIRECTORY_FORMAT_CISCO,
+    DIRECTORY_FORMAT_SNOM,
+    DIRECTORY_FORMAT_JSON,
+    DIRECTORY_FORMAT_COUNT
+} DirectoryFormat;
+
+#define DIRECTORY_RENDER_STALE     2 // Liveness was computed for entries that have since changed
+#define DIRECTORY_RENDER_UNCHANGED 3 // Output file already holds the current rendering
+
+// One rendering of a directory format, shared read-only between its users.
+typedef struct {
+    char *data;
+    size_t len;
+    unsigned char *gzip;   // Compressed variant; NULL unless requested
+    size_t gzip_len;
+    char etag[20];         // Quoted hash of data
+    time_t rendered;
+    int entries;
+    int refs;              // Owned by directory_render
+} DirectoryOutput;
+
+// Name used in DIRECTORY_FORMATS and output file names, e.g. "grandstream".
+const char *directory_format_name(DirectoryFormat format);
+const char *directory_format_extension(DirectoryFormat format);
+const char *directory_format_content_type(DirectoryFormat format);
+// Returns the format with that name, or -1.
+int directory_format_from_name(const char *name);
+
+// Rebuilds the entries for 'model', in model order, and clears liveness.
+// Yealink fragments of entries whose fields did not change are copied from the
+// previous build instead of being formatted again. Returns 0 on success.
+int directory_render_update(const PhonebookModel *model);
+
+/**
+ * @brief Copies the user IDs of the current entries, for liveness checks.
+ *
+ * @param ids Receives a malloc'd array of count IDs; caller frees.
+ * @param count Number of entries.
+ * @param version Receives the entries version the IDs belong to.
+ * @return 0 on success, 1 if no phonebook has been rendered yet or out of memory.
+ */
+int directory_render_entry_ids(char (**ids)[MAX_PHONE_NUMBER_LEN], int *count, unsigned long *version);
+
+// Sets the liveness bitmap (bit i = entry i active) computed for entries 'version'.
+// Cached outputs are only invalidated if a bit changed.
+// Returns 0 on success, DIRECTORY_RENDER_STALE or 1 on error.
+int directory_render_set_liveness(const unsigned char *active, unsigned long version);
+
+// Writes the current directory in 'format' to 'path' (meant for tmpfs). With a
+// nonzero 'version', returns DIRECTORY_RENDER_STALE if the entries changed since.
+// 'path' is replaced atomically from the cached rendering, without holding the
+// lock the SIP loop takes to serve and search. Formats other than Yealink return
+// DIRECTORY_RENDER_UNCHANGED if 'path' was last written with this very
+// rendering. Otherwise returns 0 on success, 1 on error.
+int directory_render_to_file(DirectoryFormat format, const char *path, unsigned long version);
+
+/**
+ * @brief Returns the current rendering of 'format' from memory.
+ *
+ * Only the first call for a format renders (and compresses) it on the calling
+ * thread. From then on directory_render_update() and
+ * directory_render_set_liveness() render and compress the format again on
+ * their own threads, and until they are done this returns the previous
+ * rendering. The result stays valid, and unchanged, until released.
+ *
+ * @param gzip Also prepare the gzip variant (kept with the rendering); on
+ *        failure the result simply has none.
+ * @return The rendering, or NULL if no phonebook is loaded yet or out of memory.
+ */
+const DirectoryOutput *directory_render_acquire(DirectoryFormat format, bool gzip);
+void directory_render_release(const DirectoryOutput *out);
+
+typedef struct {
+    const char *prefix;   // Matches the start of first name, name, callsign or number; NULL or "" for all
+    bool active_only;
+    int page;             // 1-based
+    int per_page;         // 0 for all results on one page
+    const char *next_url; // Link to the following page, added where the format has one; may be NULL
+} DirectoryQuery;
+
+/**
+ * @brief Renders one page of search results in 'format'.
+ *
+ * Entries keep their directory order. XML formats end with their paging soft
+ * key when more results follow; JSON ends with total, page, per_page and next.
+ *
+ * @param out Receives a malloc'd buffer with the document; caller frees.
+ * @param total Receives the number of matching entries on all pages.
+ * @return 0 on success, 1 if no phonebook is loaded yet or out of memory.
+ */
+int directory_render_query(DirectoryFormat format, const DirectoryQuery *query, char **out, size_t *out_len,
+                           int *total);
+
+#endif // DIRECTORY_RENDER_H
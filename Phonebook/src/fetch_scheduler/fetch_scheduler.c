@@ -0,0 +1,318 @@
+#define MODULE_NAME "SCHED"
+
+#include "fetch_scheduler.h"
+#include "../common.h"
+#include "../config_loader/config_loader.h" // For g_phonebook_servers_list, g_num_phonebook_servers, g_pb_interval_seconds
+#include "../file_utils/file_utils.h"
+#include <stdint.h>
+
+// Only the fetcher thread changes this state. /metrics copies server_health from
+// the SIP loop, so the fetcher updates it under health_mutex (time_t fields are
+// 64 bits even on MIPS32 and would otherwise be read torn); its own reads need no lock.
+static ServerHealth server_health[MAX_PB_SERVERS];
+static pthread_mutex_t health_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t health_once = PTHREAD_ONCE_INIT;
+static unsigned int consecutive_failed_cycles = 0;
+static unsigned int completed_cycles = 0;
+static unsigned int jitter_seed = 0;
+static uint32_t node_hash = 0;
+
+static uint32_t fnv1a(uint32_t h, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Stable per-node value from the node name and LAN MAC. Nodes that boot
+// together (e.g. after a regional power restore) get different fetch phases,
+// and a node keeps the same phase across restarts.
+static uint32_t compute_node_hash(void) {
+    static const char *mac_paths[] = {
+        "/sys/class/net/br-lan/address",
+        "/sys/class/net/eth0/address",
+        "/sys/class/net/wlan0/address",
+    };
+    uint32_t h = 2166136261u;
+    char buf[128] = "";
+
+    if (gethostname(buf, sizeof(buf) - 1) == 0) {
+        h = fnv1a(h, buf, strlen(buf));
+    }
+    for (size_t i = 0; i < sizeof(mac_paths) / sizeof(mac_paths[0]); i++) {
+        FILE *fp = fopen(mac_paths[i], "r");
+        if (!fp) continue;
+        if (fgets(buf, sizeof(buf), fp)) {
+            h = fnv1a(h, buf, strcspn(buf, "\r\n"));
+            fclose(fp);
+            break;
+        }
+        fclose(fp);
+    }
+    return h;
+}
+
+// Mixes the node hash with a counter so each cycle gets a different, but
+// reproducible, offset.
+static uint32_t node_mix(uint32_t counter) {
+    uint32_t x = node_hash ^ (counter * 0x9E3779B9u);
+    x ^= x >> 16;
+    x *= 0x85EBCA6Bu;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35u;
+    x ^= x >> 16;
+    return x;
+}
+
+static void health_init_once(void) {
+    memset(server_health, 0, sizeof(server_health));
+    for (int i = 0; i < MAX_PB_SERVERS; i++) {
+        server_health[i].latency_ms = -1;
+    }
+    node_hash = compute_node_hash();
+    jitter_seed = node_hash;
+    LOG_DEBUG("Node fetch jitter hash: %08X.", node_hash);
+}
+
+static void health_init(void) {
+    pthread_once(&health_once, health_init_once);
+}
+
+void fetch_scheduler_set_node_identity(const char *identity) {
+    health_init();
+    node_hash = fnv1a(2166136261u, identity, strlen(identity));
+    jitter_seed = node_hash;
+    LOG_DEBUG("Node fetch jitter hash for '%s': %08X.", identity, node_hash);
+}
+
+// Returns a value in [delay/2, delay] so failing nodes do not retry in lockstep.
+// The generator is seeded from the node hash, so the sequence is reproducible per node.
+static int jittered(int delay) {
+    if (delay < 2) {
+        return delay;
+    }
+    int half = delay / 2;
+    return half + rand_r(&jitter_seed) % (delay - half + 1);
+}
+
+// Exponential delay base * 2^(n-1), capped.
+static int exp_backoff(int base, unsigned int n, int cap) {
+    long delay = base;
+    for (unsigned int i = 1; i < n && delay < cap; i++) {
+        delay *= 2;
+    }
+    return (delay > cap) ? cap : (int)delay;
+}
+
+// Higher is better: Laplace-smoothed success rate scaled down by latency.
+// Unmeasured servers are treated as answering within one stagger slot.
+static double health_score(const ServerHealth *h) {
+    double success_rate = (h->successes + 1.0) / (h->attempts + 2.0);
+    long latency = (h->latency_ms >= 0) ? h->latency_ms : PB_FETCH_STAGGER_MS;
+    return success_rate * 1000.0 / (double)(latency + 100);
+}
+
+int fetch_scheduler_order(int *order) {
+    health_init();
+    time_t now = time(NULL);
+    int n = 0;
+    int soonest = -1;
+
+    for (int i = 0; i < g_num_phonebook_servers && i < MAX_PB_SERVERS; i++) {
+        const ServerHealth *h = &server_health[i];
+        if (h->backoff_until > now) {
+            LOG_DEBUG("Server %s in backoff for %ld more seconds.", g_phonebook_servers_list[i].host, (long)(h->backoff_until - now));
+            if (soonest < 0 || h->backoff_until < server_health[soonest].backoff_until) {
+                soonest = i;
+            }
+            continue;
+        }
+        // Insertion sort by score; stable, so ties keep configuration order.
+        double score = health_score(h);
+        int j = n++;
+        while (j > 0 && health_score(&server_health[order[j - 1]]) < score) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    if (n == 0 && soonest >= 0) {
+        LOG_INFO("All phonebook servers are backed off; trying %s (backoff ends first).", g_phonebook_servers_list[soonest].host);
+        order[n++] = soonest;
+    }
+    return n;
+}
+
+static void record_failure(int server_index, ServerHealth *h, int retry_after_s) {
+    h->failures++;
+    h->consecutive_failures++;
+    int delay;
+    if (retry_after_s > 0) {
+        // The server said when to come back; spread nodes over the following 10% so they do not all return at once.
+        if (retry_after_s > PB_SERVER_BACKOFF_MAX_SECONDS) {
+            retry_after_s = PB_SERVER_BACKOFF_MAX_SECONDS;
+        }
+        delay = retry_after_s + (int)(node_mix(h->consecutive_failures) % (uint32_t)(retry_after_s / 10 + 1));
+    } else {
+        delay = jittered(exp_backoff(PB_SERVER_BACKOFF_BASE_SECONDS, h->consecutive_failures, PB_SERVER_BACKOFF_MAX_SECONDS));
+    }
+    h->backoff_until = time(NULL) + delay;
+    LOG_INFO("Server %s failed %u time(s) in a row; backing off %d seconds%s.",
+             g_phonebook_servers_list[server_index].host, h->consecutive_failures, delay,
+             retry_after_s > 0 ? " (Retry-After)" : "");
+}
+
+void fetch_scheduler_record(int server_index, const HttpAttemptResult *result) {
+    health_init();
+    if (server_index < 0 || server_index >= MAX_PB_SERVERS) {
+        return;
+    }
+    if (result->outcome != HTTP_ATTEMPT_WON && result->outcome != HTTP_ATTEMPT_FAILED) {
+        return; // Cancelled or not started: says nothing about this server
+    }
+
+    pthread_mutex_lock(&health_mutex);
+    ServerHealth *h = &server_health[server_index];
+    h->attempts++;
+    h->last_attempt = time(NULL);
+    h->last_http_status = result->http_status;
+
+    if (result->outcome == HTTP_ATTEMPT_WON) {
+        h->successes++;
+        h->consecutive_failures = 0;
+        h->backoff_until = 0;
+        h->last_success = h->last_attempt;
+        h->latency_ms = (h->latency_ms < 0) ? result->latency_ms : (h->latency_ms * 3 + result->latency_ms) / 4;
+        LOG_DEBUG("Server %s answered in %ld ms, smoothed %ld ms.", g_phonebook_servers_list[server_index].host, result->latency_ms, h->latency_ms);
+    } else {
+        record_failure(server_index, h, result->retry_after_s);
+    }
+    pthread_mutex_unlock(&health_mutex);
+}
+
+void fetch_scheduler_record_body_failure(int server_index) {
+    health_init();
+    if (server_index < 0 || server_index >= MAX_PB_SERVERS) {
+        return;
+    }
+    pthread_mutex_lock(&health_mutex);
+    ServerHealth *h = &server_health[server_index];
+    // The attempt was already counted as a success when it won the race.
+    if (h->successes > 0) {
+        h->successes--;
+    }
+    record_failure(server_index, h, 0);
+    pthread_mutex_unlock(&health_mutex);
+}
+
+int fetch_scheduler_initial_delay(bool have_local_copy) {
+    health_init();
+    // A node that can serve from flash can wait longer for its slot than one with nothing loaded.
+    int spread = have_local_copy ? PB_FIRST_FETCH_SPREAD_SECONDS : PB_FIRST_FETCH_SPREAD_EMPTY_SECONDS;
+    int delay = (int)(node_hash % (uint32_t)spread);
+    LOG_INFO("First phonebook fetch in %d seconds (per-node offset within %d s).", delay, spread);
+    return delay;
+}
+
+int fetch_scheduler_end_cycle(bool fetch_succeeded) {
+    health_init();
+    int delay;
+    completed_cycles++;
+    if (fetch_succeeded) {
+        consecutive_failed_cycles = 0;
+        // Per-node, per-cycle offset of up to +/- PB_INTERVAL_JITTER_PERCENT of the interval
+        int span = g_pb_interval_seconds * PB_INTERVAL_JITTER_PERCENT / 100;
+        delay = g_pb_interval_seconds;
+        if (span > 0) {
+            delay += (int)(node_mix(completed_cycles) % (uint32_t)(2 * span + 1)) - span;
+        }
+    } else {
+        consecutive_failed_cycles++;
+        int cap = (g_pb_interval_seconds > PB_RETRY_BASE_SECONDS) ? g_pb_interval_seconds : PB_RETRY_BASE_SECONDS;
+        delay = jittered(exp_backoff(PB_RETRY_BASE_SECONDS, consecutive_failed_cycles, cap));
+
+        // Do not wake before at least one server is out of backoff (honours Retry-After).
+        time_t now = time(NULL);
+        time_t soonest = 0;
+        for (int i = 0; i < g_num_phonebook_servers && i < MAX_PB_SERVERS; i++) {
+            time_t until = server_health[i].backoff_until;
+            if (until <= now) {
+                soonest = 0;
+                break;
+            }
+            if (soonest == 0 || until < soonest) {
+                soonest = until;
+            }
+        }
+        if (soonest > now && soonest - now > delay) {
+            delay = (int)(soonest - now);
+        }
+        LOG_INFO("Fetch cycle failed (%u in a row); retrying in %d seconds instead of %d.",
+                 consecutive_failed_cycles, delay, g_pb_interval_seconds);
+    }
+    fetch_scheduler_write_status();
+    return delay;
+}
+
+int fetch_scheduler_health(ServerHealth *out, int max) {
+    health_init();
+    int count = g_num_phonebook_servers < max ? g_num_phonebook_servers : max;
+    pthread_mutex_lock(&health_mutex);
+    memcpy(out, server_health, (size_t)count * sizeof(ServerHealth));
+    pthread_mutex_unlock(&health_mutex);
+    return count;
+}
+
+static void write_json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\') {
+            fprintf(fp, "\\%c", ch);
+        } else if (ch < 0x20) {
+            fprintf(fp, "\\u%04x", ch);
+        } else {
+            fputc(ch, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+void fetch_scheduler_write_status(void) {
+    health_init();
+    char temp_path[sizeof(PB_FETCH_STATUS_PATH) + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", PB_FETCH_STATUS_PATH);
+
+    FILE *fp = fopen(temp_path, "w");
+    if (!fp) {
+        LOG_WARN("Failed to write fetch status to '%s'. Error: %s", temp_path, strerror(errno));
+        return;
+    }
+    time_t now = time(NULL);
+    fprintf(fp, "{\"timestamp\":%ld,\"node_jitter_hash\":\"%08X\",\"completed_cycles\":%u,\"consecutive_failed_cycles\":%u,\"servers\":[",
+            (long)now, node_hash, completed_cycles, consecutive_failed_cycles);
+    for (int i = 0; i < g_num_phonebook_servers && i < MAX_PB_SERVERS; i++) {
+        const ServerHealth *h = &server_health[i];
+        long backoff_left = (h->backoff_until > now) ? (long)(h->backoff_until - now) : 0;
+        // Host/port/path are copied from the config file as written
+        fprintf(fp, "%s{\"host\":", i ? "," : "");
+        write_json_string(fp, g_phonebook_servers_list[i].host);
+        fprintf(fp, ",\"port\":");
+        write_json_string(fp, g_phonebook_servers_list[i].port);
+        fprintf(fp, ",\"path\":");
+        write_json_string(fp, g_phonebook_servers_list[i].path);
+        fprintf(fp, ",\"attempts\":%u,\"successes\":%u,"
+                    "\"failures\":%u,\"consecutive_failures\":%u,\"latency_ms\":%ld,\"last_http_status\":%d,"
+                    "\"last_attempt\":%ld,\"last_success\":%ld,\"backoff_remaining_s\":%ld,\"score\":%.3f}",
+                h->attempts, h->successes, h->failures,
+                h->consecutive_failures, h->latency_ms, h->last_http_status, (long)h->last_attempt,
+                (long)h->last_success, backoff_left, health_score(h));
+    }
+    fprintf(fp, "]}\n");
+    if (fclose(fp) != 0 || file_utils_publish_file_to_destination(temp_path, PB_FETCH_STATUS_PATH) != 0) {
+        LOG_WARN("Failed to publish fetch status '%s'.", PB_FETCH_STATUS_PATH);
+        remove(temp_path);
+    }
+}
@@ -0,0 +1,67 @@
+// fetch_scheduler.h
+#ifndef FETCH_SCHEDULER_H
+#define FETCH_SCHEDULER_H
+
+#include "../common.h"
+#include "../http_client/http_client.h"
+
+// Decides which phonebook servers to try, in what order, and when the next
+// fetch cycle runs. Keeps per-server health (success rate, smoothed latency,
+// consecutive failures) for the servers in g_phonebook_servers_list; a server
+// that keeps failing is backed off exponentially (with jitter) and skipped
+// until its backoff expires. A Retry-After from the server overrides the
+// computed backoff. All jitter derives from a per-node hash, so schedules are
+// spread across the mesh but reproducible on each node.
+
+typedef struct {
+    unsigned int attempts;
+    unsigned int successes;
+    unsigned int failures;
+    unsigned int consecutive_failures;
+    long latency_ms;          // Smoothed time-to-headers, -1 while unmeasured
+    int last_http_status;     // 0 if no response header was received
+    time_t last_attempt;
+    time_t last_success;
+    time_t backoff_until;     // Server is skipped until this time (0 = not backed off)
+} ServerHealth;
+
+/**
+ * @brief Fills order[] with server indices to race this cycle, best score first.
+ *
+ * Servers in backoff are left out; if every server is backed off, the one
+ * whose backoff expires first is returned so a cycle is never empty.
+ * @return Number of indices written.
+ */
+int fetch_scheduler_order(int *order);
+
+// Records the outcome of one server attempt. Cancelled/not-started attempts are ignored.
+void fetch_scheduler_record(int server_index, const HttpAttemptResult *result);
+
+// Records that a server won the race but its body could not be used.
+void fetch_scheduler_record_body_failure(int server_index);
+
+// Derives the per-node hash from 'identity' instead of the node name and MAC,
+// e.g. for tools/fetch_sim, which runs many simulated nodes on one host.
+void fetch_scheduler_set_node_identity(const char *identity);
+
+// Seconds to wait before the first fetch after start-up: a stable per-node
+// offset (hash of node name and MAC) so nodes booting together spread out.
+int fetch_scheduler_initial_delay(bool have_local_copy);
+
+/**
+ * @brief Ends a fetch cycle and returns the number of seconds to sleep before the next one.
+ *
+ * @param fetch_succeeded true if a server delivered the phonebook (200 or 304).
+ * @return g_pb_interval_seconds with a per-node offset after success, a short jittered
+ *         exponential backoff after failure (never before some server's backoff or Retry-After ends).
+ */
+int fetch_scheduler_end_cycle(bool fetch_succeeded);
+
+// Copies the health of the configured servers (at most 'max') into 'out' and returns how many.
+// Safe from any thread: the copy is taken under the lock the fetcher updates it with.
+int fetch_scheduler_health(ServerHealth *out, int max);
+
+// Writes the per-server stats as JSON to PB_FETCH_STATUS_PATH (tmpfs).
+void fetch_scheduler_write_status(void);
+
+#endif // FETCH_SCHEDULER_H
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // For fallocate
 #include "file_utils.h"
 #include "../common.h" // For logging macros
 #include <sys/stat.h> // For mkdir
@@ -6,49 +7,518 @@
 #include <errno.h>    // For strerror
 #include <time.h>     // For timestamp in debug copies
 #include <unistd.h>   // For fsync, fileno, access
+#include <fcntl.h>    // For open, fallocate
+#include <sys/sendfile.h>
+#include <stdint.h>
 
 #define MODULE_NAME "UTILS"
 
-int file_utils_copy_file(const char *src, const char *dst) {
-    FILE *fsrc = NULL, *fdst = NULL;
-    char buf[4096];
-    size_t bytes;
-    int ret = 0;
+// --- Write accounting --------------------------------------------------------
+// Every write through this module is attributed to a category. Flash writes are
+// counted per UTC day against g_flash_write_budget_per_day. Deferrable writes
+// over budget, or sooner than the budget's even spacing allows, go to tmpfs
+// instead and are coalesced into the next permitted write. Identical content is
+// never rewritten.
 
-    fsrc = fopen(src, "rb");
-    if (!fsrc) {
+typedef struct {
+    unsigned long writes_today;
+    unsigned long bytes_today;
+    unsigned long deferred_today;
+    unsigned long unchanged_today;  // Skipped because flash already holds this content
+    unsigned long writes_total;
+    unsigned long bytes_total;
+    uint64_t last_content_hash;     // Of the content last written to this category's file
+    bool have_content_hash;
+} WriteCategoryStats;
+
+static const char *category_names[FILE_CAT_COUNT] = { "csv", "hash", "validators", "xml", "other_flash", "tmpfs" };
+static WriteCategoryStats category_stats[FILE_CAT_COUNT];
+static pthread_mutex_t write_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static long stats_day = -1;                  // UTC day number the *_today counters belong to
+static time_t last_deferrable_flash_write = 0;
+static bool budget_warned_today = false;
+static bool status_dirty = true;             // Counters changed since PB_FLASH_STATUS_PATH was last written
+static pthread_mutex_t status_file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static FileWriteCategory category_for_path(const char *path) {
+    if (strcmp(path, PB_CSV_PATH) == 0) return FILE_CAT_CSV;
+    if (strcmp(path, PB_LAST_GOOD_CSV_HASH_PATH) == 0) return FILE_CAT_HASH;
+    if (strcmp(path, PB_HTTP_VALIDATORS_PATH) == 0) return FILE_CAT_VALIDATORS;
+    if (strcmp(path, PB_XML_PUBLIC_PATH) == 0) return FILE_CAT_XML;
+    if (strncmp(path, "/tmp/", 5) == 0 || strncmp(path, "/var/", 5) == 0) return FILE_CAT_TMPFS;
+    return FILE_CAT_OTHER_FLASH;
+}
+
+// Only categories backed by a single known file can skip unchanged content.
+static bool category_tracks_content(FileWriteCategory cat) {
+    return cat == FILE_CAT_CSV || cat == FILE_CAT_HASH || cat == FILE_CAT_VALIDATORS || cat == FILE_CAT_XML;
+}
+
+static uint64_t content_hash(const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static unsigned long flash_writes_today_locked(void) {
+    unsigned long total = 0;
+    for (int i = 0; i < FILE_CAT_COUNT; i++) {
+        if (i != FILE_CAT_TMPFS) total += category_stats[i].writes_today;
+    }
+    return total;
+}
+
+static void roll_day_locked(time_t now) {
+    long day = (long)(now / 86400);
+    if (day == stats_day) {
+        return;
+    }
+    if (stats_day >= 0) {
+        LOG_INFO("Flash writes on previous day: %lu (budget %d).", flash_writes_today_locked(), g_flash_write_budget_per_day);
+    }
+    for (int i = 0; i < FILE_CAT_COUNT; i++) {
+        category_stats[i].writes_today = 0;
+        category_stats[i].bytes_today = 0;
+        category_stats[i].deferred_today = 0;
+        category_stats[i].unchanged_today = 0;
+    }
+    stats_day = day;
+    budget_warned_today = false;
+    status_dirty = true;
+}
+
+// Formats the status JSON into buf. Returns its length.
+static int format_status_locked(time_t now, char *buf, size_t size) {
+    unsigned long flash_writes = flash_writes_today_locked();
+    unsigned long flash_bytes = 0;
+    for (int i = 0; i < FILE_CAT_COUNT; i++) {
+        if (i != FILE_CAT_TMPFS) flash_bytes += category_stats[i].bytes_today;
+    }
+    int n = snprintf(buf, size, "{\"timestamp\":%ld,\"day_start\":%ld,\"budget_per_day\":%d,\"flash_writes_today\":%lu,"
+                                "\"flash_bytes_today\":%lu,\"budget_exceeded\":%s,\"categories\":{",
+                     (long)now, stats_day * 86400L, g_flash_write_budget_per_day, flash_writes, flash_bytes,
+                     flash_writes > (unsigned long)g_flash_write_budget_per_day ? "true" : "false");
+    for (int i = 0; i < FILE_CAT_COUNT && n > 0 && (size_t)n < size; i++) {
+        const WriteCategoryStats *c = &category_stats[i];
+        n += snprintf(buf + n, size - (size_t)n,
+                      "%s\"%s\":{\"writes_today\":%lu,\"bytes_today\":%lu,\"deferred_today\":%lu,"
+                      "\"unchanged_today\":%lu,\"writes_total\":%lu,\"bytes_total\":%lu}",
+                      i ? "," : "", category_names[i], c->writes_today, c->bytes_today, c->deferred_today,
+                      c->unchanged_today, c->writes_total, c->bytes_total);
+    }
+    if (n > 0 && (size_t)n < size) {
+        n += snprintf(buf + n, size - (size_t)n, "}}\n");
+    }
+    return n;
+}
+
+static void account_write_locked(FileWriteCategory cat, size_t len) {
+    WriteCategoryStats *c = &category_stats[cat];
+    c->writes_today++;
+    c->bytes_today += len;
+    c->writes_total++;
+    c->bytes_total += len;
+    if (cat != FILE_CAT_TMPFS && !budget_warned_today &&
+        flash_writes_today_locked() > (unsigned long)g_flash_write_budget_per_day) {
+        LOG_WARN("Flash write budget of %d/day exceeded by critical writes.", g_flash_write_budget_per_day);
+        budget_warned_today = true;
+    }
+    status_dirty = true;
+}
+
+static void account_write(const char *dst, size_t len) {
+    pthread_mutex_lock(&write_stats_mutex);
+    time_t now = time(NULL);
+    roll_day_locked(now);
+    account_write_locked(category_for_path(dst), len);
+    pthread_mutex_unlock(&write_stats_mutex);
+}
+
+// The status file lives on tmpfs and is deliberately not accounted. It is
+// formatted under write_stats_mutex but written outside it, so accounted
+// writes never wait on its file I/O.
+void file_utils_write_budget_status(void) {
+    char buf[2048];
+    pthread_mutex_lock(&write_stats_mutex);
+    time_t now = time(NULL);
+    roll_day_locked(now);
+    if (!status_dirty) {
+        pthread_mutex_unlock(&write_stats_mutex);
+        return;
+    }
+    int len = format_status_locked(now, buf, sizeof(buf));
+    status_dirty = false;
+    pthread_mutex_unlock(&write_stats_mutex);
+    if (len <= 0 || (size_t)len >= sizeof(buf)) {
+        return;
+    }
+
+    char temp_path[sizeof(PB_FLASH_STATUS_PATH) + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", PB_FLASH_STATUS_PATH);
+    pthread_mutex_lock(&status_file_mutex); // The fetcher and the status updater both refresh it
+    FILE *fp = fopen(temp_path, "w");
+    if (fp) {
+        fwrite(buf, 1, (size_t)len, fp);
+        if (fclose(fp) != 0 || file_utils_publish_file_to_destination(temp_path, PB_FLASH_STATUS_PATH) != 0) {
+            remove(temp_path);
+        }
+    }
+    pthread_mutex_unlock(&status_file_mutex);
+}
+
+// Copy strategies, tried in this order until one is supported for the fd pair.
+enum { COPY_VIA_COPY_FILE_RANGE, COPY_VIA_SENDFILE, COPY_VIA_READ_WRITE };
+static const char *copy_method_names[] = { "copy_file_range", "sendfile", "read/write" };
+
+static ssize_t copy_chunk(int method, int in_fd, int out_fd, size_t len, char *buf, size_t buf_len) {
+    switch (method) {
+#ifdef SYS_copy_file_range
+    case COPY_VIA_COPY_FILE_RANGE:
+        return syscall(SYS_copy_file_range, in_fd, NULL, out_fd, NULL, len, 0);
+#endif
+    case COPY_VIA_SENDFILE:
+        return sendfile(out_fd, in_fd, NULL, len);
+    default: {
+        ssize_t n = read(in_fd, buf, len < buf_len ? len : buf_len);
+        if (n <= 0) {
+            return n;
+        }
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t w = write(out_fd, buf + off, (size_t)(n - off));
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            off += w;
+        }
+        return n;
+    }
+    }
+}
+
+static bool same_filesystem(const char *src, const char *dst) {
+    struct stat src_st, dir_st;
+    char *dst_copy = strdup(dst);
+    if (!dst_copy) {
+        return false;
+    }
+    bool same = stat(src, &src_st) == 0 && stat(dirname(dst_copy), &dir_st) == 0 && src_st.st_dev == dir_st.st_dev;
+    free(dst_copy);
+    return same;
+}
+
+int file_utils_copy_file_ex(const char *src, const char *dst, int flags) {
+    // A rename moves no data; like a symlink it is not accounted as a write
+    if ((flags & FILE_UTILS_COPY_MOVE_IF_SAME_FS) && same_filesystem(src, dst)) {
+        if (rename(src, dst) == 0) {
+            LOG_DEBUG("Moved '%s' to '%s' (same filesystem, no data copied).", src, dst);
+            return 0;
+        }
+        LOG_WARN("Rename '%s' -> '%s' failed, copying instead. Error: %s", src, dst, strerror(errno));
+    }
+
+    int in_fd = open(src, O_RDONLY);
+    if (in_fd < 0) {
         LOG_ERROR("Failed to open source file for copy '%s'. Error: %s", src, strerror(errno));
         return 1;
     }
-
-    fdst = fopen(dst, "wb");
-    if (!fdst) {
+    struct stat st;
+    if (fstat(in_fd, &st) != 0) {
+        LOG_ERROR("Failed to stat source file for copy '%s'. Error: %s", src, strerror(errno));
+        close(in_fd);
+        return 1;
+    }
+    int out_fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0) {
         LOG_ERROR("Failed to open destination file for copy '%s'. Error: %s", dst, strerror(errno));
-        fclose(fsrc);
+        close(in_fd);
         return 1;
     }
 
-    while ((bytes = fread(buf, 1, sizeof(buf), fsrc)) > 0) {
-        if (fwrite(buf, 1, bytes, fdst) != bytes) {
-            LOG_ERROR("Error writing to destination file '%s' during copy. Error: %s", dst, strerror(errno));
+    // Reserve the space up front; filesystems without fallocate (jffs2) just skip this
+    if (st.st_size > 0) {
+        fallocate(out_fd, 0, 0, st.st_size);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    char buf[16384];
+    int method = COPY_VIA_COPY_FILE_RANGE;
+#ifndef SYS_copy_file_range
+    method = COPY_VIA_SENDFILE;
+#endif
+    off_t done = 0;
+    int ret = 0;
+    while (done < st.st_size) {
+        ssize_t n = copy_chunk(method, in_fd, out_fd, (size_t)(st.st_size - done), buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (done == 0 && method != COPY_VIA_READ_WRITE &&
+                (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+                method++; // Not supported for this pair of files
+                continue;
+            }
+            LOG_ERROR("Error copying '%s' to '%s' via %s. Error: %s", src, dst, copy_method_names[method], strerror(errno));
             ret = 1;
             break;
         }
+        if (n == 0) {
+            break; // Source shrank while copying
+        }
+        done += n;
     }
 
-    if (ferror(fsrc)) {
-        LOG_ERROR("Error reading from source file '%s' during copy. Error: %s", src, strerror(errno));
+    if (fsync(out_fd) != 0 && ret == 0) {
+        LOG_ERROR("Failed to fsync '%s' after copy. Error: %s", dst, strerror(errno));
+        ret = 1;
+    }
+    if (close(out_fd) != 0 && ret == 0) {
+        LOG_ERROR("Error closing '%s' after copy. Error: %s", dst, strerror(errno));
+        ret = 1;
+    }
+    close(in_fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ms = (t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+    LOG_DEBUG("Copied %lld bytes '%s' -> '%s' via %s in %.1f ms (%.1f MB/s).", (long long)done, src, dst,
+              copy_method_names[method], ms, ms > 0 ? done / (ms * 1000.0) : 0.0);
+
+    account_write(dst, (size_t)done);
+    if (ret == 0 && (flags & FILE_UTILS_COPY_MOVE_IF_SAME_FS)) {
+        remove(src); // Moved across filesystems
+    }
+    return ret;
+}
+
+int file_utils_copy_file(const char *src, const char *dst) {
+    return file_utils_copy_file_ex(src, dst, 0);
+}
+
+static int write_file_unaccounted(const char *dst, const void *data, size_t len) {
+    FILE *fdst = fopen(dst, "wb");
+    if (!fdst) {
+        LOG_ERROR("Failed to open destination file for writing '%s'. Error: %s", dst, strerror(errno));
+        return 1;
+    }
+
+    int ret = 0;
+    if (len > 0 && fwrite(data, 1, len, fdst) != len) {
+        LOG_ERROR("Error writing %zu bytes to '%s'. Error: %s", len, dst, strerror(errno));
         ret = 1;
     }
 
     fflush(fdst);
     fsync(fileno(fdst));
-    fclose(fdst);
-    fclose(fsrc);
+    if (fclose(fdst) != 0) {
+        LOG_ERROR("Error closing '%s' after write. Error: %s", dst, strerror(errno));
+        ret = 1;
+    }
+    return ret;
+}
+
+// fsyncs the directory containing 'path' so a rename inside it is durable.
+static int fsync_parent_directory(const char *path) {
+    char *path_copy = strdup(path);
+    if (!path_copy) {
+        return 1;
+    }
+    int dir_fd = open(dirname(path_copy), O_RDONLY | O_DIRECTORY);
+    if (dir_fd < 0) {
+        LOG_WARN("Failed to open directory of '%s' for fsync. Error: %s", path, strerror(errno));
+        free(path_copy);
+        return 1;
+    }
+    int ret = 0;
+    if (fsync(dir_fd) != 0) {
+        LOG_WARN("Failed to fsync directory of '%s'. Error: %s", path, strerror(errno));
+        ret = 1;
+    }
+    close(dir_fd);
+    free(path_copy);
+    return ret;
+}
+
+int file_utils_write_file(const char *dst, const void *data, size_t len) {
+    int ret = write_file_unaccounted(dst, data, len);
+    account_write(dst, len);
+    return ret;
+}
+
+static int atomic_write_unaccounted(const char *dst, const void *data, size_t len) {
+    char temp_path[MAX_CONFIG_PATH_LEN];
+    if (snprintf(temp_path, sizeof(temp_path), "%s%s", dst, FILE_UTILS_TEMP_SUFFIX) >= (int)sizeof(temp_path)) {
+        LOG_ERROR("Path too long for atomic write: '%s'", dst);
+        return 1;
+    }
+
+    // Same directory as dst, so the rename below never crosses filesystems
+    if (write_file_unaccounted(temp_path, data, len) != 0) {
+        remove(temp_path);
+        return 1;
+    }
+    if (rename(temp_path, dst) != 0) {
+        LOG_ERROR("Failed to rename '%s' over '%s'. Error: %s", temp_path, dst, strerror(errno));
+        remove(temp_path);
+        return 1;
+    }
+    fsync_parent_directory(dst);
+    return 0;
+}
+
+// tmpfs location that receives deferred content for dst.
+static void deferred_path_for(const char *dst, char *out, size_t out_len) {
+    const char *base = strrchr(dst, '/');
+    snprintf(out, out_len, "/tmp/%s.deferred", base ? base + 1 : dst);
+}
+
+// write_stats_mutex only guards the counters: hashing and the file I/O run
+// outside it, so a slow flash write never holds up another thread's accounting.
+// Each file is written by one thread at a time (the fetcher, or a holder of
+// phonebook_file_mutex), which keeps its category's content hash consistent.
+static int atomic_write_accounted(const char *dst, const void *data, size_t len, bool deferrable) {
+    FileWriteCategory cat = category_for_path(dst);
+    WriteCategoryStats *c = &category_stats[cat];
+    bool tracks_content = category_tracks_content(cat);
+    uint64_t hash = tracks_content ? content_hash(data, len) : 0;
+    bool dst_exists = tracks_content && access(dst, F_OK) == 0;
+    char deferred_path[MAX_CONFIG_PATH_LEN];
+    deferred_path_for(dst, deferred_path, sizeof(deferred_path));
+    int ret;
+
+    pthread_mutex_lock(&write_stats_mutex);
+    time_t now = time(NULL);
+    roll_day_locked(now);
+
+    if (dst_exists && c->have_content_hash && c->last_content_hash == hash) {
+        c->unchanged_today++;
+        status_dirty = true;
+        pthread_mutex_unlock(&write_stats_mutex);
+        remove(deferred_path); // Flash is current again
+        LOG_DEBUG("'%s' already holds this content; write skipped.", dst);
+        return 0;
+    }
+
+    time_t previous_slot = last_deferrable_flash_write;
+    if (deferrable && cat != FILE_CAT_TMPFS && g_flash_write_budget_per_day > 0) {
+        time_t spacing = 86400 / g_flash_write_budget_per_day;
+        bool over_budget = flash_writes_today_locked() >= (unsigned long)g_flash_write_budget_per_day;
+        bool too_soon = last_deferrable_flash_write != 0 && now - last_deferrable_flash_write < spacing;
+        if (over_budget || too_soon) {
+            c->deferred_today++;
+            status_dirty = true;
+            pthread_mutex_unlock(&write_stats_mutex);
+            ret = atomic_write_unaccounted(deferred_path, data, len);
+            if (ret == 0) {
+                account_write(deferred_path, len);
+            }
+            LOG_DEBUG("Deferred write of '%s' to '%s' (%s).", dst, deferred_path,
+                      over_budget ? "daily flash budget used" : "coalescing until next slot");
+            return ret == 0 ? FILE_UTILS_WRITE_DEFERRED : 1;
+        }
+        last_deferrable_flash_write = now; // Claim the slot before writing
+    }
+    pthread_mutex_unlock(&write_stats_mutex);
+
+    ret = atomic_write_unaccounted(dst, data, len);
 
+    pthread_mutex_lock(&write_stats_mutex);
+    if (ret == 0) {
+        if (tracks_content) {
+            c->last_content_hash = hash;
+            c->have_content_hash = true;
+        }
+        account_write_locked(cat, len);
+    } else if (deferrable && last_deferrable_flash_write == now) {
+        last_deferrable_flash_write = previous_slot; // Nothing reached flash
+    }
+    pthread_mutex_unlock(&write_stats_mutex);
+    if (ret == 0) {
+        remove(deferred_path); // Superseded
+    }
     return ret;
 }
 
+int file_utils_atomic_write(const char *dst, const void *data, size_t len) {
+    return atomic_write_accounted(dst, data, len, false);
+}
+
+int file_utils_atomic_write_deferrable(const char *dst, const void *data, size_t len) {
+    return atomic_write_accounted(dst, data, len, true);
+}
+
+int file_utils_ensure_symlink(const char *link_path, const char *target) {
+    struct stat st;
+    if (lstat(link_path, &st) == 0 && S_ISLNK(st.st_mode)) {
+        char current[MAX_CONFIG_PATH_LEN];
+        ssize_t n = readlink(link_path, current, sizeof(current) - 1);
+        if (n >= 0) {
+            current[n] = '\0';
+            if (strcmp(current, target) == 0) {
+                return 0;
+            }
+        }
+    }
+
+    char temp_path[MAX_CONFIG_PATH_LEN];
+    snprintf(temp_path, sizeof(temp_path), "%s%s", link_path, FILE_UTILS_TEMP_SUFFIX);
+    remove(temp_path);
+    if (symlink(target, temp_path) != 0) {
+        LOG_WARN("Failed to create symlink '%s' -> '%s'. Error: %s", temp_path, target, strerror(errno));
+        return 1;
+    }
+    if (rename(temp_path, link_path) != 0) {
+        LOG_WARN("Failed to move symlink into place at '%s'. Error: %s", link_path, strerror(errno));
+        remove(temp_path);
+        return 1;
+    }
+    fsync_parent_directory(link_path);
+    LOG_INFO("'%s' now links to '%s'.", link_path, target);
+    return 0;
+}
+
+int file_utils_read_file(const char *src, char **data, size_t *len) {
+    *data = NULL;
+    *len = 0;
+
+    FILE *fsrc = fopen(src, "rb");
+    if (!fsrc) {
+        LOG_ERROR("Failed to open file for reading '%s'. Error: %s", src, strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fileno(fsrc), &st) != 0 || st.st_size < 0) {
+        LOG_ERROR("Failed to stat '%s'. Error: %s", src, strerror(errno));
+        fclose(fsrc);
+        return 1;
+    }
+
+    char *buf = malloc((size_t)st.st_size + 1);
+    if (!buf) {
+        LOG_ERROR("Out of memory reading %ld bytes from '%s'.", (long)st.st_size, src);
+        fclose(fsrc);
+        return 1;
+    }
+    size_t n = fread(buf, 1, (size_t)st.st_size, fsrc);
+    if (ferror(fsrc)) {
+        LOG_ERROR("Error reading '%s'. Error: %s", src, strerror(errno));
+        free(buf);
+        fclose(fsrc);
+        return 1;
+    }
+    fclose(fsrc);
+    buf[n] = '\0';
+    *data = buf;
+    *len = n;
+    return 0;
+}
+
 // Recursive helper function to create directories like 'mkdir -p'
 static int create_directory_recursive(const char *path) {
     char *path_copy = strdup(path);
@@ -144,14 +614,12 @@ int file_utils_ensure_directory_exists(const char *path) {
 }
 
 int file_utils_publish_file_to_destination(const char *source_path, const char *destination_path) {
-    LOG_INFO("Copying from '%s' to '%s'.", source_path, destination_path);
-    if (file_utils_copy_file(source_path, destination_path) == 0) {
-        LOG_INFO("Copied '%s' to '%s'. Temporary source file NOT deleted for debugging.", source_path, destination_path);
+    LOG_DEBUG("Publishing '%s' at '%s'.", source_path, destination_path);
+    if (file_utils_copy_file_ex(source_path, destination_path, FILE_UTILS_COPY_MOVE_IF_SAME_FS) == 0) {
         return 0;
-    } else {
-        LOG_ERROR("Failed to copy file from '%s' to '%s'. Error: %s", source_path, destination_path, strerror(errno));
-        return 1;
     }
+    LOG_ERROR("Failed to publish '%s' to '%s'.", source_path, destination_path);
+    return 1;
 }
 
 // Removed entire #ifdef DEBUG_BUILD ... #endif block for file_utils_make_debug_copy
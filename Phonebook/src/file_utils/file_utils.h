@@ -3,13 +3,59 @@
 
 #include "../common.h" 
 
-// General file copying utility
+// General file copying utility. Data moves inside the kernel where possible
+// (copy_file_range, then sendfile, then a read/write loop); fsync'd.
 int file_utils_copy_file(const char *src, const char *dst);
 
+#define FILE_UTILS_COPY_MOVE_IF_SAME_FS 0x1 // rename() src to dst instead when they share a filesystem (consumes src)
+
+int file_utils_copy_file_ex(const char *src, const char *dst, int flags);
+
+// Writes an in-memory buffer to a file (fsync'd)
+int file_utils_write_file(const char *dst, const void *data, size_t len);
+
+// Suffix of the temp file used by file_utils_atomic_write (next to the target)
+#define FILE_UTILS_TEMP_SUFFIX ".tmp"
+
+// Replaces dst with the buffer: one write to dst.tmp, fsync, rename, directory
+// fsync. Readers see either the old or the new file, never a partial one.
+// Skipped (returning 0) when dst already holds exactly this content.
+int file_utils_atomic_write(const char *dst, const void *data, size_t len);
+
+// Categories that written bytes are attributed to (see PB_FLASH_STATUS_PATH)
+typedef enum {
+    FILE_CAT_CSV,
+    FILE_CAT_HASH,
+    FILE_CAT_VALIDATORS,
+    FILE_CAT_XML,
+    FILE_CAT_OTHER_FLASH,
+    FILE_CAT_TMPFS,
+    FILE_CAT_COUNT
+} FileWriteCategory;
+
+#define FILE_UTILS_WRITE_DEFERRED 2 // Content went to /tmp/<name>.deferred, not to flash
+
+// As file_utils_atomic_write, for content that may lag on flash (e.g. liveness
+// markers). Subject to the daily flash write budget: returns
+// FILE_UTILS_WRITE_DEFERRED when the write was held back.
+int file_utils_atomic_write_deferrable(const char *dst, const void *data, size_t len);
+
+// Refreshes the write counters in PB_FLASH_STATUS_PATH when they changed since
+// the last call. Called at startup and once per fetcher and updater cycle.
+void file_utils_write_budget_status(void);
+
+// Makes link_path a symlink to target, atomically replacing whatever is there.
+// Does nothing (and costs no flash write) when the link is already correct.
+int file_utils_ensure_symlink(const char *link_path, const char *target);
+
+// Reads a whole file into a NUL-terminated malloc'd buffer. Caller frees *data.
+int file_utils_read_file(const char *src, char **data, size_t *len);
+
 // Utility to ensure a directory exists 
 int file_utils_ensure_directory_exists(const char *path);
 
-// Utility to publish a file to a destination 
+// Publishes a temporary file at its destination: renamed when both are on the
+// same filesystem, copied otherwise. The source is gone afterwards either way.
 int file_utils_publish_file_to_destination(const char *source_path, const char *destination_path);
 
 // Removed file_utils_make_debug_copy as it's no longer used
@@ -0,0 +1,153 @@
+#define MODULE_NAME "DEFLATE"
+
+#include "gzip_deflate.h"
+#include "../common.h"
+#include "../gzip_inflate/gzip_inflate.h" // For gzip_crc32
+
+#define WINDOW_SIZE   32768
+#define HASH_BITS     14
+#define HASH_SIZE     (1 << HASH_BITS)
+#define MIN_MATCH     3
+#define MAX_MATCH     258
+#define MAX_CHAIN     32  // Candidates tried per position; bounds the time on repetitive input
+
+typedef struct {
+    unsigned char *out;
+    size_t pos;
+    unsigned int bitbuf;
+    int bitcnt;
+} BitWriter;
+
+static const unsigned short length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Appends 'count' bits of 'value', least significant first.
+static void put_bits(BitWriter *w, unsigned int value, int count) {
+    w->bitbuf |= value << w->bitcnt;
+    w->bitcnt += count;
+    while (w->bitcnt >= 8) {
+        w->out[w->pos++] = (unsigned char)w->bitbuf;
+        w->bitbuf >>= 8;
+        w->bitcnt -= 8;
+    }
+}
+
+// Huffman codes are defined most significant bit first.
+static void put_code(BitWriter *w, unsigned int code, int len) {
+    unsigned int reversed = 0;
+    for (int i = 0; i < len; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    put_bits(w, reversed, len);
+}
+
+// Fixed literal/length code (RFC 1951 3.2.6)
+static void put_symbol(BitWriter *w, int sym) {
+    if (sym < 144)      put_code(w, 0x30 + sym, 8);
+    else if (sym < 256) put_code(w, 0x190 + sym - 144, 9);
+    else if (sym < 280) put_code(w, sym - 256, 7);
+    else                put_code(w, 0xC0 + sym - 280, 8);
+}
+
+static void put_match(BitWriter *w, int length, int distance) {
+    int lc = 28;
+    while (length_base[lc] > length) lc--;
+    put_symbol(w, 257 + lc);
+    put_bits(w, (unsigned int)(length - length_base[lc]), length_extra[lc]);
+
+    int dc = 29;
+    while (dist_base[dc] > distance) dc--;
+    put_code(w, (unsigned int)dc, 5);
+    put_bits(w, (unsigned int)(distance - dist_base[dc]), dist_extra[dc]);
+}
+
+static unsigned int hash3(const unsigned char *p) {
+    return ((unsigned int)p[0] << 10 ^ (unsigned int)p[1] << 5 ^ p[2]) & (HASH_SIZE - 1);
+}
+
+static void put_le32(BitWriter *w, unsigned long v) {
+    for (int i = 0; i < 4; i++) {
+        w->out[w->pos++] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+int gzip_deflate_buffer(const unsigned char *in, size_t len, unsigned char **out, size_t *out_len) {
+    // Fixed codes never take more than 9 bits per input byte
+    size_t cap = len + len / 8 + 64;
+    int *head = malloc(HASH_SIZE * sizeof(int));
+    int *prev = malloc(WINDOW_SIZE * sizeof(int));
+    BitWriter w = { malloc(cap), 0, 0, 0 };
+    if (!head || !prev || !w.out) {
+        LOG_ERROR("Out of memory compressing %zu bytes.", len);
+        free(head);
+        free(prev);
+        free(w.out);
+        return 1;
+    }
+    memset(head, 0xFF, HASH_SIZE * sizeof(int));
+
+    static const unsigned char gzip_header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    memcpy(w.out, gzip_header, sizeof(gzip_header));
+    w.pos = sizeof(gzip_header);
+    put_bits(&w, 1, 1); // BFINAL
+    put_bits(&w, 1, 2); // BTYPE = fixed Huffman
+
+    size_t i = 0;
+    while (i < len) {
+        int best_len = 0, best_dist = 0;
+        if (i + MIN_MATCH <= len) {
+            unsigned int h = hash3(in + i);
+            size_t max_len = len - i < MAX_MATCH ? len - i : MAX_MATCH;
+            int chain = MAX_CHAIN;
+            for (int cand = head[h]; cand >= 0 && i - (size_t)cand <= WINDOW_SIZE && chain-- > 0;
+                 cand = prev[cand % WINDOW_SIZE]) {
+                const unsigned char *a = in + cand, *b = in + i;
+                if (a[best_len] != b[best_len]) continue;
+                size_t l = 0;
+                while (l < max_len && a[l] == b[l]) l++;
+                if ((int)l > best_len) {
+                    best_len = (int)l;
+                    best_dist = (int)(i - (size_t)cand);
+                    if (l == max_len) break;
+                }
+            }
+        }
+
+        size_t advance;
+        if (best_len >= MIN_MATCH) {
+            put_match(&w, best_len, best_dist);
+            advance = (size_t)best_len;
+        } else {
+            put_symbol(&w, in[i]);
+            advance = 1;
+        }
+        // Insert every position covered, so later matches can start inside this one
+        for (size_t end = i + advance; i < end; i++) {
+            if (i + MIN_MATCH <= len) {
+                unsigned int h = hash3(in + i);
+                prev[i % WINDOW_SIZE] = head[h];
+                head[h] = (int)i;
+            }
+        }
+    }
+    put_symbol(&w, 256); // End of block
+    if (w.bitcnt > 0) {
+        put_bits(&w, 0, 8 - w.bitcnt);
+    }
+    put_le32(&w, gzip_crc32(0, in, len));
+    put_le32(&w, (unsigned long)len);
+
+    free(head);
+    free(prev);
+    *out = w.out;
+    *out_len = w.pos;
+    return 0;
+}
@@ -0,0 +1,23 @@
+// gzip_deflate.h
+#ifndef GZIP_DEFLATE_H
+#define GZIP_DEFLATE_H
+
+#include "../common.h"
+
+// Small gzip (RFC 1951/1952) encoder for serving precompressed directory
+// variants. Greedy LZ77 over a 32 KB window with fixed Huffman codes: far
+// from zlib's best ratio, but the directory formats are repetitive markup,
+// so this already shrinks them several-fold, without a dependency.
+
+/**
+ * @brief Compresses a buffer into a new gzip member.
+ *
+ * @param in Data to compress.
+ * @param len Length of in.
+ * @param out Receives a malloc'd buffer with the gzip data; caller frees.
+ * @param out_len Receives the compressed length.
+ * @return 0 on success, 1 if out of memory.
+ */
+int gzip_deflate_buffer(const unsigned char *in, size_t len, unsigned char **out, size_t *out_len);
+
+#endif // GZIP_DEFLATE_H
@@ -0,0 +1,506 @@
+#define MODULE_NAME "INFLATE"
+
+#include "gzip_inflate.h"
+#include "../common.h"
+
+// Decoder follows the canonical-Huffman approach of zlib's "puff" reference
+// inflater, reworked to pull input from a callback and to flush output
+// through a 32 KB ring window instead of requiring the whole body in memory.
+
+#define WINDOW_SIZE   32768
+#define WINDOW_MASK   (WINDOW_SIZE - 1)
+#define INPUT_CHUNK   4096
+#define MAX_BITS      15
+#define MAX_LCODES    286
+#define MAX_DCODES    30
+#define FIX_LCODES    288
+
+typedef struct {
+    unsigned short counts[MAX_BITS + 1]; // Number of codes of each length
+    unsigned short symbols[FIX_LCODES];  // Symbols ordered by code
+} HuffTable;
+
+typedef struct {
+    // Input side
+    inflate_read_fn rd;
+    void *rd_ctx;
+    unsigned char in[INPUT_CHUNK];
+    size_t in_pos;
+    size_t in_len;
+    size_t in_total;
+    unsigned int bitbuf;
+    int bitcnt;
+
+    // Output side
+    inflate_write_fn wr;
+    void *wr_ctx;
+    unsigned char window[WINDOW_SIZE];
+    size_t wpos;       // Next write position in window
+    size_t wflushed;   // Start of bytes not yet handed to wr
+    size_t out_total;
+    size_t max_output;
+    unsigned long crc;
+    bool want_adler;   // Adler-32 is only needed for zlib-wrapped streams
+    unsigned long adler_a;
+    unsigned long adler_b;
+
+    int error;         // First error seen (INFLATE_*), sticky
+} InflateState;
+
+// Built once, on first use from whichever thread (fetcher, status updater, HTTP)
+static unsigned long crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (unsigned long n = 0; n < 256; n++) {
+        unsigned long c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320UL ^ (c >> 1) : c >> 1;
+        }
+        crc_table[n] = c;
+    }
+}
+
+unsigned long gzip_crc32(unsigned long crc, const unsigned char *data, size_t len) {
+    pthread_once(&crc_table_once, crc_table_init);
+    crc = crc ^ 0xFFFFFFFFUL;
+    for (size_t i = 0; i < len; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return (crc ^ 0xFFFFFFFFUL) & 0xFFFFFFFFUL;
+}
+
+static void set_error(InflateState *s, int err) {
+    if (s->error == INFLATE_OK) {
+        s->error = err;
+    }
+}
+
+static int get_byte(InflateState *s) {
+    if (s->error) {
+        return 0;
+    }
+    if (s->in_pos == s->in_len) {
+        ssize_t n = s->rd(s->rd_ctx, s->in, sizeof(s->in));
+        if (n <= 0) {
+            LOG_DEBUG("Compressed input ended early (read returned %zd after %zu bytes).", n, s->in_total);
+            set_error(s, INFLATE_IO_ERROR);
+            return 0;
+        }
+        s->in_len = (size_t)n;
+        s->in_pos = 0;
+        s->in_total += (size_t)n;
+    }
+    return s->in[s->in_pos++];
+}
+
+static int get_bits(InflateState *s, int need) {
+    unsigned int val = s->bitbuf;
+    while (s->bitcnt < need) {
+        val |= (unsigned int)get_byte(s) << s->bitcnt;
+        s->bitcnt += 8;
+    }
+    s->bitbuf = val >> need;
+    s->bitcnt -= need;
+    return (int)(val & ((1U << need) - 1));
+}
+
+static void flush_window(InflateState *s) {
+    if (s->wpos > s->wflushed && !s->error) {
+        const unsigned char *chunk = s->window + s->wflushed;
+        size_t len = s->wpos - s->wflushed;
+        if (s->want_adler) {
+            for (size_t i = 0; i < len; i++) {
+                s->adler_a = (s->adler_a + chunk[i]) % 65521UL;
+                s->adler_b = (s->adler_b + s->adler_a) % 65521UL;
+            }
+        } else {
+            s->crc = gzip_crc32(s->crc, chunk, len);
+        }
+        if (s->wr(s->wr_ctx, chunk, len) != 0) {
+            set_error(s, INFLATE_IO_ERROR);
+        }
+    }
+    s->wflushed = s->wpos;
+}
+
+static void put_byte(InflateState *s, unsigned char c) {
+    if (s->out_total >= s->max_output) {
+        set_error(s, INFLATE_TOO_LARGE);
+        return;
+    }
+    s->window[s->wpos++] = c;
+    s->out_total++;
+    if (s->wpos == WINDOW_SIZE) {
+        flush_window(s);
+        s->wpos = 0;
+        s->wflushed = 0;
+    }
+}
+
+// Discards the rest of the current byte. Whole bytes already in the bit buffer
+// (the raw deflate fallback preloads two) stay there for get_aligned_byte().
+static void align_to_byte(InflateState *s) {
+    s->bitbuf >>= s->bitcnt % 8;
+    s->bitcnt -= s->bitcnt % 8;
+}
+
+static int get_aligned_byte(InflateState *s) {
+    if (s->bitcnt >= 8) {
+        int c = (int)(s->bitbuf & 0xFF);
+        s->bitbuf >>= 8;
+        s->bitcnt -= 8;
+        return c;
+    }
+    return get_byte(s);
+}
+
+static void inflate_stored(InflateState *s) {
+    align_to_byte(s);
+    unsigned int len = (unsigned int)get_aligned_byte(s);
+    len |= (unsigned int)get_aligned_byte(s) << 8;
+    unsigned int nlen = (unsigned int)get_aligned_byte(s);
+    nlen |= (unsigned int)get_aligned_byte(s) << 8;
+    if (s->error) {
+        return;
+    }
+    if (len != (~nlen & 0xFFFF)) {
+        LOG_WARN("Stored block length check failed.");
+        set_error(s, INFLATE_CORRUPT);
+        return;
+    }
+    while (len-- && !s->error) {
+        put_byte(s, (unsigned char)get_byte(s));
+    }
+}
+
+// Returns 0 for a complete code set, >0 for incomplete, <0 for over-subscribed.
+static int huff_construct(HuffTable *h, const unsigned short *lengths, int n) {
+    unsigned short offs[MAX_BITS + 1];
+    memset(h->counts, 0, sizeof(h->counts));
+    for (int symbol = 0; symbol < n; symbol++) {
+        h->counts[lengths[symbol]]++;
+    }
+    if (h->counts[0] == n) {
+        return 0; // No codes at all; decode will fail if used
+    }
+    int left = 1;
+    for (int len = 1; len <= MAX_BITS; len++) {
+        left <<= 1;
+        left -= h->counts[len];
+        if (left < 0) {
+            return left;
+        }
+    }
+    offs[1] = 0;
+    for (int len = 1; len < MAX_BITS; len++) {
+        offs[len + 1] = offs[len] + h->counts[len];
+    }
+    for (int symbol = 0; symbol < n; symbol++) {
+        if (lengths[symbol] != 0) {
+            h->symbols[offs[lengths[symbol]]++] = (unsigned short)symbol;
+        }
+    }
+    return left;
+}
+
+static int huff_decode(InflateState *s, const HuffTable *h) {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= MAX_BITS; len++) {
+        code |= get_bits(s, 1);
+        int count = h->counts[len];
+        if (code - count < first) {
+            return h->symbols[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+        if (s->error) {
+            return -1;
+        }
+    }
+    return -1; // Ran out of codes
+}
+
+static const unsigned short length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned short length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577 };
+static const unsigned short dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static void inflate_codes(InflateState *s, const HuffTable *lencode, const HuffTable *distcode) {
+    while (!s->error) {
+        int symbol = huff_decode(s, lencode);
+        if (symbol < 0) {
+            set_error(s, INFLATE_CORRUPT);
+            return;
+        }
+        if (symbol < 256) {
+            put_byte(s, (unsigned char)symbol);
+            continue;
+        }
+        if (symbol == 256) {
+            return; // End of block
+        }
+        symbol -= 257;
+        if (symbol >= 29) {
+            set_error(s, INFLATE_CORRUPT);
+            return;
+        }
+        int len = length_base[symbol] + get_bits(s, length_extra[symbol]);
+        symbol = huff_decode(s, distcode);
+        if (symbol < 0 || symbol >= 30) {
+            set_error(s, INFLATE_CORRUPT);
+            return;
+        }
+        size_t dist = dist_base[symbol] + (size_t)get_bits(s, dist_extra[symbol]);
+        if (dist > s->out_total || dist > WINDOW_SIZE) {
+            LOG_WARN("Back-reference distance %zu exceeds produced output %zu.", dist, s->out_total);
+            set_error(s, INFLATE_CORRUPT);
+            return;
+        }
+        while (len-- && !s->error) {
+            put_byte(s, s->window[(s->wpos - dist) & WINDOW_MASK]);
+        }
+    }
+}
+
+static HuffTable fixed_lencode, fixed_distcode;
+static pthread_once_t fixed_tables_once = PTHREAD_ONCE_INIT;
+
+static void fixed_tables_init(void) {
+    unsigned short lengths[FIX_LCODES];
+    int symbol = 0;
+    for (; symbol < 144; symbol++) lengths[symbol] = 8;
+    for (; symbol < 256; symbol++) lengths[symbol] = 9;
+    for (; symbol < 280; symbol++) lengths[symbol] = 7;
+    for (; symbol < FIX_LCODES; symbol++) lengths[symbol] = 8;
+    huff_construct(&fixed_lencode, lengths, FIX_LCODES);
+    for (symbol = 0; symbol < MAX_DCODES; symbol++) lengths[symbol] = 5;
+    huff_construct(&fixed_distcode, lengths, MAX_DCODES);
+}
+
+static void inflate_fixed(InflateState *s) {
+    pthread_once(&fixed_tables_once, fixed_tables_init);
+    inflate_codes(s, &fixed_lencode, &fixed_distcode);
+}
+
+static void inflate_dynamic(InflateState *s) {
+    static const unsigned char order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    unsigned short lengths[MAX_LCODES + MAX_DCODES];
+    HuffTable lencode, distcode;
+
+    int nlen = get_bits(s, 5) + 257;
+    int ndist = get_bits(s, 5) + 1;
+    int ncode = get_bits(s, 4) + 4;
+    if (s->error) {
+        return;
+    }
+    if (nlen > MAX_LCODES || ndist > MAX_DCODES) {
+        set_error(s, INFLATE_CORRUPT);
+        return;
+    }
+
+    int index;
+    for (index = 0; index < ncode; index++) {
+        lengths[order[index]] = (unsigned short)get_bits(s, 3);
+    }
+    for (; index < 19; index++) {
+        lengths[order[index]] = 0;
+    }
+    if (huff_construct(&lencode, lengths, 19) != 0) {
+        set_error(s, INFLATE_CORRUPT);
+        return;
+    }
+
+    index = 0;
+    while (index < nlen + ndist && !s->error) {
+        int symbol = huff_decode(s, &lencode);
+        if (symbol < 0) {
+            set_error(s, INFLATE_CORRUPT);
+            return;
+        }
+        if (symbol < 16) {
+            lengths[index++] = (unsigned short)symbol;
+            continue;
+        }
+        unsigned short len = 0;
+        int repeat;
+        if (symbol == 16) {
+            if (index == 0) {
+                set_error(s, INFLATE_CORRUPT);
+                return;
+            }
+            len = lengths[index - 1];
+            repeat = 3 + get_bits(s, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + get_bits(s, 3);
+        } else {
+            repeat = 11 + get_bits(s, 7);
+        }
+        if (index + repeat > nlen + ndist) {
+            set_error(s, INFLATE_CORRUPT);
+            return;
+        }
+        while (repeat--) {
+            lengths[index++] = len;
+        }
+    }
+    if (s->error) {
+        return;
+    }
+    if (lengths[256] == 0) {
+        set_error(s, INFLATE_CORRUPT); // No end-of-block code
+        return;
+    }
+
+    int err = huff_construct(&lencode, lengths, nlen);
+    if (err < 0 || (err > 0 && nlen - lencode.counts[0] != 1)) {
+        set_error(s, INFLATE_CORRUPT);
+        return;
+    }
+    err = huff_construct(&distcode, lengths + nlen, ndist);
+    if (err < 0 || (err > 0 && ndist - distcode.counts[0] != 1)) {
+        set_error(s, INFLATE_CORRUPT);
+        return;
+    }
+    inflate_codes(s, &lencode, &distcode);
+}
+
+static void inflate_blocks(InflateState *s) {
+    int last;
+    do {
+        last = get_bits(s, 1);
+        int type = get_bits(s, 2);
+        if (s->error) {
+            return;
+        }
+        switch (type) {
+            case 0:  inflate_stored(s);  break;
+            case 1:  inflate_fixed(s);   break;
+            case 2:  inflate_dynamic(s); break;
+            default: set_error(s, INFLATE_CORRUPT); break;
+        }
+    } while (!last && !s->error);
+    flush_window(s);
+}
+
+static unsigned long get_le32(InflateState *s) {
+    unsigned long v = 0;
+    for (int i = 0; i < 4; i++) {
+        v |= (unsigned long)get_aligned_byte(s) << (8 * i);
+    }
+    return v;
+}
+
+static void skip_gzip_header(InflateState *s) {
+    int id1 = get_byte(s);
+    int id2 = get_byte(s);
+    int cm = get_byte(s);
+    int flags = get_byte(s);
+    if (s->error) {
+        return;
+    }
+    if (id1 != 0x1F || id2 != 0x8B || cm != 8) {
+        LOG_WARN("Not a gzip stream (magic %02X %02X, method %d).", id1, id2, cm);
+        set_error(s, INFLATE_CORRUPT);
+        return;
+    }
+    for (int i = 0; i < 6; i++) {
+        get_byte(s); // MTIME, XFL, OS
+    }
+    if (flags & 0x04) { // FEXTRA
+        unsigned int xlen = (unsigned int)get_byte(s);
+        xlen |= (unsigned int)get_byte(s) << 8;
+        while (xlen-- && !s->error) get_byte(s);
+    }
+    if (flags & 0x08) { // FNAME
+        while (get_byte(s) != 0 && !s->error) {}
+    }
+    if (flags & 0x10) { // FCOMMENT
+        while (get_byte(s) != 0 && !s->error) {}
+    }
+    if (flags & 0x02) { // FHCRC
+        get_byte(s);
+        get_byte(s);
+    }
+}
+
+int gzip_inflate_stream(int format,
+                        inflate_read_fn rd, void *rd_ctx,
+                        inflate_write_fn wr, void *wr_ctx,
+                        size_t max_output, size_t *in_total, size_t *out_total) {
+    InflateState *s = calloc(1, sizeof(InflateState));
+    if (!s) {
+        LOG_ERROR("Failed to allocate inflate state (%zu bytes).", sizeof(InflateState));
+        return INFLATE_IO_ERROR;
+    }
+    s->rd = rd;
+    s->rd_ctx = rd_ctx;
+    s->wr = wr;
+    s->wr_ctx = wr_ctx;
+    s->max_output = max_output;
+    s->adler_a = 1;
+
+    if (format == INFLATE_FORMAT_GZIP) {
+        skip_gzip_header(s);
+        if (!s->error) {
+            inflate_blocks(s);
+        }
+        if (!s->error) {
+            align_to_byte(s); // Trailer is byte aligned
+            unsigned long crc = get_le32(s);
+            unsigned long isize = get_le32(s);
+            if (!s->error && (crc != s->crc || isize != (s->out_total & 0xFFFFFFFFUL))) {
+                LOG_WARN("gzip trailer mismatch (crc %08lX vs %08lX, size %lu vs %zu).", crc, s->crc, isize, s->out_total);
+                set_error(s, INFLATE_CORRUPT);
+            }
+        }
+    } else {
+        // zlib wrapper if the header checks out, otherwise raw deflate data
+        int cmf = get_byte(s);
+        int flg = get_byte(s);
+        bool zlib_wrapped = !s->error && (cmf & 0x0F) == 8 && (cmf >> 4) <= 7 &&
+                            ((cmf << 8) | flg) % 31 == 0;
+        s->want_adler = zlib_wrapped;
+        if (zlib_wrapped && (flg & 0x20)) {
+            LOG_WARN("zlib stream requires a preset dictionary; not supported.");
+            set_error(s, INFLATE_CORRUPT);
+        } else if (!zlib_wrapped && !s->error) {
+            s->bitbuf = (unsigned int)cmf | ((unsigned int)flg << 8);
+            s->bitcnt = 16;
+        }
+        if (!s->error) {
+            inflate_blocks(s);
+        }
+        if (zlib_wrapped && !s->error) {
+            align_to_byte(s);
+            unsigned long adler = 0;
+            for (int i = 0; i < 4; i++) {
+                adler = (adler << 8) | (unsigned long)get_aligned_byte(s);
+            }
+            if (!s->error && adler != ((s->adler_b << 16) | s->adler_a)) {
+                LOG_WARN("zlib Adler-32 mismatch.");
+                set_error(s, INFLATE_CORRUPT);
+            }
+        }
+    }
+
+    int result = s->error;
+    if (in_total) *in_total = s->in_total - (s->in_len - s->in_pos);
+    if (out_total) *out_total = s->out_total;
+    LOG_DEBUG("Inflate finished: result %d, %zu compressed -> %zu bytes.", result,
+              s->in_total - (s->in_len - s->in_pos), s->out_total);
+    free(s);
+    return result;
+}
@@ -0,0 +1,44 @@
+// gzip_inflate.h
+#ifndef GZIP_INFLATE_H
+#define GZIP_INFLATE_H
+
+#include "../common.h"
+
+// Self-contained streaming DEFLATE decoder (RFC 1950/1951/1952) for
+// compressed phonebook downloads. Input is pulled through a read callback,
+// output is pushed through a write callback; the only state kept is the
+// 32 KB history window, so memory use does not grow with the body size.
+
+// Wrapper formats accepted by gzip_inflate_stream()
+#define INFLATE_FORMAT_GZIP     0 // Content-Encoding: gzip / x-gzip
+#define INFLATE_FORMAT_DEFLATE  1 // Content-Encoding: deflate (zlib, or raw deflate as sent by some servers)
+
+// Result codes
+#define INFLATE_OK          0
+#define INFLATE_CORRUPT     1 // Malformed stream or checksum mismatch
+#define INFLATE_TOO_LARGE   2 // Output would exceed max_output (decompression bomb guard)
+#define INFLATE_IO_ERROR    3 // Read callback failed, stream truncated, or write callback aborted
+
+// Returns number of bytes placed in buf, 0 on end of input, <0 on error.
+typedef ssize_t (*inflate_read_fn)(void *ctx, unsigned char *buf, size_t len);
+// Returns 0 to continue, non-zero to abort decoding.
+typedef int (*inflate_write_fn)(void *ctx, const unsigned char *data, size_t len);
+
+/**
+ * @brief Decodes one compressed stream from rd into wr.
+ *
+ * @param format INFLATE_FORMAT_GZIP or INFLATE_FORMAT_DEFLATE.
+ * @param max_output Upper bound on decompressed bytes; exceeding it aborts with INFLATE_TOO_LARGE.
+ * @param in_total If not NULL, receives the number of compressed bytes consumed.
+ * @param out_total If not NULL, receives the number of decompressed bytes produced.
+ * @return INFLATE_OK or one of the error codes above.
+ */
+int gzip_inflate_stream(int format,
+                        inflate_read_fn rd, void *rd_ctx,
+                        inflate_write_fn wr, void *wr_ctx,
+                        size_t max_output, size_t *in_total, size_t *out_total);
+
+// CRC-32 (IEEE 802.3, as used by gzip). Pass 0 as the initial crc.
+unsigned long gzip_crc32(unsigned long crc, const unsigned char *data, size_t len);
+
+#endif // GZIP_INFLATE_H
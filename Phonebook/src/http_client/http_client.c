@@ -0,0 +1,579 @@
+#define MODULE_NAME "HTTP"
+#define _GNU_SOURCE // For strptime and timegm
+
+#include "http_client.h"
+#include "../common.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+
+// Per-server attempt states
+#define ATTEMPT_IDLE        0
+#define ATTEMPT_CONNECTING  1
+#define ATTEMPT_SENDING     2
+#define ATTEMPT_READING     3
+#define ATTEMPT_DONE        4 // Failed, cancelled or won; socket no longer owned here
+#define ATTEMPT_RESOLVING   5 // Waiting for the resolver thread
+
+// getaddrinfo() has no timeout, so host names are resolved on a detached
+// thread that signals a pipe the race loop polls. A cancelled or timed-out
+// attempt just drops its reference; the thread frees the job if it finishes
+// last.
+typedef struct {
+    char host[MAX_SERVER_HOST_LEN];
+    char port[MAX_SERVER_PORT_LEN];
+    int pipe_fds[2];         // Thread writes one byte to [1] once the result is stored
+    int rv;                  // getaddrinfo() return value
+    struct addrinfo *addrs;
+    int refs;                // Attempt and thread, under resolve_mutex
+} ResolveJob;
+
+static pthread_mutex_t resolve_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    int state;
+    int sock;
+    ResolveJob *resolve;
+    struct addrinfo *addrs;
+    struct addrinfo *next_addr;
+    size_t req_len;
+    size_t req_sent;
+    char buffer[HTTP_MAX_HEADER_BYTES];
+    size_t buffer_len;
+    long long started_ms;
+    long long phase_deadline_ms; // Connect deadline while resolving or connecting, idle deadline afterwards
+} RaceAttempt;
+
+long long http_client_monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int http_client_find_header(const char *headers, const char *name, char *out, size_t out_len) {
+    size_t name_len = strlen(name);
+    const char *line = strstr(headers, "\r\n");
+    out[0] = '\0';
+    while (line) {
+        line += 2;
+        if (strncmp(line, "\r\n", 2) == 0 || *line == '\0') {
+            break;
+        }
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char *v = line + name_len + 1;
+            while (*v == ' ' || *v == '\t') v++;
+            size_t l = strcspn(v, "\r\n");
+            if (l >= out_len) l = out_len - 1;
+            memcpy(out, v, l);
+            out[l] = '\0';
+            return 1;
+        }
+        line = strstr(line, "\r\n");
+    }
+    return 0;
+}
+
+int http_client_parse_retry_after(const char *value) {
+    char *end = NULL;
+    long seconds;
+    if (!value || !value[0]) {
+        return 0;
+    }
+    seconds = strtol(value, &end, 10);
+    if (end != value && (*end == '\0' || isspace((unsigned char)*end))) {
+        return (seconds > 0) ? (int)((seconds > INT_MAX) ? INT_MAX : seconds) : 0;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (strptime(value, "%a, %d %b %Y %H:%M:%S", &tm) != NULL) {
+        time_t at = timegm(&tm);
+        time_t now = time(NULL);
+        return (at > now) ? (int)(at - now) : 0;
+    }
+    return 0;
+}
+
+static void resolve_job_unref(ResolveJob *job) {
+    pthread_mutex_lock(&resolve_mutex);
+    bool last = --job->refs == 0;
+    pthread_mutex_unlock(&resolve_mutex);
+    if (!last) {
+        return;
+    }
+    if (job->addrs) {
+        freeaddrinfo(job->addrs);
+    }
+    close(job->pipe_fds[0]);
+    close(job->pipe_fds[1]);
+    free(job);
+}
+
+static void *resolve_thread(void *arg) {
+    ResolveJob *job = (ResolveJob *)arg;
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *addrs = NULL;
+    int rv = getaddrinfo(job->host, job->port, &hints, &addrs);
+
+    pthread_mutex_lock(&resolve_mutex);
+    job->rv = rv;
+    job->addrs = (rv == 0) ? addrs : NULL;
+    pthread_mutex_unlock(&resolve_mutex);
+    if (write(job->pipe_fds[1], "", 1) != 1) {
+        LOG_WARN("Resolver for %s could not signal completion: %s", job->host, strerror(errno));
+    }
+    resolve_job_unref(job);
+    return NULL;
+}
+
+// Starts resolving on a resolver thread. Returns 0 with a->resolve set, 1 if
+// the thread could not be started.
+static int resolve_start(RaceAttempt *a, const ConfigurableServer *server) {
+    ResolveJob *job = calloc(1, sizeof(*job));
+    if (!job) {
+        return 1;
+    }
+    if (pipe(job->pipe_fds) != 0) {
+        free(job);
+        return 1;
+    }
+    snprintf(job->host, sizeof(job->host), "%s", server->host);
+    snprintf(job->port, sizeof(job->port), "%s", server->port);
+    job->refs = 2;
+
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&tid, &attr, resolve_thread, job);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        LOG_WARN("Failed to start resolver thread for %s: %s", server->host, strerror(rc));
+        close(job->pipe_fds[0]);
+        close(job->pipe_fds[1]);
+        free(job);
+        return 1;
+    }
+    a->resolve = job;
+    return 0;
+}
+
+static void attempt_release(RaceAttempt *a) {
+    if (a->resolve) {
+        resolve_job_unref(a->resolve); // An unfinished lookup completes on its own
+        a->resolve = NULL;
+    }
+    if (a->sock >= 0) {
+        close(a->sock);
+        a->sock = -1;
+    }
+    if (a->addrs) {
+        freeaddrinfo(a->addrs);
+        a->addrs = NULL;
+    }
+    a->next_addr = NULL;
+    a->state = ATTEMPT_DONE;
+}
+
+static void attempt_fail(RaceAttempt *a, HttpAttemptResult *result, long long now, const char *host, const char *why) {
+    LOG_INFO("Fetch from %s failed after %lld ms: %s", host, now - a->started_ms, why);
+    attempt_release(a);
+    if (result) {
+        result->outcome = HTTP_ATTEMPT_FAILED;
+        result->latency_ms = (long)(now - a->started_ms);
+    }
+}
+
+// Starts a non-blocking connect to the next resolved address. Returns 0 if a
+// connect is in progress (or done), 1 if no address is left.
+static int attempt_connect_next(RaceAttempt *a, const HttpRaceEntry *e, long long now) {
+    if (a->sock >= 0) {
+        close(a->sock);
+        a->sock = -1;
+    }
+    while (a->next_addr) {
+        struct addrinfo *rp = a->next_addr;
+        a->next_addr = rp->ai_next;
+
+        char ip_str[INET6_ADDRSTRLEN] = "";
+        void *addr = (rp->ai_family == AF_INET)
+                     ? (void *)&((struct sockaddr_in *)rp->ai_addr)->sin_addr
+                     : (void *)&((struct sockaddr_in6 *)rp->ai_addr)->sin6_addr;
+        inet_ntop(rp->ai_family, addr, ip_str, sizeof(ip_str));
+
+        int sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+        if (sock < 0) {
+            LOG_DEBUG("Failed to create socket for address family %d: %s. Trying next...", rp->ai_family, strerror(errno));
+            continue;
+        }
+        int flags = fcntl(sock, F_GETFL, 0);
+        if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+            LOG_WARN("Failed to make fetch socket non-blocking: %s", strerror(errno));
+            close(sock);
+            continue;
+        }
+
+        LOG_DEBUG("Connecting to %s:%s (%s)...", e->server->host, e->server->port, ip_str);
+        if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) {
+            a->sock = sock;
+            a->state = ATTEMPT_SENDING;
+            a->phase_deadline_ms = now + PB_FETCH_IDLE_TIMEOUT_MS;
+            return 0;
+        }
+        if (errno == EINPROGRESS) {
+            a->sock = sock;
+            a->state = ATTEMPT_CONNECTING;
+            a->phase_deadline_ms = now + PB_FETCH_CONNECT_TIMEOUT_MS;
+            return 0;
+        }
+        LOG_DEBUG("Connection failed to %s:%s: %s. Trying next address...", ip_str, e->server->port, strerror(errno));
+        close(sock);
+    }
+    return 1;
+}
+
+// Moves to connecting once the addresses are known
+static void attempt_resolved(RaceAttempt *a, const HttpRaceEntry *e, HttpAttemptResult *result, int rv, long long now) {
+    if (rv != 0) {
+        char why[128];
+        snprintf(why, sizeof(why), "DNS resolution failed: %s", gai_strerror(rv));
+        attempt_fail(a, result, now, e->server->host, why);
+        return;
+    }
+    a->next_addr = a->addrs;
+    if (attempt_connect_next(a, e, now) != 0) {
+        attempt_fail(a, result, now, e->server->host, "no usable address");
+    }
+}
+
+static void attempt_start(RaceAttempt *a, const HttpRaceEntry *e, HttpAttemptResult *result, long long now) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM,
+                              .ai_flags = AI_NUMERICHOST | AI_NUMERICSERV };
+    int rv;
+
+    a->started_ms = now;
+    a->req_len = strlen(e->request);
+    a->req_sent = 0;
+    a->buffer_len = 0;
+    LOG_INFO("Starting fetch from %s:%s%s", e->server->host, e->server->port, e->server->path);
+
+    // Literal addresses need no lookup; names go to the resolver thread so a
+    // slow resolver is bounded by the connect deadline and never holds up the
+    // staggered launches.
+    rv = getaddrinfo(e->server->host, e->server->port, &hints, &a->addrs);
+    if (rv == 0) {
+        attempt_resolved(a, e, result, 0, now);
+        return;
+    }
+    a->addrs = NULL;
+    if (resolve_start(a, e->server) == 0) {
+        a->state = ATTEMPT_RESOLVING;
+        a->phase_deadline_ms = now + PB_FETCH_CONNECT_TIMEOUT_MS;
+        return;
+    }
+    hints.ai_flags = 0; // No thread: resolve here, as a last resort
+    rv = getaddrinfo(e->server->host, e->server->port, &hints, &a->addrs);
+    if (rv != 0) {
+        a->addrs = NULL;
+    }
+    attempt_resolved(a, e, result, rv, http_client_monotonic_ms());
+}
+
+// Handles readiness on an attempt. Returns 1 if this attempt produced an acceptable response.
+static int attempt_progress(RaceAttempt *a, const HttpRaceEntry *e, HttpAttemptResult *result, short revents, long long now) {
+    if (a->state == ATTEMPT_RESOLVING) {
+        pthread_mutex_lock(&resolve_mutex);
+        int rv = a->resolve->rv;
+        a->addrs = a->resolve->addrs;
+        a->resolve->addrs = NULL;
+        pthread_mutex_unlock(&resolve_mutex);
+        resolve_job_unref(a->resolve);
+        a->resolve = NULL;
+        LOG_DEBUG("Resolved %s after %lld ms.", e->server->host, now - a->started_ms);
+        attempt_resolved(a, e, result, rv, now);
+        return 0;
+    }
+
+    if (a->state == ATTEMPT_CONNECTING) {
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        if (getsockopt(a->sock, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0) {
+            err = errno;
+        }
+        if (err != 0) {
+            LOG_DEBUG("Connect to %s failed: %s", e->server->host, strerror(err));
+            if (attempt_connect_next(a, e, now) != 0) {
+                attempt_fail(a, result, now, e->server->host, strerror(err));
+            }
+            return 0;
+        }
+        LOG_DEBUG("Connected to %s:%s after %lld ms.", e->server->host, e->server->port, now - a->started_ms);
+        a->state = ATTEMPT_SENDING;
+        a->phase_deadline_ms = now + PB_FETCH_IDLE_TIMEOUT_MS;
+    }
+
+    if (a->state == ATTEMPT_SENDING) {
+        ssize_t n = send(a->sock, e->request + a->req_sent, a->req_len - a->req_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                attempt_fail(a, result, now, e->server->host, strerror(errno));
+            }
+            return 0;
+        }
+        a->req_sent += (size_t)n;
+        a->phase_deadline_ms = now + PB_FETCH_IDLE_TIMEOUT_MS;
+        if (a->req_sent == a->req_len) {
+            LOG_DEBUG("Sent %zu byte request to %s (conditional: %s, delta: %s).", a->req_len, e->server->host,
+                      e->conditional ? "yes" : "no", e->delta ? "yes" : "no");
+            a->state = ATTEMPT_READING;
+        }
+        return 0;
+    }
+
+    if (a->state == ATTEMPT_READING && (revents & (POLLIN | POLLHUP | POLLERR))) {
+        if (a->buffer_len >= sizeof(a->buffer) - 1) {
+            attempt_fail(a, result, now, e->server->host, "response header too large");
+            return 0;
+        }
+        ssize_t n = recv(a->sock, a->buffer + a->buffer_len, sizeof(a->buffer) - 1 - a->buffer_len, 0);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                attempt_fail(a, result, now, e->server->host, strerror(errno));
+            }
+            return 0;
+        }
+        if (n == 0) {
+            attempt_fail(a, result, now, e->server->host, "connection closed before response headers");
+            return 0;
+        }
+        a->buffer_len += (size_t)n;
+        a->buffer[a->buffer_len] = '\0';
+        a->phase_deadline_ms = now + PB_FETCH_IDLE_TIMEOUT_MS;
+
+        if (!strstr(a->buffer, "\r\n\r\n")) {
+            return 0; // Headers not complete yet
+        }
+        int status = 0;
+        if (sscanf(a->buffer, "HTTP/%*f %d", &status) != 1) {
+            attempt_fail(a, result, now, e->server->host, "malformed status line");
+            return 0;
+        }
+        if (result) {
+            result->http_status = status;
+            result->latency_ms = (long)(now - a->started_ms);
+        }
+        if (status == 200 || (status == 304 && e->conditional) || (status == 226 && e->delta)) {
+            LOG_INFO("Server %s answered %d after %lld ms.", e->server->host, status, now - a->started_ms);
+            return 1;
+        }
+        char why[96];
+        char retry_after[64];
+        int why_len = snprintf(why, sizeof(why), "HTTP status %d", status);
+        char *end_of_headers = strstr(a->buffer, "\r\n\r\n");
+        *end_of_headers = '\0';
+        if (http_client_find_header(a->buffer, "Retry-After", retry_after, sizeof(retry_after)) && result) {
+            result->retry_after_s = http_client_parse_retry_after(retry_after);
+            snprintf(why + why_len, sizeof(why) - why_len, ", Retry-After %d s", result->retry_after_s);
+        }
+        attempt_fail(a, result, now, e->server->host, why);
+    }
+    return 0;
+}
+
+int http_client_race(HttpRaceEntry *entries, int count, HttpResponse *resp, HttpAttemptResult *results) {
+    if (count <= 0) {
+        return 1;
+    }
+    if (count > MAX_PB_SERVERS) {
+        count = MAX_PB_SERVERS;
+    }
+
+    RaceAttempt *attempts = calloc((size_t)count, sizeof(RaceAttempt));
+    if (!attempts) {
+        LOG_ERROR("Failed to allocate fetch attempts.");
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        attempts[i].sock = -1;
+        if (results) {
+            memset(&results[i], 0, sizeof(results[i]));
+            results[i].outcome = HTTP_ATTEMPT_NOT_STARTED;
+        }
+    }
+
+    long long now = http_client_monotonic_ms();
+    long long total_deadline = now + PB_FETCH_TOTAL_TIMEOUT_MS;
+    long long next_launch_ms = now;
+    int launched = 0;
+    int winner = -1;
+
+    while (winner < 0) {
+        now = http_client_monotonic_ms();
+
+        int active = 0;
+        for (int i = 0; i < launched; i++) {
+            if (attempts[i].state != ATTEMPT_DONE) active++;
+        }
+        // Start the next server when its stagger slot arrives or nothing else is running.
+        if (launched < count && (now >= next_launch_ms || active == 0)) {
+            attempt_start(&attempts[launched], &entries[launched], results ? &results[launched] : NULL, now);
+            launched++;
+            next_launch_ms = now + PB_FETCH_STAGGER_MS;
+            continue;
+        }
+        if (active == 0) {
+            break; // Everything launched and everything failed
+        }
+        if (now >= total_deadline) {
+            LOG_WARN("Fetch race exceeded total deadline of %d ms.", PB_FETCH_TOTAL_TIMEOUT_MS);
+            break;
+        }
+
+        struct pollfd pfds[MAX_PB_SERVERS];
+        int pfd_owner[MAX_PB_SERVERS];
+        int npfd = 0;
+        long long wake_ms = total_deadline;
+        if (launched < count && next_launch_ms < wake_ms) {
+            wake_ms = next_launch_ms;
+        }
+        for (int i = 0; i < launched; i++) {
+            RaceAttempt *a = &attempts[i];
+            if (a->state == ATTEMPT_DONE) continue;
+            if (a->state == ATTEMPT_RESOLVING) {
+                pfds[npfd].fd = a->resolve->pipe_fds[0];
+                pfds[npfd].events = POLLIN;
+            } else {
+                pfds[npfd].fd = a->sock;
+                pfds[npfd].events = (a->state == ATTEMPT_READING) ? POLLIN : POLLOUT;
+            }
+            pfds[npfd].revents = 0;
+            pfd_owner[npfd++] = i;
+            if (a->phase_deadline_ms < wake_ms) {
+                wake_ms = a->phase_deadline_ms;
+            }
+        }
+
+        int timeout = (wake_ms > now) ? (int)(wake_ms - now) : 0;
+        int ready = poll(pfds, npfd, timeout);
+        if (ready < 0 && errno != EINTR) {
+            LOG_ERROR("poll() failed during fetch race: %s", strerror(errno));
+            break;
+        }
+        now = http_client_monotonic_ms();
+
+        for (int p = 0; p < npfd && winner < 0; p++) {
+            int i = pfd_owner[p];
+            RaceAttempt *a = &attempts[i];
+            HttpAttemptResult *r = results ? &results[i] : NULL;
+            if (ready > 0 && pfds[p].revents) {
+                if (attempt_progress(a, &entries[i], r, pfds[p].revents, now)) {
+                    winner = i;
+                    break;
+                }
+            }
+            if (a->state != ATTEMPT_DONE && now >= a->phase_deadline_ms) {
+                if (a->state == ATTEMPT_CONNECTING && attempt_connect_next(a, &entries[i], now) == 0) {
+                    LOG_DEBUG("Connect to %s timed out; trying next address.", entries[i].server->host);
+                    continue;
+                }
+                attempt_fail(a, r, now, entries[i].server->host,
+                             a->state == ATTEMPT_RESOLVING  ? "DNS timeout" :
+                             a->state == ATTEMPT_CONNECTING ? "connect timeout" : "idle timeout");
+            }
+            if (a->state == ATTEMPT_DONE && launched < count) {
+                next_launch_ms = now; // Failure frees the slot: start the next server right away
+            }
+        }
+    }
+
+    // Cancel every attempt that did not win.
+    for (int i = 0; i < launched; i++) {
+        if (i == winner) continue;
+        if (attempts[i].state != ATTEMPT_DONE) {
+            LOG_DEBUG("Cancelling fetch from %s.", entries[i].server->host);
+            attempt_release(&attempts[i]);
+            if (results) {
+                results[i].outcome = HTTP_ATTEMPT_CANCELLED;
+                results[i].latency_ms = (long)(now - attempts[i].started_ms);
+            }
+        }
+    }
+
+    if (winner < 0) {
+        free(attempts);
+        return 1;
+    }
+
+    RaceAttempt *w = &attempts[winner];
+    memset(resp, 0, sizeof(*resp));
+    resp->sock = w->sock;
+    resp->winner = winner;
+    resp->total_deadline_ms = total_deadline;
+    memcpy(resp->buffer, w->buffer, w->buffer_len + 1);
+    resp->buffer_len = w->buffer_len;
+    char *end_of_headers = strstr(resp->buffer, "\r\n\r\n");
+    resp->header_len = (size_t)(end_of_headers - resp->buffer) + 4;
+    *end_of_headers = '\0'; // Header lookups stop at the header block
+    resp->pending_pos = resp->header_len;
+    sscanf(resp->buffer, "HTTP/%*f %d", &resp->status_code);
+    if (results) {
+        results[winner].outcome = HTTP_ATTEMPT_WON;
+    }
+    w->sock = -1; // Ownership moves to resp
+    attempt_release(w);
+    free(attempts);
+    return 0;
+}
+
+ssize_t http_client_read_body(void *ctx, unsigned char *buf, size_t len) {
+    HttpResponse *resp = (HttpResponse *)ctx;
+    if (resp->pending_pos < resp->buffer_len) {
+        size_t n = resp->buffer_len - resp->pending_pos;
+        if (n > len) n = len;
+        memcpy(buf, resp->buffer + resp->pending_pos, n);
+        resp->pending_pos += n;
+        resp->body_wire_bytes += n;
+        return (ssize_t)n;
+    }
+
+    while (1) {
+        long long now = http_client_monotonic_ms();
+        if (now >= resp->total_deadline_ms) {
+            LOG_WARN("Body transfer exceeded total deadline of %d ms.", PB_FETCH_TOTAL_TIMEOUT_MS);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        long long wait = resp->total_deadline_ms - now;
+        if (wait > PB_FETCH_IDLE_TIMEOUT_MS) {
+            wait = PB_FETCH_IDLE_TIMEOUT_MS;
+        }
+        struct pollfd pfd = { .fd = resp->sock, .events = POLLIN, .revents = 0 };
+        int ready = poll(&pfd, 1, (int)wait);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (ready == 0) {
+            if (wait == PB_FETCH_IDLE_TIMEOUT_MS) {
+                LOG_WARN("No body data for %d ms; giving up.", PB_FETCH_IDLE_TIMEOUT_MS);
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            continue; // Loop re-checks the total deadline
+        }
+        ssize_t n = recv(resp->sock, buf, len, 0);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            continue;
+        }
+        if (n > 0) {
+            resp->body_wire_bytes += (size_t)n;
+        }
+        return n;
+    }
+}
+
+void http_client_close(HttpResponse *resp) {
+    if (resp->sock >= 0) {
+        close(resp->sock);
+        resp->sock = -1;
+    }
+}
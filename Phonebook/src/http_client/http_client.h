@@ -0,0 +1,75 @@
+// http_client.h
+#ifndef HTTP_CLIENT_H
+#define HTTP_CLIENT_H
+
+#include "../common.h"
+
+// Minimal non-blocking HTTP/1.0 client used by the phonebook fetcher.
+// Several servers can be raced: the preferred one starts first, the next is
+// started after PB_FETCH_STAGGER_MS (or as soon as an earlier one fails), and
+// the first one to answer with an acceptable status wins. All others are
+// cancelled. Host names resolve on a helper thread, so DNS counts against the
+// connect deadline like the TCP handshake; connect, idle and total deadlines
+// bound every phase.
+
+#define HTTP_MAX_REQUEST_LEN  1536
+#define HTTP_MAX_HEADER_BYTES 4096
+
+// Outcome of one server attempt within a race
+#define HTTP_ATTEMPT_NOT_STARTED 0 // Race was decided before this server was tried
+#define HTTP_ATTEMPT_FAILED      1 // DNS, connect, timeout, or unacceptable status
+#define HTTP_ATTEMPT_CANCELLED   2 // Was in progress when another server won
+#define HTTP_ATTEMPT_WON         3
+
+typedef struct {
+    const ConfigurableServer *server;
+    char request[HTTP_MAX_REQUEST_LEN]; // Complete request text
+    bool conditional;                   // Request carried validators; 304 counts as success
+    bool delta;                         // Request offered a delta base; 226 counts as success
+} HttpRaceEntry;
+
+typedef struct {
+    int outcome;       // HTTP_ATTEMPT_*
+    int http_status;   // 0 if no response header was received
+    long latency_ms;   // Start of attempt until response headers (or failure)
+    int retry_after_s; // Retry-After of a rejected response (e.g. 503/429), 0 if none
+} HttpAttemptResult;
+
+typedef struct {
+    int sock;
+    int winner;                          // Index into the race entries
+    int status_code;
+    char buffer[HTTP_MAX_HEADER_BYTES];  // Status line + headers (NUL-terminated), then early body bytes
+    size_t header_len;                   // Offset of the body within buffer
+    size_t buffer_len;
+    size_t pending_pos;                  // Next early body byte to hand out
+    size_t body_wire_bytes;              // Body bytes received so far (before any decoding)
+    long long total_deadline_ms;         // CLOCK_MONOTONIC deadline for the whole transfer
+} HttpResponse;
+
+/**
+ * @brief Races the given servers (in preference order) for a response.
+ *
+ * @param entries Requests to race, best server first.
+ * @param count Number of entries.
+ * @param resp Receives the winning connection; read the body with http_client_read_body().
+ * @param results Optional array of count elements receiving per-server outcomes.
+ * @return 0 if a server won (resp must then be closed with http_client_close), 1 otherwise.
+ */
+int http_client_race(HttpRaceEntry *entries, int count, HttpResponse *resp, HttpAttemptResult *results);
+
+// Body reader matching inflate_read_fn: >0 bytes, 0 at end of body, <0 on error/timeout.
+ssize_t http_client_read_body(void *resp, unsigned char *buf, size_t len);
+
+void http_client_close(HttpResponse *resp);
+
+// Case-insensitive lookup of a header in a NUL-terminated response header block.
+int http_client_find_header(const char *headers, const char *name, char *out, size_t out_len);
+
+// Parses a Retry-After value (delta-seconds or HTTP-date) into seconds from now; 0 if absent or invalid.
+int http_client_parse_retry_after(const char *value);
+
+// CLOCK_MONOTONIC in milliseconds
+long long http_client_monotonic_ms(void);
+
+#endif // HTTP_CLIENT_H
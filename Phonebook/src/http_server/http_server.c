@@ -0,0 +1,526 @@
+#define MODULE_NAME "HTTPD"
+
+#include "http_server.h"
+#include "../common.h"
+#include "../directory_render/directory_render.h"
+#include "../file_utils/file_utils.h"
+#include "../passive_safety/passive_safety.h" // For thread heartbeats
+#include "../stats_shm/stats_shm.h"
+#include "../metrics/metrics.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/uio.h>
+
+typedef struct {
+    int fd; // -1 when the slot is free
+    char in[HTTP_REQUEST_MAX];
+    size_t in_len;
+    char head[512];
+    size_t head_len;
+    const char *body;
+    size_t body_len;
+    size_t sent;                 // Bytes of head + body sent so far
+    const DirectoryOutput *ref;  // Held while body points into a rendering
+    char *owned;                 // Body allocated for this response
+    bool sending;
+    bool keep_alive;
+    time_t last_active;
+} HttpConnection;
+
+static HttpConnection conns[HTTP_MAX_CONNECTIONS];
+static int listen_fd = -1;
+static time_t started_at = 0;
+static unsigned long requests_served = 0;
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int http_server_init(int port) {
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        conns[i].fd = -1;
+    }
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        LOG_ERROR("HTTP socket creation failed: %s", strerror(errno));
+        return 1;
+    }
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 32) < 0 ||
+        set_nonblocking(listen_fd) < 0) {
+        LOG_ERROR("HTTP server could not listen on TCP port %d: %s", port, strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return 1;
+    }
+    started_at = time(NULL);
+    LOG_INFO("HTTP server listening on TCP port %d.", port);
+    return 0;
+}
+
+static void finish_response(HttpConnection *c) {
+    if (c->ref) {
+        directory_render_release(c->ref);
+        c->ref = NULL;
+    }
+    free(c->owned);
+    c->owned = NULL;
+    c->body = NULL;
+    c->body_len = 0;
+    c->head_len = 0;
+    c->sent = 0;
+    c->sending = false;
+}
+
+static void close_connection(HttpConnection *c) {
+    finish_response(c);
+    close(c->fd);
+    c->fd = -1;
+    c->in_len = 0;
+}
+
+// Value of header 'name' in the request, or NULL. *len receives its length.
+static const char *header_value(const char *req, const char *name, size_t *len) {
+    size_t name_len = strlen(name);
+    for (const char *line = strstr(req, "\r\n"); line && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+        const char *p = line + 2;
+        if (strncasecmp(p, name, name_len) == 0 && p[name_len] == ':') {
+            p += name_len + 1;
+            while (*p == ' ' || *p == '\t') p++;
+            const char *end = strstr(p, "\r\n");
+            *len = end ? (size_t)(end - p) : strlen(p);
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static bool header_contains(const char *req, const char *name, const char *token) {
+    size_t len = 0;
+    const char *v = header_value(req, name, &len);
+    size_t token_len = strlen(token);
+    for (size_t i = 0; v && i + token_len <= len; i++) {
+        if (strncasecmp(v + i, token, token_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A negative content_length omits the header (304 responses).
+static void set_head(HttpConnection *c, const char *status, const char *content_type, long content_length,
+                     const char *extra) {
+    char length[40] = "";
+    if (content_length >= 0) {
+        snprintf(length, sizeof(length), "Content-Length: %ld\r\n", content_length);
+    }
+    c->head_len = (size_t)snprintf(c->head, sizeof(c->head),
+                                   "HTTP/1.1 %s\r\nServer: %s/%s\r\nContent-Type: %s\r\n%s"
+                                   "Access-Control-Allow-Origin: *\r\n%sConnection: %s\r\n\r\n",
+                                   status, APP_NAME, AREDN_PHONEBOOK_VERSION, content_type, length,
+                                   extra ? extra : "", c->keep_alive ? "keep-alive" : "close");
+}
+
+static void respond_text(HttpConnection *c, const char *status, const char *text) {
+    c->body = text;
+    c->body_len = strlen(text);
+    set_head(c, status, "text/plain", (long)c->body_len, NULL);
+}
+
+// JSON document built for this response; 'doc' is malloc'd and owned by the connection.
+static void respond_owned_json(HttpConnection *c, char *doc, size_t len) {
+    c->owned = doc;
+    c->body = doc;
+    c->body_len = len;
+    set_head(c, "200 OK", "application/json", (long)len, "Cache-Control: no-cache\r\n");
+}
+
+static void respond_health(HttpConnection *c) {
+    time_t now = time(NULL);
+    pthread_mutex_lock(&registered_users_mutex);
+    int registered = num_registered_users;
+    int directory = num_directory_entries;
+    pthread_mutex_unlock(&registered_users_mutex);
+
+    char *doc = malloc(512);
+    if (!doc) {
+        respond_text(c, "503 Service Unavailable", "Out of memory\n");
+        return;
+    }
+    int len = snprintf(doc, 512,
+                       "{\"status\":\"ok\",\"version\":\"%s\",\"uptime_seconds\":%ld,"
+                       "\"fetcher_heartbeat_age\":%ld,\"updater_heartbeat_age\":%ld,"
+                       "\"registered_users\":%d,\"directory_entries\":%d,\"http_requests\":%lu}\n",
+                       AREDN_PHONEBOOK_VERSION, (long)(now - started_at),
+                       g_fetcher_last_heartbeat ? (long)(now - g_fetcher_last_heartbeat) : -1L,
+                       g_updater_last_heartbeat ? (long)(now - g_updater_last_heartbeat) : -1L,
+                       registered, directory, requests_served);
+    respond_owned_json(c, doc, (size_t)len);
+}
+
+// OpenMetrics when the scraper asks for it, Prometheus text 0.0.4 otherwise
+static void respond_metrics(HttpConnection *c, const char *req) {
+    bool openmetrics = header_contains(req, "Accept", "application/openmetrics-text");
+    size_t len = 0;
+    char *text = metrics_render(openmetrics, &len);
+    if (!text) {
+        respond_text(c, "503 Service Unavailable", "Out of memory\n");
+        return;
+    }
+    c->owned = text;
+    c->body = text;
+    c->body_len = len;
+    set_head(c, "200 OK",
+             openmetrics ? "application/openmetrics-text; version=1.0.0; charset=utf-8"
+                         : "text/plain; version=0.0.4; charset=utf-8",
+             (long)len, "Cache-Control: no-cache\r\n");
+}
+
+static void respond_status_file(HttpConnection *c, const char *path) {
+    char *doc = NULL;
+    size_t len = 0;
+    if (file_utils_read_file(path, &doc, &len) != 0) {
+        respond_text(c, "503 Service Unavailable", "Status not available yet\n");
+        return;
+    }
+    respond_owned_json(c, doc, len);
+}
+
+static void respond_directory(HttpConnection *c, DirectoryFormat format, const char *req) {
+    bool gzip = header_contains(req, "Accept-Encoding", "gzip");
+    const DirectoryOutput *out = directory_render_acquire(format, gzip);
+    if (!out) {
+        respond_text(c, "503 Service Unavailable", "Phonebook not loaded yet\n");
+        return;
+    }
+    gzip = gzip && out->gzip;
+
+    // The gzip variant gets its own validator
+    char etag[sizeof(out->etag) + 4];
+    if (gzip) {
+        snprintf(etag, sizeof(etag), "%.*s-gz\"", (int)strlen(out->etag) - 1, out->etag);
+    } else {
+        snprintf(etag, sizeof(etag), "%s", out->etag);
+    }
+    char extra[160];
+    snprintf(extra, sizeof(extra), "ETag: %s\r\nCache-Control: no-cache\r\nVary: Accept-Encoding\r\n%s", etag,
+             gzip ? "Content-Encoding: gzip\r\n" : "");
+
+    if (header_contains(req, "If-None-Match", etag)) {
+        directory_render_release(out);
+        set_head(c, "304 Not Modified", directory_format_content_type(format), -1, extra);
+        STATS_INC(http_not_modified);
+        return;
+    }
+    c->ref = out;
+    c->body = gzip ? (const char *)out->gzip : out->data;
+    c->body_len = gzip ? out->gzip_len : out->len;
+    set_head(c, "200 OK", directory_format_content_type(format), (long)c->body_len, extra);
+}
+
+// Copies the URL-decoded value of parameter 'name' from a query string. Returns false if absent.
+static bool query_param(const char *query, const char *name, char *out, size_t out_len) {
+    size_t name_len = strlen(name);
+    for (const char *p = query; *p; ) {
+        const char *end = strchr(p, '&');
+        if (!end) end = p + strlen(p);
+        if ((size_t)(end - p) > name_len && strncmp(p, name, name_len) == 0 && p[name_len] == '=') {
+            size_t o = 0;
+            for (const char *v = p + name_len + 1; v < end && o + 1 < out_len; v++) {
+                unsigned int hex;
+                if (*v == '+') {
+                    out[o++] = ' ';
+                } else if (*v == '%' && end - v > 2 && sscanf(v + 1, "%2x", &hex) == 1) {
+                    out[o++] = (char)hex;
+                    v += 2;
+                } else {
+                    out[o++] = *v;
+                }
+            }
+            out[o] = '\0';
+            return true;
+        }
+        p = *end ? end + 1 : end;
+    }
+    return false;
+}
+
+static void url_encode(const char *in, char *out, size_t out_len) {
+    size_t o = 0;
+    for (const unsigned char *p = (const unsigned char *)in; *p && o + 4 < out_len; p++) {
+        if (isalnum(*p) || *p == '-' || *p == '_' || *p == '.' || *p == '~') {
+            out[o++] = (char)*p;
+        } else {
+            o += (size_t)snprintf(out + o, out_len - o, "%%%02X", *p);
+        }
+    }
+    out[o] = '\0';
+}
+
+// /directory?q=<prefix>&active=1&page=<n>&limit=<n>&format=<name>. 'search' and
+// 'key' are accepted for q, so phones' remote phonebook URLs (e.g. Yealink's
+// ...?q=#SEARCH) can be pointed here directly.
+static void respond_search(HttpConnection *c, const char *query_string) {
+    char prefix[MAX_DISPLAY_NAME_LEN] = "", value[32];
+    if (!query_param(query_string, "q", prefix, sizeof(prefix)) &&
+        !query_param(query_string, "search", prefix, sizeof(prefix))) {
+        query_param(query_string, "key", prefix, sizeof(prefix));
+    }
+    size_t prefix_len = strlen(prefix);
+    while (prefix_len > 0 && isspace((unsigned char)prefix[prefix_len - 1])) prefix[--prefix_len] = '\0';
+    char *start = prefix;
+    while (isspace((unsigned char)*start)) start++;
+    memmove(prefix, start, strlen(start) + 1);
+    if (strcmp(prefix, "#SEARCH") == 0) {
+        prefix[0] = '\0'; // Placeholder left unexpanded by the phone
+    }
+    int format = DIRECTORY_FORMAT_YEALINK;
+    if (query_param(query_string, "format", value, sizeof(value)) && (format = directory_format_from_name(value)) < 0) {
+        respond_text(c, "400 Bad Request", "Unknown format\n");
+        return;
+    }
+    DirectoryQuery q = { prefix, false, 1, HTTP_SEARCH_PAGE_SIZE, NULL };
+    if (query_param(query_string, "active", value, sizeof(value))) {
+        q.active_only = strcmp(value, "1") == 0 || strcasecmp(value, "true") == 0;
+    }
+    if (query_param(query_string, "page", value, sizeof(value))) {
+        long page = strtol(value, NULL, 10);
+        q.page = page < 1 ? 1 : page > HTTP_SEARCH_MAX_PAGE ? HTTP_SEARCH_MAX_PAGE : (int)page;
+    }
+    if (query_param(query_string, "limit", value, sizeof(value))) {
+        long limit = strtol(value, NULL, 10);
+        if (limit > 0) {
+            q.per_page = limit < HTTP_SEARCH_MAX_PAGE_SIZE ? (int)limit : HTTP_SEARCH_MAX_PAGE_SIZE;
+        }
+    }
+
+    // Absolute link to the next page, as phones need for their soft keys
+    char host[128] = "", encoded[MAX_DISPLAY_NAME_LEN * 3], next_url[512];
+    size_t host_len = 0;
+    const char *h = header_value(c->in, "Host", &host_len);
+    if (h && host_len < sizeof(host)) {
+        memcpy(host, h, host_len);
+        host[host_len] = '\0';
+    }
+    url_encode(prefix, encoded, sizeof(encoded));
+    snprintf(next_url, sizeof(next_url), "%s%s/directory?format=%s&q=%s&active=%d&limit=%d&page=%d",
+             host[0] ? "http://" : "", host, directory_format_name((DirectoryFormat)format), encoded,
+             q.active_only ? 1 : 0, q.per_page, q.page + 1);
+    q.next_url = next_url;
+
+    char *doc = NULL;
+    size_t len = 0;
+    int total = 0;
+    if (directory_render_query((DirectoryFormat)format, &q, &doc, &len, &total) != 0) {
+        respond_text(c, "503 Service Unavailable", "Phonebook not loaded yet\n");
+        return;
+    }
+    LOG_DEBUG("Directory search '%s' (active only: %d): %d matches, page %d.", prefix, q.active_only, total, q.page);
+    c->owned = doc;
+    c->body = doc;
+    c->body_len = len;
+    set_head(c, "200 OK", directory_format_content_type((DirectoryFormat)format), (long)len,
+             "Cache-Control: no-cache\r\n");
+}
+
+// Maps "/phonebook_<format>.<ext>" to its format, or -1.
+static int directory_format_for_path(const char *path) {
+    if (strcmp(path, "/phonebook_generic_direct.xml") == 0) {
+        return DIRECTORY_FORMAT_YEALINK;
+    }
+    if (strcmp(path, "/showphonebook") == 0) {
+        return DIRECTORY_FORMAT_JSON;
+    }
+    for (int i = 0; i < DIRECTORY_FORMAT_COUNT; i++) {
+        char candidate[64];
+        snprintf(candidate, sizeof(candidate), "/phonebook_%s.%s", directory_format_name((DirectoryFormat)i),
+                 directory_format_extension((DirectoryFormat)i));
+        if (strcmp(path, candidate) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Prepares the response to the request in c->in (NUL-terminated, ending with its blank line).
+static void handle_request(HttpConnection *c) {
+    char method[8], target[256], version[16];
+    c->keep_alive = false;
+    if (sscanf(c->in, "%7s %255s %15s", method, target, version) != 3 || strncmp(version, "HTTP/1.", 7) != 0) {
+        respond_text(c, "400 Bad Request", "Bad request\n");
+        return;
+    }
+    // HTTP/1.1 keeps the connection by default, HTTP/1.0 only when asked
+    c->keep_alive = strcmp(version, "HTTP/1.0") != 0 ? !header_contains(c->in, "Connection", "close")
+                                                     : header_contains(c->in, "Connection", "keep-alive");
+    bool head_only = strcmp(method, "HEAD") == 0;
+    if (!head_only && strcmp(method, "GET") != 0) {
+        respond_text(c, "405 Method Not Allowed", "Only GET and HEAD are supported\n");
+        return;
+    }
+    char *query = strchr(target, '?');
+    if (query) *query++ = '\0';
+
+    int format = directory_format_for_path(target);
+    if (strcmp(target, "/directory") == 0) {
+        respond_search(c, query ? query : "");
+    } else if (format >= 0) {
+        respond_directory(c, (DirectoryFormat)format, c->in);
+    } else if (strcmp(target, "/metrics") == 0) {
+        respond_metrics(c, c->in);
+    } else if (strcmp(target, "/health") == 0) {
+        respond_health(c);
+    } else if (strcmp(target, "/fetchstatus") == 0) {
+        respond_status_file(c, PB_FETCH_STATUS_PATH);
+    } else if (strcmp(target, "/flashstatus") == 0) {
+        respond_status_file(c, PB_FLASH_STATUS_PATH);
+    } else {
+        respond_text(c, "404 Not Found", "Not found\n");
+    }
+    if (head_only) {
+        c->body_len = 0; // Content-Length still describes the GET response
+    }
+    requests_served++;
+    STATS_INC(http_requests);
+}
+
+// Sends what the socket takes. Returns 0 while the connection stays open.
+static int send_pending(HttpConnection *c) {
+    while (c->sent < c->head_len + c->body_len) {
+        struct iovec iov[2];
+        int n = 0;
+        if (c->sent < c->head_len) {
+            iov[n].iov_base = c->head + c->sent;
+            iov[n++].iov_len = c->head_len - c->sent;
+            if (c->body_len) {
+                iov[n].iov_base = (void *)c->body;
+                iov[n++].iov_len = c->body_len;
+            }
+        } else {
+            iov[n].iov_base = (void *)(c->body + (c->sent - c->head_len));
+            iov[n++].iov_len = c->body_len - (c->sent - c->head_len);
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)n;
+        ssize_t w = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0; // Wait for writability
+            return 1;
+        }
+        c->sent += (size_t)w;
+        c->last_active = time(NULL);
+    }
+    finish_response(c);
+    return c->keep_alive ? 0 : 1;
+}
+
+// Answers complete requests in the input buffer, one at a time. Returns 0 while the connection stays open.
+static int serve_buffered(HttpConnection *c) {
+    while (!c->sending) {
+        c->in[c->in_len] = '\0';
+        char *end = strstr(c->in, "\r\n\r\n");
+        if (!end) {
+            if (c->in_len >= sizeof(c->in) - 1) {
+                c->keep_alive = false;
+                respond_text(c, "431 Request Header Fields Too Large", "Request too large\n");
+                c->in_len = 0;
+                c->sending = true;
+                return send_pending(c);
+            }
+            return 0;
+        }
+        size_t req_len = (size_t)(end - c->in) + 4;
+        char next = c->in[req_len];
+        c->in[req_len] = '\0';
+        handle_request(c);
+        c->in[req_len] = next;
+        memmove(c->in, c->in + req_len, c->in_len - req_len); // Keep pipelined requests
+        c->in_len -= req_len;
+        c->sending = true;
+        if (send_pending(c) != 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void accept_connections(void) {
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            return; // EAGAIN: backlog drained
+        }
+        HttpConnection *c = NULL;
+        for (int i = 0; i < HTTP_MAX_CONNECTIONS && !c; i++) {
+            if (conns[i].fd < 0) c = &conns[i];
+        }
+        if (!c || fd >= FD_SETSIZE || set_nonblocking(fd) < 0) {
+            LOG_DEBUG("Refusing HTTP connection: %s.", c ? "descriptor out of range" : "all slots busy");
+            close(fd);
+            continue;
+        }
+        memset(c, 0, sizeof(*c));
+        c->fd = fd;
+        c->last_active = time(NULL);
+    }
+}
+
+void http_server_fill_fds(fd_set *readfds, fd_set *writefds, int *maxfd) {
+    if (listen_fd < 0) {
+        return;
+    }
+    FD_SET(listen_fd, readfds);
+    if (listen_fd > *maxfd) *maxfd = listen_fd;
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        HttpConnection *c = &conns[i];
+        if (c->fd < 0) continue;
+        FD_SET(c->fd, c->sending ? writefds : readfds);
+        if (c->fd > *maxfd) *maxfd = c->fd;
+    }
+}
+
+void http_server_process(const fd_set *readfds, const fd_set *writefds) {
+    if (listen_fd < 0) {
+        return;
+    }
+    time_t now = time(NULL);
+    for (int i = 0; i < HTTP_MAX_CONNECTIONS; i++) {
+        HttpConnection *c = &conns[i];
+        if (c->fd < 0) continue;
+
+        int closing = 0;
+        if (c->sending && FD_ISSET(c->fd, writefds)) {
+            closing = send_pending(c);
+            if (!closing) closing = serve_buffered(c);
+        } else if (!c->sending && FD_ISSET(c->fd, readfds)) {
+            ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len, 0);
+            if (n > 0) {
+                c->in_len += (size_t)n;
+                c->last_active = now;
+                closing = serve_buffered(c);
+            } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                closing = 1; // Peer closed or reset
+            }
+        } else if (now - c->last_active > HTTP_IDLE_TIMEOUT_SECONDS) {
+            closing = 1;
+        }
+        if (closing) {
+            close_connection(c);
+        }
+    }
+    if (FD_ISSET(listen_fd, readfds)) {
+        accept_connections();
+    }
+}
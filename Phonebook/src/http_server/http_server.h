@@ -0,0 +1,39 @@
+// http_server.h
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include "../common.h"
+#include <sys/select.h>
+
+// Optional HTTP/1.1 server (HTTP_SERVER_PORT) for phones and status pages.
+// It has no thread of its own: its sockets are non-blocking and polled by the
+// main select() loop next to the SIP socket. Directory formats come from the
+// in-memory renderings of directory_render (ETag/If-None-Match, gzip when
+// accepted); connections are kept alive and may pipeline requests.
+//
+//   /phonebook_generic_direct.xml         Yealink directory (as published by uhttpd)
+//   /phonebook_<format>.<ext>             Any directory format, e.g. /phonebook_cisco.xml
+//   /showphonebook                        JSON directory, as the showphonebook CGI
+//   /directory?q=&active=&page=&limit=&format=
+//                                         Prefix search and paging over the directory
+//   /health                               Thread heartbeats and counters (JSON)
+//   /metrics                              OpenMetrics / Prometheus text exposition
+//   /fetchstatus, /flashstatus            Same documents as the CGI scripts
+
+#define HTTP_MAX_CONNECTIONS 64
+#define HTTP_REQUEST_MAX 2048            // Request line and headers
+#define HTTP_IDLE_TIMEOUT_SECONDS 15     // Idle keep-alive connections are closed after this
+#define HTTP_SEARCH_PAGE_SIZE 32         // Default /directory page (the most a Cisco directory page holds)
+#define HTTP_SEARCH_MAX_PAGE_SIZE 500
+#define HTTP_SEARCH_MAX_PAGE 100000      // Higher page numbers are clamped (always past the last entry)
+
+// Opens the listening socket. Returns 0 on success, 1 on error.
+int http_server_init(int port);
+
+// Adds the server's sockets to the sets for the next select(); raises *maxfd as needed.
+void http_server_fill_fds(fd_set *readfds, fd_set *writefds, int *maxfd);
+
+// Accepts, reads and writes whatever select() reported ready, and closes idle connections.
+void http_server_process(const fd_set *readfds, const fd_set *writefds);
+
+#endif // HTTP_SERVER_H
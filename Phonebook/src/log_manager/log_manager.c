@@ -1,67 +1,312 @@
 // log_manager.c
 #include "../common.h"
 #include "log_manager.h"
+#include "../stats_shm/stats_shm.h" // For the dropped-message counter
 #include <syslog.h>
 #include <stdarg.h>
 #include <string.h>
 #include <time.h>
-#include <unistd.h> 
-#include <sys/syscall.h> 
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <semaphore.h>
+#include <strings.h>
 
 #define MODULE_NAME "LOG" // Corrected MODULE_NAME
 
-// Define the desired compile-time log level here.
-#define LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+// Runtime levels. LOG_ENABLED() reads log_max_level first, so a line no module
+// wants is rejected with one compare; only otherwise does it read its module's
+// level, found by name once per file. Writers hold modules_mutex and store
+// with atomics; readers take no lock.
+static int default_level = LOG_DEFAULT_LEVEL;
+int log_max_level = LOG_DEFAULT_LEVEL;
+static LogModuleLevel modules[LOG_MAX_MODULES];
+static int module_count = 0;
+static pthread_mutex_t modules_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Records queued by the LOG_* callers and shipped to syslog by the writer
+// thread. The ring is a bounded multi-producer queue (one sequence number per
+// slot): a producer claims a slot with a 32-bit compare-and-swap on 'head',
+// formats its message straight into it and publishes it by advancing the
+// slot's sequence. Nothing a producer does can block; when the ring is full
+// the message is counted as dropped instead.
+typedef struct {
+    uint32_t seq;
+    uint8_t level;
+    pid_t tid;
+    const char *app_name;   // String literals (APP_NAME, MODULE_NAME)
+    const char *module_name;
+    char *spill;            // Heap copy of a message too long for text[], freed by the writer
+    char text[LOG_RECORD_TEXT_LEN];
+} LogRecord;
+
+static LogRecord ring[LOG_RING_SLOTS];
+static uint32_t head;                // Next slot to claim (producers)
+static uint32_t tail;                // Next slot to ship (advanced by the writer thread only)
+static uint32_t dropped;
+static int writer_waiting;           // Writer is (about to be) asleep on 'wakeup', and may be posted
+static sem_t wakeup;
+static pthread_t writer_tid;
+static volatile int writer_running = 0;
+static volatile int writer_stop = 0;
+static pid_t process_pid;
+static __thread pid_t thread_tid;    // Cached: gettid() is a system call
+
+static int syslog_level_for(int level) {
+    switch (level) {
+        case LOG_LEVEL_ERROR:   return LOG_ERR;
+        case LOG_LEVEL_WARNING: return LOG_WARNING;
+        case LOG_LEVEL_INFO:    return LOG_INFO;
+        case LOG_LEVEL_DEBUG:   return LOG_DEBUG;
+        default:                return LOG_NOTICE;
+    }
+}
+
+static void ship(const LogRecord *r) {
+    syslog(syslog_level_for(r->level), "%s [%d/%d]: %s: %s", r->app_name, process_pid, r->tid, r->module_name,
+           r->spill ? r->spill : r->text);
+}
+
+// Ships every published record. Returns the number shipped.
+static int drain(void) {
+    int shipped = 0;
+    while (1) {
+        LogRecord *r = &ring[tail % LOG_RING_SLOTS];
+        if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+            return shipped;
+        }
+        ship(r);
+        free(r->spill);
+        r->spill = NULL;
+        __atomic_store_n(&r->seq, tail + LOG_RING_SLOTS, __ATOMIC_RELEASE); // Free for the producer one lap later
+        __atomic_store_n(&tail, tail + 1, __ATOMIC_RELAXED);
+        shipped++;
+    }
+}
+
+static void *log_writer_thread(void *arg) {
+    (void)arg;
+    thread_tid = (pid_t)syscall(SYS_gettid);
+    uint32_t reported_drops = 0;
+    while (1) {
+        drain();
+
+        uint32_t drops = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+        if (drops != reported_drops) {
+            syslog(LOG_WARNING, "%s [%d/%d]: %s: Log ring full, %u message(s) dropped (%u total).", APP_NAME,
+                   process_pid, thread_tid, MODULE_NAME, drops - reported_drops, drops);
+            STATS_SET(log_dropped, drops);
+            reported_drops = drops;
+        }
+        if (writer_stop) {
+            drain();
+            return NULL;
+        }
+
+        // Wakes every LOG_WRITER_PERIOD_MS, or earlier when a producer finds the ring half full
+        __atomic_store_n(&writer_waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&head, __ATOMIC_SEQ_CST) - tail < LOG_RING_SLOTS / 2) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_nsec += LOG_WRITER_PERIOD_MS * 1000000L;
+            until.tv_sec += until.tv_nsec / 1000000000L;
+            until.tv_nsec %= 1000000000L;
+            sem_timedwait(&wakeup, &until);
+        }
+        __atomic_store_n(&writer_waiting, 0, __ATOMIC_RELAXED);
+    }
+}
 
 void log_init(const char* app_name) {
     openlog(app_name, LOG_PID | LOG_CONS | LOG_NDELAY, LOG_DAEMON);
+    process_pid = getpid();
+    for (uint32_t i = 0; i < LOG_RING_SLOTS; i++) {
+        ring[i].seq = i;
+    }
+    head = tail = 0;
+    if (sem_init(&wakeup, 0, 0) != 0) {
+        return; // Stays synchronous
+    }
+    if (pthread_create(&writer_tid, NULL, log_writer_thread, NULL) == 0) {
+        writer_running = 1;
+    }
 }
 
 void log_shutdown(void) {
+    if (writer_running) {
+        writer_stop = 1;
+        sem_post(&wakeup);
+        pthread_join(writer_tid, NULL);
+        writer_running = 0;
+    }
     closelog();
 }
 
-void log_message(int level, const char* app_name_in, const char* module_name_in, const char *format, ...) {
-    if (LOG_COMPILE_LEVEL == LOG_LEVEL_NONE) {
-        if (level != LOG_LEVEL_ERROR && level != LOG_LEVEL_WARNING) {
-            return;
-        }
-    } else {
-        if (level > LOG_COMPILE_LEVEL) {
-            return;
-        }
+// Caller holds modules_mutex
+static void update_max_level(void) {
+    int max = default_level;
+    for (int i = 0; i < module_count; i++) {
+        if (modules[i].level > max) max = modules[i].level;
     }
+    __atomic_store_n(&log_max_level, max, __ATOMIC_RELAXED);
+}
 
-    int syslog_level;
-    switch (level) {
-        case LOG_LEVEL_ERROR:   syslog_level = LOG_ERR;     break;
-        case LOG_LEVEL_WARNING: syslog_level = LOG_WARNING; break;
-        case LOG_LEVEL_INFO:    syslog_level = LOG_INFO;    break;
-        case LOG_LEVEL_DEBUG:   syslog_level = LOG_DEBUG;   break;
-        default:                syslog_level = LOG_NOTICE;  break;
+// Caller holds modules_mutex. Returns NULL when the table is full.
+static LogModuleLevel *find_module(const char *module_name, bool add) {
+    for (int i = 0; i < module_count; i++) {
+        if (strcasecmp(modules[i].name, module_name) == 0) return &modules[i];
+    }
+    if (!add || module_count == LOG_MAX_MODULES) {
+        return NULL;
+    }
+    LogModuleLevel *m = &modules[module_count];
+    snprintf(m->name, sizeof(m->name), "%s", module_name);
+    m->level = default_level;
+    m->overridden = false;
+    module_count++; // Published after the entry is complete; readers of the table hold the mutex anyway
+    return m;
+}
+
+int *log_module_level_ref(const char *module_name) {
+    pthread_mutex_lock(&modules_mutex);
+    LogModuleLevel *m = find_module(module_name, true);
+    pthread_mutex_unlock(&modules_mutex);
+    return m ? &m->level : &default_level;
+}
+
+int log_set_level(int level) {
+    if (level < LOG_LEVEL_NONE || level > LOG_COMPILE_LEVEL) {
+        return 1;
+    }
+    pthread_mutex_lock(&modules_mutex);
+    __atomic_store_n(&default_level, level, __ATOMIC_RELAXED);
+    for (int i = 0; i < module_count; i++) {
+        __atomic_store_n(&modules[i].level, level, __ATOMIC_RELAXED);
+        modules[i].overridden = false;
+    }
+    update_max_level();
+    pthread_mutex_unlock(&modules_mutex);
+    return 0;
+}
+
+int log_get_level(void) {
+    return __atomic_load_n(&default_level, __ATOMIC_RELAXED);
+}
+
+int log_set_module_level(const char *module_name, int level) {
+    if (level < LOG_LEVEL_NONE || level > LOG_COMPILE_LEVEL) {
+        return 1;
     }
+    pthread_mutex_lock(&modules_mutex);
+    LogModuleLevel *m = find_module(module_name, true); // A module may be configured before it first logs
+    if (m) {
+        __atomic_store_n(&m->level, level, __ATOMIC_RELAXED);
+        m->overridden = true;
+        update_max_level();
+    }
+    pthread_mutex_unlock(&modules_mutex);
+    return m ? 0 : 1;
+}
+
+int log_module_levels(LogModuleLevel *out, int max) {
+    pthread_mutex_lock(&modules_mutex);
+    int n = module_count < max ? module_count : max;
+    memcpy(out, modules, (size_t)n * sizeof(*out));
+    pthread_mutex_unlock(&modules_mutex);
+    return n;
+}
+
+int log_level_from_name(const char *name) {
+    if (isdigit((unsigned char)name[0]) && !name[1]) {
+        return name[0] - '0' <= LOG_LEVEL_DEBUG ? name[0] - '0' : -1;
+    }
+    for (int l = LOG_LEVEL_NONE; l <= LOG_LEVEL_DEBUG; l++) {
+        if (strcasecmp(name, log_level_name(l)) == 0) return l;
+    }
+    if (strcasecmp(name, "warn") == 0) return LOG_LEVEL_WARNING;
+    return -1;
+}
 
-    pid_t current_pid = getpid();
-    pid_t current_tid = syscall(SYS_gettid); 
+uint32_t log_dropped_count(void) {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
 
-    char final_log_message[MAX_SIP_MSG_LEN + 64];
+const char *log_level_name(int level) {
+    switch (level) {
+        case LOG_LEVEL_NONE:    return "none";
+        case LOG_LEVEL_ERROR:   return "error";
+        case LOG_LEVEL_WARNING: return "warning";
+        case LOG_LEVEL_INFO:    return "info";
+        case LOG_LEVEL_DEBUG:   return "debug";
+        default:                return "unknown";
+    }
+}
+
+// The level was checked by LOG_ENABLED() before the arguments were evaluated.
+void log_message(int level, const char* app_name_in, const char* module_name_in, const char *format, ...) {
+    if (!thread_tid) {
+        thread_tid = (pid_t)syscall(SYS_gettid);
+    }
 
     va_list args;
     va_start(args, format);
 
-    char original_message_content[MAX_SIP_MSG_LEN];
-    vsnprintf(original_message_content, sizeof(original_message_content), format, args);
-    original_message_content[sizeof(original_message_content) - 1] = '\0';
+    if (!writer_running) {
+        // Before log_init(), after log_shutdown() and in the command line modes
+        char text[LOG_SPILL_TEXT_LEN];
+        LogRecord r = { .level = (uint8_t)level, .tid = thread_tid, .app_name = app_name_in,
+                        .module_name = module_name_in, .spill = text };
+        vsnprintf(text, sizeof(text), format, args);
+        va_end(args);
+        if (!process_pid) process_pid = getpid();
+        ship(&r);
+        return;
+    }
 
-    snprintf(final_log_message, sizeof(final_log_message),
-             "%s [%d/%d]: %s: %s",
-             app_name_in, 
-             current_pid,
-             current_tid,
-             module_name_in, 
-             original_message_content);
-    final_log_message[sizeof(final_log_message) - 1] = '\0';
+    uint32_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    LogRecord *r;
+    while (1) {
+        r = &ring[pos % LOG_RING_SLOTS];
+        int32_t diff = (int32_t)(__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break; // Slot claimed
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED); // Full: the writer is a whole lap behind
+            va_end(args);
+            return;
+        } else {
+            pos = __atomic_load_n(&head, __ATOMIC_RELAXED); // Another producer took it
+        }
+    }
 
-    syslog(syslog_level, "%s", final_log_message);
+    r->level = (uint8_t)level;
+    r->tid = thread_tid;
+    r->app_name = app_name_in;
+    r->module_name = module_name_in;
+    va_list spill_args;
+    va_copy(spill_args, args);
+    int len = vsnprintf(r->text, sizeof(r->text), format, args);
     va_end(args);
-}
\ No newline at end of file
+    if (len >= (int)sizeof(r->text)) {
+        // Rare (DEBUG dumps of whole SIP messages): format again into a heap
+        // copy, keeping the truncated text if there is no memory for it
+        size_t size = (len < LOG_SPILL_TEXT_LEN) ? (size_t)len + 1 : LOG_SPILL_TEXT_LEN;
+        r->spill = malloc(size);
+        if (r->spill) {
+            vsnprintf(r->spill, size, format, spill_args);
+        }
+    }
+    va_end(spill_args);
+    __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+
+    // Most messages cost no system call at all: the writer ships them on its next round
+    if (pos + 1 - __atomic_load_n(&tail, __ATOMIC_RELAXED) < LOG_RING_SLOTS / 2) {
+        return;
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&writer_waiting, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&writer_waiting, 0, __ATOMIC_RELAXED)) {
+        sem_post(&wakeup);
+    }
+}
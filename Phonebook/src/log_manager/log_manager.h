@@ -2,8 +2,47 @@
 #ifndef LOG_MANAGER_H
 #define LOG_MANAGER_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// LOG_* calls format into a lock-free ring and return; a writer thread started
+// by log_init() ships the records to syslog. When the ring is full a message
+// is dropped and counted rather than blocking the caller (SIP loop included).
+#define LOG_RING_SLOTS 256            // Power of two
+#define LOG_RECORD_TEXT_LEN 256       // Longer messages spill to a heap copy shipped in the slot's place
+#define LOG_SPILL_TEXT_LEN 4096       // Spilled messages are truncated here (a whole SIP message fits)
+#define LOG_WRITER_PERIOD_MS 20       // Writer round; records wait at most this long for syslog
+#define LOG_MAX_MODULES 32
+#define LOG_MODULE_NAME_LEN 24
+
+typedef struct {
+    char name[LOG_MODULE_NAME_LEN];
+    int level;
+    bool overridden;                  // Set by name, not following the default level
+} LogModuleLevel;
+
 void log_init(const char* app_name);
 void log_shutdown(void);
 void log_message(int level, const char* app_name_in, const char* module_name_in, const char *format, ...);
 
+// Runtime levels (LOG_LEVEL_NONE..LOG_COMPILE_LEVEL); errors and warnings are logged at any level.
+// log_set_level() sets the default and every module, dropping per-module settings.
+// Both return 0 on success, 1 if the level is out of range (or the module table is full).
+int log_set_level(int level);
+int log_get_level(void);
+int log_set_module_level(const char *module_name, int level);
+const char *log_level_name(int level);
+
+// "debug", "info", ... or a digit. Returns -1 if unknown.
+int log_level_from_name(const char *name);
+
+// Copies up to 'max' modules that have logged or been configured. Returns the number copied.
+int log_module_levels(LogModuleLevel *out, int max);
+
+// Level of 'module_name', registering it at the default level. Used by LOG_ENABLED() once per file.
+int *log_module_level_ref(const char *module_name);
+
+// Messages dropped because the ring was full
+uint32_t log_dropped_count(void);
+
 #endif // LOG_MANAGER_H
\ No newline at end of file
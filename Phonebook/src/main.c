@@ -12,6 +12,10 @@
 #include "user_manager/user_manager.h"   // For user management functions
 #include "call-sessions/call_sessions.h" // For call session management functions
 #include "passive_safety/passive_safety.h" // For passive safety and self-healing
+#include "http_server/http_server.h"     // For the optional embedded HTTP server
+#include "control_socket/control_socket.h" // For reload/status requests from the CGI scripts
+#include "stats_shm/stats_shm.h"         // For the shared-memory statistics segment
+#include "sip_trace/sip_trace.h"         // For per-stage SIP latency tracing
 
 // Define MODULE_NAME specific to main.c
 #define MODULE_NAME "MAIN"
@@ -24,6 +28,7 @@ CallSession call_sessions[MAX_CALL_SESSIONS];
 // volatile sig_atomic_t keep_running = 1; // REMOVED
 // volatile sig_atomic_t phonebook_updated_flag = 0; // REMOVED as related to signal handling
 volatile sig_atomic_t phonebook_reload_requested = 0; // For webhook-triggered reload
+volatile sig_atomic_t log_levels_reload_requested = 0; // Set by SIGHUP, handled by the main loop
 int num_registered_users = 0;
 int num_directory_entries = 0;
 
@@ -45,6 +50,13 @@ void phonebook_reload_signal_handler(int sig) {
     }
 }
 
+// Signal handler for re-reading the log levels; the file is read by the main loop
+void log_levels_reload_signal_handler(int sig) {
+    if (sig == SIGHUP) {
+        log_levels_reload_requested = 1;
+    }
+}
+
 // sockaddr_to_ip_str prototype is in common.h, definition remains here
 const char* sockaddr_to_ip_str(const struct sockaddr_in* addr) {
     static char ip_str[INET_ADDRSTRLEN];
@@ -59,16 +71,38 @@ int main(int argc, char *argv[]) {
     char buffer[MAX_SIP_MSG_LEN]; // Max SIP message length
     socklen_t len; // socklen_t defined in common.h through sys/socket.h
     ssize_t n;
-    fd_set readfds;
+    fd_set readfds, writefds;
+    int maxfd;
     struct timeval tv;
     int reuse_addr = 1;
     int retval;
 
+    // Client mode for scripts: AREDN-Phonebook ctl <command> [args]
+    if (argc >= 3 && strcmp(argv[1], "ctl") == 0) {
+        char command[CONTROL_REQUEST_MAX] = "";
+        for (int i = 2; i < argc; i++) {
+            if (i > 2) strncat(command, " ", sizeof(command) - strlen(command) - 1);
+            strncat(command, argv[i], sizeof(command) - strlen(command) - 1);
+        }
+        return control_socket_client(PB_CONTROL_SOCKET_PATH, command); // 2 tells scripts the daemon is unreachable
+    }
+    // Reads the statistics segment without contacting the daemon
+    if (argc == 2 && strcmp(argv[1], "stats") == 0) {
+        return stats_shm_dump_json(PB_STATS_SHM_PATH) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     log_init(APP_NAME); // APP_NAME is defined in common.h
     LOG_INFO("Starting main function for %s process (PID %d).", MODULE_NAME, getpid());
 
     // --- Load configuration from file ---
-    load_configuration("/etc/sipserver.conf"); // Call the loader function
+    load_configuration(PB_CONFIG_PATH); // Call the loader function
+    file_utils_write_budget_status(); // Publish zeroed write counters
+    if (stats_shm_init(PB_STATS_SHM_PATH) != 0) {
+        LOG_WARN("Continuing without the statistics segment.");
+    }
+    if (g_sip_trace || g_sip_trace_sample) {
+        sip_trace_configure(true, g_sip_trace_sample);
+    }
 
     // --- Passive Safety: Self-correct configuration ---
     validate_and_correct_config(); // Fix common config errors automatically
@@ -76,6 +110,7 @@ int main(int argc, char *argv[]) {
     // --- Register signal handler for webhook-triggered phonebook reload ---
     signal(SIGUSR1, phonebook_reload_signal_handler);
     LOG_INFO("Registered SIGUSR1 handler for webhook-triggered phonebook reload");
+    signal(SIGHUP, log_levels_reload_signal_handler);
 
     LOG_INFO("Attempting to set process priority...");
     if (setpriority(PRIO_PROCESS, 0, SIP_HANDLER_NICE_VALUE) == -1) { // SIP_HANDLER_NICE_VALUE from common.h
@@ -137,13 +172,11 @@ int main(int argc, char *argv[]) {
     }
     LOG_DEBUG("Public XML directory '%s' ensured.", PB_XML_PUBLIC_PATH);
 
-    if (access(PB_XML_PUBLIC_PATH, F_OK) == 0) {
-        LOG_INFO("Deleting existing production XML file: %s", PB_XML_PUBLIC_PATH);
-        if (remove(PB_XML_PUBLIC_PATH) != 0) {
-            LOG_WARN("Failed to delete production XML file. Error: %s", strerror(errno));
-        }
+    // The XML from the previous run keeps being served; the fetcher replaces it
+    // atomically once it knows the phonebook changed.
+    if (access(PB_XML_PUBLIC_PATH, R_OK) == 0) {
+        LOG_INFO("Keeping existing public XML file %s until the fetcher has validated it.", PB_XML_PUBLIC_PATH);
     }
-    LOG_DEBUG("Existing public XML file checked/deleted.");
 
     LOG_INFO("Creating phonebook fetcher thread...");
     if (pthread_create(&fetcher_tid, NULL, phonebook_fetcher_thread, NULL) != 0) {
@@ -199,20 +232,41 @@ int main(int argc, char *argv[]) {
     LOG_INFO("Successfully bound to UDP port %d.", SIP_PORT);
 
     LOG_INFO("AREDN Phonebook SIP Server listening on UDP port %d", SIP_PORT);
+
+    // Shares the select() below. Directory renderings are prepared by the fetcher and
+    // status updater threads; only the first request for a format after startup
+    // renders and compresses it here, stalling SIP processing for that long.
+    if (g_http_server_port > 0 && http_server_init(g_http_server_port) != 0) {
+        LOG_WARN("Continuing without the embedded HTTP server.");
+    }
+    if (control_socket_init(PB_CONTROL_SOCKET_PATH) != 0) {
+        LOG_WARN("Continuing without the control socket; reloads fall back to SIGUSR1.");
+    }
     LOG_INFO("Entering main SIP message processing loop.");
 
     while (1) { // Changed from while(keep_running) to while(1)
         len = sizeof(cliaddr);
         FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
         FD_SET(sockfd, &readfds);
+        maxfd = sockfd;
+        http_server_fill_fds(&readfds, &writefds, &maxfd);
+        control_socket_fill_fds(&readfds, &writefds, &maxfd);
         tv.tv_sec = 1; tv.tv_usec = 0;
-        retval = select(sockfd + 1, &readfds, NULL, NULL, &tv);
+        retval = select(maxfd + 1, &readfds, &writefds, NULL, &tv);
 
         if (retval < 0) {
-            // if (errno == EINTR) continue; // REMOVED
+            if (errno == EINTR) continue; // SIGUSR1/SIGHUP; their flags are handled on the next pass
             LOG_ERROR("select() error.");
             break; // Exit on select error
-        } else if (retval == 0) {
+        }
+        http_server_process(&readfds, &writefds); // Also expires idle connections on timeouts
+        control_socket_process(&readfds, &writefds); // Also answers reloads whose fetch cycle finished
+        if (log_levels_reload_requested) {
+            log_levels_reload_requested = 0;
+            reload_log_levels(PB_CONFIG_PATH);
+        }
+        if (retval == 0 || !FD_ISSET(sockfd, &readfds)) {
             continue;
         }
 
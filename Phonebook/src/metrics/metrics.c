@@ -0,0 +1,291 @@
+#define MODULE_NAME "METRICS"
+
+#include "metrics.h"
+#include "../common.h"
+#include "../stats_shm/stats_shm.h"
+#include "../fetch_scheduler/fetch_scheduler.h"
+#include "../sip_trace/sip_trace.h"
+#include <stdarg.h>
+#include <stddef.h>
+
+#define SIP_PROCESSING_HISTOGRAM { .scale = 1000000, .bounds = METRICS_SIP_US_BUCKETS }
+#define CALL_SETUP_HISTOGRAM { .scale = 1000, .bounds = { 100, 250, 500, 1000, 2000, 4000, 8000, 15000, 30000, 60000 } }
+
+Metrics g_metrics = {
+    .sip_processing = {
+        SIP_PROCESSING_HISTOGRAM, SIP_PROCESSING_HISTOGRAM, SIP_PROCESSING_HISTOGRAM, SIP_PROCESSING_HISTOGRAM,
+        SIP_PROCESSING_HISTOGRAM, SIP_PROCESSING_HISTOGRAM, SIP_PROCESSING_HISTOGRAM, SIP_PROCESSING_HISTOGRAM,
+    },
+    .call_setup_ringing = CALL_SETUP_HISTOGRAM,
+    .call_setup_answered = CALL_SETUP_HISTOGRAM,
+    .fetch_duration = { .scale = 1000, .bounds = { 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000, 120000 } },
+    .updater_cycle = { .scale = 1000, .bounds = { 100, 500, 1000, 2500, 5000, 10000, 30000, 60000, 120000, 300000 } },
+};
+
+static const char *sip_kind_names[METRICS_SIP_KIND_COUNT] = {
+    "register", "invite", "ack", "bye", "cancel", "options", "other", "response"
+};
+
+void metrics_observe(MetricsHistogram *h, uint32_t value) {
+    int i = 0;
+    while (i < METRICS_MAX_BUCKETS && h->bounds[i] && value > h->bounds[i]) i++;
+    if (i < METRICS_MAX_BUCKETS && !h->bounds[i]) i = METRICS_MAX_BUCKETS; // Past the last bound: +Inf
+    __atomic_fetch_add(&h->counts[i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+}
+
+void metrics_count_sip_response(uint32_t *by_code, int code) {
+    if (code >= METRICS_SIP_CODE_MIN && code < METRICS_SIP_CODE_MIN + METRICS_SIP_CODE_COUNT) {
+        __atomic_fetch_add(&by_code[code - METRICS_SIP_CODE_MIN], 1, __ATOMIC_RELAXED);
+    }
+}
+
+MetricsSipKind metrics_sip_kind(const char *msg) {
+    static const struct {
+        const char *prefix;
+        size_t len;
+        MetricsSipKind kind;
+    } kinds[] = {
+        { "SIP/2.0 ", 8, METRICS_SIP_RESPONSE }, { "REGISTER ", 9, METRICS_SIP_REGISTER },
+        { "INVITE ", 7, METRICS_SIP_INVITE },    { "ACK ", 4, METRICS_SIP_ACK },
+        { "BYE ", 4, METRICS_SIP_BYE },          { "CANCEL ", 7, METRICS_SIP_CANCEL },
+        { "OPTIONS ", 8, METRICS_SIP_OPTIONS },
+    };
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        if (strncmp(msg, kinds[i].prefix, kinds[i].len) == 0) return kinds[i].kind;
+    }
+    return METRICS_SIP_OTHER;
+}
+
+const char *metrics_sip_kind_name(MetricsSipKind kind) {
+    return kind >= 0 && kind < METRICS_SIP_KIND_COUNT ? sip_kind_names[kind] : "unknown";
+}
+
+uint64_t metrics_monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+uint64_t metrics_monotonic_ms(void) {
+    return metrics_monotonic_us() / 1000u;
+}
+
+// --- Exposition ---
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+    bool openmetrics;
+} Text;
+
+static void text_printf(Text *t, const char *format, ...) {
+    if (t->failed) {
+        return;
+    }
+    while (1) {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(t->data ? t->data + t->len : NULL, t->data ? t->cap - t->len : 0, format, args);
+        va_end(args);
+        if (n < 0) {
+            t->failed = true;
+            return;
+        }
+        if (t->data && t->len + (size_t)n < t->cap) {
+            t->len += (size_t)n;
+            return;
+        }
+        size_t cap = t->cap ? t->cap * 2 : 8192;
+        while (cap <= t->len + (size_t)n) cap *= 2;
+        char *data = realloc(t->data, cap);
+        if (!data) {
+            t->failed = true;
+            return;
+        }
+        t->data = data;
+        t->cap = cap;
+    }
+}
+
+static uint32_t load(const uint32_t *v) {
+    return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+// OpenMetrics names a counter family without its _total suffix, Prometheus text 0.0.4 with it.
+static void family(Text *t, const char *name, const char *type, const char *help) {
+    const char *suffix = (!t->openmetrics && strcmp(type, "counter") == 0) ? "_total" : "";
+    text_printf(t, "# TYPE %s%s %s\n# HELP %s%s %s\n", name, suffix, type, name, suffix, help);
+}
+
+// 'labels' is empty or a label list without braces, e.g. kind="invite".
+static void histogram(Text *t, const char *name, const char *labels, const MetricsHistogram *h) {
+    const char *sep = labels[0] ? "," : "";
+    uint32_t cumulative = 0;
+    for (int i = 0; i < METRICS_MAX_BUCKETS && h->bounds[i]; i++) {
+        cumulative += load(&h->counts[i]);
+        text_printf(t, "%s_bucket{%s%sle=\"%g\"} %u\n", name, labels, sep, (double)h->bounds[i] / h->scale,
+                    cumulative);
+    }
+    cumulative += load(&h->counts[METRICS_MAX_BUCKETS]);
+    text_printf(t, "%s_bucket{%s%sle=\"+Inf\"} %u\n", name, labels, sep, cumulative);
+    const char *open = labels[0] ? "{" : "", *close = labels[0] ? "}" : "";
+    text_printf(t, "%s_count%s%s%s %u\n", name, open, labels, close, cumulative);
+    text_printf(t, "%s_sum%s%s%s %.6f\n", name, open, labels, close, (double)load(&h->sum) / h->scale);
+}
+
+static void label_value(const char *in, char *out, size_t out_len) {
+    size_t o = 0;
+    for (; *in && o + 2 < out_len; in++) {
+        if (*in == '"' || *in == '\\') out[o++] = '\\';
+        if (*in == '\n') {
+            out[o++] = '\\';
+            out[o++] = 'n';
+            continue;
+        }
+        out[o++] = *in;
+    }
+    out[o] = '\0';
+}
+
+static void render_sip(Text *t) {
+    static const struct {
+        const char *method;
+        size_t offset;
+    } requests[] = {
+        { "REGISTER", offsetof(PhonebookStats, sip_registers) }, { "INVITE", offsetof(PhonebookStats, sip_invites) },
+        { "ACK", offsetof(PhonebookStats, sip_acks) },           { "BYE", offsetof(PhonebookStats, sip_byes) },
+        { "CANCEL", offsetof(PhonebookStats, sip_cancels) },     { "OPTIONS", offsetof(PhonebookStats, sip_options) },
+        { "other", offsetof(PhonebookStats, sip_unhandled) },
+    };
+    family(t, "phonebook_sip_requests", "counter", "SIP requests received, by method.");
+    for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); i++) {
+        text_printf(t, "phonebook_sip_requests_total{method=\"%s\"} %u\n", requests[i].method,
+                    load((const uint32_t *)((const char *)g_stats + requests[i].offset)));
+    }
+
+    family(t, "phonebook_sip_responses", "counter",
+           "SIP responses by status code; sent = generated here, relayed = proxied from a callee.");
+    for (int i = 0; i < METRICS_SIP_CODE_COUNT; i++) {
+        uint32_t sent = load(&g_metrics.sip_responses_sent[i]);
+        uint32_t relayed = load(&g_metrics.sip_responses_relayed[i]);
+        if (sent) {
+            text_printf(t, "phonebook_sip_responses_total{code=\"%d\",direction=\"sent\"} %u\n",
+                        i + METRICS_SIP_CODE_MIN, sent);
+        }
+        if (relayed) {
+            text_printf(t, "phonebook_sip_responses_total{code=\"%d\",direction=\"relayed\"} %u\n",
+                        i + METRICS_SIP_CODE_MIN, relayed);
+        }
+    }
+
+    family(t, "phonebook_sip_processing_seconds", "histogram", "Time to handle one SIP message, by kind.");
+    for (int k = 0; k < METRICS_SIP_KIND_COUNT; k++) {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "kind=\"%s\"", sip_kind_names[k]);
+        histogram(t, "phonebook_sip_processing_seconds", labels, &g_metrics.sip_processing[k]);
+    }
+
+    // Only stages a kind has gone through while tracing was on (SIP_TRACE)
+    family(t, "phonebook_sip_stage_seconds", "histogram",
+           "Time from the previous processing stage (or receive) to this one, by kind.");
+    for (int k = 0; k < METRICS_SIP_KIND_COUNT; k++) {
+        for (int s = 0; s < SIP_STAGE_COUNT; s++) {
+            const MetricsHistogram *h = sip_trace_histogram((MetricsSipKind)k, (SipStage)s);
+            uint32_t observed = 0;
+            for (int i = 0; i <= METRICS_MAX_BUCKETS; i++) observed += load(&h->counts[i]);
+            if (!observed) continue;
+            char labels[48];
+            snprintf(labels, sizeof(labels), "kind=\"%s\",stage=\"%s\"", sip_kind_names[k],
+                     sip_stage_name((SipStage)s));
+            histogram(t, "phonebook_sip_stage_seconds", labels, h);
+        }
+    }
+}
+
+static void render_calls_and_users(Text *t) {
+    family(t, "phonebook_calls", "counter", "INVITEs by outcome.");
+    text_printf(t, "phonebook_calls_total{outcome=\"proxied\"} %u\n", load(&g_stats->calls_proxied));
+    text_printf(t, "phonebook_calls_total{outcome=\"established\"} %u\n", load(&g_stats->calls_established));
+    text_printf(t, "phonebook_calls_total{outcome=\"rejected\"} %u\n", load(&g_stats->calls_rejected));
+    family(t, "phonebook_active_calls", "gauge", "Call sessions (dialogs) in use.");
+    text_printf(t, "phonebook_active_calls %d\n", (int)load((const uint32_t *)&g_stats->active_calls));
+    family(t, "phonebook_call_setup_seconds", "histogram", "Time from INVITE to ringing and to answer.");
+    histogram(t, "phonebook_call_setup_seconds", "stage=\"ringing\"", &g_metrics.call_setup_ringing);
+    histogram(t, "phonebook_call_setup_seconds", "stage=\"answered\"", &g_metrics.call_setup_answered);
+
+    family(t, "phonebook_registered_users", "gauge", "Active dynamic registrations.");
+    text_printf(t, "phonebook_registered_users %d\n", (int)load((const uint32_t *)&g_stats->registered_users));
+    family(t, "phonebook_directory_entries", "gauge", "Phonebook entries in the SIP user table.");
+    text_printf(t, "phonebook_directory_entries %d\n", (int)load((const uint32_t *)&g_stats->directory_entries));
+}
+
+static void render_fetch_and_updater(Text *t) {
+    family(t, "phonebook_fetch_cycles", "counter", "Fetch cycles by result.");
+    text_printf(t, "phonebook_fetch_cycles_total{result=\"changed\"} %u\n", load(&g_stats->fetch_changed));
+    text_printf(t, "phonebook_fetch_cycles_total{result=\"unchanged\"} %u\n", load(&g_stats->fetch_unchanged));
+    text_printf(t, "phonebook_fetch_cycles_total{result=\"failed\"} %u\n", load(&g_stats->fetch_failed));
+    family(t, "phonebook_fetch_duration_seconds", "histogram", "Duration of a fetch cycle.");
+    histogram(t, "phonebook_fetch_duration_seconds", "", &g_metrics.fetch_duration);
+    family(t, "phonebook_fetch_received_bytes", "counter", "Phonebook bytes received from servers.");
+    text_printf(t, "phonebook_fetch_received_bytes_total %u\n", load(&g_metrics.fetch_bytes));
+
+    ServerHealth health[MAX_PB_SERVERS];
+    int servers = fetch_scheduler_health(health, MAX_PB_SERVERS);
+    char hosts[MAX_PB_SERVERS][2 * MAX_SERVER_HOST_LEN];
+    for (int i = 0; i < servers; i++) {
+        label_value(g_phonebook_servers_list[i].host, hosts[i], sizeof(hosts[i]));
+    }
+    family(t, "phonebook_fetch_server_attempts", "counter", "Fetch attempts per phonebook server, by result.");
+    for (int i = 0; i < servers; i++) {
+        text_printf(t, "phonebook_fetch_server_attempts_total{server=\"%s\",result=\"success\"} %u\n", hosts[i],
+                    health[i].successes);
+        text_printf(t, "phonebook_fetch_server_attempts_total{server=\"%s\",result=\"failure\"} %u\n", hosts[i],
+                    health[i].failures);
+    }
+    family(t, "phonebook_fetch_server_latency_seconds", "gauge", "Smoothed time to response headers per server.");
+    for (int i = 0; i < servers; i++) {
+        if (health[i].latency_ms >= 0) {
+            text_printf(t, "phonebook_fetch_server_latency_seconds{server=\"%s\"} %.3f\n", hosts[i],
+                        health[i].latency_ms / 1000.0);
+        }
+    }
+
+    family(t, "phonebook_updater_cycle_seconds", "histogram", "Duration of a liveness update cycle.");
+    histogram(t, "phonebook_updater_cycle_seconds", "", &g_metrics.updater_cycle);
+    family(t, "phonebook_directory_liveness_entries", "gauge", "Entries found reachable or not in the last update cycle.");
+    text_printf(t, "phonebook_directory_liveness_entries{state=\"active\"} %d\n",
+                (int)load((const uint32_t *)&g_metrics.updater_active));
+    text_printf(t, "phonebook_directory_liveness_entries{state=\"inactive\"} %d\n",
+                (int)load((const uint32_t *)&g_metrics.updater_inactive));
+}
+
+char *metrics_render(bool openmetrics, size_t *len) {
+    Text t = { .openmetrics = openmetrics };
+    family(&t, "phonebook_info", "gauge", "Daemon version.");
+    text_printf(&t, "phonebook_info{version=\"%s\"} 1\n", AREDN_PHONEBOOK_VERSION);
+    family(&t, "phonebook_start_time_seconds", "gauge", "Unix time the daemon started.");
+    text_printf(&t, "phonebook_start_time_seconds %u\n", g_stats->started_at);
+
+    render_sip(&t);
+    render_calls_and_users(&t);
+    render_fetch_and_updater(&t);
+
+    family(&t, "phonebook_http_requests", "counter", "Requests served by the embedded HTTP server.");
+    text_printf(&t, "phonebook_http_requests_total %u\n", load(&g_stats->http_requests));
+    family(&t, "phonebook_control_requests", "counter", "Commands served on the control socket.");
+    text_printf(&t, "phonebook_control_requests_total %u\n", load(&g_stats->control_requests));
+    family(&t, "phonebook_log_dropped_messages", "counter", "Log messages dropped because the log ring was full.");
+    text_printf(&t, "phonebook_log_dropped_messages_total %u\n", log_dropped_count());
+    if (openmetrics) {
+        text_printf(&t, "# EOF\n");
+    }
+    if (t.failed) {
+        free(t.data);
+        return NULL;
+    }
+    *len = t.len;
+    return t.data;
+}
@@ -0,0 +1,82 @@
+// metrics.h
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "../common.h"
+#include <stdint.h>
+
+// Metrics registry behind /metrics of the embedded HTTP server (OpenMetrics
+// text, or Prometheus text 0.0.4 for scrapers that do not ask for it).
+// Histograms and labeled counters live here; the plain counters and gauges
+// already kept in the statistics segment (stats_shm) are exported from there,
+// so no event is counted twice. All storage is static: an observation is a
+// bucket search over a few constants plus two relaxed atomic adds, with no
+// locks or allocation. Histogram sums are 32 bits in the histogram's own
+// unit (microseconds for SIP processing, milliseconds otherwise) so they stay
+// lock-free on MIPS32.
+
+#define METRICS_MAX_BUCKETS 12
+#define METRICS_SIP_CODE_MIN 100
+#define METRICS_SIP_CODE_COUNT 600 // Status codes 100..699
+#define METRICS_SIP_US_BUCKETS { 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000 }
+
+typedef struct {
+    uint32_t scale;                            // Units per second of observed values
+    uint32_t bounds[METRICS_MAX_BUCKETS];      // Upper bucket bounds, ascending; unused ones are 0
+    uint32_t counts[METRICS_MAX_BUCKETS + 1];  // Per bucket (not cumulative); the last one is +Inf
+    uint32_t sum;
+} MetricsHistogram;
+
+// What a SIP message was, for the processing histogram
+typedef enum {
+    METRICS_SIP_REGISTER,
+    METRICS_SIP_INVITE,
+    METRICS_SIP_ACK,
+    METRICS_SIP_BYE,
+    METRICS_SIP_CANCEL,
+    METRICS_SIP_OPTIONS,
+    METRICS_SIP_OTHER,
+    METRICS_SIP_RESPONSE,
+    METRICS_SIP_KIND_COUNT
+} MetricsSipKind;
+
+typedef struct {
+    MetricsHistogram sip_processing[METRICS_SIP_KIND_COUNT]; // us, receive to handled
+    uint32_t sip_responses_sent[METRICS_SIP_CODE_COUNT];     // Generated here, by status code
+    uint32_t sip_responses_relayed[METRICS_SIP_CODE_COUNT];  // From a callee, proxied to the caller
+    MetricsHistogram call_setup_ringing;                     // ms, INVITE to first 180/183
+    MetricsHistogram call_setup_answered;                    // ms, INVITE to 200 OK
+    MetricsHistogram fetch_duration;                         // ms per fetch cycle
+    uint32_t fetch_bytes;                                    // Phonebook bytes received
+    MetricsHistogram updater_cycle;                          // ms per liveness cycle
+    int32_t updater_active;                                  // Entries found reachable in the last cycle
+    int32_t updater_inactive;
+} Metrics;
+
+extern Metrics g_metrics;
+
+#define METRICS_ADD(field, n) __atomic_fetch_add(&g_metrics.field, (n), __ATOMIC_RELAXED)
+#define METRICS_SET(field, v) __atomic_store_n(&g_metrics.field, (v), __ATOMIC_RELAXED)
+
+void metrics_observe(MetricsHistogram *h, uint32_t value);
+
+// Counts 'code' (e.g. 200) in one of the sip_responses_* arrays. Codes outside 100..699 are ignored.
+void metrics_count_sip_response(uint32_t *by_code, int code);
+
+// Kind of the SIP message starting at 'msg' ("SIP/2.0 ..." for responses).
+MetricsSipKind metrics_sip_kind(const char *msg);
+const char *metrics_sip_kind_name(MetricsSipKind kind);
+
+// CLOCK_MONOTONIC in microseconds / milliseconds
+uint64_t metrics_monotonic_us(void);
+uint64_t metrics_monotonic_ms(void);
+
+/**
+ * @brief Renders every metric in text exposition format.
+ *
+ * @param openmetrics true for application/openmetrics-text, false for Prometheus text 0.0.4.
+ * @return malloc'd text (caller frees), or NULL if out of memory.
+ */
+char *metrics_render(bool openmetrics, size_t *len);
+
+#endif // METRICS_H
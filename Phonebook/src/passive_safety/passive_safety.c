@@ -1,4 +1,5 @@
 #define MODULE_NAME "PASSIVE_SAFETY"
+#define _GNU_SOURCE // For memmem
 
 #include "passive_safety.h"
 #include "../common.h"
@@ -118,28 +119,31 @@ void enable_graceful_degradation_if_needed(void) {
 
 // 3.5. ORPHANED FILE CLEANUP - Remove any leftover backup/temp files
 void cleanup_orphaned_phonebook_files(void) {
-    char backup_path[512];
-    char temp_path[512];
-
-    // Check for orphaned backup and temp files
-    snprintf(backup_path, sizeof(backup_path), "%s.backup", PB_XML_PUBLIC_PATH);
-    snprintf(temp_path, sizeof(temp_path), "%s.temp", PB_XML_PUBLIC_PATH);
-
-    // Remove orphaned backup file
-    if (access(backup_path, F_OK) == 0) {
-        if (remove(backup_path) == 0) {
-            LOG_INFO("Cleaned up orphaned backup file: %s", backup_path);
-        } else {
-            LOG_WARN("Failed to remove orphaned backup file: %s", backup_path);
+    // .backup/.temp come from the old copy-based publish, .tmp from an
+    // atomic write interrupted before its rename
+    static const char *published[] = { PB_XML_PUBLIC_PATH, PB_CSV_PATH, PB_LAST_GOOD_CSV_HASH_PATH };
+    static const char *suffixes[] = { ".backup", ".temp", FILE_UTILS_TEMP_SUFFIX };
+    // Binary phonebook snapshot written by earlier versions; booting reads the CSV
+    static const char *retired[] = { "/www/arednstack/phonebook.snapshot",
+                                     "/www/arednstack/phonebook.snapshot" FILE_UTILS_TEMP_SUFFIX };
+    char orphan_path[512];
+
+    for (size_t i = 0; i < sizeof(published) / sizeof(published[0]); i++) {
+        for (size_t j = 0; j < sizeof(suffixes) / sizeof(suffixes[0]); j++) {
+            snprintf(orphan_path, sizeof(orphan_path), "%s%s", published[i], suffixes[j]);
+            if (access(orphan_path, F_OK) != 0) {
+                continue;
+            }
+            if (remove(orphan_path) == 0) {
+                LOG_INFO("Cleaned up orphaned file: %s", orphan_path);
+            } else {
+                LOG_WARN("Failed to remove orphaned file: %s", orphan_path);
+            }
         }
     }
-
-    // Remove orphaned temp file
-    if (access(temp_path, F_OK) == 0) {
-        if (remove(temp_path) == 0) {
-            LOG_INFO("Cleaned up orphaned temp file: %s", temp_path);
-        } else {
-            LOG_WARN("Failed to remove orphaned temp file: %s", temp_path);
+    for (size_t i = 0; i < sizeof(retired) / sizeof(retired[0]); i++) {
+        if (access(retired[i], F_OK) == 0 && remove(retired[i]) == 0) {
+            LOG_INFO("Removed retired file: %s", retired[i]);
         }
     }
 }
@@ -149,86 +153,40 @@ void cleanup_orphaned_phonebook_files(void) {
 // ============================================================================
 
 // 4. SMART FILE HANDLING - Never corrupt phonebook data
-void safe_phonebook_file_operation(const char *source_path, const char *dest_path) {
-    char backup_path[512];
-    char temp_path[512];
-    bool rollback_needed = false;
-
-    // Create backup and temporary file paths
-    snprintf(backup_path, sizeof(backup_path), "%s.backup", dest_path);
-    snprintf(temp_path, sizeof(temp_path), "%s.temp", dest_path);
-
-    // Step 1: Create backup of current file (if it exists)
-    if (access(dest_path, F_OK) == 0) {
-        if (file_utils_copy_file(dest_path, backup_path) != 0) {
-            LOG_ERROR("Failed to create backup before phonebook update");
-            return; // Abort if we can't create backup
-        }
-    }
-
-    // Step 2: Copy new data to temporary file
-    if (file_utils_copy_file(source_path, temp_path) != 0) {
-        LOG_ERROR("Failed to create temporary file for phonebook update");
-        // Clean up backup file if we created one
-        if (access(backup_path, F_OK) == 0) {
-            remove(backup_path);
-        }
-        return; // Abort if copy fails
-    }
-
-    // Step 3: Verify temporary file integrity (basic check)
-    FILE *verify_fp = fopen(temp_path, "r");
-    if (!verify_fp) {
-        LOG_ERROR("Cannot verify temporary phonebook file integrity");
-        remove(temp_path); // Clean up failed temp file
-        // Clean up backup file if we created one
-        if (access(backup_path, F_OK) == 0) {
-            remove(backup_path);
-        }
-        return;
+int safe_phonebook_buffer_operation(const char *data, size_t len, const char *dest_path, bool deferrable) {
+    // Validate in memory before anything touches flash
+    if (len < 50) { // Phonebook should be at least 50 bytes
+        LOG_ERROR("Phonebook data appears corrupted (size: %zu bytes), aborting update", len);
+        return 1;
     }
-
-    // Basic verification: file should have some content
-    fseek(verify_fp, 0, SEEK_END);
-    long file_size = ftell(verify_fp);
-    fclose(verify_fp);
-
-    if (file_size < 50) { // Phonebook should be at least 50 bytes
-        LOG_ERROR("Phonebook file appears corrupted (size: %ld bytes), aborting update", file_size);
-        remove(temp_path);
-        // Clean up backup file if we created one
-        if (access(backup_path, F_OK) == 0) {
-            remove(backup_path);
-        }
-        return;
+    if (!memmem(data, len, "<YealinkIPPhoneDirectory>", 25) ||
+        !memmem(data, len, "</YealinkIPPhoneDirectory>", 26)) {
+        LOG_ERROR("Phonebook data is missing its directory element (size: %zu bytes), aborting update", len);
+        return 1;
     }
 
-    // Step 4: Atomic rename (replace destination with verified temp file)
-    if (rename(temp_path, dest_path) != 0) {
-        LOG_ERROR("Failed to replace phonebook file, attempting rollback");
-        rollback_needed = true;
+    // Single write + rename: the old file stays in place until the new one is
+    // complete on flash, so no backup copy is needed for rollback
+    int ret = deferrable ? file_utils_atomic_write_deferrable(dest_path, data, len)
+                         : file_utils_atomic_write(dest_path, data, len);
+    if (ret == 1) {
+        LOG_ERROR("Failed to replace phonebook file, previous version kept");
+        return 1;
     }
+    LOG_DEBUG("Phonebook update completed successfully");
+    return ret;
+}
 
-    // Step 5: Rollback if needed
-    if (rollback_needed && access(backup_path, F_OK) == 0) {
-        if (rename(backup_path, dest_path) == 0) {
-            LOG_INFO("Successfully rolled back to previous phonebook version");
-        } else {
-            LOG_ERROR("Rollback failed - phonebook may be unavailable");
-            // Clean up backup file even if rollback failed
-            remove(backup_path);
-        }
-    } else if (!rollback_needed) {
-        // Success - clean up backup
-        remove(backup_path);
-        LOG_DEBUG("Phonebook update completed successfully");
-    } else {
-        // Backup doesn't exist but rollback was needed - clean up anyway
-        remove(backup_path);
+int safe_phonebook_file_operation(const char *source_path, const char *dest_path, bool deferrable) {
+    char *data;
+    size_t len;
+    if (file_utils_read_file(source_path, &data, &len) != 0) {
+        LOG_ERROR("Cannot read new phonebook file for update");
+        return 1;
     }
-
-    // Always clean up any remaining temporary files
-    remove(temp_path);
+    int ret = safe_phonebook_buffer_operation(data, len, dest_path, deferrable);
+    free(data);
+    return ret;
 }
 
 // 5. THREAD RECOVERY - Auto-restart hung threads
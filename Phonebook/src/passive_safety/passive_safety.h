@@ -13,7 +13,11 @@ void enable_graceful_degradation_if_needed(void);
 void cleanup_orphaned_phonebook_files(void);
 
 // Week 2: File protection and thread recovery
-void safe_phonebook_file_operation(const char *source_path, const char *dest_path);
+// Validates the new phonebook in memory, then replaces dest_path atomically.
+// Returns 0 on success, 1 on failure, FILE_UTILS_WRITE_DEFERRED if a deferrable
+// update was held on tmpfs by the flash write budget.
+int safe_phonebook_buffer_operation(const char *data, size_t len, const char *dest_path, bool deferrable);
+int safe_phonebook_file_operation(const char *source_path, const char *dest_path, bool deferrable);
 void passive_thread_recovery_check(void);
 
 // Background safety thread
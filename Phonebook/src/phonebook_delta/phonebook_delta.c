@@ -0,0 +1,194 @@
+#define MODULE_NAME "DELTA"
+
+#include "phonebook_delta.h"
+#include "../common.h"
+#include "../file_utils/file_utils.h"
+#include <dirent.h>
+#include <sys/stat.h>
+#include <utime.h>
+
+typedef struct {
+    const char *start;
+    size_t len;
+} DeltaLine;
+
+// Splits 'data' into lines without their '\n'. A trailing '\n' does not start another line.
+static DeltaLine *split_lines(const char *data, size_t len, size_t *count) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] == '\n') n++;
+    }
+    if (len > 0 && data[len - 1] != '\n') n++;
+
+    DeltaLine *lines = malloc((n ? n : 1) * sizeof(DeltaLine));
+    if (!lines) {
+        return NULL;
+    }
+    size_t line = 0;
+    const char *p = data, *end = data + len;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t l = nl ? (size_t)(nl - p) : (size_t)(end - p);
+        lines[line].start = p;
+        lines[line].len = l;
+        line++;
+        p += l + (nl ? 1 : 0);
+    }
+    *count = n;
+    return lines;
+}
+
+typedef struct {
+    PhonebookModel *model;
+    size_t produced;
+    size_t lines;
+} DeltaOutput;
+
+static int emit_line(DeltaOutput *out, const char *text, size_t len) {
+    if (out->lines++ > 0) {
+        if (phonebook_model_feed(out->model, "\n", 1) != 0) return 1;
+        out->produced++;
+    }
+    if (len > 0 && phonebook_model_feed(out->model, text, len) != 0) return 1;
+    out->produced += len;
+    return 0;
+}
+
+int phonebook_delta_apply(const char *base, size_t base_len, const char *base_hash,
+                          const char *patch, size_t patch_len, PhonebookModel *model) {
+    char patch_base[HASH_LENGTH + 1], patch_target[HASH_LENGTH + 1];
+    unsigned long target_len = 0;
+    const char *header_end = memchr(patch, '\n', patch_len);
+    char header[128];
+    size_t header_len = header_end ? (size_t)(header_end - patch) : 0;
+    if (!header_end || header_len >= sizeof(header)) {
+        LOG_WARN("Delta patch has no valid header.");
+        return 1;
+    }
+    memcpy(header, patch, header_len);
+    header[header_len] = '\0';
+    if (sscanf(header, "PBDELTA1 %16s %16s %lu", patch_base, patch_target, &target_len) != 3) {
+        LOG_WARN("Unsupported delta patch header '%s'.", header);
+        return 1;
+    }
+    if (strcmp(patch_base, base_hash) != 0) {
+        LOG_WARN("Delta patch is against %s, local copy is %s.", patch_base, base_hash);
+        return 1;
+    }
+    if (target_len > MAX_PHONEBOOK_CSV_BYTES) {
+        LOG_WARN("Delta patch target of %lu bytes exceeds %d bytes.", target_len, MAX_PHONEBOOK_CSV_BYTES);
+        return 1;
+    }
+
+    size_t base_count = 0;
+    DeltaLine *base_lines = split_lines(base, base_len, &base_count);
+    if (!base_lines) {
+        LOG_ERROR("Out of memory indexing %zu byte delta base.", base_len);
+        return 1;
+    }
+
+    DeltaOutput out = { model, 0, 0 };
+    int ret = 0;
+    const char *p = header_end + 1, *end = patch + patch_len;
+    while (ret == 0 && p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t l = nl ? (size_t)(nl - p) : (size_t)(end - p);
+        if (l > 0 && p[0] == '+') {
+            ret = emit_line(&out, p + 1, l - 1);
+        } else if (l > 0 && p[0] == '=') {
+            unsigned long start = 0, count = 0;
+            char op[48];
+            size_t op_len = l < sizeof(op) - 1 ? l : sizeof(op) - 1;
+            memcpy(op, p, op_len);
+            op[op_len] = '\0';
+            if (sscanf(op, "=%lu,%lu", &start, &count) != 2 || start == 0 || count > base_count ||
+                start - 1 > base_count - count) {
+                LOG_WARN("Invalid delta copy instruction '%s' (base has %zu lines).", op, base_count);
+                ret = 1;
+                break;
+            }
+            for (unsigned long i = start - 1; ret == 0 && i < start - 1 + count; i++) {
+                ret = emit_line(&out, base_lines[i].start, base_lines[i].len);
+            }
+        } else if (l > 0) {
+            LOG_WARN("Unknown delta instruction '%.*s'.", (int)(l < 32 ? l : 32), p);
+            ret = 1;
+        }
+        if (out.produced > target_len) {
+            ret = 1;
+        }
+        p += l + (nl ? 1 : 0);
+    }
+    free(base_lines);
+
+    if (ret == 0 && out.produced + 1 == target_len) {
+        ret = phonebook_model_feed(model, "\n", 1);
+        out.produced++;
+    }
+    if (ret != 0 || out.produced != target_len) {
+        LOG_WARN("Delta patch produced %zu bytes, expected %lu.", out.produced, target_len);
+        return 1;
+    }
+    if (phonebook_model_finish(model) != 0) {
+        return 1;
+    }
+    if (strcmp(model->content_hash, patch_target) != 0) {
+        LOG_WARN("Patched phonebook hash %s does not match announced %s.", model->content_hash, patch_target);
+        return 1;
+    }
+    LOG_INFO("Applied %zu byte delta patch: %s -> %s (%zu bytes).", patch_len, base_hash, patch_target, out.produced);
+    return 0;
+}
+
+void phonebook_delta_store_version(const char *content_hash, const char *csv_path) {
+    if (!content_hash[0] || file_utils_ensure_directory_exists(PB_VERSIONS_DIR) != 0) {
+        return;
+    }
+    char path[MAX_CONFIG_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s.csv", PB_VERSIONS_DIR, content_hash);
+    if (access(path, F_OK) != 0 && file_utils_copy_file(csv_path, path) != 0) {
+        LOG_WARN("Failed to keep phonebook version %s for delta serving.", content_hash);
+        return;
+    }
+    utime(path, NULL); // Most recently seen version is kept longest
+
+    // Drop the oldest versions beyond PB_VERSIONS_KEEP
+    while (1) {
+        DIR *dir = opendir(PB_VERSIONS_DIR);
+        if (!dir) {
+            return;
+        }
+        int versions = 0;
+        char oldest[MAX_CONFIG_PATH_LEN] = "";
+        time_t oldest_mtime = 0;
+        struct dirent *de;
+        while ((de = readdir(dir)) != NULL) {
+            size_t n = strlen(de->d_name);
+            if (n < 5 || strcmp(de->d_name + n - 4, ".csv") != 0) {
+                continue;
+            }
+            char candidate[MAX_CONFIG_PATH_LEN];
+            struct stat st;
+            snprintf(candidate, sizeof(candidate), "%s/%s", PB_VERSIONS_DIR, de->d_name);
+            if (stat(candidate, &st) != 0) {
+                continue;
+            }
+            versions++;
+            if (strcmp(candidate, path) == 0) {
+                continue; // Never drop the version just stored
+            }
+            if (!oldest[0] || st.st_mtime < oldest_mtime) {
+                oldest_mtime = st.st_mtime;
+                snprintf(oldest, sizeof(oldest), "%s", candidate);
+            }
+        }
+        closedir(dir);
+        if (versions <= PB_VERSIONS_KEEP || !oldest[0]) {
+            return;
+        }
+        LOG_DEBUG("Dropping old phonebook version %s.", oldest);
+        if (remove(oldest) != 0) {
+            return;
+        }
+    }
+}
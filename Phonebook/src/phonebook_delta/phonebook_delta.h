@@ -0,0 +1,36 @@
+// phonebook_delta.h
+#ifndef PHONEBOOK_DELTA_H
+#define PHONEBOOK_DELTA_H
+
+#include "../common.h"
+#include "../phonebook_model/phonebook_model.h"
+
+// Row-level patch between two CSV versions, sent by a delta-capable server
+// (see files/www/cgi-bin/phonebookdelta) as "226 IM Used" with "IM: pbdelta".
+// Text format, one instruction per line:
+//
+//   PBDELTA1 <base hash> <target hash> <target length>
+//   =<start>,<count>   copy base lines start..start+count-1 (1-based)
+//   +<text>            literal line
+//
+// Lines are split on '\n' only, so a '\r' stays part of its line. Output lines
+// are joined with '\n'; a final '\n' is added if the target length calls for it.
+
+#define PB_DELTA_IM "pbdelta"
+
+/**
+ * @brief Rebuilds the target CSV from 'base' and a patch, feeding it into 'model'.
+ *
+ * @param base Local CSV the patch was computed against.
+ * @param base_hash Content hash of 'base'; must match the patch header.
+ * @param model Initialized, empty model; finished on success.
+ * @return 0 if the result has the length and content hash announced by the patch, 1 otherwise.
+ */
+int phonebook_delta_apply(const char *base, size_t base_len, const char *base_hash,
+                          const char *patch, size_t patch_len, PhonebookModel *model);
+
+// Keeps a copy of the CSV at csv_path under PB_VERSIONS_DIR as a future delta
+// base and drops the oldest copies beyond PB_VERSIONS_KEEP.
+void phonebook_delta_store_version(const char *content_hash, const char *csv_path);
+
+#endif // PHONEBOOK_DELTA_H
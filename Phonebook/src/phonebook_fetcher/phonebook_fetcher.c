@@ -1,4 +1,5 @@
 #define MODULE_NAME "FETCHER" // Define MODULE_NAME at the top of the file
+#define _GNU_SOURCE // For memmem
 
 #include "phonebook_fetcher.h"
 #include "../common.h" // This includes necessary system headers and core types
@@ -6,6 +7,14 @@
 #include "../user_manager/user_manager.h"
 #include "../file_utils/file_utils.h"
 #include "../csv_processor/csv_processor.h"
+#include "../fetch_scheduler/fetch_scheduler.h"
+#include "../phonebook_model/phonebook_model.h"
+#include "../phonebook_delta/phonebook_delta.h"
+#include "../directory_render/directory_render.h"
+#include "../control_socket/control_socket.h"
+#include "../stats_shm/stats_shm.h"
+#include "../metrics/metrics.h"
+#include <sys/stat.h>
 #include "../passive_safety/passive_safety.h" // For heartbeat tracking
 
 // Note: Global extern declarations moved to common.h
@@ -18,10 +27,8 @@ int ensure_phonebook_directory_exists(const char *path) {
     return file_utils_ensure_directory_exists(path);
 }
 
-int publish_phonebook_xml(const char *source_filepath) {
-    pthread_mutex_lock(&phonebook_file_mutex);
-    int publish_success = 0;
-
+// Caller holds phonebook_file_mutex
+static int ensure_public_xml_directory(void) {
     char public_path_copy[MAX_CONFIG_PATH_LEN]; // MAX_CONFIG_PATH_LEN from common.h
     strncpy(public_path_copy, PB_XML_PUBLIC_PATH, sizeof(public_path_copy) - 1); // PB_XML_PUBLIC_PATH from common.h
     public_path_copy[sizeof(public_path_copy) - 1] = '\0';
@@ -29,62 +36,268 @@ int publish_phonebook_xml(const char *source_filepath) {
 
     if (file_utils_ensure_directory_exists(public_dir) != 0) {
         LOG_ERROR("Critical: Failed to ensure public directory '%s' for publish. Exiting publish.", public_dir);
+        return 1;
+    }
+    return 0;
+}
+
+int publish_directory_xml(unsigned long directory_version, bool liveness_only, size_t *tmpfs_bytes,
+                          size_t *flash_bytes) {
+    pthread_mutex_lock(&phonebook_file_mutex);
+    if (ensure_public_xml_directory() != 0) {
         pthread_mutex_unlock(&phonebook_file_mutex);
         return 1;
     }
+    // The XML lives on tmpfs and the public path links to it, so updates
+    // cost no flash writes
+    int ret = directory_render_to_file(DIRECTORY_FORMAT_YEALINK, PB_XML_VOLATILE_PATH, directory_version);
+    struct stat st;
+    size_t xml_bytes = (ret == 0 && stat(PB_XML_VOLATILE_PATH, &st) == 0) ? (size_t)st.st_size : 0;
+    if (tmpfs_bytes) {
+        *tmpfs_bytes += xml_bytes;
+    }
+    if (ret == 0 && file_utils_ensure_symlink(PB_XML_PUBLIC_PATH, PB_XML_VOLATILE_PATH) != 0) {
+        LOG_WARN("Cannot link %s to tmpfs; publishing a copy on flash instead.", PB_XML_PUBLIC_PATH);
+        int op = safe_phonebook_file_operation(PB_XML_VOLATILE_PATH, PB_XML_PUBLIC_PATH, liveness_only);
+        if (op == FILE_UTILS_WRITE_DEFERRED) {
+            LOG_INFO("Liveness-only XML update held on tmpfs by the flash write budget.");
+        } else if (op == 0 && flash_bytes) {
+            *flash_bytes += xml_bytes;
+        }
+        ret = op == 1 ? 1 : 0;
+    }
+    pthread_mutex_unlock(&phonebook_file_mutex);
+    return ret;
+}
 
-    // Passive Safety: Use safe file operation with automatic rollback
-    safe_phonebook_file_operation(source_filepath, PB_XML_PUBLIC_PATH);
+static bool initial_population_done = false;
+static PhonebookModel applied_model; // Phonebook currently in the SIP user table and XML
 
-    // Check if the operation succeeded
-    if (access(PB_XML_PUBLIC_PATH, F_OK) == 0) {
-        LOG_INFO("Phonebook XML safely published at %s.", PB_XML_PUBLIC_PATH);
-        publish_success = 1;
-    } else {
-        LOG_ERROR("Safe file operation failed for XML publish");
+// Makes 'model' the applied phonebook; its raw CSV is no longer needed.
+static void keep_as_applied(PhonebookModel *model) {
+    phonebook_model_free(&applied_model);
+    free(model->csv_data);
+    model->csv_data = NULL;
+    model->csv_len = model->csv_cap = 0;
+    applied_model = *model;
+    phonebook_model_init(model);
+}
+
+// The change set ignores row order, but the directory lists rows as the CSV does.
+static bool same_row_order(const PhonebookModel *a, const PhonebookModel *b) {
+    if (a->count != b->count) {
+        return false;
     }
+    for (int i = 0; i < a->count; i++) {
+        if (strcmp(a->entries[i].user_id, b->entries[i].user_id) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    if (publish_success) {
-        pthread_mutex_lock(&updater_trigger_mutex);
-        pthread_cond_signal(&updater_trigger_cond);
-        pthread_mutex_unlock(&updater_trigger_mutex);
-        LOG_INFO("Signaled Status Updater for new phonebook.");
-    } else {
-        LOG_INFO("Phonebook XML publishing failed.");
-        if (access(source_filepath, F_OK) == 0) { // access from common.h
-            if (remove(source_filepath) != 0) { // remove from common.h
-                LOG_WARN("Failed to delete temporary XML file '%s' after failed publish. Error: %s", source_filepath, strerror(errno));
-            } else {
-                LOG_DEBUG("Deleted temporary XML file '%s' after failed publish.", source_filepath);
-            }
+// Reload requests from the control socket. A request made while a cycle runs
+// leaves reload_pending set, so the following sleep ends at once.
+static pthread_mutex_t reload_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reload_cond = PTHREAD_COND_INITIALIZER;
+static bool reload_pending = false;
+static unsigned long cycles_started = 0;
+static FetchCycleReport last_report;
+
+unsigned long phonebook_fetcher_request_reload(void) {
+    pthread_mutex_lock(&reload_mutex);
+    reload_pending = true;
+    unsigned long cycle = cycles_started + 1;
+    pthread_cond_signal(&reload_cond);
+    pthread_mutex_unlock(&reload_mutex);
+    return cycle;
+}
+
+bool phonebook_fetcher_last_report(FetchCycleReport *report) {
+    pthread_mutex_lock(&reload_mutex);
+    *report = last_report;
+    pthread_mutex_unlock(&reload_mutex);
+    return report->cycle > 0;
+}
+
+const char *fetch_result_name(FetchResult result) {
+    switch (result) {
+        case FETCH_RESULT_CHANGED:   return "changed";
+        case FETCH_RESULT_UNCHANGED: return "unchanged";
+        default:                     return "failed";
+    }
+}
+
+static unsigned long begin_cycle(void) {
+    pthread_mutex_lock(&reload_mutex);
+    reload_pending = false;
+    unsigned long cycle = ++cycles_started;
+    pthread_mutex_unlock(&reload_mutex);
+    return cycle;
+}
+
+static void end_cycle(const FetchCycleReport *report) {
+    pthread_mutex_lock(&reload_mutex);
+    last_report = *report;
+    pthread_mutex_unlock(&reload_mutex);
+    stats_shm_record_fetch(report->result, report->duration_ms, report->finished);
+    control_socket_notify(); // Answers the clients waiting for this cycle
+}
+
+// Sleeps up to 'seconds', returning as soon as a reload is requested. The
+// legacy SIGUSR1 flag cannot signal the condition variable from the handler,
+// so it is still checked once per second.
+static void fetcher_sleep(int seconds) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += seconds;
+    pthread_mutex_lock(&reload_mutex);
+    while (!reload_pending) {
+        if (phonebook_reload_requested) {
+            phonebook_reload_requested = 0;
+            reload_pending = true;
+            break;
+        }
+        struct timespec slice;
+        clock_gettime(CLOCK_REALTIME, &slice);
+        if (slice.tv_sec >= deadline.tv_sec) {
+            break;
         }
+        slice.tv_sec += 1;
+        if (slice.tv_sec > deadline.tv_sec) slice = deadline;
+        pthread_cond_timedwait(&reload_cond, &reload_mutex, &slice);
+    }
+    bool reload = reload_pending;
+    pthread_mutex_unlock(&reload_mutex);
+    if (reload) {
+        LOG_INFO("Reload requested - interrupting sleep to fetch phonebook immediately");
+    }
+}
+
+// Byte counts for one fetch cycle, logged at the end of the cycle.
+typedef struct {
+    size_t network_read;   // HTTP response bytes received
+    size_t file_read;      // Bytes read back from files
+    size_t flash_written;  // Bytes written to /www (flash)
+    size_t tmpfs_written;  // Bytes written to /tmp
+} FetchCycleIo;
+
+// Renders the model's directory and publishes it. Returns 0 on success.
+static int render_and_publish_xml(const PhonebookModel *model, FetchCycleIo *io) {
+    LOG_INFO("Rendering XML directory from %d phonebook entries...", model->count);
+    if (directory_render_update(model) != 0 ||
+        publish_directory_xml(0, false, &io->tmpfs_written, &io->flash_written) != 0) {
+        LOG_ERROR("Phonebook XML publishing failed.");
+        return 1;
+    }
+    LOG_INFO("Phonebook XML safely published at %s.", PB_XML_PUBLIC_PATH);
+
+    pthread_mutex_lock(&updater_trigger_mutex);
+    pthread_cond_signal(&updater_trigger_cond);
+    pthread_mutex_unlock(&updater_trigger_mutex);
+    LOG_INFO("Signaled Status Updater for new phonebook.");
+    return 0;
+}
+
+// Reads the hash of the persisted CSV into 'out' (empty if unknown). Returns bytes read.
+static size_t read_last_good_hash(char out[HASH_LENGTH + 1]) {
+    out[0] = '\0';
+    FILE *hash_fp = fopen(PB_LAST_GOOD_CSV_HASH_PATH, "r");
+    if (!hash_fp) {
+        LOG_INFO("No last good CSV hash file found. Assuming change for first run.");
+        return 0;
+    }
+    size_t bytes = 0;
+    if (fgets(out, HASH_LENGTH + 1, hash_fp) != NULL) {
+        out[strcspn(out, "\r\n")] = '\0';
+        bytes = strlen(out) + 1;
+        LOG_DEBUG("Last good CSV hash: %s", out);
+    } else {
+        LOG_INFO("Could not read last good CSV hash. Assuming change.");
+        out[0] = '\0';
+    }
+    fclose(hash_fp);
+    return bytes;
+}
+
+// True if the published XML was rendered from the CSV with 'content_hash' by this version.
+static bool published_xml_is_current(const char *content_hash) {
+    if (!content_hash[0] || access(PB_XML_PUBLIC_PATH, R_OK) != 0) {
+        return false;
     }
+    char marker[128];
+    csv_processor_format_xml_marker(content_hash, marker, sizeof(marker));
+    char *data;
+    size_t len;
+    pthread_mutex_lock(&phonebook_file_mutex);
+    int read_result = file_utils_read_file(PB_XML_PUBLIC_PATH, &data, &len);
     pthread_mutex_unlock(&phonebook_file_mutex);
-    return publish_success ? 0 : 1;
+    if (read_result != 0) {
+        return false;
+    }
+    bool current = memmem(data, len, marker, strlen(marker)) != NULL &&
+                   memmem(data, len, "</YealinkIPPhoneDirectory>", 26) != NULL;
+    free(data);
+    return current;
 }
 
-static bool initial_population_done = false;
+static long ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long)((now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000);
+}
 
 void *phonebook_fetcher_thread(void *arg) {
     (void)arg;
     LOG_INFO("Phonebook fetcher started. Checking for existing phonebook data.");
 
-    // Emergency boot sequence: Load existing phonebook immediately if available
+    // Emergency boot sequence: Load existing phonebook immediately if available.
+    struct timespec boot_start;
+    clock_gettime(CLOCK_MONOTONIC, &boot_start);
+    PhonebookModel boot_model;
+    phonebook_model_init(&boot_model);
+    const char *boot_source = NULL;
+
     if (access(PB_CSV_PATH, F_OK) == 0) {
         LOG_INFO("Found existing phonebook CSV at '%s'. Loading immediately for service availability.", PB_CSV_PATH);
-        populate_registered_users_from_csv(PB_CSV_PATH);
-        LOG_INFO("Emergency boot: SIP user database loaded from persistent storage. Directory entries: %d.", num_directory_entries);
+        if (phonebook_model_load_file(&boot_model, PB_CSV_PATH) == 0) {
+            boot_source = "CSV";
+        } else {
+            LOG_ERROR("Emergency boot: failed to load phonebook from '%s'.", PB_CSV_PATH);
+        }
+    }
+
+    if (boot_source) {
+        populate_registered_users_from_model(&boot_model);
+        LOG_INFO("Emergency boot: SIP user database loaded from %s in %ld ms. Directory entries: %d.", boot_source,
+                 ms_since(&boot_start), num_directory_entries);
         initial_population_done = true;
+        keep_as_applied(&boot_model);
+        phonebook_delta_store_version(applied_model.content_hash, PB_CSV_PATH);
 
-        // Convert to XML for web interface
-        char existing_xml_temp_path[MAX_CONFIG_PATH_LEN];
-        if (csv_processor_convert_csv_to_xml_and_get_path(existing_xml_temp_path, sizeof(existing_xml_temp_path)) == 0) {
-            publish_phonebook_xml(existing_xml_temp_path);
-            LOG_INFO("Emergency boot: XML phonebook published from existing data.");
+        // The XML left by the previous run is still valid unless the phonebook
+        // or the renderer changed; only then convert to XML for web interface
+        if (published_xml_is_current(applied_model.content_hash)) {
+            LOG_INFO("Emergency boot: existing XML phonebook is current, directory available after %ld ms.",
+                     ms_since(&boot_start));
+            directory_render_update(&applied_model); // Status updater renders liveness from the fragments
+            pthread_mutex_lock(&updater_trigger_mutex);
+            pthread_cond_signal(&updater_trigger_cond);
+            pthread_mutex_unlock(&updater_trigger_mutex);
+        } else {
+            FetchCycleIo io = {0};
+            if (render_and_publish_xml(&applied_model, &io) == 0) {
+                LOG_INFO("Emergency boot: XML phonebook published from existing data, directory available after %ld ms.",
+                         ms_since(&boot_start));
+            }
         }
-    } else {
+    } else if (access(PB_CSV_PATH, F_OK) != 0) {
         LOG_INFO("No existing phonebook found. Service will be available after first successful fetch.");
     }
+    phonebook_model_free(&boot_model);
+
+    // Spread the first fetch of nodes that boot together (e.g. after a power restore)
+    fetcher_sleep(fetch_scheduler_initial_delay(initial_population_done));
 
     LOG_INFO("Entering main phonebook fetch loop.");
     while (1) { // Changed from while (keep_running) to while (1)
@@ -92,107 +305,125 @@ void *phonebook_fetcher_thread(void *arg) {
         g_fetcher_last_heartbeat = time(NULL);
 
         LOG_INFO("Starting new fetcher cycle.");
-        char new_csv_hash[HASH_LENGTH + 1]; // HASH_LENGTH from common.h
+        struct timespec cycle_start;
+        clock_gettime(CLOCK_MONOTONIC, &cycle_start);
+        FetchCycleReport report = { .cycle = begin_cycle(), .result = FETCH_RESULT_FAILED,
+                                    .added = -1, .removed = -1, .modified = -1 };
+        bool fetch_succeeded = false; // A server delivered the phonebook (200 or 304)
+        FetchCycleIo io = {0};
+        PhonebookModel model;
+        phonebook_model_init(&model);
         char last_good_csv_hash[HASH_LENGTH + 1];
 
-        if (csv_processor_download_csv() != 0) {
-            LOG_ERROR("CSV download failed. Skipping this cycle.");
-            goto end_fetcher_cycle;
-        }
+        // Read existing hash from flash (only if we have persistent data)
+        io.file_read += read_last_good_hash(last_good_csv_hash);
 
-        // Calculate hash of downloaded temp file (in RAM)
-        if (csv_processor_calculate_file_conceptual_hash(PB_CSV_TEMP_PATH, new_csv_hash, sizeof(new_csv_hash)) != 0) {
-            LOG_ERROR("Failed to calculate hash for downloaded CSV. Skipping this cycle.");
-            remove(PB_CSV_TEMP_PATH); // Clean up temp file
+        // Download, hash and parse in one pass; nothing is written until we know the content changed.
+        // Conditional GET: validators are only offered if the local copy is actually loaded
+        int download_result = csv_processor_download_csv(initial_population_done ? last_good_csv_hash : NULL,
+                                                         &model, &io.network_read);
+        fetch_succeeded = (download_result == CSV_DOWNLOAD_OK || download_result == CSV_DOWNLOAD_NOT_MODIFIED);
+        if (download_result == CSV_DOWNLOAD_NOT_MODIFIED) {
+            LOG_INFO("Phonebook not modified on server (304). No download or flash write needed.");
+            report.result = FETCH_RESULT_UNCHANGED;
+            goto end_fetcher_cycle;
+        } else if (download_result != CSV_DOWNLOAD_OK) {
+            LOG_ERROR("CSV download failed. Retrying after backoff.");
             goto end_fetcher_cycle;
         }
-
-        // Read existing hash from flash (only if we have persistent data)
-        FILE *hash_fp = fopen(PB_LAST_GOOD_CSV_HASH_PATH, "r");
-        if (hash_fp) {
-            if (fgets(last_good_csv_hash, sizeof(last_good_csv_hash), hash_fp) != NULL) {
-                last_good_csv_hash[strcspn(last_good_csv_hash, "\r\n")] = '\0';
-                LOG_DEBUG("Last good CSV hash: %s", last_good_csv_hash);
-            } else {
-                LOG_INFO("Could not read last good CSV hash. Assuming change.");
-                last_good_csv_hash[0] = '\0';
-            }
-            fclose(hash_fp);
-        } else {
-            LOG_INFO("No last good CSV hash file found. Assuming change for first run.");
-            last_good_csv_hash[0] = '\0';
-        }
-        LOG_DEBUG("New CSV hash: %s", new_csv_hash);
+        LOG_DEBUG("New CSV hash: %s", model.content_hash);
 
         // Flash-friendly comparison: Only write to flash if data actually changed
-        if (strcmp(new_csv_hash, last_good_csv_hash) == 0 && initial_population_done) {
+        if (strcmp(model.content_hash, last_good_csv_hash) == 0 && initial_population_done) {
             LOG_INFO("Downloaded CSV is identical to flash copy. No flash write needed - preserving flash lifespan.");
-            remove(PB_CSV_TEMP_PATH); // Clean up unchanged temp file
+            report.result = FETCH_RESULT_UNCHANGED;
             goto end_fetcher_cycle;
+        }
+        if (!initial_population_done) {
+            LOG_INFO("Initial population required. Writing CSV to persistent storage.");
         } else {
-            if (!initial_population_done) {
-                LOG_INFO("Initial population required. Moving temp CSV to persistent storage.");
-            } else {
-                LOG_INFO("CSV content changed. Updating persistent storage (flash write).");
-            }
+            LOG_INFO("CSV content changed. Updating persistent storage (flash write).");
+        }
+        if (file_utils_atomic_write(PB_CSV_PATH, model.csv_data, model.csv_len) != 0) {
+            LOG_ERROR("Failed to write CSV to persistent storage");
+            goto end_fetcher_cycle;
+        }
+        io.flash_written += model.csv_len;
+        LOG_INFO("CSV written to persistent storage with a single flash write.");
+        phonebook_delta_store_version(model.content_hash, PB_CSV_PATH);
 
-            // Cross-filesystem move: copy temp file to flash, then remove temp
-            if (file_utils_copy_file(PB_CSV_TEMP_PATH, PB_CSV_PATH) != 0) {
-                LOG_ERROR("Failed to copy temp CSV to persistent storage");
-                remove(PB_CSV_TEMP_PATH); // Clean up temp file
-                goto end_fetcher_cycle;
+        // Only the rows that differ from the applied phonebook touch the SIP user table and XML
+        bool xml_needed = true;
+        PhonebookChangeSet changes;
+        if (initial_population_done && phonebook_model_diff(&applied_model, &model, &changes) == 0) {
+            LOG_INFO("Phonebook change set: %d added, %d removed, %d modified (%d entries).",
+                     changes.added, changes.removed, changes.modified, model.count);
+            apply_phonebook_changes_to_registered_users(&changes);
+            report.added = changes.added;
+            report.removed = changes.removed;
+            report.modified = changes.modified;
+            xml_needed = changes.count > 0 || !same_row_order(&applied_model, &model);
+            if (changes.count == 0 && xml_needed) {
+                LOG_INFO("Phonebook rows were reordered.");
             }
-            remove(PB_CSV_TEMP_PATH); // Clean up temp file after successful copy
-            LOG_INFO("CSV successfully copied to persistent storage with minimal flash wear.");
+            phonebook_change_set_free(&changes);
+        } else {
+            LOG_INFO("Populating SIP users from CSV for phonebook update.");
+            populate_registered_users_from_model(&model);
+            LOG_INFO("SIP user database populated from CSV. Total directory entries: %d.", num_directory_entries); // num_directory_entries from common.h
         }
-
-        LOG_INFO("Populating SIP users from CSV for phonebook update.");
-        populate_registered_users_from_csv(PB_CSV_PATH);
-        LOG_INFO("SIP user database populated from CSV. Total directory entries: %d.", num_directory_entries); // num_directory_entries from common.h
         initial_population_done = true;
 
-        LOG_INFO("Initiating XML conversion...");
-        char fetched_xml_temp_path[MAX_CONFIG_PATH_LEN];
-        if (csv_processor_convert_csv_to_xml_and_get_path(fetched_xml_temp_path, sizeof(fetched_xml_temp_path)) == 0) {
-            LOG_INFO("XML conversion successful.");
-
-            if (publish_phonebook_xml(fetched_xml_temp_path) == 0) {
-                // Only update hash in flash if we haven't already written this hash
-                if (strcmp(new_csv_hash, last_good_csv_hash) != 0) {
-                    FILE *hash_fp_write = fopen(PB_LAST_GOOD_CSV_HASH_PATH, "w");
-                    if (hash_fp_write) {
-                        fprintf(hash_fp_write, "%s\n", new_csv_hash);
-                        fclose(hash_fp_write);
-                        LOG_INFO("Flash write: Updated CSV hash to '%s' (flash wear minimized).", new_csv_hash);
-                    } else {
-                        LOG_ERROR("Failed to write new CSV hash to '%s'. Error: %s", PB_LAST_GOOD_CSV_HASH_PATH, strerror(errno));
-                    }
+        int publish_result = 0;
+        if (xml_needed) {
+            LOG_INFO("Initiating XML conversion...");
+            publish_result = render_and_publish_xml(&model, &io);
+            if (publish_result == 0) {
+                LOG_INFO("XML conversion successful.");
+            }
+        } else {
+            LOG_INFO("No directory entries changed; keeping the published XML.");
+            directory_render_update(&model); // Every fragment is reused; only the source marker changes
+        }
+        if (publish_result == 0) {
+            // Only update hash in flash if we haven't already written this hash
+            if (strcmp(model.content_hash, last_good_csv_hash) != 0) {
+                char hash_line[HASH_LENGTH + 2];
+                int hash_line_len = snprintf(hash_line, sizeof(hash_line), "%s\n", model.content_hash);
+                if (file_utils_atomic_write(PB_LAST_GOOD_CSV_HASH_PATH, hash_line, (size_t)hash_line_len) == 0) {
+                    io.flash_written += (size_t)hash_line_len;
+                    LOG_INFO("Flash write: Updated CSV hash to '%s' (flash wear minimized).", model.content_hash);
                 } else {
-                    LOG_DEBUG("Hash unchanged, skipping flash write for hash file.");
+                    LOG_ERROR("Failed to write new CSV hash to '%s'.", PB_LAST_GOOD_CSV_HASH_PATH);
                 }
             } else {
-                LOG_WARN("XML publish failed, not updating hash file.");
+                LOG_DEBUG("Hash unchanged, skipping flash write for hash file.");
             }
-
             // Keep CSV in persistent storage for emergency availability - do not delete
-
+            report.result = FETCH_RESULT_CHANGED;
+            keep_as_applied(&model);
         } else {
-            LOG_WARN("XML conversion failed. Keeping CSV in persistent storage for emergency availability.");
-            // Do not delete CSV even if XML conversion fails - emergency data preservation
+            // The applied model still describes the published XML, so the next cycle
+            // (which re-downloads, as the hash was not stored) finds these changes again
+            LOG_WARN("XML conversion or publish failed. Keeping CSV in persistent storage for emergency availability.");
         }
         LOG_INFO("Finished fetcher cycle.");
 
         end_fetcher_cycle:;
-        LOG_INFO("Sleeping %d seconds...", g_pb_interval_seconds); // Use global g_pb_interval_seconds
-        for (int i = 0; i < g_pb_interval_seconds; i++) {
-            // Check for webhook-triggered reload request
-            if (phonebook_reload_requested) {
-                phonebook_reload_requested = 0; // Reset flag
-                LOG_INFO("Webhook reload requested - interrupting sleep to fetch phonebook immediately");
-                break; // Exit sleep loop and restart fetch cycle
-            }
-            sleep(1); // sleep from common.h
-        }
+        phonebook_model_free(&model);
+        report.entries = applied_model.count;
+        report.duration_ms = ms_since(&cycle_start);
+        report.finished = time(NULL);
+        end_cycle(&report);
+        metrics_observe(&g_metrics.fetch_duration, (uint32_t)report.duration_ms);
+        METRICS_ADD(fetch_bytes, (uint32_t)io.network_read);
+        LOG_INFO("Cycle I/O: %zu bytes from network, %zu bytes read from files, %zu bytes written to flash, %zu bytes to tmpfs.",
+                 io.network_read, io.file_read, io.flash_written, io.tmpfs_written);
+        file_utils_write_budget_status();
+        // Jittered interval after success, short exponential backoff after a failed download
+        int sleep_seconds = fetch_scheduler_end_cycle(fetch_succeeded);
+        LOG_INFO("Sleeping %d seconds...", sleep_seconds);
+        fetcher_sleep(sleep_seconds);
     }
     LOG_INFO("Phonebook fetcher thread exiting.");
     return NULL;
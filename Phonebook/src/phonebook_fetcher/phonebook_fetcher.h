@@ -7,10 +7,45 @@
 // Thread function
 void *phonebook_fetcher_thread(void *arg);
 
+// Outcome of one fetch cycle
+typedef enum {
+    FETCH_RESULT_CHANGED,   // A new phonebook was applied
+    FETCH_RESULT_UNCHANGED, // The server copy matches the applied one (304 or same hash)
+    FETCH_RESULT_FAILED     // No server delivered, or the new phonebook could not be stored
+} FetchResult;
+
+typedef struct {
+    unsigned long cycle;    // Cycles are numbered from 1
+    FetchResult result;
+    int entries;            // Directory entries after the cycle
+    int added, removed, modified; // Rows changed; -1 when the whole table was repopulated or nothing was applied
+    long duration_ms;
+    time_t finished;
+} FetchCycleReport;
+
+/**
+ * @brief Wakes the fetcher for a cycle now instead of at the end of its sleep.
+ *
+ * A cycle already running does not count: the request is answered by the next one.
+ * @return Number of the cycle that will answer the request.
+ */
+unsigned long phonebook_fetcher_request_reload(void);
+
+// Copies the report of the last completed cycle. Returns false before the first cycle completes.
+bool phonebook_fetcher_last_report(FetchCycleReport *report);
+
+const char *fetch_result_name(FetchResult result);
+
 // Utility function to ensure directory exists (now in file_utils)
 int ensure_phonebook_directory_exists(const char *path);
 
-// Function to publish XML (called from status_updater)
-int publish_phonebook_xml(const char *source_filepath);
+// Renders the directory straight to PB_XML_VOLATILE_PATH and links the public
+// path to it. Where no link can be made the XML is copied to flash, and then
+// 'liveness_only' updates are deferrable under the flash write budget. Adds
+// the bytes written to *tmpfs_bytes and *flash_bytes when they are given.
+// Returns 0 on success, DIRECTORY_RENDER_STALE if the entries changed since a
+// nonzero 'directory_version', or 1 on error.
+int publish_directory_xml(unsigned long directory_version, bool liveness_only, size_t *tmpfs_bytes,
+                          size_t *flash_bytes);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,296 @@
+#define MODULE_NAME "MODEL"
+
+#include "phonebook_model.h"
+#include "../common.h"
+#include <inttypes.h>
+
+static void trim_whitespace(char *str) {
+    if (!str || *str == '\0') {
+        return;
+    }
+    char *first_char = str;
+    while (isspace((unsigned char)*first_char)) {
+        first_char++;
+    }
+    char *end_char = first_char + strlen(first_char);
+    while (end_char > first_char && isspace((unsigned char)end_char[-1])) {
+        end_char--;
+    }
+    *end_char = '\0';
+    if (str != first_char) {
+        memmove(str, first_char, strlen(first_char) + 1);
+    }
+}
+
+void phonebook_model_init(PhonebookModel *model) {
+    memset(model, 0, sizeof(*model));
+    model->checksum = 14695981039346656037ULL; // FNV-1a 64-bit offset basis
+}
+
+void phonebook_model_free(PhonebookModel *model) {
+    free(model->entries);
+    free(model->csv_data);
+    phonebook_model_init(model);
+}
+
+static PhonebookEntry *model_append_entry(PhonebookModel *model) {
+    if (model->count == model->capacity) {
+        int new_capacity = model->capacity ? model->capacity * 2 : 256;
+        PhonebookEntry *grown = realloc(model->entries, (size_t)new_capacity * sizeof(PhonebookEntry));
+        if (!grown) {
+            LOG_ERROR("Out of memory growing phonebook model to %d entries.", new_capacity);
+            model->failed = true;
+            return NULL;
+        }
+        model->entries = grown;
+        model->capacity = new_capacity;
+    }
+    PhonebookEntry *e = &model->entries[model->count++];
+    memset(e, 0, sizeof(*e));
+    return e;
+}
+
+// Splits one CSV line (first name, name, callsign, <unused>, telephone) into an entry.
+static void model_parse_line(PhonebookModel *model, char *line) {
+    int ln = ++model->line_number;
+    if (ln == 1) {
+        LOG_DEBUG("Skipping CSV header row: '%.*s'", (int)strcspn(line, "\r\n"), line);
+        return;
+    }
+
+    char *cols[5] = {NULL};
+    char *p = line;
+    for (int i = 0; i < 5; i++) {
+        if (i < 4) {
+            char *c = strchr(p, ',');
+            cols[i] = p;
+            if (!c) {
+                LOG_WARN("Line %d has fewer than 5 columns. Missing column %d and subsequent. Line: '%.*s'", ln, i + 1, (int)strcspn(line, "\r\n"), line);
+                return;
+            }
+            *c = '\0';
+            p = c + 1;
+        } else {
+            cols[i] = p;
+        }
+    }
+    cols[4][strcspn(cols[4], ",\r\n")] = '\0'; // Ignore extra columns and the line ending
+
+    PhonebookEntry tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    sanitize_utf8(cols[4], tmp.user_id, sizeof(tmp.user_id));
+    trim_whitespace(tmp.user_id);
+    if (!tmp.user_id[0]) {
+        LOG_WARN("Skipping CSV row %d due to missing or empty Telephone number (column 5).", ln);
+        return;
+    }
+    sanitize_utf8(cols[0], tmp.first_name, sizeof(tmp.first_name));
+    sanitize_utf8(cols[1], tmp.name, sizeof(tmp.name));
+    sanitize_utf8(cols[2], tmp.callsign, sizeof(tmp.callsign));
+    trim_whitespace(tmp.first_name);
+    trim_whitespace(tmp.name);
+    trim_whitespace(tmp.callsign);
+
+    PhonebookEntry *e = model_append_entry(model);
+    if (e) {
+        *e = tmp;
+    }
+}
+
+static void model_end_line(PhonebookModel *model) {
+    model->line[model->line_len] = '\0';
+    if (model->line_overflow) {
+        LOG_WARN("CSV line %d longer than %d bytes; truncated.", model->line_number + 1, PB_MODEL_MAX_LINE_LEN - 1);
+    }
+    model_parse_line(model, model->line);
+    model->line_len = 0;
+    model->line_overflow = false;
+}
+
+int phonebook_model_feed(PhonebookModel *model, const char *data, size_t len) {
+    if (model->failed) {
+        return 1;
+    }
+    if (model->csv_len + len > MAX_PHONEBOOK_CSV_BYTES) {
+        LOG_ERROR("Phonebook CSV exceeds %d bytes; rejecting.", MAX_PHONEBOOK_CSV_BYTES);
+        model->failed = true;
+        return 1;
+    }
+
+    // Keep the raw bytes for persisting
+    if (model->csv_len + len > model->csv_cap) {
+        size_t new_cap = model->csv_cap ? model->csv_cap : 64 * 1024;
+        while (new_cap < model->csv_len + len) new_cap *= 2;
+        if (new_cap > MAX_PHONEBOOK_CSV_BYTES) new_cap = MAX_PHONEBOOK_CSV_BYTES;
+        char *grown = realloc(model->csv_data, new_cap);
+        if (!grown) {
+            LOG_ERROR("Out of memory buffering %zu bytes of phonebook CSV.", new_cap);
+            model->failed = true;
+            return 1;
+        }
+        model->csv_data = grown;
+        model->csv_cap = new_cap;
+    }
+    memcpy(model->csv_data + model->csv_len, data, len);
+    model->csv_len += len;
+
+    // Hash and tokenize in the same pass
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        model->checksum = (model->checksum ^ (unsigned char)c) * 1099511628211ULL; // Every byte counts, wherever it is
+        if (c == '\n') {
+            model_end_line(model);
+        } else if (model->line_len < sizeof(model->line) - 1) {
+            model->line[model->line_len++] = c;
+        } else {
+            model->line_overflow = true;
+        }
+    }
+    return model->failed ? 1 : 0;
+}
+
+int phonebook_model_finish(PhonebookModel *model) {
+    if (model->failed) {
+        return 1;
+    }
+    if (model->line_len > 0) {
+        model_end_line(model);
+    }
+    snprintf(model->content_hash, sizeof(model->content_hash), "%0*" PRIX64, HASH_LENGTH, model->checksum);
+    model->content_hash[HASH_LENGTH] = '\0';
+    LOG_DEBUG("Phonebook model complete: %d entries from %zu CSV bytes, hash %s.", model->count, model->csv_len, model->content_hash);
+    return model->failed ? 1 : 0;
+}
+
+int phonebook_model_load_file(PhonebookModel *model, const char *filepath) {
+    FILE *fp = fopen(filepath, "rb");
+    if (!fp) {
+        LOG_ERROR("Failed to open CSV phonebook file '%s'. Error: %s", filepath, strerror(errno));
+        return 1;
+    }
+    char buf[4096];
+    size_t n;
+    int ret = 0;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        if (phonebook_model_feed(model, buf, n) != 0) {
+            ret = 1;
+            break;
+        }
+    }
+    if (ferror(fp)) {
+        LOG_ERROR("Error reading CSV phonebook file '%s'. Error: %s", filepath, strerror(errno));
+        ret = 1;
+    }
+    fclose(fp);
+    if (ret == 0) {
+        ret = phonebook_model_finish(model);
+    }
+    return ret;
+}
+
+void phonebook_model_format_name(const PhonebookEntry *e, char *out, size_t out_len) {
+    if (e->first_name[0] && e->name[0] && e->callsign[0]) {
+        snprintf(out, out_len, "%s %s (%s)", e->first_name, e->name, e->callsign);
+    } else if (e->first_name[0] && e->name[0]) {
+        snprintf(out, out_len, "%s %s", e->first_name, e->name);
+    } else if (e->first_name[0]) {
+        snprintf(out, out_len, "%s", e->first_name);
+    } else if (e->name[0]) {
+        snprintf(out, out_len, "%s", e->name);
+    } else if (e->callsign[0]) {
+        snprintf(out, out_len, "%s", e->callsign);
+    } else {
+        snprintf(out, out_len, "Unnamed");
+    }
+}
+
+static int compare_entry_ptrs(const void *a, const void *b) {
+    const PhonebookEntry *ea = *(const PhonebookEntry *const *)a;
+    const PhonebookEntry *eb = *(const PhonebookEntry *const *)b;
+    int c = strcmp(ea->user_id, eb->user_id);
+    if (c) {
+        return c;
+    }
+    return (ea > eb) - (ea < eb); // Keep CSV order among duplicates
+}
+
+// Returns the model's entries sorted by user_id, keeping the last row of each number.
+static const PhonebookEntry **sorted_unique_entries(const PhonebookModel *model, int *count) {
+    const PhonebookEntry **sorted = malloc((size_t)(model->count ? model->count : 1) * sizeof(*sorted));
+    if (!sorted) {
+        return NULL;
+    }
+    for (int i = 0; i < model->count; i++) {
+        sorted[i] = &model->entries[i];
+    }
+    qsort(sorted, (size_t)model->count, sizeof(*sorted), compare_entry_ptrs);
+    int n = 0;
+    for (int i = 0; i < model->count; i++) {
+        if (n > 0 && strcmp(sorted[n - 1]->user_id, sorted[i]->user_id) == 0) {
+            sorted[n - 1] = sorted[i];
+        } else {
+            sorted[n++] = sorted[i];
+        }
+    }
+    *count = n;
+    return sorted;
+}
+
+static bool entries_equal(const PhonebookEntry *a, const PhonebookEntry *b) {
+    return strcmp(a->first_name, b->first_name) == 0 && strcmp(a->name, b->name) == 0 &&
+           strcmp(a->callsign, b->callsign) == 0;
+}
+
+static void change_set_add(PhonebookChangeSet *cs, PhonebookChangeType type, const PhonebookEntry *old_entry,
+                           const PhonebookEntry *new_entry) {
+    PhonebookChange *c = &cs->changes[cs->count++];
+    c->type = type;
+    c->old_entry = old_entry;
+    c->new_entry = new_entry;
+    if (type == PB_CHANGE_ADD) {
+        cs->added++;
+    } else if (type == PB_CHANGE_REMOVE) {
+        cs->removed++;
+    } else {
+        cs->modified++;
+    }
+}
+
+int phonebook_model_diff(const PhonebookModel *old_model, const PhonebookModel *new_model, PhonebookChangeSet *out) {
+    memset(out, 0, sizeof(*out));
+    int old_count = 0, new_count = 0;
+    const PhonebookEntry **old_sorted = sorted_unique_entries(old_model, &old_count);
+    const PhonebookEntry **new_sorted = sorted_unique_entries(new_model, &new_count);
+    out->changes = malloc((size_t)(old_count + new_count + 1) * sizeof(PhonebookChange));
+    if (!old_sorted || !new_sorted || !out->changes) {
+        LOG_ERROR("Out of memory comparing phonebooks (%d and %d entries).", old_model->count, new_model->count);
+        free(old_sorted);
+        free(new_sorted);
+        phonebook_change_set_free(out);
+        return 1;
+    }
+
+    int i = 0, j = 0;
+    while (i < old_count || j < new_count) {
+        int c = (i == old_count) ? 1 : (j == new_count) ? -1 : strcmp(old_sorted[i]->user_id, new_sorted[j]->user_id);
+        if (c < 0) {
+            change_set_add(out, PB_CHANGE_REMOVE, old_sorted[i++], NULL);
+        } else if (c > 0) {
+            change_set_add(out, PB_CHANGE_ADD, NULL, new_sorted[j++]);
+        } else {
+            if (!entries_equal(old_sorted[i], new_sorted[j])) {
+                change_set_add(out, PB_CHANGE_MODIFY, old_sorted[i], new_sorted[j]);
+            }
+            i++;
+            j++;
+        }
+    }
+    free(old_sorted);
+    free(new_sorted);
+    return 0;
+}
+
+void phonebook_change_set_free(PhonebookChangeSet *changes) {
+    free(changes->changes);
+    memset(changes, 0, sizeof(*changes));
+}
@@ -0,0 +1,85 @@
+// phonebook_model.h
+#ifndef PHONEBOOK_MODEL_H
+#define PHONEBOOK_MODEL_H
+
+#include "../common.h"
+#include <stdint.h>
+
+// In-memory phonebook built in a single pass over the CSV bytes, whether they
+// come from the network or from flash. Feeding bytes updates the conceptual
+// hash, keeps a copy of the raw CSV (so it can be persisted later without
+// re-downloading) and tokenizes complete lines into entries as they arrive.
+
+#define PB_MODEL_MAX_LINE_LEN 2048
+
+// One directory row. Fields are UTF-8 sanitized and trimmed.
+typedef struct {
+    char user_id[MAX_PHONE_NUMBER_LEN]; // Telephone column, used as SIP user ID
+    char first_name[MAX_FIRST_NAME_LEN];
+    char name[MAX_NAME_LEN];
+    char callsign[MAX_CALLSIGN_LEN];
+} PhonebookEntry;
+
+typedef struct {
+    PhonebookEntry *entries;  // In CSV order
+    int count;
+    int capacity;
+
+    char *csv_data;           // Raw CSV exactly as received
+    size_t csv_len;
+    size_t csv_cap;
+
+    uint64_t checksum;        // Running FNV-1a hash of csv_data
+    char content_hash[HASH_LENGTH + 1]; // Formatted by phonebook_model_finish()
+
+    // Tokenizer state
+    char line[PB_MODEL_MAX_LINE_LEN];
+    size_t line_len;
+    bool line_overflow;       // Current line exceeded PB_MODEL_MAX_LINE_LEN; rest is dropped
+    int line_number;
+    bool failed;              // Out of memory or size limit exceeded
+} PhonebookModel;
+
+void phonebook_model_init(PhonebookModel *model);
+void phonebook_model_free(PhonebookModel *model);
+
+// Feeds raw CSV bytes. Returns 0 on success, 1 if the model can no longer accept data.
+int phonebook_model_feed(PhonebookModel *model, const char *data, size_t len);
+
+// Processes a trailing line without newline and formats content_hash. Returns 0 on success.
+int phonebook_model_finish(PhonebookModel *model);
+
+// Builds a model from a CSV file (e.g. the persisted copy on flash). Returns 0 on success.
+int phonebook_model_load_file(PhonebookModel *model, const char *filepath);
+
+// Display name as used for SIP and the directory: "First Name (CALL)", with fallbacks.
+void phonebook_model_format_name(const PhonebookEntry *entry, char *out, size_t out_len);
+
+typedef enum {
+    PB_CHANGE_ADD,
+    PB_CHANGE_REMOVE,
+    PB_CHANGE_MODIFY
+} PhonebookChangeType;
+
+// One directory difference. Entries point into the models passed to the diff.
+typedef struct {
+    PhonebookChangeType type;
+    const PhonebookEntry *old_entry; // NULL for PB_CHANGE_ADD
+    const PhonebookEntry *new_entry; // NULL for PB_CHANGE_REMOVE
+} PhonebookChange;
+
+typedef struct {
+    PhonebookChange *changes; // Sorted by user_id
+    int count;
+    int added;
+    int removed;
+    int modified;
+} PhonebookChangeSet;
+
+// Compares two models by user_id with a sorted merge. When a number appears on
+// several rows the last one counts, as it does for the SIP user table.
+// Returns 0 on success, 1 if out of memory.
+int phonebook_model_diff(const PhonebookModel *old_model, const PhonebookModel *new_model, PhonebookChangeSet *out);
+void phonebook_change_set_free(PhonebookChangeSet *changes);
+
+#endif // PHONEBOOK_MODEL_H
@@ -2,6 +2,9 @@
 #include "../common.h" // This now includes all necessary headers and types
 #include "../user_manager/user_manager.h" // For RegisteredUser, find_registered_user, etc.
 #include "../call-sessions/call_sessions.h" // For CallSession, create_call_session, find_call_session_by_callid, etc.
+#include "../stats_shm/stats_shm.h" // For STATS_INC
+#include "../metrics/metrics.h"     // For latency histograms and response codes
+#include "../sip_trace/sip_trace.h" // For SIP_TRACE_MARK
 
 #define MODULE_NAME "SIP"
 
@@ -319,6 +322,7 @@ end_send:;
                     sockaddr_to_ip_str(dest_addr),
                     ntohs(dest_addr->sin_port));
     } else {
+        metrics_count_sip_response(g_metrics.sip_responses_sent, atoi(status_line + 8));
         LOG_DEBUG("SIP: Sent SIP response to %s:%d (bytes: %zd):\n%s",
                     sockaddr_to_ip_str(dest_addr),
                     ntohs(dest_addr->sin_port),
@@ -371,8 +375,8 @@ void send_response_to_registered(int sockfd,
                       extra_hdrs, body);
 }
 
-void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
-                                  const struct sockaddr_in *cliaddr, socklen_t cli_len) {
+static void handle_sip_message(int sockfd, const char *buffer, ssize_t n,
+                               const struct sockaddr_in *cliaddr, socklen_t cli_len) {
     char first_line[MAX_SIP_MSG_LEN];
     get_first_line(buffer, first_line, sizeof(first_line));
 
@@ -397,22 +401,35 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
 
     if (strncmp(first_line, "SIP/2.0", 7) == 0) {
         LOG_INFO("Received SIP Response: %s", first_line);
+        STATS_INC(sip_responses);
+        SIP_TRACE_MARK(SIP_STAGE_PARSED);
 
         CallSession *session = find_call_session_by_callid(call_id_hdr);
+        SIP_TRACE_MARK(SIP_STAGE_LOOKUP);
         if (session) {
             LOG_DEBUG("Matching session found for response: %s", session->call_id);
             send_sip_message(sockfd, &session->original_caller_addr, sizeof(session->original_caller_addr), buffer);
+            SIP_TRACE_MARK(SIP_STAGE_FORWARDED);
+            metrics_count_sip_response(g_metrics.sip_responses_relayed, atoi(first_line + 8));
             LOG_DEBUG("Proxied response for Call-ID %s to original caller (%s:%d).",
                         session->call_id, sockaddr_to_ip_str(&session->original_caller_addr),
                         ntohs(session->original_caller_addr.sin_port));
 
             if (strstr(first_line, "200 OK") && strstr(cseq_hdr, "INVITE")) {
+                if (session->state != CALL_STATE_ESTABLISHED) { // Not for retransmissions
+                    STATS_INC(calls_established);
+                    metrics_observe(&g_metrics.call_setup_answered, (uint32_t)(metrics_monotonic_ms() - session->invite_ms));
+                }
                 session->state = CALL_STATE_ESTABLISHED;
                 LOG_INFO("Call-ID %s state changed to ESTABLISHED.", session->call_id);
             } else if (strstr(first_line, "4") == first_line + 8 || strstr(first_line, "5") == first_line + 8 || strstr(first_line, "6") == first_line + 8) {
                 LOG_WARN("Received error response for Call-ID %s: %s", session->call_id, first_line);
+                STATS_INC(calls_rejected);
                 terminate_call_session(session);
             } else if (strstr(first_line, "180 Ringing") || strstr(first_line, "183 Session Progress")) {
+                if (session->state == CALL_STATE_INVITE_SENT) {
+                    metrics_observe(&g_metrics.call_setup_ringing, (uint32_t)(metrics_monotonic_ms() - session->invite_ms));
+                }
                 session->state = CALL_STATE_RINGING;
                 LOG_INFO("Call-ID %s state changed to RINGING.", session->call_id);
             }
@@ -429,6 +446,7 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
             return;
         }
         LOG_DEBUG("Identified incoming as SIP Request: %s.", method);
+        STATS_INC(sip_requests);
 
         char from_uri[MAX_CONTACT_URI_LEN] = "";
         char from_user_id[MAX_USER_ID_LEN] = "";
@@ -442,9 +460,10 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
 
         extract_uri_from_header(to_hdr, to_uri, sizeof(to_uri));
         parse_user_id_from_uri(to_uri, to_user_id, sizeof(to_user_id));
-
+        SIP_TRACE_MARK(SIP_STAGE_PARSED);
 
         if (strcmp(method, "REGISTER") == 0) {
+            STATS_INC(sip_registers);
             char expires_hdr[32] = "";
             extract_sip_header(buffer, "Expires:", expires_hdr,
                                sizeof(expires_hdr));
@@ -469,6 +488,7 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
 
             // Call simplified add_or_update_registered_user
             add_or_update_registered_user(from_user_id, display_name, expires);
+            SIP_TRACE_MARK(SIP_STAGE_LOOKUP);
 
             send_response_to_registered(sockfd,
                                         from_user_id,
@@ -478,13 +498,16 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
                                         from_hdr, to_hdr, via_hdr,
                                         contact_hdr, // Respond with client's Contact
                                         "Expires: 3600", NULL); // Default expiry is fine
+            SIP_TRACE_MARK(SIP_STAGE_FORWARDED);
             LOG_INFO("REGISTER processed for user %s from %s:%d. Expires: %d.",
                         from_user_id, sockaddr_to_ip_str(cliaddr),
                         ntohs(cliaddr->sin_port), expires);
 
         } else if (strcmp(method, "INVITE") == 0) {
             LOG_INFO("Received INVITE for %s from %s.", to_user_id, from_user_id);
+            STATS_INC(sip_invites);
             RegisteredUser *callee = find_registered_user(to_user_id);
+            SIP_TRACE_MARK(SIP_STAGE_LOOKUP);
             if (callee) {
                 // For simplified model, callee's IP/port are always derived via DNS + SIP_PORT
                 struct sockaddr_in resolved_callee_addr;
@@ -512,9 +535,11 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
                     }
                     freeaddrinfo(res);
                 }
+                SIP_TRACE_MARK(SIP_STAGE_RESOLVED);
 
                 if (!resolved) {
                     LOG_INFO("INVITE failed: Callee %s hostname '%s' could not be resolved or invalid IP.", to_user_id, hostname_to_resolve);
+                    STATS_INC(calls_rejected);
                     send_response_to_registered(sockfd, from_user_id, cliaddr, cli_len,
                                                 "SIP/2.0 404 Not Found", call_id_hdr, cseq_hdr,
                                                 from_hdr, to_hdr, via_hdr, NULL, NULL, NULL);
@@ -523,8 +548,10 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
                 resolved_callee_addr.sin_port = htons(SIP_PORT); // Always use SIP_PORT
 
                 CallSession *session = create_call_session();
+                SIP_TRACE_MARK(SIP_STAGE_SESSION);
                 if (!session) {
                     LOG_INFO("INVITE failed: Max call sessions reached.");
+                    STATS_INC(calls_rejected);
                     send_response_to_registered(sockfd,
                                                 from_user_id,
                                                 cliaddr, cli_len,
@@ -542,6 +569,7 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
                 session->from_tag[sizeof(session->from_tag) - 1] = '\0';
 
                 memcpy(&session->original_caller_addr, cliaddr, cli_len);
+                session->invite_ms = metrics_monotonic_ms();
                 memcpy(&session->callee_addr, &resolved_callee_addr, sizeof(resolved_callee_addr)); // Copy resolved address
 
                 LOG_DEBUG("Callee '%s' target: %s:%d",
@@ -566,11 +594,14 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
                 reconstruct_invite_message(buffer, new_request_line_uri, proxied_invite, sizeof(proxied_invite));
 
                 send_sip_message(sockfd, &session->callee_addr, sizeof(session->callee_addr), proxied_invite);
+                SIP_TRACE_MARK(SIP_STAGE_FORWARDED);
+                STATS_INC(calls_proxied);
                 LOG_INFO("Proxied INVITE for Call-ID %s from %s to %s.",
                             session->call_id, from_user_id, to_user_id);
 
             } else {
                 LOG_INFO("INVITE failed: Callee '%s' not found or not active.", to_user_id);
+                STATS_INC(calls_rejected);
                 send_response_to_registered(sockfd,
                                             from_user_id,
                                             cliaddr, cli_len,
@@ -582,7 +613,9 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
 
         } else if (strcmp(method, "BYE") == 0) {
             LOG_INFO("Received BYE for Call-ID %s.", call_id_hdr);
+            STATS_INC(sip_byes);
             CallSession *session = find_call_session_by_callid(call_id_hdr);
+            SIP_TRACE_MARK(SIP_STAGE_LOOKUP);
             if (session) {
                 session->state = CALL_STATE_TERMINATING;
 
@@ -603,6 +636,7 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
                 }
 
                 send_sip_message(sockfd, &other_party_addr, sizeof(other_party_addr), buffer);
+                SIP_TRACE_MARK(SIP_STAGE_FORWARDED);
 
                 send_response_to_registered(sockfd,
                                             from_user_id,
@@ -626,12 +660,15 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
 
         } else if (strcmp(method, "CANCEL") == 0) {
             LOG_INFO("Received CANCEL for Call-ID %s.", call_id_hdr);
+            STATS_INC(sip_cancels);
             CallSession *session = find_call_session_by_callid(call_id_hdr);
+            SIP_TRACE_MARK(SIP_STAGE_LOOKUP);
             if (session &&
                (session->state == CALL_STATE_INVITE_SENT ||
                 session->state == CALL_STATE_RINGING)) {
 
                 send_sip_message(sockfd, &session->callee_addr, sizeof(session->callee_addr), buffer);
+                SIP_TRACE_MARK(SIP_STAGE_FORWARDED);
                 LOG_DEBUG("Proxied CANCEL for Call-ID %s to callee (%s:%d).",
                             session->call_id, sockaddr_to_ip_str(&session->callee_addr),
                             ntohs(session->callee_addr.sin_port));
@@ -658,6 +695,7 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
 
         } else if (strcmp(method, "OPTIONS") == 0) {
             LOG_INFO("Received OPTIONS from %s:%d. Responding 200 OK.", sockaddr_to_ip_str(cliaddr), ntohs(cliaddr->sin_port));
+            STATS_INC(sip_options);
             send_response_to_registered(sockfd,
                                         from_user_id,
                                         cliaddr, cli_len,
@@ -667,12 +705,16 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
                                         NULL, // No specific contact URI to echo back for OPTIONS
                                         "Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REGISTER, SUBSCRIBE, NOTIFY, REFER, INFO, MESSAGE, UPDATE",
                                         NULL);
+            SIP_TRACE_MARK(SIP_STAGE_FORWARDED);
 
         } else if (strcmp(method, "ACK") == 0) {
             LOG_INFO("Received ACK for Call-ID %s.", call_id_hdr);
+            STATS_INC(sip_acks);
             CallSession *session = find_call_session_by_callid(call_id_hdr);
+            SIP_TRACE_MARK(SIP_STAGE_LOOKUP);
             if (session && session->state == CALL_STATE_ESTABLISHED) {
                 send_sip_message(sockfd, &session->callee_addr, sizeof(session->callee_addr), buffer);
+                SIP_TRACE_MARK(SIP_STAGE_FORWARDED);
                 LOG_DEBUG("Proxied ACK for Call-ID %s to callee.", session->call_id);
             } else {
                 LOG_WARN("Received ACK for no matching session or invalid state: Call-ID %s.", call_id_hdr);
@@ -681,6 +723,7 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
         else {
             LOG_WARN("Received unhandled SIP method: %s from %s:%d. Responding 501 Not Implemented.",
                         method, sockaddr_to_ip_str(cliaddr), ntohs(cliaddr->sin_port));
+            STATS_INC(sip_unhandled);
             send_response_to_registered(sockfd,
                                         from_user_id,
                                         cliaddr, cli_len,
@@ -691,3 +734,18 @@ void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
         }
     }
 }
+
+void process_incoming_sip_message(int sockfd, const char *buffer, ssize_t n,
+                                  const struct sockaddr_in *cliaddr, socklen_t cli_len) {
+    uint64_t start_us = metrics_monotonic_us();
+    if (sip_trace_enabled) {
+        sip_trace_begin(start_us);
+    }
+    handle_sip_message(sockfd, buffer, n, cliaddr, cli_len);
+    uint64_t done_us = metrics_monotonic_us();
+    MetricsSipKind kind = metrics_sip_kind(buffer);
+    metrics_observe(&g_metrics.sip_processing[kind], (uint32_t)(done_us - start_us));
+    if (sip_trace_enabled) {
+        sip_trace_end(done_us, kind, buffer, cliaddr);
+    }
+}
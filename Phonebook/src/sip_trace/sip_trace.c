@@ -0,0 +1,98 @@
+#define MODULE_NAME "TRACE"
+
+#include "sip_trace.h"
+#include "../common.h"
+#include "../sip_core/sip_core.h" // For get_first_line, extract_sip_header
+
+int sip_trace_enabled = 0;
+
+static int sample_rate = 0;
+static unsigned int sample_countdown = 0;
+
+static MetricsHistogram stage_histograms[METRICS_SIP_KIND_COUNT][SIP_STAGE_COUNT];
+
+// Message being processed
+static uint64_t current_received_us;
+static uint32_t current_stage_us[SIP_STAGE_COUNT];
+
+static SipTrace ring[SIP_TRACE_RING_SIZE];
+static int ring_next = 0;
+static int ring_count = 0;
+
+static const char *stage_names[SIP_STAGE_COUNT] = { "parsed", "lookup", "resolved", "session", "forwarded" };
+
+void sip_trace_configure(bool enabled, int sample) {
+    static const MetricsHistogram empty = { .scale = 1000000, .bounds = METRICS_SIP_US_BUCKETS };
+    if (enabled && stage_histograms[0][0].scale == 0) {
+        for (int k = 0; k < METRICS_SIP_KIND_COUNT; k++) {
+            for (int s = 0; s < SIP_STAGE_COUNT; s++) {
+                stage_histograms[k][s] = empty;
+            }
+        }
+    }
+    sample_rate = sample > 0 ? sample : 0;
+    sample_countdown = 0;
+    sip_trace_enabled = enabled;
+    LOG_INFO("SIP stage tracing %s (ring sample: %s%d).", enabled ? "enabled" : "disabled",
+             sample_rate ? "1 in " : "", sample_rate);
+}
+
+int sip_trace_sample_rate(void) {
+    return sample_rate;
+}
+
+void sip_trace_begin(uint64_t received_us) {
+    current_received_us = received_us;
+    for (int s = 0; s < SIP_STAGE_COUNT; s++) {
+        current_stage_us[s] = SIP_TRACE_NOT_REACHED;
+    }
+}
+
+void sip_trace_mark(SipStage stage) {
+    current_stage_us[stage] = (uint32_t)(metrics_monotonic_us() - current_received_us);
+}
+
+void sip_trace_end(uint64_t done_us, MetricsSipKind kind, const char *msg, const struct sockaddr_in *source) {
+    // Each reached stage is charged the time since the previous one (or since receive)
+    uint32_t previous = 0;
+    for (int s = 0; s < SIP_STAGE_COUNT; s++) {
+        if (current_stage_us[s] == SIP_TRACE_NOT_REACHED) continue;
+        uint32_t at = current_stage_us[s] > previous ? current_stage_us[s] : previous;
+        metrics_observe(&stage_histograms[kind][s], at - previous);
+        previous = at;
+    }
+
+    if (!sample_rate || sample_countdown-- > 0) {
+        return;
+    }
+    sample_countdown = (unsigned int)sample_rate - 1;
+
+    SipTrace *t = &ring[ring_next];
+    t->received = time(NULL);
+    t->kind = kind;
+    t->source = *source;
+    get_first_line(msg, t->first_line, sizeof(t->first_line));
+    t->call_id[0] = '\0';
+    extract_sip_header(msg, "Call-ID:", t->call_id, sizeof(t->call_id));
+    memcpy(t->stage_us, current_stage_us, sizeof(t->stage_us));
+    t->total_us = (uint32_t)(done_us - current_received_us);
+    ring_next = (ring_next + 1) % SIP_TRACE_RING_SIZE;
+    if (ring_count < SIP_TRACE_RING_SIZE) ring_count++;
+}
+
+const char *sip_stage_name(SipStage stage) {
+    return stage >= 0 && stage < SIP_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+const MetricsHistogram *sip_trace_histogram(MetricsSipKind kind, SipStage stage) {
+    return &stage_histograms[kind][stage];
+}
+
+int sip_trace_snapshot(SipTrace *out, int max) {
+    int n = ring_count < max ? ring_count : max;
+    int first = (ring_next - n + SIP_TRACE_RING_SIZE) % SIP_TRACE_RING_SIZE;
+    for (int i = 0; i < n; i++) {
+        out[i] = ring[(first + i) % SIP_TRACE_RING_SIZE];
+    }
+    return n;
+}
@@ -0,0 +1,60 @@
+// sip_trace.h
+#ifndef SIP_TRACE_H
+#define SIP_TRACE_H
+
+#include "../common.h"
+#include "../metrics/metrics.h"
+#include <stdint.h>
+
+// Per-stage latency of SIP message processing. sip_core marks the stages a
+// message goes through; the time spent reaching each one is aggregated per
+// message kind into histograms (exported as phonebook_sip_stage_seconds by
+// /metrics), and one message in 'sample' is copied whole into an in-memory
+// ring that 'dump traces' on the control socket returns.
+//
+// Everything runs on the SIP loop thread, which also serves the control
+// socket, so there are no locks. When tracing is off a mark is a single
+// test of sip_trace_enabled and nothing else.
+
+#define SIP_TRACE_RING_SIZE 64
+#define SIP_TRACE_NOT_REACHED UINT32_MAX
+
+// In the order a proxied INVITE goes through them; other messages skip some
+typedef enum {
+    SIP_STAGE_PARSED,     // Headers and URIs extracted
+    SIP_STAGE_LOOKUP,     // Registrar or call session lookup done
+    SIP_STAGE_RESOLVED,   // Callee resolved through DNS
+    SIP_STAGE_SESSION,    // Call session allocated
+    SIP_STAGE_FORWARDED,  // Proxied message or response sent
+    SIP_STAGE_COUNT
+} SipStage;
+
+typedef struct {
+    time_t received;                    // Wall clock, for reading the dump
+    MetricsSipKind kind;
+    struct sockaddr_in source;
+    char first_line[80];
+    char call_id[64];
+    uint32_t stage_us[SIP_STAGE_COUNT]; // Since receive, or SIP_TRACE_NOT_REACHED
+    uint32_t total_us;
+} SipTrace;
+
+extern int sip_trace_enabled; // SIP loop only; set through sip_trace_configure()
+
+#define SIP_TRACE_MARK(stage) do { if (sip_trace_enabled) sip_trace_mark(stage); } while (0)
+
+// enabled: aggregate stage histograms; sample: keep one message in 'sample' in the ring (0 = none).
+void sip_trace_configure(bool enabled, int sample);
+int sip_trace_sample_rate(void);
+
+void sip_trace_begin(uint64_t received_us);
+void sip_trace_mark(SipStage stage);
+void sip_trace_end(uint64_t done_us, MetricsSipKind kind, const char *msg, const struct sockaddr_in *source);
+
+const char *sip_stage_name(SipStage stage);
+const MetricsHistogram *sip_trace_histogram(MetricsSipKind kind, SipStage stage);
+
+// Copies up to 'max' traces from the ring, oldest first. Returns the number copied.
+int sip_trace_snapshot(SipTrace *out, int max);
+
+#endif // SIP_TRACE_H
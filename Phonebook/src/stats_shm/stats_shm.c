@@ -0,0 +1,150 @@
+#define MODULE_NAME "STATS"
+
+#include "stats_shm.h"
+#include "../common.h"
+#include "../phonebook_fetcher/phonebook_fetcher.h" // For FetchResult
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define STATS_READ_ATTEMPTS 1000
+
+static PhonebookStats private_stats;
+PhonebookStats *g_stats = &private_stats;
+
+int stats_shm_init(const char *path) {
+    // Built under a temporary name and renamed, so a reader never maps a half-initialized file
+    char tmp_path[MAX_CONFIG_PATH_LEN];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Cannot create stats segment '%s': %s", tmp_path, strerror(errno));
+        return 1;
+    }
+    if (ftruncate(fd, sizeof(PhonebookStats)) != 0) {
+        LOG_ERROR("Cannot size stats segment '%s': %s", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return 1;
+    }
+    PhonebookStats *seg = mmap(NULL, sizeof(PhonebookStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        LOG_ERROR("Cannot map stats segment '%s': %s", tmp_path, strerror(errno));
+        unlink(tmp_path);
+        return 1;
+    }
+
+    *seg = private_stats; // Keep anything counted before the segment existed
+    seg->layout = STATS_LAYOUT;
+    seg->size = sizeof(PhonebookStats);
+    seg->pid = (int32_t)getpid();
+    seg->started_at = (uint32_t)time(NULL);
+    if (seg->fetch_cycles == 0) {
+        seg->last_fetch_result = -1;
+    }
+    __atomic_store_n(&seg->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+    if (rename(tmp_path, path) != 0) {
+        LOG_ERROR("Cannot publish stats segment '%s': %s", path, strerror(errno));
+        munmap(seg, sizeof(PhonebookStats));
+        unlink(tmp_path);
+        return 1;
+    }
+    g_stats = seg;
+    LOG_INFO("Statistics published at %s (%zu bytes).", path, sizeof(PhonebookStats));
+    return 0;
+}
+
+void stats_shm_record_fetch(int result, long duration_ms, time_t finished) {
+    uint32_t seq = g_stats->seq;
+    __atomic_store_n(&g_stats->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    STATS_INC(fetch_cycles);
+    switch (result) {
+        case FETCH_RESULT_CHANGED:   STATS_INC(fetch_changed);   break;
+        case FETCH_RESULT_UNCHANGED: STATS_INC(fetch_unchanged); break;
+        default:                     STATS_INC(fetch_failed);    break;
+    }
+    STATS_SET(last_fetch_result, (int32_t)result);
+    STATS_SET(last_fetch_finished, (uint32_t)finished);
+    STATS_SET(last_fetch_duration_ms, (int32_t)duration_ms);
+
+    __atomic_store_n(&g_stats->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+// --- Reader ---
+
+typedef struct {
+    const char *name;
+    size_t offset;
+    bool is_signed;
+} StatsField;
+
+#define FIELD(name, is_signed) { #name, offsetof(PhonebookStats, name), is_signed }
+
+static const StatsField fields[] = {
+    FIELD(sip_requests, false), FIELD(sip_responses, false), FIELD(sip_registers, false),
+    FIELD(sip_invites, false), FIELD(sip_byes, false), FIELD(sip_cancels, false),
+    FIELD(sip_options, false), FIELD(sip_acks, false), FIELD(sip_unhandled, false),
+    FIELD(calls_proxied, false), FIELD(calls_established, false), FIELD(calls_rejected, false),
+    FIELD(active_calls, true), FIELD(registered_users, true), FIELD(directory_entries, true),
+    FIELD(fetch_cycles, false), FIELD(fetch_changed, false), FIELD(fetch_unchanged, false),
+    FIELD(fetch_failed, false), FIELD(last_fetch_duration_ms, true),
+    FIELD(http_requests, false), FIELD(http_not_modified, false), FIELD(control_requests, false),
+    FIELD(log_dropped, false),
+};
+
+int stats_shm_dump_json(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("{\"status\":\"error\",\"message\":\"No statistics segment at %s\"}\n", path);
+        return 1;
+    }
+    const PhonebookStats *seg = mmap(NULL, sizeof(PhonebookStats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED || __atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+        seg->layout != STATS_LAYOUT) {
+        printf("{\"status\":\"error\",\"message\":\"Statistics segment is not valid\"}\n");
+        if (seg != MAP_FAILED) munmap((void *)seg, sizeof(PhonebookStats));
+        return 1;
+    }
+    // An older writer maps less; the fields it does not have read as zero
+    size_t valid = seg->size < sizeof(PhonebookStats) ? seg->size : sizeof(PhonebookStats);
+
+    PhonebookStats copy = { 0 };
+    bool consistent = false;
+    for (int attempt = 0; attempt < STATS_READ_ATTEMPTS && !consistent; attempt++) {
+        uint32_t before = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        if (before & 1) {
+            sched_yield(); // Fetch report being written
+            continue;
+        }
+        memset(&copy, 0, sizeof(copy));
+        memcpy(&copy, seg, valid);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        consistent = __atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == before;
+    }
+    munmap((void *)seg, sizeof(PhonebookStats));
+
+    time_t now = time(NULL);
+    bool running = kill(copy.pid, 0) == 0 || errno == EPERM;
+    const char *last_result = copy.last_fetch_result >= 0 ? fetch_result_name((FetchResult)copy.last_fetch_result)
+                                                          : "none";
+
+    printf("{\"status\":\"ok\",\"running\":%s,\"consistent\":%s,\"pid\":%d,\"uptime_seconds\":%ld,"
+           "\"last_fetch_result\":\"%s\",\"last_fetch_age\":%ld",
+           running ? "true" : "false", consistent ? "true" : "false", copy.pid,
+           (long)(now - (time_t)copy.started_at), last_result,
+           copy.last_fetch_finished ? (long)(now - (time_t)copy.last_fetch_finished) : -1L);
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        const void *p = (const char *)&copy + fields[i].offset;
+        if (fields[i].is_signed) {
+            printf(",\"%s\":%d", fields[i].name, *(const int32_t *)p);
+        } else {
+            printf(",\"%s\":%u", fields[i].name, *(const uint32_t *)p);
+        }
+    }
+    printf("}\n");
+    return 0;
+}
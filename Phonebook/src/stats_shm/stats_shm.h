@@ -0,0 +1,89 @@
+// stats_shm.h
+#ifndef STATS_SHM_H
+#define STATS_SHM_H
+
+#include "../common.h"
+#include <stdint.h>
+
+// Daemon counters in a memory-mapped tmpfs file (PB_STATS_SHM_PATH). Readers
+// map it read-only and never talk to the daemon, so reading cannot block or
+// slow the SIP loop.
+//
+// Counters and gauges are single 32-bit words updated in place with relaxed
+// atomics; 32 bits keeps them lock-free on the 32-bit MIPS routers, where
+// 64-bit atomics would need libatomic. Fields that only make sense together
+// (the fetch cycle report) are written by one thread under a seqlock: 'seq'
+// is odd while they change, and a reader retries a copy taken while it was
+// odd or that saw it move. New fields are only appended; 'size' tells a
+// reader how much of the segment it may use, and 'layout' changes if an
+// existing field changes meaning.
+
+#define STATS_MAGIC 0x54534250u  // "PBST"
+#define STATS_LAYOUT 1
+
+typedef struct {
+    uint32_t magic;              // Written last, once the header is complete
+    uint32_t layout;
+    uint32_t size;               // sizeof(PhonebookStats) of the writer
+    uint32_t seq;                // Seqlock over the fetch fields
+    int32_t pid;
+    uint32_t started_at;         // Unix time
+
+    // SIP loop
+    uint32_t sip_requests;
+    uint32_t sip_responses;
+    uint32_t sip_registers;
+    uint32_t sip_invites;
+    uint32_t sip_byes;
+    uint32_t sip_cancels;
+    uint32_t sip_options;
+    uint32_t sip_acks;
+    uint32_t sip_unhandled;      // Answered 501
+    uint32_t calls_proxied;      // INVITEs forwarded to a callee
+    uint32_t calls_established;
+    uint32_t calls_rejected;     // 404/503 from us or an error response from the callee
+
+    // Gauges
+    int32_t active_calls;
+    int32_t registered_users;    // Dynamic registrations
+    int32_t directory_entries;
+
+    // Fetcher (seqlock)
+    uint32_t fetch_cycles;
+    uint32_t fetch_changed;
+    uint32_t fetch_unchanged;
+    uint32_t fetch_failed;
+    int32_t last_fetch_result;   // FetchResult, -1 before the first cycle
+    uint32_t last_fetch_finished;
+    int32_t last_fetch_duration_ms;
+
+    // Servers
+    uint32_t http_requests;
+    uint32_t http_not_modified;
+    uint32_t control_requests;
+
+    // Logger
+    uint32_t log_dropped;        // Messages dropped because the log ring was full
+} PhonebookStats;
+
+// Points at the mapped segment, or at a private copy if it could not be created. Never NULL.
+extern PhonebookStats *g_stats;
+
+#define STATS_INC(field)        __atomic_fetch_add(&g_stats->field, 1, __ATOMIC_RELAXED)
+#define STATS_DEC(field)        __atomic_fetch_sub(&g_stats->field, 1, __ATOMIC_RELAXED)
+#define STATS_SET(field, value) __atomic_store_n(&g_stats->field, (value), __ATOMIC_RELAXED)
+
+// Creates the segment at 'path' (replacing the one of a previous run). Returns 0 on success, 1 on error.
+int stats_shm_init(const char *path);
+
+// Seqlock writer for the fetch fields. Only the fetcher thread calls this.
+void stats_shm_record_fetch(int result, long duration_ms, time_t finished);
+
+/**
+ * @brief Maps the segment at 'path' read-only and prints it to stdout as JSON.
+ *
+ * @return 0 on success, 1 if there is no valid segment.
+ */
+int stats_shm_dump_json(const char *path);
+
+#endif // STATS_SHM_H
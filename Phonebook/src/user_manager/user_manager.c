@@ -1,31 +1,9 @@
 #include "user_manager.h" // This include remains the same, as the header will be in the same new directory
 #include "../common.h" // This now includes necessary system headers and core types
+#include "../stats_shm/stats_shm.h" // For the user gauges
 
 #define MODULE_NAME "USER"
 
-static void trim_whitespace(char *str) {
-    if (!str || *str == '\0') {
-        return;
-    }
-
-    char *first_char = str;
-    while (isspace((unsigned char)*first_char)) {
-        first_char++;
-    }
-
-    char *end_char = first_char + strlen(first_char) - 1;
-    while (end_char > first_char && isspace((unsigned char)*end_char)) {
-        end_char--;
-    }
-
-    *(end_char + 1) = '\0';
-
-    if (str != first_char) {
-        memmove(str, first_char, strlen(first_char) + 1);
-    }
-}
-
-
 RegisteredUser* find_registered_user(const char *user_id) {
     pthread_mutex_lock(&registered_users_mutex);
     for (int i = 0; i < MAX_REGISTERED_USERS; i++) {
@@ -67,6 +45,7 @@ RegisteredUser* add_or_update_registered_user(const char *user_id,
             // user->user_id is already MAX_PHONE_NUMBER_LEN, assumed to be same as user_id from REGISTER
             // strncpy(user->user_id, user_id, MAX_PHONE_NUMBER_LEN - 1); // Not needed here, user_id is the key
             user->user_id[MAX_PHONE_NUMBER_LEN - 1] = '\0'; // Ensure null-termination if user_id was updated
+            user->is_registered = true;
             // No longer storing contact_uri, ip_address, port, registration_time here
             
             if (strlen(display_name) > 0 && strcmp(user->display_name, display_name) != 0) {
@@ -80,16 +59,19 @@ RegisteredUser* add_or_update_registered_user(const char *user_id,
                     LOG_INFO("Directory user '%s' (%s) now dynamically active.", user_id, user->display_name);
                 } else {
                     num_registered_users++; // Count dynamic registrations
+                    STATS_SET(registered_users, num_registered_users);
                     LOG_INFO("Activated existing dynamic registration for user '%s' (%s). Total active dynamic: %d.", user_id, user->display_name, num_registered_users);
                 }
             } else {
                 LOG_INFO("Refreshed dynamic registration for user '%s' (%s).", user_id, user->display_name);
             }
         } else { // expires == 0, deactivate
+            user->is_registered = false;
             if (user->is_active) {
                 user->is_active = false;
                 if(!user->is_known_from_directory) { // Only decrement if it was a purely dynamic registration
                    num_registered_users--;
+                   STATS_SET(registered_users, num_registered_users);
                    LOG_INFO("Deactivated dynamic registration for user '%s' (%s). Remaining active dynamic: %d.", user_id, user->display_name, num_registered_users);
                    // Clear the slot if it was purely dynamic and now inactive
                    user->user_id[0] = '\0';
@@ -116,7 +98,9 @@ RegisteredUser* add_or_update_registered_user(const char *user_id,
                         newu->display_name[MAX_DISPLAY_NAME_LEN - 1] = '\0';
                         newu->is_active = true;
                         newu->is_known_from_directory = false; // This is a new dynamic registration
+                        newu->is_registered = true;
                         num_registered_users++;
+                        STATS_SET(registered_users, num_registered_users);
                         LOG_INFO("New dynamic registration for user '%s' (%s). Total active dynamic: %d.", user_id, display_name, num_registered_users);
                         pthread_mutex_unlock(&registered_users_mutex);
                         return newu;
@@ -156,12 +140,22 @@ RegisteredUser* add_csv_user_to_registered_users_table(const char *user_id_numer
         } else {
             LOG_DEBUG("CSV/directory user '%s' already exists with same display name.", user_id_numeric);
         }
-        existing->is_known_from_directory = true; // Confirm it's from directory
+        if (!existing->is_known_from_directory) {
+            // A dynamic registration the phonebook now lists: the slot moves from the
+            // dynamic count to the directory count, so each slot is counted once
+            if (existing->is_active) {
+                num_registered_users--;
+                STATS_SET(registered_users, num_registered_users);
+            }
+            num_directory_entries++;
+            STATS_SET(directory_entries, num_directory_entries);
+            existing->is_known_from_directory = true;
+            LOG_DEBUG("Dynamic registration '%s' is now also a CSV/directory user.", user_id_numeric);
+        }
         // Keep active, regardless of previous dynamic state (since it's in the directory)
         if (!existing->is_active) {
             existing->is_active = true; // Mark active if it was inactive
-            // num_registered_users not incremented as this is not a new dynamic registration
-            // num_directory_entries is incremented only when new slot is used
+            // Already counted as a directory entry; num_registered_users counts dynamic-only slots
             LOG_INFO("CSV/directory user '%s' (%s) marked active from phonebook.", user_id_numeric, display_name);
         }
 
@@ -174,7 +168,7 @@ RegisteredUser* add_csv_user_to_registered_users_table(const char *user_id_numer
         for (int i = 0; i < MAX_REGISTERED_USERS; i++) {
             if (registered_users[i].user_id[0] == '\0') { // Found empty slot
                 RegisteredUser *u = &registered_users[i];
-                // user_id_numeric is now sanitized by populate_registered_users_from_csv before this call
+                // user_id_numeric is already sanitized and trimmed by the phonebook model
                 strncpy(u->user_id, user_id_numeric, MAX_PHONE_NUMBER_LEN - 1);
                 u->user_id[MAX_PHONE_NUMBER_LEN - 1] = '\0';
                 strncpy(u->display_name, display_name, MAX_DISPLAY_NAME_LEN - 1);
@@ -183,6 +177,7 @@ RegisteredUser* add_csv_user_to_registered_users_table(const char *user_id_numer
                 u->is_active = true; // Directory users are considered active by default
                 u->is_known_from_directory = true;
                 num_directory_entries++;
+                STATS_SET(directory_entries, num_directory_entries);
                 // Changed log level from INFO to DEBUG and removed total count
                 LOG_DEBUG("Added new CSV/directory user '%s' (%s).", user_id_numeric, display_name);
                 pthread_mutex_unlock(&registered_users_mutex);
@@ -201,102 +196,75 @@ void init_registered_users_table() {
     for (int i = 0; i < MAX_REGISTERED_USERS; i++) {
         registered_users[i].is_active = false;
         registered_users[i].is_known_from_directory = false;
+        registered_users[i].is_registered = false;
         registered_users[i].user_id[0] = '\0';
         registered_users[i].display_name[0] = '\0';
         // No need to clear removed fields
     }
     num_registered_users = 0; // Reset dynamic count
+    STATS_SET(registered_users, num_registered_users);
     num_directory_entries = 0; // Reset directory count
+    STATS_SET(directory_entries, num_directory_entries);
     LOG_DEBUG("Initialized user tables (cleared all entries).");
     pthread_mutex_unlock(&registered_users_mutex);
 }
 
-void populate_registered_users_from_csv(const char *filepath) {
-    FILE *fp = fopen(filepath, "r");
-    if (!fp) {
-        LOG_ERROR("Failed to open CSV phonebook file '%s' for populating registered users.",
-                    filepath);
-        return;
-    }
-    LOG_INFO("Populating registered users from CSV '%s'...", filepath);
+void populate_registered_users_from_model(const PhonebookModel *model) {
+    LOG_INFO("Populating registered users from phonebook model (%d entries)...", model->count);
 
     init_registered_users_table(); // Clear all existing entries first
 
-    char line[2048];
-    int ln = 0;
-    while (fgets(line, sizeof(line), fp)) {
-        if (ln++ == 0) continue; // Skip header
+    for (int i = 0; i < model->count; i++) {
+        char full_name[MAX_DISPLAY_NAME_LEN];
+        phonebook_model_format_name(&model->entries[i], full_name, sizeof(full_name));
+        add_csv_user_to_registered_users_table(model->entries[i].user_id, full_name);
+    }
+    LOG_INFO("Finished populating registered users from CSV. Total directory entries: %d.", num_directory_entries);
+}
 
-        char *cols[5] = {NULL};
-        char *p = line;
-        for (int i=0; i<5; i++) {
-            if (i<4) {
-                char *c = strchr(p, ',');
-                if (c) {
-                    *c = '\0';
-                    cols[i] = p;
-                    p = c+1;
-                } else {
-                    cols[i] = p;
-                    p = NULL;
-                }
-            } else {
-                cols[i] = p;
-            }
-            if (!p && i < 4) { // Only break if missing expected columns before the last one
-                LOG_WARN("Line %d has fewer than 5 columns. Missing column %d and subsequent. Line: '%.*s'", ln, i+1, (int)strcspn(line, "\r\n"), line);
+void remove_csv_user_from_registered_users_table(const char *user_id_numeric) {
+    pthread_mutex_lock(&registered_users_mutex);
+    for (int i = 0; i < MAX_REGISTERED_USERS; i++) {
+        RegisteredUser *u = &registered_users[i];
+        if (u->user_id[0] != '\0' && u->is_known_from_directory && strcmp(u->user_id, user_id_numeric) == 0) {
+            u->is_known_from_directory = false;
+            num_directory_entries--;
+            STATS_SET(directory_entries, num_directory_entries);
+            if (u->is_registered && u->is_active) {
+                // Still registered: it stays as a dynamic registration
+                num_registered_users++;
+                STATS_SET(registered_users, num_registered_users);
+                LOG_DEBUG("CSV/directory user '%s' (%s) removed from the phonebook, kept as dynamic registration.",
+                          user_id_numeric, u->display_name);
                 break;
             }
+            LOG_DEBUG("Removed CSV/directory user '%s' (%s).", user_id_numeric, u->display_name);
+            u->user_id[0] = '\0';
+            u->display_name[0] = '\0';
+            u->is_active = false;
+            u->is_registered = false;
+            break;
         }
+    }
+    pthread_mutex_unlock(&registered_users_mutex);
+}
 
-        if (cols[4]) {
-            char *e = strchr(cols[4], ','); // Handle potential extra commas in last field
-            if (e) *e = '\0';
-            cols[4][strcspn(cols[4], "\r\n")] = '\0'; // Remove newline
-        }
-        if (!cols[4] || !*cols[4]) {
-            LOG_WARN("Skipping CSV row %d due to missing or empty Telephone number (column 5). Line: '%.*s'", ln, (int)strcspn(line, "\r\n"), line);
-            continue;
-        }
-
-        char s0[MAX_FIRST_NAME_LEN]={0}, s1[MAX_NAME_LEN]={0}, s2[MAX_CALLSIGN_LEN]={0};
-        char sanitized_user_id_numeric[MAX_PHONE_NUMBER_LEN] = {0}; // New buffer for sanitized user_id
-
-        sanitize_utf8(cols[0] ? cols[0] : "", s0, sizeof(s0));
-        sanitize_utf8(cols[1] ? cols[1] : "", s1, sizeof(s1));
-        sanitize_utf8(cols[2] ? cols[2] : "", s2, sizeof(s2));
-        sanitize_utf8(cols[4] ? cols[4] : "", sanitized_user_id_numeric, sizeof(sanitized_user_id_numeric)); // Sanitize user ID
-
-        trim_whitespace(s0);
-        trim_whitespace(s1);
-        trim_whitespace(s2);
-        trim_whitespace(sanitized_user_id_numeric); // Also trim whitespace from the sanitized user ID
-
-        char full_name[MAX_DISPLAY_NAME_LEN];
-        if (s0[0] && s1[0] && s2[0]) {
-            snprintf(full_name, sizeof(full_name), "%s %s (%s)", s0, s1, s2);
-        } else if (s0[0] && s1[0]) {
-            snprintf(full_name, sizeof(full_name), "%s %s", s0, s1);
-        } else if (s0[0]) {
-            strncpy(full_name, s0, sizeof(full_name) - 1);
-            full_name[sizeof(full_name) - 1] = '\0';
-        } else if (s1[0]) {
-            strncpy(full_name, s1, sizeof(full_name) - 1);
-            full_name[sizeof(full_name) - 1] = '\0';
-        } else if (s2[0]) {
-            strncpy(full_name, s2, sizeof(full_name) - 1);
-            full_name[sizeof(full_name) - 1] = '\0';
+void apply_phonebook_changes_to_registered_users(const PhonebookChangeSet *changes) {
+    // Removals first so their slots are free for additions
+    for (int i = 0; i < changes->count; i++) {
+        if (changes->changes[i].type == PB_CHANGE_REMOVE) {
+            remove_csv_user_from_registered_users_table(changes->changes[i].old_entry->user_id);
         }
-        else {
-            strncpy(full_name, "Unnamed", sizeof(full_name) - 1);
-            full_name[sizeof(full_name) - 1] = '\0';
+    }
+    for (int i = 0; i < changes->count; i++) {
+        const PhonebookChange *c = &changes->changes[i];
+        if (c->type != PB_CHANGE_REMOVE) {
+            char full_name[MAX_DISPLAY_NAME_LEN];
+            phonebook_model_format_name(c->new_entry, full_name, sizeof(full_name));
+            add_csv_user_to_registered_users_table(c->new_entry->user_id, full_name);
         }
-
-        // Pass the new, sanitized_user_id_numeric buffer
-        add_csv_user_to_registered_users_table(sanitized_user_id_numeric, full_name);
     }
-    fclose(fp);
-    LOG_INFO("Finished populating registered users from CSV. Total directory entries: %d.", num_directory_entries);
+    LOG_INFO("Applied phonebook changes to registered users. Total directory entries: %d.", num_directory_entries);
 }
 
 void load_directory_from_xml(const char *filepath) {
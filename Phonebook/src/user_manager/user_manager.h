@@ -3,6 +3,7 @@
 #define USER_MANAGER_H
 
 #include "../common.h" // For RegisteredUser type and other common definitions
+#include "../phonebook_model/phonebook_model.h"
 
 // Function prototypes for user management
 RegisteredUser* find_registered_user(const char *user_id);
@@ -10,7 +11,11 @@ RegisteredUser* find_registered_user(const char *user_id);
 RegisteredUser* add_or_update_registered_user(const char *user_id, const char *display_name, int expires);
 RegisteredUser* add_csv_user_to_registered_users_table(const char *user_id_numeric, const char *display_name);
 void init_registered_users_table();
-void populate_registered_users_from_csv(const char *filepath);
+void populate_registered_users_from_model(const PhonebookModel *model);
+// Removes a directory user; dynamic-only registrations are left alone.
+void remove_csv_user_from_registered_users_table(const char *user_id_numeric);
+// Applies a phonebook diff to the user table without touching unchanged entries.
+void apply_phonebook_changes_to_registered_users(const PhonebookChangeSet *changes);
 void load_directory_from_xml(const char *filepath); // Deprecated but retained prototype
 
 #endif // USER_MANAGER_H
@@ -0,0 +1,149 @@
+// bench_copy.c
+//
+// Time to publish a temporary file from /tmp into a directory, for 1 MB and
+// 10 MB files:
+//
+//   stdio   the 4 KB fread/fwrite loop file_utils_copy_file() used to be
+//   kernel  file_utils_copy_file(): copy_file_range, sendfile or read/write
+//   move    file_utils_copy_file_ex() with FILE_UTILS_COPY_MOVE_IF_SAME_FS, a
+//           rename when the directory shares /tmp's filesystem and a kernel
+//           copy otherwise
+//
+//   bench_copy [-r runs] dir...     (default 5 runs; best run reported)
+//
+// All three fsync the destination, as the daemon does. The request's targets
+// are tmpfs and flash; on a node that means /tmp and /www, or a loop-mounted
+// jffs2/ubifs image on a build host whose kernel has those filesystems:
+//
+//   bench_copy /tmp /www/arednstack
+//
+// Build: make -C Phonebook/tools bench_copy
+
+#include "common.h"
+#include "file_utils/file_utils.h"
+#include "log_manager/log_manager.h"
+
+#define RUNS_DEFAULT 5
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// The copy loop as it was before the kernel-assisted version
+static int stdio_copy(const char *src, const char *dst) {
+    FILE *fsrc = fopen(src, "rb");
+    FILE *fdst = fsrc ? fopen(dst, "wb") : NULL;
+    if (!fdst) {
+        if (fsrc) fclose(fsrc);
+        return 1;
+    }
+    char buf[4096];
+    size_t bytes;
+    int ret = 0;
+    while ((bytes = fread(buf, 1, sizeof(buf), fsrc)) > 0) {
+        if (fwrite(buf, 1, bytes, fdst) != bytes) {
+            ret = 1;
+            break;
+        }
+    }
+    fflush(fdst);
+    fsync(fileno(fdst));
+    fclose(fdst);
+    fclose(fsrc);
+    return ret;
+}
+
+static int make_source(const char *path, size_t size) {
+    char *data = malloc(size);
+    if (!data) {
+        return 1;
+    }
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < size; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5; // Incompressible, for filesystems that compress
+        data[i] = (char)x;
+    }
+    FILE *fp = fopen(path, "wb");
+    int ret = !fp || fwrite(data, 1, size, fp) != size;
+    if (fp && fclose(fp) != 0) ret = 1;
+    free(data);
+    return ret;
+}
+
+static bool same_content(const char *a, const char *b) {
+    char *da, *db;
+    size_t la, lb;
+    if (file_utils_read_file(a, &da, &la) != 0) return false;
+    if (file_utils_read_file(b, &db, &lb) != 0) {
+        free(da);
+        return false;
+    }
+    bool same = la == lb && memcmp(da, db, la) == 0;
+    free(da);
+    free(db);
+    return same;
+}
+
+int main(int argc, char **argv) {
+    int runs = RUNS_DEFAULT;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        if (opt == 'r') {
+            runs = atoi(optarg);
+        } else {
+            runs = 0;
+        }
+    }
+    if (runs < 1 || optind >= argc) {
+        fprintf(stderr, "Usage: %s [-r runs] dir...\n", argv[0]);
+        return 2;
+    }
+    log_set_level(LOG_LEVEL_WARNING);
+
+    static const size_t sizes[] = { 1 << 20, 10 << 20 };
+    char reference[64], source[64];
+    snprintf(reference, sizeof(reference), "/tmp/bench_copy.%d.ref", (int)getpid());
+    snprintf(source, sizeof(source), "/tmp/bench_copy.%d.src", (int)getpid());
+
+    printf("%-24s %6s %10s %10s %10s\n", "directory", "size", "stdio ms", "kernel ms", "move ms");
+    for (int d = optind; d < argc; d++) {
+        char dst[MAX_CONFIG_PATH_LEN];
+        snprintf(dst, sizeof(dst), "%s/bench_copy.%d.dst", argv[d], (int)getpid());
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            if (make_source(reference, sizes[s]) != 0) {
+                fprintf(stderr, "Cannot create %s.\n", reference);
+                return 1;
+            }
+            double best[3] = { 1e12, 1e12, 1e12 };
+            bool ok = true;
+            for (int r = 0; r < runs && ok; r++) {
+                for (int method = 0; method < 3 && ok; method++) {
+                    remove(dst);
+                    const char *from = reference;
+                    if (method == 2) {
+                        file_utils_copy_file(reference, source); // Fresh temp file to consume
+                        from = source;
+                    }
+                    double start = now_ms();
+                    int ret = method == 0 ? stdio_copy(from, dst)
+                            : method == 1 ? file_utils_copy_file(from, dst)
+                                          : file_utils_copy_file_ex(from, dst, FILE_UTILS_COPY_MOVE_IF_SAME_FS);
+                    double ms = now_ms() - start;
+                    ok = ret == 0 && same_content(reference, dst);
+                    if (ms < best[method]) best[method] = ms;
+                }
+            }
+            remove(dst);
+            remove(source);
+            if (!ok) {
+                fprintf(stderr, "Copy to %s failed or differs from the source.\n", argv[d]);
+                return 1;
+            }
+            printf("%-24s %4zuMB %10.2f %10.2f %10.2f\n", argv[d], sizes[s] >> 20, best[0], best[1], best[2]);
+        }
+    }
+    remove(reference);
+    return 0;
+}
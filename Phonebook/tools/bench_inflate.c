@@ -0,0 +1,145 @@
+// bench_inflate.c
+//
+// Compares a compressed phonebook download with an uncompressed one: bytes on
+// the wire, and CPU time to get the body into a PhonebookModel (parsing only,
+// or inflating with gzip_inflate_stream and parsing).
+//
+//   bench_inflate [rows] [iterations]      synthetic phonebook (default 5000 rows)
+//   bench_inflate -f phonebook.csv.gz [iterations]
+//
+// The synthetic phonebook is compressed with the daemon's own encoder, which
+// only uses fixed Huffman codes; a file made with "gzip -9" shows the ratio a
+// web server's gzip achieves.
+//
+// Build: make -C Phonebook/tools bench_inflate
+
+#include "common.h"
+#include "gzip_deflate/gzip_deflate.h"
+#include "gzip_inflate/gzip_inflate.h"
+#include "file_utils/file_utils.h"
+#include "phonebook_model/phonebook_model.h"
+
+#define READ_CHUNK 1460 // One TCP segment per read, as the fetcher sees them
+
+static const char *first_names[] = { "Anna", "Bruno", "Claudia", "Daniel", "Eva", "Felix", "Gabi", "Hans",
+                                     "Ines", "Jonas", "Karin", "Lukas", "Maria", "Niklaus", "Olga", "Peter" };
+static const char *names[] = { "Muller", "Meier", "Schmid", "Keller", "Weber", "Huber", "Schneider", "Meyer",
+                               "Steiner", "Fischer", "Gerber", "Brunner", "Baumann", "Frei", "Zimmermann", "Moser" };
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+} Body;
+
+static ssize_t body_read(void *ctx, unsigned char *buf, size_t len) {
+    Body *b = ctx;
+    size_t n = b->len - b->pos;
+    if (n > len) n = len;
+    if (n > READ_CHUNK) n = READ_CHUNK;
+    memcpy(buf, b->data + b->pos, n);
+    b->pos += n;
+    return (ssize_t)n;
+}
+
+static int model_write(void *ctx, const unsigned char *data, size_t len) {
+    return phonebook_model_feed(ctx, (const char *)data, len);
+}
+
+static double cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *synthetic_csv(int rows, size_t *len) {
+    size_t cap = 64 + (size_t)rows * 64;
+    char *csv = malloc(cap);
+    if (!csv) {
+        return NULL;
+    }
+    size_t n = (size_t)snprintf(csv, cap, "First,Name,Callsign,IP,Telephone\n");
+    for (int i = 0; i < rows; i++) {
+        n += (size_t)snprintf(csv + n, cap - n, "%s,%s,HB9%c%c%c,,%d\n", first_names[(i * 7) % 16],
+                              names[(i * 11 / 3) % 16], 'A' + i % 26, 'A' + (i / 26) % 26, 'A' + (i / 676) % 26,
+                              100000 + i * 37 % 900000);
+    }
+    *len = n;
+    return csv;
+}
+
+int main(int argc, char **argv) {
+    int rows = 5000, iterations = 50;
+    char *csv = NULL;
+    size_t csv_len = 0;
+    unsigned char *gz = NULL;
+    size_t gz_len = 0;
+
+    if (argc > 2 && strcmp(argv[1], "-f") == 0) {
+        char *file;
+        if (file_utils_read_file(argv[2], &file, &gz_len) != 0) {
+            fprintf(stderr, "Cannot read '%s'.\n", argv[2]);
+            return 1;
+        }
+        gz = (unsigned char *)file;
+        if (argc > 3) iterations = atoi(argv[3]);
+    } else {
+        if (argc > 1) rows = atoi(argv[1]);
+        if (argc > 2) iterations = atoi(argv[2]);
+        csv = synthetic_csv(rows, &csv_len);
+        if (!csv || gzip_deflate_buffer((unsigned char *)csv, csv_len, &gz, &gz_len) != 0) {
+            fprintf(stderr, "Out of memory.\n");
+            return 1;
+        }
+    }
+    if (iterations < 1) {
+        fprintf(stderr, "Iterations must be at least 1.\n");
+        return 2;
+    }
+
+    // Compressed path: inflate straight into the model, as the fetcher does
+    PhonebookModel model;
+    double inflate_cpu = 0;
+    for (int i = 0; i < iterations; i++) {
+        Body body = { gz, gz_len, 0 };
+        phonebook_model_init(&model);
+        double start = cpu_seconds();
+        int result = gzip_inflate_stream(INFLATE_FORMAT_GZIP, body_read, &body, model_write, &model,
+                                         MAX_PHONEBOOK_CSV_BYTES, NULL, NULL);
+        phonebook_model_finish(&model);
+        inflate_cpu += cpu_seconds() - start;
+        if (result != INFLATE_OK) {
+            fprintf(stderr, "Inflate failed (%d).\n", result);
+            return 1;
+        }
+        if (!csv) {
+            csv = malloc(model.csv_len); // Decoded file is the uncompressed baseline
+            memcpy(csv, model.csv_data, model.csv_len);
+            csv_len = model.csv_len;
+        }
+        rows = model.count;
+        phonebook_model_free(&model);
+    }
+
+    // Uncompressed path: the same body fed in segment-sized reads
+    double plain_cpu = 0;
+    for (int i = 0; i < iterations; i++) {
+        phonebook_model_init(&model);
+        double start = cpu_seconds();
+        for (size_t pos = 0; pos < csv_len; pos += READ_CHUNK) {
+            phonebook_model_feed(&model, csv + pos, csv_len - pos < READ_CHUNK ? csv_len - pos : READ_CHUNK);
+        }
+        phonebook_model_finish(&model);
+        plain_cpu += cpu_seconds() - start;
+        phonebook_model_free(&model);
+    }
+
+    printf("%d rows, %d iterations\n", rows, iterations);
+    printf("bytes on wire:  plain %zu, gzip %zu (%.1fx smaller)\n", csv_len, gz_len, (double)csv_len / gz_len);
+    printf("cpu per fetch:  plain %.3f ms, gzip %.3f ms (inflate adds %.3f ms, %.1f MB/s)\n",
+           plain_cpu * 1e3 / iterations, inflate_cpu * 1e3 / iterations, (inflate_cpu - plain_cpu) * 1e3 / iterations,
+           csv_len * iterations / (inflate_cpu - plain_cpu) / 1e6);
+    free(csv);
+    free(gz);
+    return 0;
+}
@@ -0,0 +1,119 @@
+// bench_log.c
+//
+// Cost of a LOG_* call on the calling thread. The INVITE path logs a handful
+// of INFO lines per call, so messages go out in bursts of six with a pause
+// between bursts: first with every call formatted and sent to syslog on the
+// spot (the logger's path before log_init(), and what every call did before
+// the ring), then through the ring and the writer thread.
+//
+// Then the cost of a LOG_DEBUG line below the level, with arguments like the
+// SIP code's (sockaddr_to_ip_str() and a message): LOG_DEBUG checks the level
+// before evaluating them, where it used to evaluate them and make the call.
+//
+//   bench_log [bursts]     (default 2000)
+//
+// Both runs ship to syslog opened as log_init() opens it. Without a syslog
+// daemon (no /dev/log, as on many build hosts) every message then goes to the
+// console, which is far slower than a send: the synchronous figure grows and
+// the writer falls behind, so the ring drops. Run it on a node for the
+// figures that matter.
+//
+// Build: make -C Phonebook/tools bench_log
+
+#include <stdarg.h>
+#include <syslog.h>
+
+static const int syslog_options = LOG_PID | LOG_CONS | LOG_NDELAY; // As log_init() opens syslog
+static const int syslog_facility = LOG_DAEMON;
+
+// syslog.h's level constants give way to the daemon's logging macros
+#undef LOG_INFO
+#undef LOG_DEBUG
+
+#include "common.h"
+#include "log_manager/log_manager.h"
+
+#define MODULE_NAME "SIP"
+
+#define BURST_CALLS 6
+#define BURST_PAUSE_US 2000
+#define DEBUG_CALLS 10000000
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Mean nanoseconds per LOG_INFO call over 'bursts' bursts
+static double time_info_calls(int bursts) {
+    uint64_t total = 0;
+    for (int b = 0; b < bursts; b++) {
+        uint64_t start = now_ns();
+        for (int i = 0; i < BURST_CALLS; i++) {
+            LOG_INFO("Proxied INVITE for Call-ID %s from %s to %s.", "a84b4c76e66710@pc33.example.com", "100201",
+                     "100305");
+        }
+        total += now_ns() - start;
+        usleep(BURST_PAUSE_US);
+    }
+    return (double)total / ((double)bursts * BURST_CALLS);
+}
+
+// What a disabled LOG_DEBUG used to cost: arguments evaluated, then a call
+// that checks the level
+static void __attribute__((noinline)) level_checked_inside(int level, const char *format, ...) {
+    if (level > log_get_level()) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args); // Not reached at level info
+    va_end(args);
+}
+
+// Mean nanoseconds per disabled debug line, the way it is written now or as it used to expand
+static double time_disabled_debug(bool checked_inside) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(SIP_PORT) };
+    inet_pton(AF_INET, "10.1.2.3", &addr.sin_addr);
+    const char *msg = "INVITE sip:100305@10.1.2.3 SIP/2.0\r\n";
+    uint64_t start = now_ns();
+    for (int i = 0; i < DEBUG_CALLS; i++) {
+        if (checked_inside) {
+            level_checked_inside(LOG_LEVEL_DEBUG, "Proxied SIP message to %s:%d (bytes: %d):\n%s",
+                                 sockaddr_to_ip_str(&addr), ntohs(addr.sin_port), i, msg);
+        } else {
+            LOG_DEBUG("Proxied SIP message to %s:%d (bytes: %d):\n%s", sockaddr_to_ip_str(&addr),
+                      ntohs(addr.sin_port), i, msg);
+        }
+        __asm__ volatile("" ::: "memory"); // Keep the loop
+    }
+    return (double)(now_ns() - start) / DEBUG_CALLS;
+}
+
+int main(int argc, char **argv) {
+    int bursts = argc > 1 ? atoi(argv[1]) : 2000;
+    if (bursts < 1) {
+        fprintf(stderr, "Usage: %s [bursts]\n", argv[0]);
+        return 2;
+    }
+    log_set_level(LOG_LEVEL_INFO);
+
+    openlog(APP_NAME, syslog_options, syslog_facility);
+    double sync_ns = time_info_calls(bursts);
+    closelog();
+
+    log_init(APP_NAME);
+    double ring_ns = time_info_calls(bursts);
+    uint32_t dropped = log_dropped_count();
+    log_shutdown();
+
+    printf("LOG_INFO, %d bursts of %d calls:\n", bursts, BURST_CALLS);
+    printf("  straight to syslog: %8.0f ns per call\n", sync_ns);
+    printf("  through the ring:   %8.0f ns per call (%u dropped)\n", ring_ns, dropped);
+
+    printf("LOG_DEBUG at level info, %d calls:\n", DEBUG_CALLS);
+    printf("  checked inside the call:         %6.2f ns per call\n", time_disabled_debug(true));
+    printf("  checked before the arguments:    %6.2f ns per call\n", time_disabled_debug(false));
+    return 0;
+}
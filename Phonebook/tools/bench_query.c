@@ -0,0 +1,136 @@
+// bench_query.c
+//
+// Latency of directory searches (directory_render_query) on a large synthetic
+// phonebook, next to a linear scan of every entry's fields as the baseline
+// the prefix index replaces. Each query renders one Yealink page of 32
+// results, as a phone's remote search would request it.
+//
+//   bench_query [entries] [iterations]     (default 50000 entries, 2000 iterations)
+//
+// Build: make -C Phonebook/tools bench_query
+
+#include "common.h"
+#include "directory_render/directory_render.h"
+#include "phonebook_model/phonebook_model.h"
+#include <strings.h>
+
+static const char *first_names[] = { "Anna", "Bruno", "Claudia", "Daniel", "Eva", "Felix", "Gabi", "Hans",
+                                     "Ines", "Jonas", "Karin", "Lukas", "Maria", "Niklaus", "Otto", "Peter" };
+static const char *syllables[] = { "ber", "li", "wil", "ko", "bach", "ger", "mo", "ser", "hu", "an",
+                                   "stei", "ner", "fi", "scher", "zim", "mer" };
+
+static uint32_t rng = 12345;
+
+static uint32_t next_random(void) {
+    rng = rng * 1103515245u + 12345u;
+    return rng >> 8;
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int build_model(PhonebookModel *model, int entries) {
+    phonebook_model_init(model);
+    const char *header = "First,Name,Callsign,IP,Telephone\n";
+    phonebook_model_feed(model, header, strlen(header));
+    for (int i = 0; i < entries; i++) {
+        char name[32] = "", row[128];
+        int parts = 2 + (int)(next_random() % 2);
+        for (int p = 0; p < parts; p++) {
+            strcat(name, syllables[next_random() % 16]);
+        }
+        name[0] = (char)(name[0] - 'a' + 'A');
+        int len = snprintf(row, sizeof(row), "%s,%s,HB9%c%c%c,,%d\n", first_names[next_random() % 16], name,
+                           'A' + (int)(next_random() % 26), 'A' + (int)(next_random() % 26),
+                           'A' + (int)(next_random() % 26), 200000 + i);
+        if (phonebook_model_feed(model, row, (size_t)len) != 0) {
+            return 1;
+        }
+    }
+    return phonebook_model_finish(model);
+}
+
+// What a search cost without the index: compare every field of every entry
+static int scan_matches(const PhonebookModel *model, const char *prefix) {
+    size_t len = strlen(prefix);
+    int matches = 0;
+    for (int i = 0; i < model->count; i++) {
+        const PhonebookEntry *e = &model->entries[i];
+        if (strncasecmp(e->first_name, prefix, len) == 0 || strncasecmp(e->name, prefix, len) == 0 ||
+            strncasecmp(e->callsign, prefix, len) == 0 || strncmp(e->user_id, prefix, len) == 0) {
+            matches++;
+        }
+    }
+    return matches;
+}
+
+int main(int argc, char **argv) {
+    int entries = argc > 1 ? atoi(argv[1]) : 50000;
+    int iterations = argc > 2 ? atoi(argv[2]) : 2000;
+    if (entries < 1 || iterations < 1) {
+        fprintf(stderr, "Usage: %s [entries] [iterations]\n", argv[0]);
+        return 2;
+    }
+
+    PhonebookModel model;
+    if (build_model(&model, entries) != 0) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+    double start = now_us();
+    if (directory_render_update(&model) != 0) {
+        fprintf(stderr, "Render failed.\n");
+        return 1;
+    }
+    printf("%d entries; render and index: %.1f ms\n", model.count, (now_us() - start) / 1e3);
+
+    // Every 7th entry is active
+    char (*ids)[MAX_PHONE_NUMBER_LEN];
+    int count;
+    unsigned long version;
+    directory_render_entry_ids(&ids, &count, &version);
+    free(ids);
+    unsigned char *active = calloc((size_t)count / 8 + 1, 1);
+    for (int i = 0; i < count; i += 7) {
+        active[i / 8] |= (unsigned char)(1u << (i % 8));
+    }
+    directory_render_set_liveness(active, version);
+    free(active);
+
+    static const char *prefixes[] = { "", "a", "an", "ber", "hb9", "hb9a", "hb9ab", "2000", "20012", "zzz" };
+    printf("%-7s %-7s %8s %10s %10s\n", "prefix", "filter", "matches", "query us", "scan us");
+    for (int active_only = 0; active_only <= 1; active_only++) {
+        for (size_t p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); p++) {
+            DirectoryQuery query = { prefixes[p], active_only, 1, 32, "http://node/directory?page=2" };
+            int total = 0;
+            start = now_us();
+            for (int i = 0; i < iterations; i++) {
+                char *out;
+                size_t out_len;
+                if (directory_render_query(DIRECTORY_FORMAT_YEALINK, &query, &out, &out_len, &total) != 0) {
+                    fprintf(stderr, "Query failed.\n");
+                    return 1;
+                }
+                free(out);
+            }
+            double query_us = (now_us() - start) / iterations;
+
+            int scans = iterations / 10 + 1;
+            volatile int scanned = 0;
+            start = now_us();
+            for (int i = 0; i < scans; i++) {
+                scanned = scan_matches(&model, prefixes[p]);
+            }
+            double scan_us = (now_us() - start) / scans;
+            (void)scanned;
+
+            printf("%-7s %-7s %8d %10.1f %10.1f\n", prefixes[p][0] ? prefixes[p] : "(all)",
+                   active_only ? "active" : "all", total, query_us, scan_us);
+        }
+    }
+    phonebook_model_free(&model);
+    return 0;
+}
@@ -0,0 +1,233 @@
+// boot_probe.c
+//
+// Starts the daemon (or whatever command follows "--") and reports:
+//
+//  - with -x, the time until the published directory at that path is
+//    complete (ends with its closing element), as phones fetching it see it.
+//  - with -u, the time until an INVITE to that number is accepted (answered
+//    with anything but 404), i.e. until the directory user table is usable.
+//    The number's <number>.local.mesh name must resolve; on a build host add
+//    e.g. "192.0.2.1 <number>.local.mesh" to /etc/hosts.
+//  - the I/O of its first fetch cycle, read from /proc/<pid>/io once -d
+//    seconds have passed: bytes moved by read and write calls (sockets and
+//    syslog included) and bytes that reached the storage layer.
+//
+// Run it against the same phonebook server and the same state on flash
+// before and after a change to compare them:
+//
+//   boot_probe -x /www/arednstack/phonebook_generic_direct.xml -u 100000 -d 20 -- /usr/bin/AREDN-Phonebook
+//
+// The daemon uses its fixed paths (/etc/sipserver.conf, /www, /tmp), so run
+// this on a node or in a disposable container. Where /tmp is not a tmpfs, as
+// on most build hosts, the storage figures include the daemon's tmpfs files;
+// the read calls include the status updater's name lookups.
+//
+// Build: make -C Phonebook/tools boot_probe
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIP_PORT 5060
+#define POLL_MS 20
+
+typedef struct {
+    unsigned long long rchar, wchar, syscr, syscw, read_bytes, write_bytes;
+} ProcessIo;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool read_process_io(pid_t pid, ProcessIo *io) {
+    char path[64], key[32];
+    unsigned long long value;
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return false;
+    }
+    memset(io, 0, sizeof(*io));
+    while (fscanf(fp, "%31[^:]: %llu\n", key, &value) == 2) {
+        if (strcmp(key, "rchar") == 0) io->rchar = value;
+        else if (strcmp(key, "wchar") == 0) io->wchar = value;
+        else if (strcmp(key, "syscr") == 0) io->syscr = value;
+        else if (strcmp(key, "syscw") == 0) io->syscw = value;
+        else if (strcmp(key, "read_bytes") == 0) io->read_bytes = value;
+        else if (strcmp(key, "write_bytes") == 0) io->write_bytes = value;
+    }
+    fclose(fp);
+    return true;
+}
+
+// True if 'path' holds a whole Yealink directory
+static bool directory_complete(const char *path) {
+    static const char closing[] = "</YealinkIPPhoneDirectory>";
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    char tail[64];
+    ssize_t n = 0;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(tail)) {
+        n = pread(fd, tail, sizeof(tail), st.st_size - (off_t)sizeof(tail));
+    }
+    close(fd);
+    return n > 0 && memmem(tail, (size_t)n, closing, sizeof(closing) - 1) != NULL;
+}
+
+// Sends one INVITE for 'number' to the daemon and waits up to POLL_MS for the
+// answer. Returns true if it was anything but 404 Not Found.
+static bool invite_accepted(int sock, const char *number, int attempt) {
+    struct sockaddr_in local;
+    socklen_t local_len = sizeof(local);
+    getsockname(sock, (struct sockaddr *)&local, &local_len);
+    int port = ntohs(local.sin_port);
+
+    char msg[768];
+    int len = snprintf(msg, sizeof(msg),
+                       "INVITE sip:%s@127.0.0.1 SIP/2.0\r\n"
+                       "Via: SIP/2.0/UDP 127.0.0.1:%d;branch=z9hG4bK-probe-%d\r\n"
+                       "From: <sip:probe@127.0.0.1>;tag=probe\r\n"
+                       "To: <sip:%s@127.0.0.1>\r\n"
+                       "Call-ID: probe-%d-%d@127.0.0.1\r\n"
+                       "CSeq: 1 INVITE\r\n"
+                       "Contact: <sip:probe@127.0.0.1:%d>\r\n"
+                       "Max-Forwards: 70\r\n"
+                       "Content-Length: 0\r\n\r\n",
+                       number, port, attempt, number, (int)getpid(), attempt, port);
+    send(sock, msg, (size_t)len, 0);
+
+    struct pollfd pfd = { .fd = sock, .events = POLLIN };
+    while (poll(&pfd, 1, POLL_MS) == 1) {
+        char reply[2048];
+        ssize_t n = recv(sock, reply, sizeof(reply) - 1, 0);
+        if (n <= 0) {
+            return false; // Nobody listening yet (ICMP port unreachable)
+        }
+        reply[n] = '\0';
+        char call_id[64];
+        snprintf(call_id, sizeof(call_id), "probe-%d-%d@", (int)getpid(), attempt);
+        if (strncmp(reply, "SIP/2.0 ", 8) == 0 && strstr(reply, call_id)) {
+            return strncmp(reply + 8, "404", 3) != 0;
+        }
+    }
+    return false;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-x directory_path] [-u number] [-d seconds] -- <daemon command...>\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    double duration = 20;
+    const char *number = NULL;
+    const char *directory = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "x:u:d:")) != -1) {
+        switch (opt) {
+            case 'x': directory = optarg; break;
+            case 'u': number = optarg; break;
+            case 'd': duration = atof(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind >= argc || duration <= 0) {
+        usage(argv[0]);
+    }
+
+    int sock = -1;
+    if (number) {
+        struct sockaddr_in daemon_addr = { .sin_family = AF_INET, .sin_port = htons(SIP_PORT) };
+        inet_pton(AF_INET, "127.0.0.1", &daemon_addr.sin_addr);
+        sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock < 0 || connect(sock, (struct sockaddr *)&daemon_addr, sizeof(daemon_addr)) != 0) {
+            perror("socket");
+            return 1;
+        }
+    }
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return 1;
+    }
+    if (pid == 0) {
+        execvp(argv[optind], argv + optind);
+        perror(argv[optind]);
+        _exit(127);
+    }
+
+    ProcessIo io = { 0 };
+    bool exited = false;
+    double invite_at = -1, directory_at = -1;
+    int attempts = 0;
+    if (directory && directory_complete(directory)) {
+        directory_at = 0; // Kept from the previous run
+    }
+    while (now() - start < duration) {
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            exited = true;
+            break;
+        }
+        read_process_io(pid, &io); // Last sample before the deadline
+        if (directory && directory_at < 0 && directory_complete(directory)) {
+            directory_at = now() - start;
+        }
+        if (number && invite_at < 0) {
+            if (invite_accepted(sock, number, ++attempts)) {
+                invite_at = now() - start;
+            } else {
+                usleep(1000); // Early 404s come back at once; keep the load off the SIP loop
+            }
+        } else {
+            usleep(directory && directory_at < 0 ? 1000 : POLL_MS * 1000);
+        }
+    }
+    if (exited) {
+        fprintf(stderr, "Daemon exited after %.1f s.\n", now() - start);
+    } else {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+
+    if (directory) {
+        if (directory_at == 0) {
+            printf("Directory %s available at start\n", directory);
+        } else if (directory_at > 0) {
+            printf("Directory %s available after %.0f ms\n", directory, directory_at * 1e3);
+        } else {
+            printf("Directory %s not available within %.0f s\n", directory, duration);
+        }
+    }
+    if (number) {
+        if (invite_at >= 0) {
+            printf("INVITE to %s accepted after %.0f ms (%d attempts)\n", number, invite_at * 1e3, attempts);
+        } else {
+            printf("INVITE to %s not accepted within %.0f s\n", number, duration);
+        }
+    }
+    printf("I/O in the first %.0f s:\n", duration);
+    printf("  read calls:  %llu bytes in %llu calls\n", io.rchar, io.syscr);
+    printf("  write calls: %llu bytes in %llu calls\n", io.wchar, io.syscw);
+    printf("  storage:     %llu bytes read, %llu bytes written\n", io.read_bytes, io.write_bytes);
+    return exited ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# cgi_timing.sh
+#
+# Times the showphonebook CGI on a synthetic phonebook, before and after the
+# daemon started publishing the JSON directory itself:
+#
+#   before  the script as it was until then, which turns the Yealink XML into
+#           JSON with grep/sed processes per entry
+#   after   the current script, which serves the daemon's JSON file as is
+#
+# Usage (from a checkout, on the build host or on a node):
+#
+#   Phonebook/tools/cgi_timing.sh [entries] [runs]     (default 1000 entries, 5 runs)
+#
+# Set OLD_CGI to the path of the previous script where git is not available.
+
+ENTRIES=${1:-1000}
+RUNS=${2:-5}
+TOOLS_DIR=$(cd "$(dirname "$0")" && pwd)
+CGI="$TOOLS_DIR/../files/www/cgi-bin/showphonebook"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if [ -z "$OLD_CGI" ]; then
+    # Parent of the commit that introduced JSON_FILE holds the XML-parsing script
+    COMMIT=$(git -C "$TOOLS_DIR" log -1 --format=%H -S'JSON_FILE=' -- "$CGI")
+    if [ -z "$COMMIT" ]; then
+        echo "Cannot find the previous showphonebook in git; set OLD_CGI." >&2
+        exit 1
+    fi
+    OLD_CGI="$WORK/showphonebook.old"
+    git -C "$TOOLS_DIR" show "$COMMIT^:Phonebook/files/www/cgi-bin/showphonebook" > "$OLD_CGI" || exit 1
+fi
+
+# Both scripts read fixed paths; point them at the synthetic files
+sed "s|^XML_FILE=.*|XML_FILE=\"$WORK/phonebook.xml\"|" "$OLD_CGI" > "$WORK/before"
+sed "s|^JSON_FILE=.*|JSON_FILE=\"$WORK/phonebook.json\"|" "$CGI" > "$WORK/after"
+chmod +x "$WORK/before" "$WORK/after"
+
+# Same layout as the daemon's Yealink and JSON renderings
+awk -v n="$ENTRIES" -v xml="$WORK/phonebook.xml" -v json="$WORK/phonebook.json" 'BEGIN {
+    print "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<YealinkIPPhoneDirectory>" > xml
+    printf "{\"status\":\"success\",\"version\":\"bench\",\"entry_count\":%d,\"active_count\":%d,\"entries\":[", n, n / 2 > json
+    for (i = 0; i < n; i++) {
+        name = sprintf("First%d Name%d (HB9%04d)", i, i, i)
+        tel = sprintf("1%05d", i)
+        printf "  <DirectoryEntry>\n    <Name>%s</Name>\n    <Telephone>%s</Telephone>\n  </DirectoryEntry>\n", \
+               (i % 2 ? "* " : "") name, tel > xml
+        printf "%s\n{\"name\":\"%s\",\"telephone\":\"%s\",\"active\":%s}", i ? "," : "", name, tel, \
+               i % 2 ? "true" : "false" > json
+    }
+    print "</YealinkIPPhoneDirectory>" > xml
+    print "\n]}" > json
+}'
+
+# Milliseconds since an arbitrary start; busybox date has no %N
+now_ms() {
+    case $(date +%N) in
+        *N*|"") awk '{ printf "%d\n", $1 * 1000 }' /proc/uptime ;;
+        *) echo $(($(date +%s%N) / 1000000)) ;;
+    esac
+}
+
+time_cgi() {
+    start=$(now_ms)
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        "$WORK/$1" > "$WORK/$1.out"
+        i=$((i + 1))
+    done
+    end=$(now_ms)
+    printf "%-7s %6d ms per request, %7d bytes, %d entries\n" "$1" $(((end - start) / RUNS)) \
+           "$(wc -c < "$WORK/$1.out")" "$(grep -o '"telephone"' "$WORK/$1.out" | wc -l)"
+}
+
+echo "showphonebook on $ENTRIES entries, mean of $RUNS runs:"
+time_cgi before
+time_cgi after
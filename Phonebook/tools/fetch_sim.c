@@ -0,0 +1,317 @@
+// fetch_sim.c
+//
+// Simulates N nodes fetching the phonebook from local HTTP servers and reports
+// the load the servers see, e.g. after a regional power restore when every
+// node boots in the same second:
+//
+//   fetch_sim -n 300                  Per-node jitter, as the daemon runs
+//   fetch_sim -n 300 -b               Baseline: no jitter, every node in lockstep
+//   fetch_sim -n 300 -c 20 -r 120     Servers reject above 20 in flight with Retry-After
+//
+// Each node is a forked process running the daemon's own fetch_scheduler and
+// http_client race against the configured servers, with its own node identity.
+// Time is simulated: this file defines time(), so the scheduler's intervals,
+// backoffs and Retry-After deadlines run on a virtual clock where one second
+// takes -m milliseconds (default 10, so an hour passes in 36 s). The servers
+// hold every accepted request for -t virtual seconds, like a slow mesh link.
+//
+// Nodes also rewrite the fetch status file in /tmp; run it on a build host, not
+// on a node.
+//
+// Build: make -C Phonebook/tools fetch_sim
+
+#define _GNU_SOURCE
+#include "common.h"
+#include "config_loader/config_loader.h"
+#include "fetch_scheduler/fetch_scheduler.h"
+#include "http_client/http_client.h"
+#include <sys/wait.h>
+
+#define SIM_MAX_SECONDS (7 * 24 * 3600)
+
+static int nodes = 200;
+static int servers = 2;
+static int ms_per_second = 10;
+static int duration = 7200;        // Virtual seconds
+static int interval = 3600;
+static int service_seconds = 2;
+static int capacity = 0;           // Requests in flight per server before 503; 0 = unlimited
+static int retry_after = 120;
+static bool baseline = false;
+static bool empty_nodes = false;   // Nodes have no phonebook on flash yet
+
+static struct timespec start_mono;
+static time_t start_wall;
+
+// Virtual clock: the daemon code linked here calls this instead of libc's time()
+time_t time(time_t *out) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long elapsed_ms = (now.tv_sec - start_mono.tv_sec) * 1000LL + (now.tv_nsec - start_mono.tv_nsec) / 1000000;
+    time_t t = start_wall + (time_t)(elapsed_ms / ms_per_second);
+    if (out) *out = t;
+    return t;
+}
+
+static long virtual_now(void) {
+    return (long)(time(NULL) - start_wall);
+}
+
+static void sleep_virtual(int seconds) {
+    usleep((useconds_t)seconds * (useconds_t)ms_per_second * 1000);
+}
+
+// --- Servers (parent process) ---
+
+typedef struct {
+    int listen_fd;
+    int port;
+    int in_flight;
+    int peak_in_flight;
+    unsigned int accepted;
+    unsigned int rejected;
+} SimServer;
+
+static SimServer sim_servers[MAX_PB_SERVERS];
+static unsigned int *arrivals;     // Requests per virtual second, all servers
+
+typedef struct {
+    SimServer *server;
+    int fd;
+} SimConnection;
+
+static void *serve_connection(void *arg) {
+    SimConnection conn = *(SimConnection *)arg;
+    free(arg);
+    SimServer *srv = conn.server;
+
+    char req[2048];
+    size_t got = 0;
+    while (got < sizeof(req) - 1) {
+        ssize_t n = read(conn.fd, req + got, sizeof(req) - 1 - got);
+        if (n <= 0) break;
+        got += (size_t)n;
+        req[got] = '\0';
+        if (strstr(req, "\r\n\r\n")) break;
+    }
+
+    long second = virtual_now();
+    if (second >= 0 && second <= duration) {
+        __atomic_fetch_add(&arrivals[second], 1, __ATOMIC_RELAXED);
+    }
+    int in_flight = __atomic_add_fetch(&srv->in_flight, 1, __ATOMIC_RELAXED);
+    int peak = __atomic_load_n(&srv->peak_in_flight, __ATOMIC_RELAXED);
+    while (in_flight > peak &&
+           !__atomic_compare_exchange_n(&srv->peak_in_flight, &peak, in_flight, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+
+    char resp[256];
+    int len;
+    if (capacity > 0 && in_flight > capacity) {
+        __atomic_fetch_add(&srv->rejected, 1, __ATOMIC_RELAXED);
+        len = snprintf(resp, sizeof(resp), "HTTP/1.0 503 Service Unavailable\r\nRetry-After: %d\r\n"
+                                           "Content-Length: 0\r\n\r\n", retry_after);
+    } else {
+        __atomic_fetch_add(&srv->accepted, 1, __ATOMIC_RELAXED);
+        sleep_virtual(service_seconds);
+        static const char body[] = "First,Name,Callsign,IP,Telephone\nSim,Node,N0CALL,,100\n";
+        len = snprintf(resp, sizeof(resp), "HTTP/1.0 200 OK\r\nContent-Type: text/csv\r\nContent-Length: %zu\r\n\r\n%s",
+                       sizeof(body) - 1, body);
+    }
+    if (write(conn.fd, resp, (size_t)len) < 0) {
+        // Client gave up; nothing to report
+    }
+    __atomic_sub_fetch(&srv->in_flight, 1, __ATOMIC_RELAXED);
+    close(conn.fd);
+    return NULL;
+}
+
+static void *accept_thread(void *arg) {
+    SimServer *srv = arg;
+    while (1) {
+        int fd = accept(srv->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return NULL;
+        }
+        SimConnection *conn = malloc(sizeof(*conn));
+        pthread_t tid;
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->server = srv;
+        conn->fd = fd;
+        if (pthread_create(&tid, NULL, serve_connection, conn) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
+
+static int open_server(SimServer *srv) {
+    srv->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    if (srv->listen_fd < 0 || bind(srv->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(srv->listen_fd, 1024) != 0 || getsockname(srv->listen_fd, (struct sockaddr *)&addr, &addr_len) != 0) {
+        perror("server socket");
+        return 1;
+    }
+    srv->port = ntohs(addr.sin_port);
+    return 0;
+}
+
+// --- Nodes (child processes) ---
+
+// One fetch cycle through the daemon's scheduler and race. Returns true if a server delivered.
+static bool fetch_once(void) {
+    int order[MAX_PB_SERVERS];
+    int count = fetch_scheduler_order(order);
+    HttpRaceEntry entries[MAX_PB_SERVERS];
+    for (int i = 0; i < count; i++) {
+        const ConfigurableServer *s = &g_phonebook_servers_list[order[i]];
+        memset(&entries[i], 0, sizeof(entries[i]));
+        entries[i].server = s;
+        snprintf(entries[i].request, sizeof(entries[i].request),
+                 "GET %s HTTP/1.0\r\nHost: %s\r\nConnection: close\r\n\r\n", s->path, s->host);
+    }
+    HttpResponse resp;
+    HttpAttemptResult results[MAX_PB_SERVERS];
+    int raced = http_client_race(entries, count, &resp, results);
+    for (int i = 0; i < count; i++) {
+        fetch_scheduler_record(order[i], &results[i]);
+    }
+    if (raced != 0) {
+        return false;
+    }
+    unsigned char buf[1024];
+    ssize_t n;
+    while ((n = http_client_read_body(&resp, buf, sizeof(buf))) > 0) {
+    }
+    http_client_close(&resp);
+    return n == 0;
+}
+
+static void run_node(int id) {
+    char identity[32];
+    snprintf(identity, sizeof(identity), "sim-node-%d", id);
+    log_set_level(LOG_LEVEL_NONE);
+    fetch_scheduler_set_node_identity(identity);
+
+    int delay = baseline ? 0 : fetch_scheduler_initial_delay(!empty_nodes);
+    while (1) {
+        if (virtual_now() + delay > duration) {
+            return;
+        }
+        sleep_virtual(delay);
+        bool ok = fetch_once();
+        if (baseline) {
+            delay = ok ? interval : PB_SERVER_BACKOFF_BASE_SECONDS;
+        } else {
+            delay = fetch_scheduler_end_cycle(ok);
+        }
+    }
+}
+
+// --- Report ---
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-n nodes] [-s servers] [-d seconds] [-i interval] [-t service_seconds]\n"
+            "          [-c capacity] [-r retry_after] [-m ms_per_second] [-b] [-e]\n"
+            "  -b  baseline without jitter   -e  nodes start without a phonebook on flash\n", prog);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:d:i:t:c:r:m:be")) != -1) {
+        switch (opt) {
+            case 'n': nodes = atoi(optarg); break;
+            case 's': servers = atoi(optarg); break;
+            case 'd': duration = atoi(optarg); break;
+            case 'i': interval = atoi(optarg); break;
+            case 't': service_seconds = atoi(optarg); break;
+            case 'c': capacity = atoi(optarg); break;
+            case 'r': retry_after = atoi(optarg); break;
+            case 'm': ms_per_second = atoi(optarg); break;
+            case 'b': baseline = true; break;
+            case 'e': empty_nodes = true; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (nodes < 1 || servers < 1 || servers > MAX_PB_SERVERS || duration < 1 || duration > SIM_MAX_SECONDS ||
+        interval < 1 || service_seconds < 0 || ms_per_second < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    clock_gettime(CLOCK_MONOTONIC, &start_mono);
+    start_wall = wall.tv_sec; // Virtual clock starts now
+    arrivals = calloc((size_t)duration + 1, sizeof(*arrivals));
+    if (!arrivals) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+
+    g_pb_interval_seconds = interval;
+    g_num_phonebook_servers = servers;
+    for (int i = 0; i < servers; i++) {
+        if (open_server(&sim_servers[i]) != 0) {
+            return 1;
+        }
+        snprintf(g_phonebook_servers_list[i].host, sizeof(g_phonebook_servers_list[i].host), "127.0.0.1");
+        snprintf(g_phonebook_servers_list[i].port, sizeof(g_phonebook_servers_list[i].port), "%d", sim_servers[i].port);
+        snprintf(g_phonebook_servers_list[i].path, sizeof(g_phonebook_servers_list[i].path), "/phonebook.csv");
+    }
+
+    // Nodes are forked before any thread exists; they all "boot" now
+    for (int i = 0; i < nodes; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            for (int s = 0; s < servers; s++) close(sim_servers[s].listen_fd);
+            run_node(i);
+            _exit(0);
+        }
+    }
+    for (int i = 0; i < servers; i++) {
+        pthread_t tid;
+        pthread_create(&tid, NULL, accept_thread, &sim_servers[i]);
+        pthread_detach(tid);
+    }
+    while (wait(NULL) > 0 || errno == EINTR) {
+    }
+    sleep_virtual(service_seconds + 1); // Let the last responses finish
+
+    unsigned int total = 0, peak_second = 0, busiest = 0;
+    int first_fetch_seconds = 0;
+    for (int s = 0; s <= duration; s++) {
+        total += arrivals[s];
+        if (arrivals[s] > peak_second) {
+            peak_second = arrivals[s];
+            busiest = (unsigned int)s;
+        }
+        if (arrivals[s] && total - arrivals[s] < (unsigned int)nodes) {
+            first_fetch_seconds = s + 1; // Span of the first round of fetches
+        }
+    }
+    printf("%d nodes, %d server(s), %d s simulated (%s, interval %d s, service %d s, capacity %s)\n", nodes,
+           servers, duration, baseline ? "baseline, no jitter" : "per-node jitter", interval, service_seconds,
+           capacity ? "limited" : "unlimited");
+    printf("requests: %u, busiest second: %u requests at t=%u s, first round spread over %d s\n", total, peak_second,
+           busiest, first_fetch_seconds);
+    for (int i = 0; i < servers; i++) {
+        printf("server %d: peak %d concurrent, %u served, %u rejected (503)\n", i, sim_servers[i].peak_in_flight,
+               sim_servers[i].accepted, sim_servers[i].rejected);
+    }
+    free(arrivals);
+    return 0;
+}
@@ -0,0 +1,216 @@
+// http_load.c
+//
+// Keep-alive HTTP load generator, used to compare the embedded HTTP server
+// (HTTP_SERVER_PORT) with the uhttpd CGI path (/cgi-bin/showphonebook) on a
+// node or on the build host:
+//
+//   http_load 127.0.0.1 8081 /showphonebook 16 10
+//   http_load 127.0.0.1 80 /cgi-bin/showphonebook 16 10
+//   http_load 127.0.0.1 8081 /phonebook_generic_direct.xml 64 10 --gzip
+//
+// Each client thread keeps one connection open and sends the next request as
+// soon as the previous response is complete; it reconnects when the server
+// closes the connection (as the CGI path does after every response). Prints
+// requests per second and latency percentiles.
+//
+// Build: make -C Phonebook/tools http_load
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CLIENTS 512
+#define RESPONSE_MAX (4 * 1024 * 1024)
+
+static struct sockaddr_in server;
+static char request[1024];
+static double end_time;
+
+static pthread_mutex_t results_mutex = PTHREAD_MUTEX_INITIALIZER;
+static double *latencies;
+static long latency_count;
+static long latency_cap;
+static long errors;
+static long reconnects;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_server(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr *)&server, sizeof(server)) != 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Reads one response into buf. Returns its length, or -1 on error. Sets
+// *closed when the server ends the connection after it.
+static long read_response(int fd, char *buf, bool *closed) {
+    size_t got = 0;
+    long content_length = -1;
+    const char *body = NULL;
+    *closed = false;
+    while (1) {
+        ssize_t n = read(fd, buf + got, RESPONSE_MAX - 1 - got);
+        if (n <= 0) {
+            *closed = true;
+            // Without Content-Length the body ends with the connection
+            return body && content_length < 0 ? (long)got : -1;
+        }
+        got += (size_t)n;
+        buf[got] = '\0';
+        if (!body) {
+            char *end = strstr(buf, "\r\n\r\n");
+            if (!end) {
+                continue;
+            }
+            body = end + 4;
+            const char *cl = strcasestr(buf, "\r\nContent-Length:");
+            if (cl && cl < end) {
+                content_length = atol(cl + 17);
+            }
+            if (strcasestr(buf, "\r\nConnection: close") || strncmp(buf, "HTTP/1.0", 8) == 0) {
+                *closed = true;
+            }
+        }
+        if (content_length >= 0 && got >= (size_t)(body - buf) + (size_t)content_length) {
+            return (long)got;
+        }
+        if (got == RESPONSE_MAX - 1) {
+            return -1;
+        }
+    }
+}
+
+static void *client_thread(void *arg) {
+    (void)arg;
+    char *buf = malloc(RESPONSE_MAX);
+    long cap = 1024, count = 0, failed = 0, connects = 0;
+    double *mine = malloc((size_t)cap * sizeof(double));
+    int fd = -1;
+    if (!buf || !mine) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+
+    while (now() < end_time) {
+        if (fd < 0) {
+            fd = connect_server();
+            connects++;
+            if (fd < 0) {
+                failed++;
+                usleep(1000);
+                continue;
+            }
+        }
+        double start = now();
+        bool closed;
+        if (write(fd, request, strlen(request)) < 0 || read_response(fd, buf, &closed) < 0 ||
+            strncmp(buf + 9, "200", 3) != 0) {
+            failed++;
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        if (count == cap) {
+            cap *= 2;
+            mine = realloc(mine, (size_t)cap * sizeof(double));
+            if (!mine) {
+                fprintf(stderr, "Out of memory.\n");
+                exit(1);
+            }
+        }
+        mine[count++] = now() - start;
+        if (closed) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    pthread_mutex_lock(&results_mutex);
+    if (latency_count + count > latency_cap) {
+        latency_cap = (latency_count + count) * 2;
+        latencies = realloc(latencies, (size_t)latency_cap * sizeof(double));
+    }
+    memcpy(latencies + latency_count, mine, (size_t)count * sizeof(double));
+    latency_count += count;
+    errors += failed;
+    reconnects += connects;
+    pthread_mutex_unlock(&results_mutex);
+    free(mine);
+    free(buf);
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(int p) {
+    return latency_count ? latencies[latency_count * p / 100] * 1e3 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 6) {
+        fprintf(stderr, "Usage: %s <ip> <port> <path> <clients> <seconds> [--gzip]\n", argv[0]);
+        return 2;
+    }
+    int clients = atoi(argv[4]);
+    int seconds = atoi(argv[5]);
+    bool gzip = argc > 6 && strcmp(argv[6], "--gzip") == 0;
+    if (clients < 1 || clients > MAX_CLIENTS || seconds < 1) {
+        fprintf(stderr, "Clients must be 1-%d and seconds at least 1.\n", MAX_CLIENTS);
+        return 2;
+    }
+    server.sin_family = AF_INET;
+    server.sin_port = htons((uint16_t)atoi(argv[2]));
+    if (inet_pton(AF_INET, argv[1], &server.sin_addr) != 1) {
+        fprintf(stderr, "Invalid IPv4 address '%s'.\n", argv[1]);
+        return 2;
+    }
+    snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n", argv[3], argv[1],
+             gzip ? "Accept-Encoding: gzip\r\n" : "");
+
+    pthread_t threads[MAX_CLIENTS];
+    end_time = now() + seconds;
+    for (int i = 0; i < clients; i++) {
+        if (pthread_create(&threads[i], NULL, client_thread, NULL) != 0) {
+            fprintf(stderr, "Failed to start client %d.\n", i);
+            return 1;
+        }
+    }
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    qsort(latencies, (size_t)latency_count, sizeof(double), compare_doubles);
+    printf("%s: %d clients, %d s: %ld requests (%.0f/s), %ld errors, %ld connections\n", argv[3], clients, seconds,
+           latency_count, latency_count / (double)seconds, errors, reconnects);
+    printf("latency ms: p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", percentile(50), percentile(90), percentile(99),
+           latency_count ? latencies[latency_count - 1] * 1e3 : 0);
+    free(latencies);
+    return errors && !latency_count ? 1 : 0;
+}
@@ -0,0 +1,292 @@
+// tests.c
+//
+// Unit tests for the daemon functions that work on memory only: DEFLATE
+// decoding (gzip_inflate_stream), delta patches (phonebook_delta_apply), the
+// directory prefix index (directory_index_lookup) and the model diff
+// (phonebook_model_diff). Prints each failed check and exits non-zero if
+// there was one.
+//
+// Build and run: make -C Phonebook/tools test
+
+#include "common.h"
+#include "directory_index/directory_index.h"
+#include "gzip_deflate/gzip_deflate.h"
+#include "gzip_inflate/gzip_inflate.h"
+#include "phonebook_delta/phonebook_delta.h"
+#include "phonebook_model/phonebook_model.h"
+
+static int checks;
+static int failures;
+
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        checks++;                                                                    \
+        if (!(cond)) {                                                               \
+            failures++;                                                              \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        }                                                                            \
+    } while (0)
+
+#define CSV_HEADER "First,Name,Callsign,IP,Telephone\n"
+
+static void load_model(PhonebookModel *model, const char *csv) {
+    phonebook_model_init(model);
+    phonebook_model_feed(model, csv, strlen(csv));
+    phonebook_model_finish(model);
+}
+
+// Synthetic phonebook text; the caller frees it
+static char *sample_csv(int rows, size_t *len) {
+    size_t cap = sizeof(CSV_HEADER) + (size_t)rows * 32;
+    char *csv = malloc(cap);
+    if (!csv) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    size_t n = (size_t)snprintf(csv, cap, "%s", CSV_HEADER);
+    for (int i = 0; i < rows; i++) {
+        n += (size_t)snprintf(csv + n, cap - n, "Anna,Muster,HB9A%02d,,1%04d\n", i % 100, i);
+    }
+    *len = n;
+    return csv;
+}
+
+// --- gzip_inflate ------------------------------------------------------------
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+    size_t chunk; // Most bytes handed out per read, to exercise refills
+} Source;
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} Sink;
+
+static ssize_t source_read(void *ctx, unsigned char *buf, size_t len) {
+    Source *s = ctx;
+    size_t n = s->len - s->pos;
+    if (n > len) n = len;
+    if (n > s->chunk) n = s->chunk;
+    memcpy(buf, s->data + s->pos, n);
+    s->pos += n;
+    return (ssize_t)n;
+}
+
+static int sink_write(void *ctx, const unsigned char *data, size_t len) {
+    Sink *s = ctx;
+    if (s->len + len > s->cap) {
+        size_t cap = (s->len + len) * 2;
+        unsigned char *grown = realloc(s->data, cap);
+        if (!grown) {
+            return 1;
+        }
+        s->data = grown;
+        s->cap = cap;
+    }
+    memcpy(s->data + s->len, data, len);
+    s->len += len;
+    return 0;
+}
+
+static int inflate_buffer(int format, const unsigned char *in, size_t len, size_t chunk, size_t max_output,
+                          Sink *out) {
+    Source src = { in, len, 0, chunk };
+    out->len = 0;
+    return gzip_inflate_stream(format, source_read, &src, sink_write, out, max_output, NULL, NULL);
+}
+
+static bool sink_equals(const Sink *s, const void *data, size_t len) {
+    return s->len == len && memcmp(s->data, data, len) == 0;
+}
+
+// The first 12 rows of sample_csv(), compressed by zlib at level 9 (dynamic Huffman codes)
+static const unsigned char zlib_dynamic[] = {
+    0x78, 0xda, 0x65, 0xd0, 0x3b, 0x0e, 0x83, 0x30, 0x10, 0x45, 0xd1, 0x9e, 0xb5, 0x4c, 0xe1, 0xe1,
+    0xef, 0x92, 0x44, 0x42, 0x50, 0x24, 0x4a, 0xc1, 0x06, 0x5c, 0x8c, 0x12, 0x24, 0xc7, 0x41, 0x98,
+    0xec, 0x1f, 0xa4, 0x57, 0xbe, 0xdb, 0x9e, 0xee, 0x8e, 0xeb, 0x9e, 0x0f, 0x79, 0x86, 0xaf, 0xc9,
+    0x3d, 0xc4, 0x98, 0xd7, 0x77, 0x92, 0xf9, 0x25, 0x8b, 0x45, 0xdb, 0x3e, 0xbf, 0x64, 0xc5, 0x90,
+    0x52, 0x90, 0xc7, 0x3f, 0x1f, 0xb6, 0xcb, 0x74, 0xf3, 0x83, 0x73, 0x22, 0xea, 0xae, 0x58, 0x14,
+    0xa2, 0x2c, 0x25, 0xa4, 0x64, 0xa9, 0x20, 0x15, 0x4b, 0x0d, 0xa9, 0x59, 0x1a, 0x48, 0xc3, 0xd2,
+    0x42, 0x5a, 0x96, 0x0e, 0xd2, 0xb1, 0xf4, 0x90, 0x9e, 0xc5, 0x43, 0x3c, 0x89, 0xe2, 0x81, 0xf2,
+    0x03, 0xc5, 0x03, 0xd5, 0xe2, 0x04, 0xb2, 0x14, 0x60, 0xaa,
+};
+
+// The same rows as a gzip member (gzip -9)
+static const unsigned char gzip_dynamic[] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x65, 0xd0, 0x3b, 0x0e, 0x83, 0x30,
+    0x10, 0x45, 0xd1, 0x9e, 0xb5, 0x4c, 0xe1, 0xe1, 0xef, 0x92, 0x44, 0x42, 0x50, 0x24, 0x4a, 0xc1,
+    0x06, 0x5c, 0x8c, 0x12, 0x24, 0xc7, 0x41, 0x98, 0xec, 0x1f, 0xa4, 0x57, 0xbe, 0xdb, 0x9e, 0xee,
+    0x8e, 0xeb, 0x9e, 0x0f, 0x79, 0x86, 0xaf, 0xc9, 0x3d, 0xc4, 0x98, 0xd7, 0x77, 0x92, 0xf9, 0x25,
+    0x8b, 0x45, 0xdb, 0x3e, 0xbf, 0x64, 0xc5, 0x90, 0x52, 0x90, 0xc7, 0x3f, 0x1f, 0xb6, 0xcb, 0x74,
+    0xf3, 0x83, 0x73, 0x22, 0xea, 0xae, 0x58, 0x14, 0xa2, 0x2c, 0x25, 0xa4, 0x64, 0xa9, 0x20, 0x15,
+    0x4b, 0x0d, 0xa9, 0x59, 0x1a, 0x48, 0xc3, 0xd2, 0x42, 0x5a, 0x96, 0x0e, 0xd2, 0xb1, 0xf4, 0x90,
+    0x9e, 0xc5, 0x43, 0x3c, 0x89, 0xe2, 0x81, 0xf2, 0x03, 0xc5, 0x03, 0xd5, 0xe2, 0x04, 0xb8, 0xf7,
+    0x11, 0x90, 0x59, 0x01, 0x00, 0x00,
+};
+
+static void test_inflate(void) {
+    Sink out = { 0 };
+    size_t csv_len;
+    char *csv = sample_csv(12, &csv_len);
+
+    // Dynamic Huffman blocks, as written by zlib and gzip; byte-at-a-time input included
+    CHECK(inflate_buffer(INFLATE_FORMAT_DEFLATE, zlib_dynamic, sizeof(zlib_dynamic), 4096, 1 << 20, &out) == INFLATE_OK);
+    CHECK(sink_equals(&out, csv, csv_len));
+    CHECK(inflate_buffer(INFLATE_FORMAT_GZIP, gzip_dynamic, sizeof(gzip_dynamic), 1, 1 << 20, &out) == INFLATE_OK);
+    CHECK(sink_equals(&out, csv, csv_len));
+
+    // Stored blocks: raw deflate (as some servers send "deflate") and zlib-wrapped
+    static const unsigned char raw_stored[] = { 0x01, 0x05, 0x00, 0xfa, 0xff, 'h', 'e', 'l', 'l', 'o' };
+    static const unsigned char zlib_stored[] = { 0x78, 0x01, 0x01, 0x05, 0x00, 0xfa, 0xff, 'h', 'e', 'l',
+                                                 'l',  'o',  0x06, 0x2c, 0x02, 0x15 };
+    CHECK(inflate_buffer(INFLATE_FORMAT_DEFLATE, raw_stored, sizeof(raw_stored), 3, 1 << 20, &out) == INFLATE_OK);
+    CHECK(sink_equals(&out, "hello", 5));
+    CHECK(inflate_buffer(INFLATE_FORMAT_DEFLATE, zlib_stored, sizeof(zlib_stored), 3, 1 << 20, &out) == INFLATE_OK);
+    CHECK(sink_equals(&out, "hello", 5));
+    free(csv);
+
+    // Fixed Huffman codes with long matches, from the daemon's own encoder
+    csv = sample_csv(2000, &csv_len);
+    unsigned char *gz;
+    size_t gz_len;
+    CHECK(gzip_deflate_buffer((const unsigned char *)csv, csv_len, &gz, &gz_len) == 0);
+    CHECK(gz_len < csv_len / 2);
+    CHECK(inflate_buffer(INFLATE_FORMAT_GZIP, gz, gz_len, 7, 1 << 20, &out) == INFLATE_OK);
+    CHECK(sink_equals(&out, csv, csv_len));
+
+    // Errors: size cap, truncation, checksum mismatch, no gzip magic
+    CHECK(inflate_buffer(INFLATE_FORMAT_GZIP, gz, gz_len, 4096, csv_len - 1, &out) == INFLATE_TOO_LARGE);
+    CHECK(inflate_buffer(INFLATE_FORMAT_GZIP, gz, gz_len - 12, 4096, 1 << 20, &out) == INFLATE_IO_ERROR);
+    gz[gz_len - 8] ^= 0x01; // CRC-32 trailer
+    CHECK(inflate_buffer(INFLATE_FORMAT_GZIP, gz, gz_len, 4096, 1 << 20, &out) == INFLATE_CORRUPT);
+    CHECK(inflate_buffer(INFLATE_FORMAT_GZIP, (const unsigned char *)csv, csv_len, 4096, 1 << 20, &out) ==
+          INFLATE_CORRUPT);
+
+    free(gz);
+    free(csv);
+    free(out.data);
+}
+
+// --- phonebook_delta_apply ---------------------------------------------------
+
+#define DELTA_BASE CSV_HEADER "Anna,Muster,HB9A,,1001\nBert,Beispiel,HB9B,,1002\nCarla,Test,HB9C,,1003\n"
+#define DELTA_TARGET CSV_HEADER "Anna,Muster,HB9A,,1001\nDora,Neu,HB9D,,1004\nCarla,Test,HB9C,,1003\n"
+
+// Applies 'patch' to DELTA_BASE. Returns the result of phonebook_delta_apply.
+static int apply_patch(const char *base_hash, const char *patch, PhonebookModel *model) {
+    phonebook_model_init(model);
+    return phonebook_delta_apply(DELTA_BASE, strlen(DELTA_BASE), base_hash, patch, strlen(patch), model);
+}
+
+static void test_delta(void) {
+    PhonebookModel base, target, result;
+    load_model(&base, DELTA_BASE);
+    load_model(&target, DELTA_TARGET);
+    char patch[512];
+
+    // Copies, literals and the final newline
+    snprintf(patch, sizeof(patch), "PBDELTA1 %s %s %zu\n=1,2\n+Dora,Neu,HB9D,,1004\n=4,1\n", base.content_hash,
+             target.content_hash, strlen(DELTA_TARGET));
+    CHECK(apply_patch(base.content_hash, patch, &result) == 0);
+    CHECK(result.csv_len == strlen(DELTA_TARGET) && memcmp(result.csv_data, DELTA_TARGET, result.csv_len) == 0);
+    CHECK(strcmp(result.content_hash, target.content_hash) == 0);
+    CHECK(result.count == 3 && strcmp(result.entries[1].user_id, "1004") == 0);
+    phonebook_model_free(&result);
+
+    // Patch computed against another base
+    CHECK(apply_patch("0000000000000000", patch, &result) != 0);
+    phonebook_model_free(&result);
+
+    // Result that does not match the announced hash
+    snprintf(patch, sizeof(patch), "PBDELTA1 %s %s %zu\n=1,2\n+Dora,Neu,HB9D,,1005\n=4,1\n", base.content_hash,
+             target.content_hash, strlen(DELTA_TARGET));
+    CHECK(apply_patch(base.content_hash, patch, &result) != 0);
+    phonebook_model_free(&result);
+
+    // Copy beyond the end of the base
+    snprintf(patch, sizeof(patch), "PBDELTA1 %s %s %zu\n=1,2\n+Dora,Neu,HB9D,,1004\n=4,2\n", base.content_hash,
+             target.content_hash, strlen(DELTA_TARGET));
+    CHECK(apply_patch(base.content_hash, patch, &result) != 0);
+    phonebook_model_free(&result);
+
+    phonebook_model_free(&base);
+    phonebook_model_free(&target);
+}
+
+// --- directory_index_lookup --------------------------------------------------
+
+// Runs a lookup and compares the matches with 'expected' (terminated by -1)
+static bool lookup_is(DirectoryIndex *index, const char *prefix, const int *expected) {
+    int *matches = NULL;
+    int n = directory_index_lookup(index, prefix, &matches);
+    bool same = n >= 0;
+    for (int i = 0; same && i <= n; i++) {
+        same = i == n ? expected[i] == -1 : expected[i] == matches[i];
+    }
+    free(matches);
+    return same;
+}
+
+static void test_directory_index(void) {
+    PhonebookModel model;
+    load_model(&model, CSV_HEADER "Anna,Muster,HB9ABC,,1001\nBert,Anders,DL1XYZ,,2002\nanders,Zed,HB9ANN,,1003\n");
+    DirectoryIndex index;
+    CHECK(directory_index_build(&index, &model) == 0);
+
+    CHECK(lookup_is(&index, "and", (const int[]){ 1, 2, -1 }));       // Name and first name
+    CHECK(lookup_is(&index, "HB9A", (const int[]){ 0, 2, -1 }));      // Case-insensitive callsign
+    CHECK(lookup_is(&index, "hb9abc", (const int[]){ 0, -1 }));       // Whole key
+    CHECK(lookup_is(&index, "100", (const int[]){ 0, 2, -1 }));       // Number
+    CHECK(lookup_is(&index, "a", (const int[]){ 0, 1, 2, -1 }));      // Each entry once, in directory order
+    CHECK(lookup_is(&index, "", (const int[]){ 0, 1, 2, -1 }));
+    CHECK(lookup_is(&index, "zzz", (const int[]){ -1 }));
+    CHECK(lookup_is(&index, "hb9abcd", (const int[]){ -1 }));
+
+    directory_index_free(&index);
+    phonebook_model_free(&model);
+}
+
+// --- phonebook_model_diff ----------------------------------------------------
+
+static void test_model_diff(void) {
+    PhonebookModel old_model, new_model;
+    PhonebookChangeSet changes;
+    load_model(&old_model, CSV_HEADER "A,One,HB9A,,1001\nB,Two,HB9B,,1002\nC,Three,HB9C,,1003\n");
+
+    // Unchanged rows in another order
+    load_model(&new_model, CSV_HEADER "C,Three,HB9C,,1003\nA,One,HB9A,,1001\nB,Two,HB9B,,1002\n");
+    CHECK(phonebook_model_diff(&old_model, &new_model, &changes) == 0);
+    CHECK(changes.count == 0);
+    phonebook_change_set_free(&changes);
+    phonebook_model_free(&new_model);
+
+    // One of each; of two rows with one number the last counts
+    load_model(&new_model, CSV_HEADER "A,One,HB9A,,1001\nB,Changed,HB9B,,1002\nD,First,HB9D,,1004\n"
+                                      "D,Last,HB9D,,1004\n");
+    CHECK(phonebook_model_diff(&old_model, &new_model, &changes) == 0);
+    CHECK(changes.count == 3 && changes.added == 1 && changes.removed == 1 && changes.modified == 1);
+    if (changes.count == 3) {
+        CHECK(changes.changes[0].type == PB_CHANGE_MODIFY && strcmp(changes.changes[0].new_entry->name, "Changed") == 0);
+        CHECK(changes.changes[1].type == PB_CHANGE_REMOVE && strcmp(changes.changes[1].old_entry->user_id, "1003") == 0 &&
+              changes.changes[1].new_entry == NULL);
+        CHECK(changes.changes[2].type == PB_CHANGE_ADD && strcmp(changes.changes[2].new_entry->name, "Last") == 0 &&
+              changes.changes[2].old_entry == NULL);
+    }
+    phonebook_change_set_free(&changes);
+    phonebook_model_free(&new_model);
+
+    phonebook_model_free(&old_model);
+}
+
+int main(void) {
+    test_inflate();
+    test_delta();
+    test_directory_index();
+    test_model_diff();
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures ? 1 : 0;
+}